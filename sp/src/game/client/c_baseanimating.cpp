@@ -4970,6 +4970,12 @@ void C_BaseAnimating::OnDataChanged( DataUpdateType_t updateType )
 	{
 		ClearRagdoll();
 	}
+	else if ( m_builtRagdoll && m_nRenderFX != kRenderFxRagdoll )
+	{
+		// The server spawned us again after our ragdoll copy was made, so the
+		// next death needs a ragdoll of its own
+		m_builtRagdoll = false;
+	}
 
 	// If ragdolling and get EF_NOINTERP, we probably were dead and are now respawning,
 	//  don't do blend out of ragdoll at respawn spot.
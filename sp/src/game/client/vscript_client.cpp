@@ -488,6 +488,8 @@ bool VScriptClientInit()
 			{
 #ifdef MAPBASE_VSCRIPT
 				CGMsg( 0, CON_GROUP_VSCRIPT, "VSCRIPT CLIENT: Started VScript virtual machine using script language '%s'\n", g_pScriptVM->GetLanguageName() );
+
+				VScriptSetupCompileCache();
 #else
 				Log( "VSCRIPT: Started VScript virtual machine using script language '%s'\n", g_pScriptVM->GetLanguageName() );
 #endif
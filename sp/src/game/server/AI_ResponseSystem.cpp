@@ -22,6 +22,7 @@
 #include "stringpool.h"
 #include "fmtstr.h"
 #include "multiplay_gamerules.h"
+#include "checksum_crc.h"
 #ifdef MAPBASE
 #include "mapbase/matchers.h"
 #endif
@@ -33,12 +34,18 @@ ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose ma
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
 
+ConVar rr_ruleindex( "rr_ruleindex", "1", FCVAR_NONE, "Only score the response rules whose required criteria can match, using an index built when the rules load. 0 scores every rule." );
+ConVar rr_cache( "rr_cache", "1", FCVAR_NONE, "Load response rule sets from a binary cache when none of their scripts have changed, and write the cache after parsing them." );
 #ifdef MAPBASE
 ConVar rr_enhanced_saverestore( "rr_enhanced_saverestore", "1", FCVAR_NONE, "Enables enhanced save/restore capabilities for the Response System." );
 #endif
 
 static CUtlSymbolTable g_RS;
 
+// Numbers the inline criteria ParseRule names. A rule set loaded from the cache
+// advances it by as much as parsing would have.
+static int instancedCriteria = 0;
+
 inline static char *CopyString( const char *in )
 {
 	if ( !in )
@@ -51,6 +58,39 @@ inline static char *CopyString( const char *in )
 	return out;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Strings in the rule set cache. NULL is stored as a length of -1.
+//-----------------------------------------------------------------------------
+static void PutCacheString( CUtlBuffer &buf, const char *in )
+{
+	int len = in ? Q_strlen( in ) : -1;
+	buf.PutInt( len );
+	if ( len > 0 )
+	{
+		buf.Put( in, len );
+	}
+}
+
+// Returns a copy allocated like CopyString's, or NULL
+static char *GetCacheString( CUtlBuffer &buf )
+{
+	int len = buf.GetInt();
+	if ( len < 0 || !buf.IsValid() )
+		return NULL;
+
+	if ( len > buf.GetBytesRemaining() )
+	{
+		// Overflow the buffer so the caller sees it as invalid
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, len );
+		return NULL;
+	}
+
+	char *out = new char[ len + 1 ];
+	buf.Get( out, len );
+	out[ len ] = 0;
+	return out;
+}
+
 #pragma pack(1)
 class Matcher
 {
@@ -166,6 +206,56 @@ public:
 		return "";
 	}
 
+	void	WriteToCache( CUtlBuffer &buf )
+	{
+		int flags = ( valid ? ( 1 << 0 ) : 0 ) |
+			( isnumeric ? ( 1 << 1 ) : 0 ) |
+			( notequal ? ( 1 << 2 ) : 0 ) |
+			( usemin ? ( 1 << 3 ) : 0 ) |
+			( minequals ? ( 1 << 4 ) : 0 ) |
+			( usemax ? ( 1 << 5 ) : 0 ) |
+#ifdef MAPBASE
+			( isbit ? ( 1 << 7 ) : 0 ) |
+#endif
+			( maxequals ? ( 1 << 6 ) : 0 );
+
+		buf.PutInt( flags );
+		buf.PutFloat( minval );
+		buf.PutFloat( maxval );
+		PutCacheString( buf, token.IsValid() ? g_RS.String( token ) : NULL );
+		PutCacheString( buf, rawtoken.IsValid() ? g_RS.String( rawtoken ) : NULL );
+	}
+
+	void	ReadFromCache( CUtlBuffer &buf )
+	{
+		int flags = buf.GetInt();
+		valid = ( flags & ( 1 << 0 ) ) != 0;
+		isnumeric = ( flags & ( 1 << 1 ) ) != 0;
+		notequal = ( flags & ( 1 << 2 ) ) != 0;
+		usemin = ( flags & ( 1 << 3 ) ) != 0;
+		minequals = ( flags & ( 1 << 4 ) ) != 0;
+		usemax = ( flags & ( 1 << 5 ) ) != 0;
+		maxequals = ( flags & ( 1 << 6 ) ) != 0;
+#ifdef MAPBASE
+		isbit = ( flags & ( 1 << 7 ) ) != 0;
+#endif
+		minval = buf.GetFloat();
+		maxval = buf.GetFloat();
+
+		char *s = GetCacheString( buf );
+		if ( s )
+		{
+			SetToken( s );
+			delete[] s;
+		}
+		s = GetCacheString( buf );
+		if ( s )
+		{
+			SetRaw( s );
+			delete[] s;
+		}
+	}
+
 private:
 	CUtlSymbol	token;
 	CUtlSymbol	rawtoken;
@@ -585,6 +675,119 @@ struct Rule
 };
 #pragma pack()
 
+//-----------------------------------------------------------------------------
+// Purpose: Narrows FindBestMatchingRule down to the rules that can score.
+//			Each rule is filed under one of its required criteria that can only
+//			match a single value, preferring "concept". A query looks up what
+//			its criteria set holds for those names and only scores the rules
+//			filed under those values, plus the rules with no such criterion.
+//			A rule that was left out would have failed a required criterion,
+//			so its score would have been 0.
+//-----------------------------------------------------------------------------
+class CResponseRuleIndex
+{
+public:
+	// The symbols are case insensitive, like the string compares in CompareUsingMatcher
+	CResponseRuleIndex() : m_Symbols( 0, 32, true ), m_Buckets( DefLessFunc( unsigned int ) ), m_bValid( false )
+	{
+	}
+
+	bool	IsValid() const		{ return m_bValid; }
+	void	Invalidate()		{ m_bValid = false; }
+
+	void	Reset()
+	{
+		m_Symbols.RemoveAll();
+		m_KeyNames.RemoveAll();
+		m_Buckets.RemoveAll();
+		m_BucketRules.RemoveAll();
+		m_Unkeyed.RemoveAll();
+		m_bValid = false;
+	}
+
+	// Files irule under criterion == value, or with the unkeyed rules if criterion is NULL
+	void	AddRule( int irule, const char *criterion, const char *value )
+	{
+		if ( !criterion )
+		{
+			m_Unkeyed.AddToTail( irule );
+			return;
+		}
+
+		CUtlSymbol name = m_Symbols.AddString( criterion );
+		if ( m_KeyNames.Find( name ) == m_KeyNames.InvalidIndex() )
+		{
+			m_KeyNames.AddToTail( name );
+		}
+
+		unsigned int key = BucketKey( name, m_Symbols.AddString( value ) );
+		unsigned short i = m_Buckets.Find( key );
+		if ( i == m_Buckets.InvalidIndex() )
+		{
+			i = m_Buckets.Insert( key, m_BucketRules.AddToTail() );
+		}
+		m_BucketRules[ m_Buckets[ i ] ].AddToTail( irule );
+	}
+
+	void	Finish()			{ m_bValid = true; }
+
+	// Fills candidates with the rules that can score against set, in rule order so that
+	// ties come out the same as from a scan of every rule
+	void	GetCandidates( const AI_CriteriaSet& set, CUtlVector< int >& candidates ) const
+	{
+		candidates.RemoveAll();
+
+		int c = m_KeyNames.Count();
+		for ( int i = 0; i < c; i++ )
+		{
+			// A criterion the set doesn't have is compared as ""
+			const char *actualValue = "";
+			int found = set.FindCriterionIndex( m_Symbols.String( m_KeyNames[ i ] ) );
+			if ( found != -1 )
+			{
+				actualValue = set.GetValue( found );
+			}
+
+			CUtlSymbol value = m_Symbols.Find( actualValue );
+			if ( !value.IsValid() )
+				continue;
+
+			unsigned short bucket = m_Buckets.Find( BucketKey( m_KeyNames[ i ], value ) );
+			if ( bucket != m_Buckets.InvalidIndex() )
+			{
+				candidates.AddVectorToTail( m_BucketRules[ m_Buckets[ bucket ] ] );
+			}
+		}
+
+		candidates.AddVectorToTail( m_Unkeyed );
+		if ( c > 0 )
+		{
+			candidates.Sort( CompareRuleIndices );
+		}
+	}
+
+	int		NumKeyedBuckets() const	{ return m_BucketRules.Count(); }
+	int		NumUnkeyed() const		{ return m_Unkeyed.Count(); }
+
+private:
+	static unsigned int BucketKey( CUtlSymbol name, CUtlSymbol value )
+	{
+		return ( (unsigned int)(UtlSymId_t)name << 16 ) | (UtlSymId_t)value;
+	}
+
+	static int __cdecl CompareRuleIndices( const int *a, const int *b )
+	{
+		return *a - *b;
+	}
+
+	CUtlSymbolTable					m_Symbols;
+	CUtlVector< CUtlSymbol >		m_KeyNames;		// criteria the rules are filed under
+	CUtlMap< unsigned int, int >	m_Buckets;		// name and value symbols -> m_BucketRules
+	CUtlVector< CUtlVector< int > >	m_BucketRules;
+	CUtlVector< int >				m_Unkeyed;
+	bool							m_bValid;
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -728,6 +931,8 @@ public:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	bool		IsIndexableCriteria( Criteria *c );
+	void		BuildRuleIndex();
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -740,6 +945,10 @@ public:
 
 	void		LoadFromBuffer( const char *scriptfile, const char *buffer, CStringPool &includedFiles );
 
+	void		AddScriptSource( const char *scriptfile, const char *buffer );
+	bool		LoadRuleSetCache( const char *basescript );
+	void		SaveRuleSetCache( const char *basescript, int nInstancedCriteria );
+
 	void		GetCurrentScript( char *buf, size_t buflen );
 	int			GetCurrentToken() const;
 	void		SetCurrentScript( const char *script );
@@ -755,6 +964,20 @@ public:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	CResponseRuleIndex	m_RuleIndex;
+	CUtlVector< int >	m_RuleCandidates;
+
+	// The scripts read by LoadRuleSet, which the rule set cache is checked against
+	struct ScriptSource_t
+	{
+		CUtlString	name;
+		int			size;	// -1 if the script couldn't be loaded
+		CRC32_t		crc;
+	};
+
+	CUtlVector< ScriptSource_t >	m_ScriptSources;
+	bool		m_bRecordScriptSources;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -807,6 +1030,7 @@ CResponseSystem::CResponseSystem()
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
+	m_bRecordScriptSources = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -862,6 +1086,7 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+	m_RuleIndex.Reset();
 }
 
 //-----------------------------------------------------------------------------
@@ -1777,11 +2002,24 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	CUtlVector< int >	bestrules;
 	float bestscore = 0.001f;
 
-	int c = m_Rules.Count();
+	// Verbose output and rr_debugrule want to see every rule scored
+	const char *pszDebugRule = rr_debugrule.GetString();
+	bool bUseIndex = rr_ruleindex.GetBool() && !verbose && !( pszDebugRule && pszDebugRule[0] );
+	if ( bUseIndex )
+	{
+		if ( !m_RuleIndex.IsValid() )
+		{
+			BuildRuleIndex();
+		}
+		m_RuleIndex.GetCandidates( set, m_RuleCandidates );
+	}
+
+	int c = bUseIndex ? m_RuleCandidates.Count() : m_Rules.Count();
 	int i;
 	for ( i = 0; i < c; i++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
+		int irule = bUseIndex ? m_RuleCandidates[ i ] : i;
+		float score = ScoreCriteriaAgainstRule( set, irule, verbose );
 		// Check equals so that we keep track of all matching rules
 		if ( score >= bestscore )
 		{
@@ -1793,7 +2031,7 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 			}
 
 			// Add to bucket
-			bestrules.AddToTail( i );
+			bestrules.AddToTail( irule );
 		}
 	}
 
@@ -1813,6 +2051,75 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	return bestrules[ idx ];
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Can the rule index file a rule under this criterion? It has to be
+//			required and only able to match one value.
+//-----------------------------------------------------------------------------
+bool CResponseSystem::IsIndexableCriteria( Criteria *c )
+{
+	if ( !c->required || c->IsSubCriteriaType() || !c->name )
+		return false;
+
+	Matcher &m = c->matcher;
+	if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+		return false;
+
+#ifdef MAPBASE
+	if ( m.isbit )
+		return false;
+
+	// Wildcards and regex can match more than one value
+	const char *pszToken = m.GetToken();
+	if ( pszToken[0] == '@' || Q_strstr( pszToken, "*" ) || Q_strstr( pszToken, "?" ) )
+		return false;
+#endif
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Files every rule in the rule index
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RuleIndex.Reset();
+
+	int c = m_Rules.Count();
+	for ( int irule = 0; irule < c; irule++ )
+	{
+		Rule *rule = &m_Rules[ irule ];
+
+		Criteria *key = NULL;
+		int count = rule->m_Criteria.Count();
+		for ( int i = 0; i < count; i++ )
+		{
+			Criteria *crit = &m_Criteria[ rule->m_Criteria[ i ] ];
+			if ( !IsIndexableCriteria( crit ) )
+				continue;
+
+			// Concepts split the rules up the most
+			if ( !key || ( Q_stricmp( key->name, "concept" ) && !Q_stricmp( crit->name, "concept" ) ) )
+			{
+				key = crit;
+			}
+		}
+
+		if ( key )
+		{
+			m_RuleIndex.AddRule( irule, key->name, key->matcher.GetToken() );
+		}
+		else
+		{
+			m_RuleIndex.AddRule( irule, NULL, NULL );
+		}
+	}
+
+	m_RuleIndex.Finish();
+
+	DevMsg( 2, "CResponseSystem:  indexed %i rules under %i criteria values, %i rules always scored\n",
+		c, m_RuleIndex.NumKeyedBuckets(), m_RuleIndex.NumUnkeyed() );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
@@ -2050,6 +2357,12 @@ void CResponseSystem::ParseInclude( CStringPool &includedFiles )
 	if ( !filesystem->ReadFile( includefile, "GAME", buf ) )
 	{
 		DevMsg( "Unable to load #included script %s\n", includefile );
+
+		// The cache has to notice if this file shows up later
+		if ( m_bRecordScriptSources )
+		{
+			AddScriptSource( includefile, NULL );
+		}
 		return;
 	}
 
@@ -2061,6 +2374,11 @@ void CResponseSystem::LoadFromBuffer( const char *scriptfile, const char *buffer
 	includedFiles.Allocate( scriptfile );
 	PushScript( scriptfile, (unsigned char * )buffer );
 
+	if ( m_bRecordScriptSources )
+	{
+		AddScriptSource( scriptfile, buffer );
+	}
+
 	if( rr_dumpresponses.GetBool() )
 	{
 		DevMsg("Reading: %s\n", scriptfile );
@@ -2137,6 +2455,16 @@ void CResponseSystem::LoadFromBuffer( const char *scriptfile, const char *buffer
 //-----------------------------------------------------------------------------
 void CResponseSystem::LoadRuleSet( const char *basescript )
 {
+	// The cache restores the dictionaries index for index, so it can only fill an empty system
+	bool bUseCache = rr_cache.GetBool() && !rr_dumpresponses.GetBool() &&
+		!m_Responses.Count() && !m_Criteria.Count() && !m_Rules.Count() && !m_Enumerations.Count();
+
+	if ( bUseCache && LoadRuleSetCache( basescript ) )
+	{
+		BuildRuleIndex();
+		return;
+	}
+
 	int length = 0;
 	unsigned char *buffer = (unsigned char *)UTIL_LoadFileForMe( basescript, &length );
 	if ( length <= 0 || !buffer )
@@ -2147,11 +2475,361 @@ void CResponseSystem::LoadRuleSet( const char *basescript )
 
 	CStringPool includedFiles;
 
+	int nFirstInstancedCriteria = instancedCriteria;
+	m_ScriptSources.RemoveAll();
+	m_bRecordScriptSources = bUseCache;
+
 	LoadFromBuffer( basescript, (const char *)buffer, includedFiles );
 
+	m_bRecordScriptSources = false;
+
 	UTIL_FreeFile( buffer );
 
 	Assert( m_ScriptStack.Count() == 0 );
+
+	if ( bUseCache )
+	{
+		SaveRuleSetCache( basescript, instancedCriteria - nFirstInstancedCriteria );
+	}
+	m_ScriptSources.Purge();
+
+	BuildRuleIndex();
+}
+
+//-----------------------------------------------------------------------------
+// Rule set cache
+//
+// Parsing the response scripts is a large part of the server's load time, so
+// LoadRuleSet writes out the dictionaries it built in binary form. The cache
+// lists every script the parse read, including #includes that were missing,
+// with its size and CRC. If any of them changed, the cache is ignored and
+// written again after the scripts are parsed.
+//-----------------------------------------------------------------------------
+#define RR_CACHE_ID			MAKEID( 'R', 'R', 'C', 'H' )
+#define RR_CACHE_VERSION	1
+
+static void GetRuleSetCacheName( const char *basescript, char *out, int outsize )
+{
+	char base[ MAX_PATH ];
+	Q_StripExtension( basescript, base, sizeof( base ) );
+	Q_snprintf( out, outsize, "cache/%s.rrc", base );
+}
+
+static bool IsScriptSourceUnchanged( const char *scriptfile, int size, CRC32_t crc )
+{
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( scriptfile, "GAME", buf ) )
+		return size < 0;
+
+	if ( size < 0 )
+		return false;
+
+	buf.PutChar( 0 );
+	const char *text = (const char *)buf.Base();
+	int len = Q_strlen( text );
+	return ( len == size ) && ( CRC32_ProcessSingleBuffer( text, len ) == crc );
+}
+
+void CResponseSystem::AddScriptSource( const char *scriptfile, const char *buffer )
+{
+	ScriptSource_t &source = m_ScriptSources[ m_ScriptSources.AddToTail() ];
+	source.name = scriptfile;
+	source.size = buffer ? Q_strlen( buffer ) : -1;
+	source.crc = buffer ? CRC32_ProcessSingleBuffer( buffer, source.size ) : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills the empty dictionaries from the cache, if none of the
+//			scripts it was built from have changed
+//-----------------------------------------------------------------------------
+bool CResponseSystem::LoadRuleSetCache( const char *basescript )
+{
+	char cachefile[ MAX_PATH ];
+	GetRuleSetCacheName( basescript, cachefile, sizeof( cachefile ) );
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( cachefile, "MOD", buf ) )
+		return false;
+
+	if ( buf.GetInt() != RR_CACHE_ID || buf.GetInt() != RR_CACHE_VERSION || buf.GetInt() != (int)sizeof( AI_ResponseParams ) )
+	{
+		DevMsg( 1, "CResponseSystem:  %s is from another version, ignoring it\n", cachefile );
+		return false;
+	}
+
+	int i, j, c;
+
+	c = buf.GetInt();
+	for ( i = 0; i < c && buf.IsValid(); i++ )
+	{
+		char *scriptfile = GetCacheString( buf );
+		int size = buf.GetInt();
+		CRC32_t crc = buf.GetUnsignedInt();
+
+		bool bUnchanged = scriptfile && buf.IsValid() && IsScriptSourceUnchanged( scriptfile, size, crc );
+		delete[] scriptfile;
+		if ( !bUnchanged )
+		{
+			DevMsg( 1, "CResponseSystem:  %s is out of date\n", cachefile );
+			return false;
+		}
+	}
+
+	int nInstancedCriteria = buf.GetInt();
+
+	// Each dictionary was written in index order, and inserting into an empty
+	// dictionary hands out the same indices again
+	bool bOk = buf.IsValid();
+
+	c = buf.GetInt();
+	for ( i = 0; i < c && bOk; i++ )
+	{
+		char *name = GetCacheString( buf );
+		Enumeration newEnum;
+		newEnum.value = buf.GetFloat();
+
+		bOk = name && buf.IsValid() && m_Enumerations.Insert( name, newEnum ) == i;
+		delete[] name;
+	}
+
+	c = bOk ? buf.GetInt() : 0;
+	for ( i = 0; i < c && bOk; i++ )
+	{
+		char *name = GetCacheString( buf );
+		bOk = name && buf.IsValid() && m_Criteria.Insert( name ) == i;
+		delete[] name;
+		if ( !bOk )
+			break;
+
+		Criteria &criteria = m_Criteria[ i ];
+		criteria.name = GetCacheString( buf );
+		criteria.value = GetCacheString( buf );
+		buf.Get( &criteria.weight, sizeof( criteria.weight ) );
+		criteria.required = buf.GetChar() != 0;
+		criteria.matcher.ReadFromCache( buf );
+
+		int nSubCriteria = buf.GetInt();
+		for ( j = 0; j < nSubCriteria && buf.IsValid(); j++ )
+		{
+			criteria.subcriteria.AddToTail( buf.GetUnsignedShort() );
+		}
+		bOk = buf.IsValid();
+	}
+
+	c = bOk ? buf.GetInt() : 0;
+	for ( i = 0; i < c && bOk; i++ )
+	{
+		char *name = GetCacheString( buf );
+		bOk = name && buf.IsValid() && m_Responses.Insert( name ) == i;
+		delete[] name;
+		if ( !bOk )
+			break;
+
+		ResponseGroup &group = m_Responses[ i ];
+		int nResponses = buf.GetInt();
+		for ( j = 0; j < nResponses && buf.IsValid(); j++ )
+		{
+			Response &response = group.group[ group.group.AddToTail() ];
+			response.value = GetCacheString( buf );
+			buf.Get( &response.weight, sizeof( response.weight ) );
+			response.depletioncount = buf.GetUnsignedChar();
+			response.type = buf.GetUnsignedChar();
+			response.first = buf.GetChar() != 0;
+			response.last = buf.GetChar() != 0;
+		}
+
+		buf.Get( &group.rp, sizeof( group.rp ) );
+		group.m_bEnabled = buf.GetChar() != 0;
+		group.m_nCurrentIndex = buf.GetUnsignedChar();
+		group.m_nDepletionCount = buf.GetUnsignedChar();
+		group.m_bDepleteBeforeRepeat = buf.GetChar() != 0;
+		group.m_bHasFirst = buf.GetChar() != 0;
+		group.m_bHasLast = buf.GetChar() != 0;
+		group.m_bSequential = buf.GetChar() != 0;
+		group.m_bNoRepeat = buf.GetChar() != 0;
+		bOk = buf.IsValid();
+	}
+
+	c = bOk ? buf.GetInt() : 0;
+	for ( i = 0; i < c && bOk; i++ )
+	{
+		char *name = GetCacheString( buf );
+		bOk = name && buf.IsValid() && m_Rules.Insert( name ) == i;
+		delete[] name;
+		if ( !bOk )
+			break;
+
+		Rule &rule = m_Rules[ i ];
+		int nCriteria = buf.GetInt();
+		for ( j = 0; j < nCriteria && buf.IsValid(); j++ )
+		{
+			rule.m_Criteria.AddToTail( buf.GetUnsignedShort() );
+		}
+		int nResponses = buf.GetInt();
+		for ( j = 0; j < nResponses && buf.IsValid(); j++ )
+		{
+			rule.m_Responses.AddToTail( buf.GetUnsignedShort() );
+		}
+
+		rule.m_szContext = GetCacheString( buf );
+#ifdef MAPBASE
+		rule.m_iContextFlags = buf.GetInt();
+#else
+		rule.m_bApplyContextToWorld = buf.GetChar() != 0;
+#endif
+		rule.m_bMatchOnce = buf.GetChar() != 0;
+		rule.m_bEnabled = buf.GetChar() != 0;
+		bOk = buf.IsValid();
+	}
+
+	if ( !bOk )
+	{
+		Warning( "CResponseSystem:  %s is damaged, reparsing %s\n", cachefile, basescript );
+		Clear();
+		return false;
+	}
+
+	instancedCriteria += nInstancedCriteria;
+
+	DevMsg( 1, "CResponseSystem:  %s (%i rules, %i criteria, and %i responses) from %s\n",
+		basescript, m_Rules.Count(), m_Criteria.Count(), m_Responses.Count(), cachefile );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the dictionaries LoadRuleSet just parsed to the cache
+//-----------------------------------------------------------------------------
+void CResponseSystem::SaveRuleSetCache( const char *basescript, int nInstancedCriteria )
+{
+	// Nothing should have been removed while parsing, but a hole in a
+	// dictionary couldn't be restored by inserting in order
+	if ( m_Enumerations.Count() != m_Enumerations.MaxElement() ||
+		m_Criteria.Count() != m_Criteria.MaxElement() ||
+		m_Responses.Count() != m_Responses.MaxElement() ||
+		m_Rules.Count() != m_Rules.MaxElement() )
+	{
+		Assert( 0 );
+		return;
+	}
+
+	// Without the base script there was nothing to cache
+	if ( !m_ScriptSources.Count() || m_ScriptSources[ 0 ].size < 0 )
+		return;
+
+	int i, j, c;
+
+	CUtlBuffer buf;
+	buf.PutInt( RR_CACHE_ID );
+	buf.PutInt( RR_CACHE_VERSION );
+	buf.PutInt( sizeof( AI_ResponseParams ) );
+
+	c = m_ScriptSources.Count();
+	buf.PutInt( c );
+	for ( i = 0; i < c; i++ )
+	{
+		PutCacheString( buf, m_ScriptSources[ i ].name );
+		buf.PutInt( m_ScriptSources[ i ].size );
+		buf.PutUnsignedInt( m_ScriptSources[ i ].crc );
+	}
+
+	buf.PutInt( nInstancedCriteria );
+
+	c = m_Enumerations.Count();
+	buf.PutInt( c );
+	for ( i = 0; i < c; i++ )
+	{
+		PutCacheString( buf, m_Enumerations.GetElementName( i ) );
+		buf.PutFloat( m_Enumerations[ i ].value );
+	}
+
+	c = m_Criteria.Count();
+	buf.PutInt( c );
+	for ( i = 0; i < c; i++ )
+	{
+		Criteria &criteria = m_Criteria[ i ];
+		PutCacheString( buf, m_Criteria.GetElementName( i ) );
+		PutCacheString( buf, criteria.name );
+		PutCacheString( buf, criteria.value );
+		buf.Put( &criteria.weight, sizeof( criteria.weight ) );
+		buf.PutChar( criteria.required ? 1 : 0 );
+		criteria.matcher.WriteToCache( buf );
+
+		buf.PutInt( criteria.subcriteria.Count() );
+		for ( j = 0; j < criteria.subcriteria.Count(); j++ )
+		{
+			buf.PutUnsignedShort( criteria.subcriteria[ j ] );
+		}
+	}
+
+	c = m_Responses.Count();
+	buf.PutInt( c );
+	for ( i = 0; i < c; i++ )
+	{
+		ResponseGroup &group = m_Responses[ i ];
+		PutCacheString( buf, m_Responses.GetElementName( i ) );
+
+		buf.PutInt( group.group.Count() );
+		for ( j = 0; j < group.group.Count(); j++ )
+		{
+			Response &response = group.group[ j ];
+			PutCacheString( buf, response.value );
+			buf.Put( &response.weight, sizeof( response.weight ) );
+			buf.PutUnsignedChar( response.depletioncount );
+			buf.PutUnsignedChar( response.type );
+			buf.PutChar( response.first ? 1 : 0 );
+			buf.PutChar( response.last ? 1 : 0 );
+		}
+
+		buf.Put( &group.rp, sizeof( group.rp ) );
+		buf.PutChar( group.m_bEnabled ? 1 : 0 );
+		buf.PutUnsignedChar( group.m_nCurrentIndex );
+		buf.PutUnsignedChar( group.m_nDepletionCount );
+		buf.PutChar( group.m_bDepleteBeforeRepeat ? 1 : 0 );
+		buf.PutChar( group.m_bHasFirst ? 1 : 0 );
+		buf.PutChar( group.m_bHasLast ? 1 : 0 );
+		buf.PutChar( group.m_bSequential ? 1 : 0 );
+		buf.PutChar( group.m_bNoRepeat ? 1 : 0 );
+	}
+
+	c = m_Rules.Count();
+	buf.PutInt( c );
+	for ( i = 0; i < c; i++ )
+	{
+		Rule &rule = m_Rules[ i ];
+		PutCacheString( buf, m_Rules.GetElementName( i ) );
+
+		buf.PutInt( rule.m_Criteria.Count() );
+		for ( j = 0; j < rule.m_Criteria.Count(); j++ )
+		{
+			buf.PutUnsignedShort( rule.m_Criteria[ j ] );
+		}
+		buf.PutInt( rule.m_Responses.Count() );
+		for ( j = 0; j < rule.m_Responses.Count(); j++ )
+		{
+			buf.PutUnsignedShort( rule.m_Responses[ j ] );
+		}
+
+		PutCacheString( buf, rule.GetContext() );
+#ifdef MAPBASE
+		buf.PutInt( rule.m_iContextFlags );
+#else
+		buf.PutChar( rule.m_bApplyContextToWorld ? 1 : 0 );
+#endif
+		buf.PutChar( rule.m_bMatchOnce ? 1 : 0 );
+		buf.PutChar( rule.m_bEnabled ? 1 : 0 );
+	}
+
+	char cachefile[ MAX_PATH ];
+	GetRuleSetCacheName( basescript, cachefile, sizeof( cachefile ) );
+
+	char cachedir[ MAX_PATH ];
+	Q_ExtractFilePath( cachefile, cachedir, sizeof( cachedir ) );
+	filesystem->CreateDirHierarchy( cachedir, "DEFAULT_WRITE_PATH" );
+
+	if ( !filesystem->WriteFile( cachefile, "DEFAULT_WRITE_PATH", buf ) )
+	{
+		DevMsg( 1, "CResponseSystem:  couldn't write %s\n", cachefile );
+	}
 }
 
 static ResponseType_t ComputeResponseType( const char *s )
@@ -2570,6 +3248,7 @@ int CResponseSystem::ParseOneCriterion( const char *criterionName )
 		//ResponseWarning( "Additional definition for criteria '%s', overwriting\n", criterionName );
 		m_Criteria[existing] = newCriterion;
 		m_Criteria.SetElementName(existing, criterionName);
+		m_RuleIndex.Invalidate();
 		return existing;
 	}
 #else
@@ -2581,6 +3260,7 @@ int CResponseSystem::ParseOneCriterion( const char *criterionName )
 #endif
 
 	int idx = m_Criteria.Insert( criterionName, newCriterion );
+	m_RuleIndex.Invalidate();
 	return idx;
 }
 
@@ -2669,8 +3349,6 @@ void CResponseSystem::ParseEnumeration( void )
 //-----------------------------------------------------------------------------
 void CResponseSystem::ParseRule( void )
 {
-	static int instancedCriteria = 0;
-
 	char ruleName[ 128 ];
 	ParseToken();
 	Q_strncpy( ruleName, token, sizeof( ruleName ) );
@@ -2810,10 +3488,12 @@ void CResponseSystem::ParseRule( void )
 			//ResponseWarning( "Additional definition for rule '%s', overwriting\n", ruleName );
 			m_Rules[existing] = newRule;
 			m_Rules.SetElementName(existing, ruleName);
+			m_RuleIndex.Invalidate();
 			return;
 		}
 #endif
 		m_Rules.Insert( ruleName, newRule );
+		m_RuleIndex.Invalidate();
 	}
 	else
 	{
@@ -3015,6 +3695,7 @@ void CResponseSystem::CopyRuleFrom( Rule *pSrcRule, int iRule, CResponseSystem *
 
 	// Add rule.
 	pCustomSystem->m_Rules.Insert( m_Rules.GetElementName( iRule ), dstRule );
+	pCustomSystem->m_RuleIndex.Invalidate();
 }
 
 #ifdef MAPBASE
@@ -246,7 +246,7 @@ CAI_Manager g_AI_Manager;
 
 CAI_Manager::CAI_Manager()
 {
-	m_AIs.EnsureCapacity( MAX_AIS );
+	m_nChanges = 0;
 }
 
 //-------------------------------------
@@ -269,18 +269,109 @@ int CAI_Manager::NumAIs()
 
 int CAI_Manager::AddAI( CAI_BaseNPC *pAI )
 {
-	m_AIs.AddToTail( pAI );
-	return NumAIs() - 1;
+	int i = m_AIs.AddToTail( pAI );
+	pAI->SetAIIndex( i );
+	m_nChanges++;
+	return i;
 }
 
 //-------------------------------------
 
 void CAI_Manager::RemoveAI( CAI_BaseNPC *pAI )
 {
-	int i = m_AIs.Find( pAI );
+	int i = pAI->GetAIIndex();
 
-	if ( i != -1 )
-		m_AIs.FastRemove( i );
+	if ( !m_AIs.IsValidIndex( i ) || m_AIs[i] != pAI )
+	{
+		Assert( m_AIs.Find( pAI ) == m_AIs.InvalidIndex() );
+		return;
+	}
+
+	// The last AI fills the hole, and its lag compensation history goes with it
+	int iLast = m_AIs.Count() - 1;
+	m_AIs.FastRemove( i );
+	if ( i != iLast )
+	{
+		m_AIs[i]->SetAIIndex( i );
+		lagcompensation->MoveNpcData( iLast, i );
+	}
+	else
+	{
+		lagcompensation->RemoveNpcData( i );
+	}
+	pAI->SetAIIndex( -1 );
+
+	int iClass = pAI->GetAIClass();
+	if ( iClass != -1 )
+	{
+		CAIArray &members = m_AIClasses[iClass];
+		int j = pAI->GetAIClassIndex();
+		Assert( members[j] == pAI );
+
+		members.FastRemove( j );
+		if ( j < members.Count() )
+		{
+			members[j]->SetAIClassSlot( iClass, j );
+		}
+		pAI->SetAIClassSlot( -1, -1 );
+	}
+
+	m_nChanges++;
+}
+
+//-------------------------------------
+
+bool CAI_Manager::FindAI( CAI_BaseNPC *pAI )
+{
+	int i = pAI->GetAIIndex();
+	return ( m_AIs.IsValidIndex( i ) && m_AIs[i] == pAI );
+}
+
+//-------------------------------------
+
+void CAI_Manager::AddAIToClass( CAI_BaseNPC *pAI, const char *pszClassname )
+{
+	Assert( pAI->GetAIClass() == -1 );
+
+	int iClass;
+	int iName = m_AIClassNames.Find( pszClassname );
+	if ( iName != m_AIClassNames.InvalidIndex() )
+	{
+		iClass = m_AIClassNames[iName];
+	}
+	else
+	{
+		iClass = m_AIClasses.AddToTail();
+		m_AIClassNames.Insert( pszClassname, iClass );
+	}
+
+	pAI->SetAIClassSlot( iClass, m_AIClasses[iClass].AddToTail( pAI ) );
+}
+
+//-------------------------------------
+
+int CAI_Manager::FindAIClass( const char *pszClassname )
+{
+	int iName = m_AIClassNames.Find( pszClassname );
+	return ( iName != m_AIClassNames.InvalidIndex() ) ? m_AIClassNames[iName] : -1;
+}
+
+//-------------------------------------
+
+CAI_BaseNPC **CAI_Manager::AccessAIsOfClass( int iClass )
+{
+	if ( iClass == -1 || !m_AIClasses[iClass].Count() )
+		return NULL;
+	return m_AIClasses[iClass].Base();
+}
+
+//-------------------------------------
+
+int CAI_Manager::NumAIsOfClass( int iClass )
+{
+	if ( iClass == -1 )
+		return 0;
+	return m_AIClasses[iClass].Count();
 }
 
 
@@ -12208,6 +12299,8 @@ void CAI_BaseNPC::PostConstructor( const char *szClassname )
 {
 	BaseClass::PostConstructor( szClassname );
 	CreateComponents();
+
+	g_AI_Manager.AddAIToClass( this, szClassname );
 }
 
 //-----------------------------------------------------------------------------
@@ -12760,7 +12853,8 @@ CAI_BaseNPC::CAI_BaseNPC(void)
 	m_interuptSchedule			= NULL;
 	m_nDebugPauseIndex			= 0;
 
-	SetAIIndex(g_AI_Manager.AddAI(this));
+	SetAIClassSlot( -1, -1 );
+	g_AI_Manager.AddAI( this );
 	lagcompensation->RemoveNpcData(GetAIIndex());
 	
 	if ( g_AI_Manager.NumAIs() == 1 )
@@ -12807,8 +12901,6 @@ CAI_BaseNPC::~CAI_BaseNPC(void)
 	delete m_pMoveProbe;
 	delete m_pSenses;
 	delete m_pTacticalServices;
-
-	lagcompensation->RemoveNpcData(GetAIIndex());
 }
 
 //-----------------------------------------------------------------------------
@@ -12829,6 +12921,107 @@ void CAI_BaseNPC::UpdateOnRemove(void)
 	BaseClass::UpdateOnRemove();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Does everything UTIL_Remove() would to a dead NPC except delete it.
+//			The NPC stays hidden, out of the world and out of the AI list until
+//			RestoreForReuse().
+//-----------------------------------------------------------------------------
+void CAI_BaseNPC::RemoveForReuse( void )
+{
+	Assert( !IsAlive() );
+
+	// Weapons would be deleted along with the NPC, but the slots have to be
+	// empty for the next life
+	RemoveAllWeapons();
+
+	// Every class gets to clean up the way it would for a removal. This tells
+	// the owner about the death, removes children, and leaves the squad.
+	UpdateOnRemove();
+	RemoveFlag( FL_KILLME );
+	SetName( NULL_STRING );
+
+	AddEffects( EF_NODRAW );
+	AddSolidFlags( FSOLID_NOT_SOLID );
+	m_takedamage = DAMAGE_NO;
+	SetThink( NULL );
+	SetNextThink( TICK_NEVER_THINK );
+	SetTouch( NULL );
+	SetUse( NULL );
+
+	g_AI_Manager.RemoveAI( this );
+	gEntList.HideEntityFromSearches( this, true );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Puts an NPC from RemoveForReuse() back the way it was when it was
+//			created, ready for the caller to spawn it again. NPCInit() and
+//			NPCInitThink() redo the schedule, squad and relationships from the
+//			NPC's keyvalues, so this only forgets what the last life left behind.
+//-----------------------------------------------------------------------------
+void CAI_BaseNPC::RestoreForReuse( void )
+{
+	Assert( !IsAlive() && GetAIIndex() == -1 );
+
+	// The NPC keeps its entity handle, so anything other NPCs still remember
+	// about the corpse would carry over to the new life
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
+	{
+		CAI_BaseNPC *pOther = ppAIs[i];
+		if ( pOther->GetEnemy() == this )
+		{
+			pOther->SetEnemy( NULL, false );
+		}
+		if ( pOther->GetTarget() == this )
+		{
+			pOther->SetTarget( NULL );
+		}
+		if ( pOther->GetEnemies() )
+		{
+			pOther->GetEnemies()->ClearMemory( this );
+		}
+		pOther->RemoveEntityRelationship( this );
+	}
+
+	gEntList.HideEntityFromSearches( this, false );
+	g_AI_Manager.AddAI( this );
+	lagcompensation->RemoveNpcData( GetAIIndex() );
+	g_AI_Manager.AddAIToClass( this, GetClassname() );
+	gEntList.NotifyCreateEntity( this );
+
+	// Memory
+	RemoveMemory();
+	m_pEnemies = new CAI_Enemies;
+	m_afMemory = MEMORY_CLEAR;
+	SetEnemy( NULL, false );
+	SetTarget( NULL );
+
+	// Squad, left in CleanupOnDeath(), and rejoined by name in StartNPC()
+	Assert( !m_pSquad );
+	m_pSquad = NULL;
+	m_bDidDeathCleanup = false;
+
+	// Relationships, rebuilt from the class table and m_RelationshipString
+	RemoveAllRelationships();
+
+	// Schedule and state
+	ClearSchedule( "Reused by an NPC maker" );
+	GetNavigator()->ClearGoal();
+	m_Conditions.ClearAll();
+	m_NPCState = NPC_STATE_NONE;
+	m_hCine = NULL;
+	SetEfficiency( AIE_NORMAL );
+
+	// Corpse
+	RemoveFlag( FL_TRANSRAGDOLL | FL_DISSOLVING | FL_ONFIRE );
+	RemoveEffects( EF_NODRAW );
+	RemoveSolidFlags( FSOLID_NOT_SOLID );
+	m_nRenderFX = kRenderFxNone;
+	SetRenderMode( kRenderNormal );
+	SetRenderColorA( 255 );
+	AddEffects( EF_NOINTERP );
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 int CAI_BaseNPC::UpdateTransmitState()
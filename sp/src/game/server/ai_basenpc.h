@@ -28,6 +28,7 @@
 #include "ai_moveshoot.h"
 #include "entityoutput.h"
 #include "utlvector.h"
+#include "utldict.h"
 #include "activitylist.h"
 #include "bitstring.h"
 #include "ai_basenpc.h"
@@ -492,10 +493,13 @@ float ChangeDistance( float flInterval, float flGoalDistance, float flGoalVeloci
 // Central location for components of the AI to operate across all AIs without
 // iterating over the global list of entities.
 //
+// The array has no fixed size and stays densely packed. Each NPC knows its
+// slot, so removing one moves the last AI into the hole in constant time.
+// AIs are also kept in a list per classname, so systems that only care about
+// some NPC types don't have to walk all of them.
+//
 //=============================================================================
 
-#define MAX_AIS	256 
-
 class CAI_Manager
 {
 public:
@@ -507,13 +511,27 @@ public:
 	int AddAI(CAI_BaseNPC *pAI);
 	void RemoveAI( CAI_BaseNPC *pAI );
 
-	bool FindAI( CAI_BaseNPC *pAI )	{ return ( m_AIs.Find( pAI ) != m_AIs.InvalidIndex() ); }
+	bool FindAI( CAI_BaseNPC *pAI );
+
+	// Bumped whenever the AI array is added to or reordered, so callers caching
+	// indices into AccessAIs() know when to rebuild
+	int GetChangeCount() const		{ return m_nChanges; }
+
+	// Classname lists. An NPC joins the list for the classname it was created
+	// with. FindAIClass returns -1 if no AI of that class was ever made.
+	void			AddAIToClass( CAI_BaseNPC *pAI, const char *pszClassname );
+	int				FindAIClass( const char *pszClassname );
+	CAI_BaseNPC **	AccessAIsOfClass( int iClass );
+	int				NumAIsOfClass( int iClass );
 	
 private:
 	
 	typedef CUtlVector<CAI_BaseNPC *> CAIArray;
 	
 	CAIArray m_AIs;
+	CUtlDict< int, int > m_AIClassNames;	// into m_AIClasses
+	CUtlVector< CAIArray > m_AIClasses;
+	int m_nChanges;
 
 };
 
@@ -578,6 +596,10 @@ public:
 	virtual void		CleanupOnDeath( CBaseEntity *pCulprit = NULL, bool bFireDeathOutput = true );
 	virtual void		UpdateOnRemove( void );
 
+	// Lets an NPC maker keep a dead NPC instead of deleting it, and spawn it again later
+	void				RemoveForReuse( void );
+	void				RestoreForReuse( void );
+
 	virtual int			UpdateTransmitState();
 
 	//---------------------------------
@@ -2341,11 +2363,18 @@ public:
 
 	void				StartPingEffect( void ) { m_flTimePingEffect = gpGlobals->curtime + 2.0f; DispatchUpdateTransmitState(); }
 
-	// used by lag compensation to be able to refer to & track specific NPCs, and detect changes in the AI list 
+	// slot in CAI_Manager's array, which lag compensation also keeps its history by
 	void				SetAIIndex(int i) { m_iAIIndex = i; }
 	int					GetAIIndex() { return m_iAIIndex; }
+
+	// CAI_Manager classname list and slot in it
+	void				SetAIClassSlot(int iClass, int i) { m_iAIClass = iClass; m_iAIClassIndex = i; }
+	int					GetAIClass() { return m_iAIClass; }
+	int					GetAIClassIndex() { return m_iAIClassIndex; }
 private:
 	int					m_iAIIndex;
+	int					m_iAIClass;
+	int					m_iAIClassIndex;
 };
 
 
@@ -14,6 +14,7 @@
 #include "ai_node.h"
 #include "ai_link.h"
 #include "ai_network.h"
+#include "ai_networkclusters.h"
 #include "ai_networkmanager.h"
 #ifdef MAPBASE
 #include "ai_hint.h"
@@ -453,6 +454,8 @@ void CAI_DynamicLink::InitDynamicLinks(void)
 							pLink->m_iAcceptedMoveTypes[i] = pDynamicLink->m_nLinkType;
 						}
 					}
+
+					g_pBigAINet->GetClusters()->Invalidate();
 				}
 			}
 
@@ -643,6 +646,12 @@ void CAI_DynamicLink::SetLinkState(void)
 		CAI_Link* pLink = FindLink();
 		if ( pLink )
 		{
+			if ( pLink->m_pDynamicLink != this )
+			{
+				// Dynamic links bound clusters, so this changes their shape
+				g_pBigAINet->GetClusters()->Invalidate();
+			}
+
 			pLink->m_pDynamicLink = this;
 			if (m_nLinkState == LINK_OFF)
 			{
@@ -652,6 +661,7 @@ void CAI_DynamicLink::SetLinkState(void)
 			{
 				pLink->m_LinkInfo &= ~bits_LINK_OFF;
 			}
+			g_pBigAINet->GetClusters()->OnLinkStateChanged();
 		}
 		else
 		{
@@ -21,6 +21,8 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+ConVar ai_hint_grid( "ai_hint_grid", "1", 0, "Use the hint grids for hint searches that have include zones or want the nearest hint" );
+
 #define REPORTFAILURE(text) if ( hintCriteria.HasFlag( bits_HINT_NODE_REPORT_FAILURES ) ) \
 								NDebugOverlay::Text( GetAbsOrigin(), text, false, 60 )
 
@@ -248,11 +250,248 @@ bool CHintCriteria::InExcludedZone( const Vector &testPosition ) const
 	return InZone( m_zoneExclude, testPosition );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Determine if any point of a box could be within our include list
+//-----------------------------------------------------------------------------
+bool CHintCriteria::IncludedZonesOverlapBox( const Vector &mins, const Vector &maxs ) const
+{
+	int	numZones = m_zoneInclude.Count();
+
+	for ( int i = 0; i < numZones; i++ )
+	{
+		if ( CalcSqrDistanceToAABB( mins, maxs, m_zoneInclude[i].position ) <= m_zoneInclude[i].radiussqr )
+			return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// CAI_HintGrid
+//-----------------------------------------------------------------------------
+CAI_HintGrid::CAI_HintGrid()
+ :	m_Cells( 0, 0, DefLessFunc( int ) ),
+	m_iNextSerial( 0 ),
+	m_iMinX( INT_MAX ),
+	m_iMinY( INT_MAX ),
+	m_iMaxX( INT_MIN ),
+	m_iMaxY( INT_MIN )
+{
+}
+
+CAI_HintGrid::~CAI_HintGrid()
+{
+	m_Cells.PurgeAndDeleteElements();
+}
+
+int CAI_HintGrid::CellForHint( CAI_Hint *pHint )
+{
+	if ( pHint->GetMoveParent() )
+		return HINT_GRID_LOOSE_CELL;
+
+	return CellForPoint( pHint->GetAbsOrigin() );
+}
+
+int CAI_HintGrid::CellForPoint( const Vector &vecPoint )
+{
+	int x = (int)floorf( vecPoint.x / HINT_GRID_CELL_SIZE );
+	int y = (int)floorf( vecPoint.y / HINT_GRID_CELL_SIZE );
+	return PackCell( x, y );
+}
+
+void CAI_HintGrid::UnpackCell( int iCell, int *pX, int *pY )
+{
+	// Sign extend the packed cell coordinates
+	*pX = (short)( ( iCell >> 16 ) & 0xffff );
+	*pY = (short)( iCell & 0xffff );
+}
+
+CAI_HintGrid::CellEntries_t *CAI_HintGrid::GetOrAddCell( int iCell )
+{
+	int slot = m_Cells.Find( iCell );
+	if ( slot == m_Cells.InvalidIndex() )
+	{
+		slot = m_Cells.Insert( iCell, new CellEntries_t );
+
+		if ( iCell != HINT_GRID_LOOSE_CELL )
+		{
+			int x, y;
+			UnpackCell( iCell, &x, &y );
+			m_iMinX = MIN( m_iMinX, x );
+			m_iMinY = MIN( m_iMinY, y );
+			m_iMaxX = MAX( m_iMaxX, x );
+			m_iMaxY = MAX( m_iMaxY, y );
+		}
+	}
+	return m_Cells[ slot ];
+}
+
+void CAI_HintGrid::AddHint( CAI_Hint *pHint, int iCell )
+{
+	Assert( iCell != HINT_GRID_NO_CELL );
+
+	Entry_t entry;
+	entry.pHint = pHint;
+	entry.iSerial = m_iNextSerial++;
+	GetOrAddCell( iCell )->AddToTail( entry );
+}
+
+void CAI_HintGrid::RemoveHint( CAI_Hint *pHint, int iCell )
+{
+	int slot = m_Cells.Find( iCell );
+	if ( slot == m_Cells.InvalidIndex() )
+		return;
+
+	CellEntries_t *pEntries = m_Cells[ slot ];
+	FOR_EACH_VEC( *pEntries, i )
+	{
+		if ( pEntries->Element( i ).pHint == pHint )
+		{
+			pEntries->Remove( i );
+			break;
+		}
+	}
+
+	if ( !pEntries->Count() )
+	{
+		delete pEntries;
+		m_Cells.RemoveAt( slot );
+	}
+}
+
+void CAI_HintGrid::MoveHint( CAI_Hint *pHint, int iOldCell, int iNewCell )
+{
+	int slot = m_Cells.Find( iOldCell );
+	if ( slot == m_Cells.InvalidIndex() )
+		return;
+
+	CellEntries_t *pEntries = m_Cells[ slot ];
+	FOR_EACH_VEC( *pEntries, i )
+	{
+		if ( pEntries->Element( i ).pHint == pHint )
+		{
+			// Keep the serial, the hint hasn't moved in its list
+			Entry_t entry = pEntries->Element( i );
+			RemoveHint( pHint, iOldCell );
+			GetOrAddCell( iNewCell )->AddToTail( entry );
+			return;
+		}
+	}
+}
+
+void CAI_HintGrid::GatherHints( const CHintCriteria &hintCriteria, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const
+{
+	bool bHasIncludeZones = hintCriteria.HasIncludeZones();
+
+	for ( int slot = m_Cells.FirstInorder(); slot != m_Cells.InvalidIndex(); slot = m_Cells.NextInorder( slot ) )
+	{
+		int iCell = m_Cells.Key( slot );
+		if ( bHasIncludeZones && iCell != HINT_GRID_LOOSE_CELL )
+		{
+			int x, y;
+			UnpackCell( iCell, &x, &y );
+			Vector mins( x * HINT_GRID_CELL_SIZE, y * HINT_GRID_CELL_SIZE, -MAX_COORD_FLOAT );
+			Vector maxs( mins.x + HINT_GRID_CELL_SIZE, mins.y + HINT_GRID_CELL_SIZE, MAX_COORD_FLOAT );
+			if ( !hintCriteria.IncludedZonesOverlapBox( mins, maxs ) )
+				continue;
+		}
+
+		AppendCell( m_Cells[ slot ], position, iList, pResult );
+	}
+}
+
+void CAI_HintGrid::GatherLooseHints( const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const
+{
+	AppendCell( HINT_GRID_LOOSE_CELL, position, iList, pResult );
+}
+
+void CAI_HintGrid::GatherHintsInRing( int x, int y, int iRing, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const
+{
+	// Only the part of the ring that overlaps cells that have been used
+	int xMin = MAX( x - iRing, m_iMinX );
+	int xMax = MIN( x + iRing, m_iMaxX );
+	int yMin = MAX( y - iRing, m_iMinY );
+	int yMax = MIN( y + iRing, m_iMaxY );
+
+	for ( int cx = xMin; cx <= xMax; ++cx )
+	{
+		// The first and last columns of the ring are whole, the columns
+		// between only have their ends
+		if ( cx == x - iRing || cx == x + iRing )
+		{
+			for ( int cy = yMin; cy <= yMax; ++cy )
+			{
+				AppendCell( PackCell( cx, cy ), position, iList, pResult );
+			}
+		}
+		else
+		{
+			if ( y - iRing >= yMin )
+				AppendCell( PackCell( cx, y - iRing ), position, iList, pResult );
+			if ( y + iRing <= yMax )
+				AppendCell( PackCell( cx, y + iRing ), position, iList, pResult );
+		}
+	}
+}
+
+void CAI_HintGrid::GatherHintsBeyondRing( int x, int y, int iRing, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const
+{
+	for ( int slot = m_Cells.FirstInorder(); slot != m_Cells.InvalidIndex(); slot = m_Cells.NextInorder( slot ) )
+	{
+		int iCell = m_Cells.Key( slot );
+		if ( iCell == HINT_GRID_LOOSE_CELL )
+			continue;
+
+		int cx, cy;
+		UnpackCell( iCell, &cx, &cy );
+		if ( MAX( abs( cx - x ), abs( cy - y ) ) <= iRing )
+			continue;
+
+		AppendCell( m_Cells[ slot ], position, iList, pResult );
+	}
+}
+
+int CAI_HintGrid::GetLastRing( int x, int y ) const
+{
+	if ( m_iMinX > m_iMaxX )
+		return 0;
+
+	return MAX( MAX( abs( m_iMinX - x ), abs( m_iMaxX - x ) ), MAX( abs( m_iMinY - y ), abs( m_iMaxY - y ) ) );
+}
+
+void CAI_HintGrid::AppendCell( int iCell, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const
+{
+	int slot = m_Cells.Find( iCell );
+	if ( slot != m_Cells.InvalidIndex() )
+	{
+		AppendCell( m_Cells[ slot ], position, iList, pResult );
+	}
+}
+
+void CAI_HintGrid::AppendCell( const CellEntries_t *pEntries, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const
+{
+	FOR_EACH_VEC( *pEntries, i )
+	{
+		const Entry_t &entry = pEntries->Element( i );
+
+		int iCandidate = pResult->AddToTail();
+		AI_HintCandidate_t &candidate = pResult->Element( iCandidate );
+		candidate.pHint = entry.pHint;
+		candidate.flDistSqr = ( entry.pHint->GetAbsOrigin() - position ).LengthSqr();
+		candidate.iList = iList;
+		candidate.iSerial = entry.iSerial;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Init static variables
 //-----------------------------------------------------------------------------
 CAIHintVector CAI_HintManager::gm_AllHints;
 CUtlMap< int,  CAIHintVector >	CAI_HintManager::gm_TypedHints( 0, 0, DefLessFunc( int ) );
+CAI_HintGrid CAI_HintManager::gm_AllHintsGrid;
+CUtlMap< int, CAI_HintGrid * >	CAI_HintManager::gm_TypedHintGrids( 0, 0, DefLessFunc( int ) );
+CBitVec< NUM_ENT_ENTRIES >		CAI_HintManager::gm_GridHintEntries;
+CUtlVector< CAI_Hint * >		CAI_HintManager::gm_MovedHints;
 CAI_Hint*	CAI_HintManager::gm_pLastFoundHints[ CAI_HintManager::HINT_HISTORY ];
 int			CAI_HintManager::gm_nFoundHintIndex = 0;
 
@@ -305,6 +544,28 @@ bool CAI_HintManager::IsInFoundHintList( CAI_Hint *hint )
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Orders hint grid candidates the way a scan of their lists would
+//			visit them
+//-----------------------------------------------------------------------------
+static int HintCandidateListOrderCompare( const AI_HintCandidate_t *pLeft, const AI_HintCandidate_t *pRight )
+{
+	if ( pLeft->iList != pRight->iList )
+		return ( pLeft->iList < pRight->iList ) ? -1 : 1;
+	return ( pLeft->iSerial - pRight->iSerial );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Orders hint grid candidates nearest first. A list scan keeps the
+//			last of several equally near hints, so ties go in reverse order.
+//-----------------------------------------------------------------------------
+static int HintCandidateNearestCompare( const AI_HintCandidate_t *pLeft, const AI_HintCandidate_t *pRight )
+{
+	if ( pLeft->flDistSqr != pRight->flDistSqr )
+		return ( pLeft->flDistSqr < pRight->flDistSqr ) ? -1 : 1;
+	return -HintCandidateListOrderCompare( pLeft, pRight );
+}
+
 //-----------------------------------------------------------------------------
 int CAI_HintManager::FindAllHints( CAI_BaseNPC *pNPC, const Vector &position, const CHintCriteria &hintCriteria, CUtlVector<CAI_Hint *> *pResult )
 {
@@ -319,12 +580,31 @@ int CAI_HintManager::FindAllHints( CAI_BaseNPC *pNPC, const Vector &position, co
 
 	//  Now loop till we find a valid hint or return to the start
 	CAI_Hint *pTestHint;
-	for ( int i = 0; i < c; ++i )
+	if ( ai_hint_grid.GetBool() && hintCriteria.HasIncludeZones() )
 	{
-		pTestHint = CAI_HintManager::gm_AllHints[ i ];
-		Assert( pTestHint );
-		if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, NULL ) )
-			pResult->AddToTail( pTestHint );
+		// Only the hints near the include zones, in list order
+		UpdateMovedHintCells();
+		CUtlVector<AI_HintCandidate_t> candidates;
+		CAI_HintManager::gm_AllHintsGrid.GatherHints( hintCriteria, position, 0, &candidates );
+		candidates.Sort( HintCandidateListOrderCompare );
+
+		FOR_EACH_VEC( candidates, i )
+		{
+			pTestHint = candidates[ i ].pHint;
+			Assert( pTestHint );
+			if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, NULL ) )
+				pResult->AddToTail( pTestHint );
+		}
+	}
+	else
+	{
+		for ( int i = 0; i < c; ++i )
+		{
+			pTestHint = CAI_HintManager::gm_AllHints[ i ];
+			Assert( pTestHint );
+			if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, NULL ) )
+				pResult->AddToTail( pTestHint );
+		}
 	}
 
 	if ( hadNearest )
@@ -384,12 +664,14 @@ CAI_Hint *CAI_HintManager::FindHint( CAI_BaseNPC *pNPC, const Vector &position,
 	bool bIgnoreHintType = true;
 
 	CUtlVector< CAIHintVector * > lists;
+	CUtlVector< CAI_HintGrid * > grids;		// the same hints as lists, by position
 	if ( singleType )
 	{
 		int slot = CAI_HintManager::gm_TypedHints.Find( hintCriteria.GetFirstHintType() );
 		if ( slot != CAI_HintManager::gm_TypedHints.InvalidIndex() )
 		{
 			lists.AddToTail( &CAI_HintManager::gm_TypedHints[ slot ] );
+			grids.AddToTail( GetTypedHintGrid( hintCriteria.GetFirstHintType() ) );
 		}
 	}
 	else
@@ -403,6 +685,7 @@ CAI_Hint *CAI_HintManager::FindHint( CAI_BaseNPC *pNPC, const Vector &position,
 				if ( slot != CAI_HintManager::gm_TypedHints.InvalidIndex() )
 				{
 					lists.AddToTail( &CAI_HintManager::gm_TypedHints[ slot ] );
+					grids.AddToTail( GetTypedHintGrid( hintCriteria.GetHintType( listType ) ) );
 				}
 			}
 		}
@@ -410,6 +693,7 @@ CAI_Hint *CAI_HintManager::FindHint( CAI_BaseNPC *pNPC, const Vector &position,
 		{
 			// Still need to check hint type in this case
 			lists.AddToTail( &CAI_HintManager::gm_AllHints );
+			grids.AddToTail( &CAI_HintManager::gm_AllHintsGrid );
 			bIgnoreHintType = false;
 		}
 	}
@@ -455,43 +739,51 @@ CAI_Hint *CAI_HintManager::FindHint( CAI_BaseNPC *pNPC, const Vector &position,
 	// Longer search, reset best distance
 	flBestDistance = MAX_TRACE_LENGTH;
 
-	for ( int listNum = 0; listNum < listCount; ++listNum )
+	if ( ai_hint_grid.GetBool() && ( lookingForNearest || hintCriteria.HasIncludeZones() ) )
 	{
-		CAIHintVector *list = lists[ listNum ];
-		count = list->Count();
-		// -------------------------------------------
-		//  If we have no hints, bail
-		// -------------------------------------------
-		if ( !count )
-			continue;
-
-		//  Now loop till we find a valid hint or return to the start
-		for ( i = 0 ; i < count; ++i )
+		// Only the hints near the include zones, nearest first if that's what we want
+		pBestHint = FindHintInGrids( pNPC, position, hintCriteria, grids, bIgnoreHintType, &visited );
+	}
+	else
+	{
+		for ( int listNum = 0; listNum < listCount; ++listNum )
 		{
-			pTestHint = list->Element( i );
-			Assert( pTestHint );
+			CAIHintVector *list = lists[ listNum ];
+			count = list->Count();
+			// -------------------------------------------
+			//  If we have no hints, bail
+			// -------------------------------------------
+			if ( !count )
+				continue;
+
+			//  Now loop till we find a valid hint or return to the start
+			for ( i = 0 ; i < count; ++i )
+			{
+				pTestHint = list->Element( i );
+				Assert( pTestHint );
 
-			++visited;
+				++visited;
 
-			Assert( dynamic_cast<CAI_Hint *>(pTestHint) != NULL );
-			if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, &flBestDistance, false, bIgnoreHintType ) )
-			{
-				// If we were searching for the nearest, just note that this is now the nearest node
-				if ( lookingForNearest )
-				{
-					pBestHint = pTestHint;
-				}
-				else 
+				Assert( dynamic_cast<CAI_Hint *>(pTestHint) != NULL );
+				if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, &flBestDistance, false, bIgnoreHintType ) )
 				{
-					// If we're not looking for the nearest, we're done
-					CAI_HintManager::AddFoundHint( pTestHint );
+					// If we were searching for the nearest, just note that this is now the nearest node
+					if ( lookingForNearest )
+					{
+						pBestHint = pTestHint;
+					}
+					else 
+					{
+						// If we're not looking for the nearest, we're done
+						CAI_HintManager::AddFoundHint( pTestHint );
 #if defined( HINT_PROFILING )
-					Msg( "visited %d\n", visited );
+						Msg( "visited %d\n", visited );
 #endif
-					return pTestHint;
+						return pTestHint;
+					}
 				}
-			}
-		} 
+			} 
+		}
 	}
 	// Return the nearest node that we found
 	if ( pBestHint )
@@ -516,6 +808,118 @@ CAI_Hint *CAI_HintManager::FindHint( CAI_BaseNPC *pNPC, const Vector &position,
 	return pBestHint;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The long search of FindHint(), limited to the hints in the grid
+//			cells near the include zones. Candidates are tested in list order,
+//			or nearest first when looking for the nearest, in which case the
+//			first hint that matches is the nearest hint that matches.
+//-----------------------------------------------------------------------------
+CAI_Hint *CAI_HintManager::FindHintInGrids( CAI_BaseNPC *pNPC, const Vector &position, const CHintCriteria &hintCriteria, const CUtlVector< CAI_HintGrid * > &grids, bool bIgnoreHintType, int *pVisited )
+{
+	UpdateMovedHintCells();
+
+	bool lookingForNearest = hintCriteria.HasFlag( bits_HINT_NODE_NEAREST );
+	if ( lookingForNearest && !hintCriteria.HasIncludeZones() )
+		return FindNearestHintInGrids( pNPC, position, hintCriteria, grids, bIgnoreHintType, pVisited );
+
+	CUtlVector<AI_HintCandidate_t> candidates;
+	FOR_EACH_VEC( grids, i )
+	{
+		grids[ i ]->GatherHints( hintCriteria, position, i, &candidates );
+	}
+	candidates.Sort( lookingForNearest ? HintCandidateNearestCompare : HintCandidateListOrderCompare );
+
+	FOR_EACH_VEC( candidates, i )
+	{
+		CAI_Hint *pTestHint = candidates[ i ].pHint;
+		Assert( pTestHint );
+
+		++(*pVisited);
+
+		// The order already makes this the nearest so far. A shared best
+		// distance would let a nearer hint that failed a later check, such
+		// as visibility to the player, reject every hint behind it.
+		float flDistance = MAX_TRACE_LENGTH;
+		if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, &flDistance, false, bIgnoreHintType ) )
+			return pTestHint;
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: FindHintInGrids() for the nearest hint anywhere. Gathers the cells
+//			ring by ring around the search position and tests the candidates
+//			nearest first, but only those nearer than any cell still to be
+//			gathered, so it settles on the same hint as sorting every
+//			candidate would without touching the far cells.
+//-----------------------------------------------------------------------------
+CAI_Hint *CAI_HintManager::FindNearestHintInGrids( CAI_BaseNPC *pNPC, const Vector &position, const CHintCriteria &hintCriteria, const CUtlVector< CAI_HintGrid * > &grids, bool bIgnoreHintType, int *pVisited )
+{
+	int x, y;
+	CAI_HintGrid::UnpackCell( CAI_HintGrid::CellForPoint( position ), &x, &y );
+
+	CUtlVector<AI_HintCandidate_t> candidates;
+	int nCells = 0;
+	int iLastRing = 0;
+	FOR_EACH_VEC( grids, i )
+	{
+		nCells += grids[ i ]->CellCount();
+		iLastRing = MAX( iLastRing, grids[ i ]->GetLastRing( x, y ) );
+
+		// Parented hints could be anywhere
+		grids[ i ]->GatherLooseHints( position, i, &candidates );
+	}
+
+	for ( int iRing = 0; ; ++iRing )
+	{
+		// Once a ring has more cells than the grids, it's cheaper to take
+		// everything that's left from the grids themselves
+		bool bLastRing = ( iRing >= iLastRing || iRing * 8 > nCells );
+		FOR_EACH_VEC( grids, i )
+		{
+			if ( bLastRing )
+				grids[ i ]->GatherHintsBeyondRing( x, y, iRing - 1, position, i, &candidates );
+			else
+				grids[ i ]->GatherHintsInRing( x, y, iRing, position, i, &candidates );
+		}
+		candidates.Sort( HintCandidateNearestCompare );
+
+		// How near a hint in a cell outside the rings gathered so far can be
+		float flUnseenDist = FLT_MAX;
+		if ( !bLastRing )
+		{
+			float flMinX = ( x - iRing ) * HINT_GRID_CELL_SIZE;
+			float flMinY = ( y - iRing ) * HINT_GRID_CELL_SIZE;
+			float flMaxX = ( x + iRing + 1 ) * HINT_GRID_CELL_SIZE;
+			float flMaxY = ( y + iRing + 1 ) * HINT_GRID_CELL_SIZE;
+			flUnseenDist = MIN( MIN( position.x - flMinX, flMaxX - position.x ), MIN( position.y - flMinY, flMaxY - position.y ) );
+		}
+		float flUnseenDistSqr = bLastRing ? FLT_MAX : Square( flUnseenDist );
+
+		int nTested = 0;
+		for ( ; nTested < candidates.Count() && candidates[ nTested ].flDistSqr < flUnseenDistSqr; ++nTested )
+		{
+			CAI_Hint *pTestHint = candidates[ nTested ].pHint;
+			Assert( pTestHint );
+
+			++(*pVisited);
+
+			// Each candidate gets its own distance, see FindHintInGrids()
+			float flDistance = MAX_TRACE_LENGTH;
+			if ( pTestHint->HintMatchesCriteria( pNPC, hintCriteria, position, &flDistance, false, bIgnoreHintType ) )
+				return pTestHint;
+		}
+		candidates.RemoveMultipleFromHead( nTested );
+
+		// Nothing further out can be near enough
+		if ( bLastRing || flUnseenDist > MAX_TRACE_LENGTH )
+			break;
+	}
+
+	return NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Searches for a hint node that this NPC cares about. If one is
 //			claims that hint node for this NPC so that no other NPCs
@@ -619,8 +1023,16 @@ void CAI_HintManager::AddHint( CAI_Hint *pHint )
 	// ---------------------------------
 	//  Add to linked list of hints
 	// ---------------------------------
+	pHint->m_iHintGridCell = CAI_HintGrid::CellForHint( pHint );
 	CAI_HintManager::gm_AllHints.AddToTail( pHint );
+	CAI_HintManager::gm_AllHintsGrid.AddHint( pHint, pHint->m_iHintGridCell );
 	CAI_HintManager::AddHintByType( pHint );
+
+	const CBaseHandle &eh = pHint->GetRefEHandle();
+	if ( eh.IsValid() )
+	{
+		gm_GridHintEntries.Set( eh.GetEntryIndex() );
+	}
 }
 
 void CAI_Hint::SetHintType( int hintType, bool force /*= false*/ )
@@ -643,6 +1055,11 @@ void CAI_HintManager::AddHintByType( CAI_Hint *pHint )
 		slot = CAI_HintManager::gm_TypedHints.Insert( type);
 	}
 	CAI_HintManager::gm_TypedHints[ slot ].AddToTail( pHint );
+
+	if ( pHint->m_iHintGridCell != HINT_GRID_NO_CELL )
+	{
+		GetTypedHintGrid( type )->AddHint( pHint, pHint->m_iHintGridCell );
+	}
 }
 
 void CAI_HintManager::RemoveHintByType( CAI_Hint *pHintToRemove )
@@ -652,6 +1069,77 @@ void CAI_HintManager::RemoveHintByType( CAI_Hint *pHintToRemove )
 	{
 		CAI_HintManager::gm_TypedHints[ slot ].FindAndRemove( pHintToRemove );
 	}
+
+	if ( pHintToRemove->m_iHintGridCell != HINT_GRID_NO_CELL )
+	{
+		GetTypedHintGrid( pHintToRemove->HintType() )->RemoveHint( pHintToRemove, pHintToRemove->m_iHintGridCell );
+	}
+}
+
+//------------------------------------------------------------------------------
+// Purpose: Moves a hint to the grid cell for where it is now
+//------------------------------------------------------------------------------
+void CAI_HintManager::UpdateHintCell( CAI_Hint *pHint )
+{
+	int iOldCell = pHint->m_iHintGridCell;
+	if ( iOldCell == HINT_GRID_NO_CELL )
+		return;
+
+	int iNewCell = CAI_HintGrid::CellForHint( pHint );
+	if ( iNewCell == iOldCell )
+		return;
+
+	gm_AllHintsGrid.MoveHint( pHint, iOldCell, iNewCell );
+	GetTypedHintGrid( pHint->HintType() )->MoveHint( pHint, iOldCell, iNewCell );
+	pHint->m_iHintGridCell = iNewCell;
+}
+
+//------------------------------------------------------------------------------
+// Purpose: Called by the entity list whenever any entity's origin changes.
+//			The new origin may not be set yet, so a hint is only queued, and
+//			moved to its new cell by the next grid search.
+//------------------------------------------------------------------------------
+void CAI_HintManager::OnEntityPositionChanged( CBaseEntity *pEntity )
+{
+	const CBaseHandle &eh = pEntity->GetRefEHandle();
+	if ( !eh.IsValid() || !gm_GridHintEntries.IsBitSet( eh.GetEntryIndex() ) )
+		return;
+
+	CAI_Hint *pHint = assert_cast<CAI_Hint *>( pEntity );
+	if ( pHint->m_bHintGridCellMoved )
+		return;
+
+	pHint->m_bHintGridCellMoved = true;
+	gm_MovedHints.AddToTail( pHint );
+}
+
+//------------------------------------------------------------------------------
+// Purpose: Moves the hints whose origins have changed since the last grid
+//			search to their new cells
+//------------------------------------------------------------------------------
+void CAI_HintManager::UpdateMovedHintCells()
+{
+	FOR_EACH_VEC( gm_MovedHints, i )
+	{
+		CAI_Hint *pHint = gm_MovedHints[ i ];
+		pHint->m_bHintGridCellMoved = false;
+		UpdateHintCell( pHint );
+	}
+	gm_MovedHints.RemoveAll();
+}
+
+//------------------------------------------------------------------------------
+// Purpose: The grid that mirrors gm_TypedHints for a hint type, created the
+//			first time it's asked for
+//------------------------------------------------------------------------------
+CAI_HintGrid *CAI_HintManager::GetTypedHintGrid( int hintType )
+{
+	int slot = gm_TypedHintGrids.Find( hintType );
+	if ( slot == gm_TypedHintGrids.InvalidIndex() )
+	{
+		slot = gm_TypedHintGrids.Insert( hintType, new CAI_HintGrid );
+	}
+	return gm_TypedHintGrids[ slot ];
 }
 
 //------------------------------------------------------------------------------
@@ -662,6 +1150,23 @@ void CAI_HintManager::RemoveHint( CAI_Hint *pHintToRemove )
 	// --------------------------------------
 	gm_AllHints.FindAndRemove( pHintToRemove );
 	RemoveHintByType( pHintToRemove );
+	if ( pHintToRemove->m_iHintGridCell != HINT_GRID_NO_CELL )
+	{
+		gm_AllHintsGrid.RemoveHint( pHintToRemove, pHintToRemove->m_iHintGridCell );
+		pHintToRemove->m_iHintGridCell = HINT_GRID_NO_CELL;
+	}
+
+	const CBaseHandle &eh = pHintToRemove->GetRefEHandle();
+	if ( eh.IsValid() )
+	{
+		gm_GridHintEntries.Clear( eh.GetEntryIndex() );
+	}
+
+	if ( pHintToRemove->m_bHintGridCellMoved )
+	{
+		gm_MovedHints.FindAndRemove( pHintToRemove );
+		pHintToRemove->m_bHintGridCellMoved = false;
+	}
 
 	if ( CAI_HintManager::IsInFoundHintList( pHintToRemove ) )
 	{
@@ -884,6 +1389,8 @@ BEGIN_DATADESC( CAI_Hint )
 	DEFINE_FIELD(	 m_flNextUseTime,	FIELD_TIME),
 	DEFINE_FIELD(	 m_vecForward,		FIELD_VECTOR),
 	DEFINE_KEYFIELD( m_nodeFOV,			FIELD_FLOAT,	"nodeFOV" ),
+	//				m_iHintGridCell (set when added to the hint manager)
+	//				m_bHintGridCellMoved
 
 	DEFINE_THINKFUNC( EnableThink ),
 
@@ -978,6 +1485,18 @@ void CAI_Hint::UpdateOnRemove( void )
 	BaseClass::UpdateOnRemove();
 }
 
+void CAI_Hint::SetParent( CBaseEntity *pNewParent, int iAttachment )
+{
+	BaseClass::SetParent( pNewParent, iAttachment );
+	CAI_HintManager::UpdateHintCell( this );
+}
+
+void CAI_Hint::Teleport( const Vector *newPosition, const QAngle *newAngles, const Vector *newVelocity )
+{
+	BaseClass::Teleport( newPosition, newAngles, newVelocity );
+	CAI_HintManager::UpdateHintCell( this );
+}
+
 //------------------------------------------------------------------------------
 // Purpose :  If connected to a node returns node position, otherwise
 //			  returns local hint position
@@ -1523,6 +2042,8 @@ CAI_Hint::CAI_Hint(void)
 {
 	m_flNextUseTime	= 0;
 	m_nTargetNodeID = NO_NODE;
+	m_iHintGridCell = HINT_GRID_NO_CELL;
+	m_bHintGridCellMoved = false;
 }
 
 //-----------------------------------------------------------------------------
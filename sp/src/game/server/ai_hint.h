@@ -150,6 +150,7 @@ public:
 
 	bool		InIncludedZone( const Vector &testPosition ) const;
 	bool		InExcludedZone( const Vector &testPosition ) const;
+	bool		IncludedZonesOverlapBox( const Vector &mins, const Vector &maxs ) const;
 
 	int			NumHintTypes() const;
 	int			GetHintType( int idx ) const;
@@ -205,6 +206,80 @@ public:
 	}
 };
 
+//-----------------------------------------------------------------------------
+// CAI_HintGrid
+//
+// Purpose: The hints of one hint list, bucketed by a cell on the ground plane
+//			so that searches limited by include zones, or looking for the
+//			nearest hint, only test the hints in nearby cells. Each entry
+//			remembers when it was added to its list, so a search can test
+//			candidates in the same order as a scan of the list would.
+//			Parented hints can move anywhere, so they share one cell that
+//			every search tests. A nearest search without include zones
+//			visits the cells in rings around the search position, and stops
+//			as soon as no unvisited cell can hold a nearer hint.
+//-----------------------------------------------------------------------------
+
+#define HINT_GRID_CELL_SIZE		512.0f
+#define HINT_GRID_NO_CELL		INT_MIN			// not in any grid
+#define HINT_GRID_LOOSE_CELL	INT_MAX			// parented hints
+
+struct AI_HintCandidate_t
+{
+	CAI_Hint	*pHint;
+	float		flDistSqr;
+	int			iList;			// which of the searched grids
+	int			iSerial;		// order the hint was added to its list
+};
+
+class CAI_HintGrid
+{
+public:
+	CAI_HintGrid();
+	~CAI_HintGrid();
+
+	void		AddHint( CAI_Hint *pHint, int iCell );
+	void		RemoveHint( CAI_Hint *pHint, int iCell );
+	void		MoveHint( CAI_Hint *pHint, int iOldCell, int iNewCell );
+
+	// Appends the hints of every cell that may hold a hint in the criteria's
+	// include zones, or every hint if the criteria has none
+	void		GatherHints( const CHintCriteria &hintCriteria, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const;
+
+	// Ring searches around cell x, y. A ring is the cells whose larger
+	// coordinate difference from x, y is the ring number.
+	void		GatherLooseHints( const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const;
+	void		GatherHintsInRing( int x, int y, int iRing, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const;
+	void		GatherHintsBeyondRing( int x, int y, int iRing, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const;
+	int			GetLastRing( int x, int y ) const;			// the ring that reaches the last cell ever used
+	int			CellCount() const						{ return m_Cells.Count(); }
+
+	static int	CellForHint( CAI_Hint *pHint );
+	static int	CellForPoint( const Vector &vecPoint );
+	static int	PackCell( int x, int y )				{ return ( ( x & 0xffff ) << 16 ) | ( y & 0xffff ); }
+	static void	UnpackCell( int iCell, int *pX, int *pY );
+
+private:
+	struct Entry_t
+	{
+		CAI_Hint	*pHint;
+		int			iSerial;
+	};
+
+	typedef CUtlVector< Entry_t > CellEntries_t;
+
+	CellEntries_t	*GetOrAddCell( int iCell );
+	void			AppendCell( int iCell, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const;
+	void			AppendCell( const CellEntries_t *pEntries, const Vector &position, int iList, CUtlVector<AI_HintCandidate_t> *pResult ) const;
+
+	CUtlMap< int, CellEntries_t * >	m_Cells;
+	int								m_iNextSerial;
+
+	// Bounds of the cells that have held hints, never shrunk
+	int								m_iMinX, m_iMinY;
+	int								m_iMaxX, m_iMaxY;
+};
+
 class CAI_HintManager
 {
 	friend class CAI_Hint;
@@ -217,6 +292,8 @@ public:
 	static void			RemoveHint( CAI_Hint *pTestHint );
 	static void			AddHintByType( CAI_Hint *pHint );
 	static void			RemoveHintByType( CAI_Hint *pHintToRemove );
+	static void			UpdateHintCell( CAI_Hint *pHint );
+	static void			OnEntityPositionChanged( CBaseEntity *pEntity );
 
 	// Interface for searching the hint node list
 	static CAI_Hint		*FindHint( CAI_BaseNPC *pNPC, const Vector &position, const CHintCriteria &hintCriteria );
@@ -253,10 +330,19 @@ private:
 	static void			ResetFoundHints();
 	static bool			IsInFoundHintList( CAI_Hint *hint );
 
+	static CAI_HintGrid	*GetTypedHintGrid( int hintType );
+	static CAI_Hint		*FindHintInGrids( CAI_BaseNPC *pNPC, const Vector &position, const CHintCriteria &hintCriteria, const CUtlVector< CAI_HintGrid * > &grids, bool bIgnoreHintType, int *pVisited );
+	static CAI_Hint		*FindNearestHintInGrids( CAI_BaseNPC *pNPC, const Vector &position, const CHintCriteria &hintCriteria, const CUtlVector< CAI_HintGrid * > &grids, bool bIgnoreHintType, int *pVisited );
+	static void			UpdateMovedHintCells();
+
 	static int			gm_nFoundHintIndex;
 	static CAI_Hint		*gm_pLastFoundHints[ HINT_HISTORY ];			// Last used hint 
 	static CAIHintVector gm_AllHints;				// A linked list of all hints
 	static CUtlMap< int,  CAIHintVector >	gm_TypedHints;
+	static CAI_HintGrid gm_AllHintsGrid;			// gm_AllHints by position
+	static CUtlMap< int, CAI_HintGrid * >	gm_TypedHintGrids;	// gm_TypedHints by position
+	static CBitVec< NUM_ENT_ENTRIES >		gm_GridHintEntries;	// entity entries of the hints in the grids
+	static CUtlVector< CAI_Hint * >			gm_MovedHints;		// hints to move to a new cell before the next grid search
 };
 
 //-----------------------------------------------------------------------------
@@ -308,6 +394,10 @@ public:
 	bool				HintMatchesCriteria( CAI_BaseNPC *pNPC, const CHintCriteria &hintCriteria, const Vector &position, float *flNearestDistance, bool bIgnoreLock = false, bool bIgnoreHintType = false );
 	bool				IsInNodeFOV( CBaseEntity *pOther );
 
+	// Keep the hint grids up to date when a hint moves
+	virtual void		SetParent( CBaseEntity* pNewParent, int iAttachment = -1 );
+	virtual void		Teleport( const Vector *newPosition, const QAngle *newAngles, const Vector *newVelocity );
+
 #ifdef MAPBASE
 	void				NPCHandleStartNav( CAI_BaseNPC *pNPC, bool bDefaultFacing );
 #endif
@@ -345,6 +435,8 @@ private:
 	COutputEHANDLE		m_OnNPCStoppedUsing;	// Triggered when an NPC has finished using this node.
 	float				m_nodeFOV;
 	Vector				m_vecForward;
+	int					m_iHintGridCell;		// cell in the hint grids, not saved
+	bool				m_bHintGridCellMoved;	// in CAI_HintManager::gm_MovedHints, not saved
 
 	// The next hint in list of all hints
 	friend class CAI_HintManager;
@@ -16,6 +16,8 @@
 #include "ai_navigator.h"
 #include "world.h"
 #include "ai_moveprobe.h"
+#include "ai_networkclusters.h"
+#include "ai_nodevisibility.h"
 #ifdef MAPBASE_VSCRIPT
 #include "ai_hint.h"
 #endif
@@ -159,6 +161,15 @@ CAI_Network::CAI_Network()
 	m_iNumNodes				= 0;		// Number of nodes in this network
 	m_pAInode				= NULL;		// Array of all nodes in this network
 
+	m_pNodeStorage			= NULL;
+	m_nNodeStorage			= 0;
+	m_pLinkStorage			= NULL;
+	m_nLinkStorage			= 0;
+	m_nLinkStorageUsed		= 0;
+
+	m_pClusters				= new CAI_NetworkClusters( this );
+	m_pVisibility			= new CAI_NodeVisibility( this );
+
 	m_iNearestCacheNext	= NEARNODE_CACHE_SIZE - 1;
 	// Force empty node caches to be rebuild
 	for (int node=0;node<NEARNODE_CACHE_SIZE;node++)
@@ -210,14 +221,28 @@ CAI_Network::~CAI_Network()
 							}
 						}
 					}
-					delete pLink;
+					if ( !IsInLinkStorage( pLink ) )
+						delete pLink;
 				}
 			}
-			delete pNode;
+			if ( IsInNodeStorage( pNode ) )
+				pNode->~CAI_Node();
+			else
+				delete pNode;
 		}
 	}
 	delete[] m_pAInode;
 	m_pAInode = NULL;
+
+	delete[] m_pNodeStorage;
+	m_pNodeStorage = NULL;
+	delete[] m_pLinkStorage;
+	m_pLinkStorage = NULL;
+
+	delete m_pClusters;
+	m_pClusters = NULL;
+	delete m_pVisibility;
+	m_pVisibility = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -582,7 +607,10 @@ CAI_Node *CAI_Network::AddNode( const Vector &origin, float yaw )
 		m_iNumNodes--;
 	}
 
-	m_pAInode[m_iNumNodes] = new CAI_Node( m_iNumNodes, origin, yaw );
+	if ( m_iNumNodes < m_nNodeStorage )
+		m_pAInode[m_iNumNodes] = ConstructNode( m_pNodeStorage + m_iNumNodes * sizeof(CAI_Node), m_iNumNodes, origin, yaw );
+	else
+		m_pAInode[m_iNumNodes] = new CAI_Node( m_iNumNodes, origin, yaw );
 
 #ifdef AI_NODE_TREE
 	if ( !m_pNodeTree )
@@ -597,6 +625,8 @@ CAI_Node *CAI_Network::AddNode( const Vector &origin, float yaw )
 
 	m_iNumNodes++;
 
+	m_pClusters->Invalidate();
+
 	return m_pAInode[m_iNumNodes-1];
 };
 
@@ -634,7 +664,7 @@ CAI_Link *CAI_Network::CreateLink( int srcID, int destID, CAI_DynamicLink *pDyna
 		return NULL;
 	}
 
-	CAI_Link *pLink = new CAI_Link;
+	CAI_Link *pLink = ( m_nLinkStorageUsed < m_nLinkStorage ) ? &m_pLinkStorage[m_nLinkStorageUsed++] : new CAI_Link;
 
 	pLink->m_iSrcID = srcID;
 	pLink->m_iDestID = destID;
@@ -643,9 +673,38 @@ CAI_Link *CAI_Network::CreateLink( int srcID, int destID, CAI_DynamicLink *pDyna
 	pSrcNode->AddLink(pLink);
 	pDestNode->AddLink(pLink);
 
+	m_pClusters->Invalidate();
+
 	return pLink;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Loading knows how big the graph is before it creates anything, so
+//			rather than a heap allocation per node and per link, carve them
+//			out of two blocks.  Anything added past the reservation (edit
+//			mode, dynamic links) falls back to individual allocations.
+//-----------------------------------------------------------------------------
+
+void CAI_Network::ReserveStorage( int nNodes, int nLinks )
+{
+	Assert( m_iNumNodes == 0 && !m_pNodeStorage && !m_pLinkStorage );
+	if ( m_iNumNodes != 0 || m_pNodeStorage || m_pLinkStorage )
+		return;
+
+	if ( nNodes > 0 )
+	{
+		m_pNodeStorage = new byte[ nNodes * sizeof(CAI_Node) ];
+		m_nNodeStorage = nNodes;
+	}
+
+	if ( nLinks > 0 )
+	{
+		m_pLinkStorage = new CAI_Link[ nLinks ];
+		m_nLinkStorage = nLinks;
+		m_nLinkStorageUsed = 0;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Returns true is two nodes are connected by the network graph
 //-----------------------------------------------------------------------------
@@ -692,3 +751,24 @@ IterationRetval_t CAI_Network::EnumElement( IHandleEntity *pHandleEntity )
 }
 
 //=============================================================================
+
+//-----------------------------------------------------------------------------
+
+#include "tier0/memdbgoff.h"
+
+CAI_Node *CAI_Network::ConstructNode( void *pMemory, int id, const Vector &origin, float yaw )
+{
+	return new( pMemory ) CAI_Node( id, origin, yaw );
+}
+
+bool CAI_Network::IsInNodeStorage( CAI_Node *pNode ) const
+{
+	return ( (byte *)pNode >= m_pNodeStorage && (byte *)pNode < m_pNodeStorage + m_nNodeStorage * sizeof(CAI_Node) );
+}
+
+bool CAI_Network::IsInLinkStorage( CAI_Link *pLink ) const
+{
+	return ( pLink >= m_pLinkStorage && pLink < m_pLinkStorage + m_nLinkStorage );
+}
+
+#include "tier0/memdbgon.h"
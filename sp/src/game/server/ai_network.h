@@ -25,6 +25,8 @@ struct AI_Waypoint_t;
 class CAI_BaseNPC;
 class CAI_Link;
 class CAI_DynamicLink;
+class CAI_NetworkClusters;
+class CAI_NodeVisibility;
 
 //-----------------------------------------------------------------------------
 
@@ -92,6 +94,7 @@ public:
 
 	CAI_Node *		AddNode( const Vector &origin, float yaw );						// Returns a new node in the network
 	CAI_Link *		CreateLink( int srcID, int destID, CAI_DynamicLink *pDynamicLink = NULL );
+	void			ReserveStorage( int nNodes, int nLinks );	// Allocate nodes and links in two blocks when the graph size is known up front
 
 	bool			IsConnected(int srcID, int destID);	// Use during run time
 	void			TestIsConnected(int startID, int endID);	// Use only for initialization!
@@ -128,6 +131,9 @@ public:
 	
 	CAI_Node**		AccessNodes() const	{ return m_pAInode; }
 
+	CAI_NetworkClusters *GetClusters()		{ return m_pClusters; }
+	CAI_NodeVisibility *GetVisibility()		{ return m_pVisibility; }
+
 #ifdef MAPBASE_VSCRIPT
 	Vector		ScriptGetNodePosition( int nodeID ) { return GetNodePosition( HULL_HUMAN, nodeID ); }
 	Vector		ScriptGetNodePositionWithHull( int nodeID, int hull ) { return GetNodePosition( (Hull_t)hull, nodeID ); }
@@ -167,9 +173,22 @@ private:
 
 	};
 
+	CAI_Node *			ConstructNode( void *pMemory, int id, const Vector &origin, float yaw );
+	bool				IsInNodeStorage( CAI_Node *pNode ) const;
+	bool				IsInLinkStorage( CAI_Link *pLink ) const;
+
 	int					m_iNumNodes;				// Number of nodes in this network
 	CAI_Node**			m_pAInode;					// Array of all nodes in this network
 
+	byte *				m_pNodeStorage;				// Nodes constructed in place, see ReserveStorage()
+	int					m_nNodeStorage;
+	CAI_Link *			m_pLinkStorage;
+	int					m_nLinkStorage;
+	int					m_nLinkStorageUsed;
+
+	CAI_NetworkClusters *m_pClusters;			// Cluster graph used to narrow pathfinding
+	CAI_NodeVisibility *m_pVisibility;			// Optional eye visibility between nodes, from the .ain
+
 	enum
 	{
 		PARTITION_NODE	= ( 1 << 0 )
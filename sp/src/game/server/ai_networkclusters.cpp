@@ -0,0 +1,374 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Cluster graph over the AI node graph, used to narrow pathfinding
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_networkclusters.h"
+#include "ai_basenpc.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "ai_link.h"
+#include "ai_pathfinder.h"
+#include "bitvec.h"
+#include "utlpriorityqueue.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Nodes that are further apart than this on any axis never share a cluster
+#define AI_CLUSTER_CELL_SIZE	512.0f
+
+// Keeps clusters small enough that a corridor doesn't cover the whole graph
+#define AI_CLUSTER_MAX_NODES	32
+
+//-----------------------------------------------------------------------------
+
+struct AI_ClusterOpen_t
+{
+	int		iCluster;
+	float	flF;
+};
+
+static bool ClusterOpenIsLowerPriority( const AI_ClusterOpen_t &lhs, const AI_ClusterOpen_t &rhs )
+{
+	return ( lhs.flF > rhs.flF );
+}
+
+//-----------------------------------------------------------------------------
+
+CAI_NetworkClusters::CAI_NetworkClusters( CAI_Network *pNetwork )
+ :	m_pNetwork( pNetwork ),
+	m_iLinkStateSerial( 0 ),
+	m_iSearchSerial( 0 )
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::Invalidate()
+{
+	for ( int i = 0; i < NUM_HULLS; i++ )
+	{
+		m_Hulls[i].bBuilt = false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Links that may join two nodes of a cluster. Anything an NPC may
+//			be refused on its own (dynamic links, jumps and climbs) or that
+//			changes node type makes a cluster boundary instead.
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkClusters::IsInternalLink( Hull_t hull, CAI_Link *pLink ) const
+{
+	if ( pLink->m_pDynamicLink || ( pLink->m_LinkInfo & bits_LINK_OFF ) )
+		return false;
+
+	int moveTypes = pLink->m_iAcceptedMoveTypes[hull];
+	if ( moveTypes != bits_CAP_MOVE_GROUND && moveTypes != bits_CAP_MOVE_FLY )
+		return false;
+
+	CAI_Node *pSrc = m_pNetwork->GetNode( pLink->m_iSrcID );
+	CAI_Node *pDest = m_pNetwork->GetNode( pLink->m_iDestID );
+	return ( pSrc->GetType() == pDest->GetType() && pSrc->GetZone() == pDest->GetZone() );
+}
+
+//-----------------------------------------------------------------------------
+
+static int ClusterLinkCompare( const int *pLhs, const int *pRhs )
+{
+	return ( *pLhs - *pRhs );
+}
+
+void CAI_NetworkClusters::Build( Hull_t hull )
+{
+	HullClusters_t &data = m_Hulls[hull];
+	int nNodes = m_pNetwork->NumNodes();
+	int node;
+
+	data.nodeCluster.SetCount( nNodes );
+	for ( node = 0; node < nNodes; node++ )
+	{
+		data.nodeCluster[node] = -1;
+	}
+	data.clusterNodes.RemoveAll();
+	data.clusters.RemoveAll();
+	data.edges.RemoveAll();
+	data.edgeLinks.RemoveAll();
+
+	// ---------------------------------
+	// Flood fill clusters from each unassigned node, staying in the seed's cell
+	// ---------------------------------
+	for ( int seed = 0; seed < nNodes; seed++ )
+	{
+		if ( data.nodeCluster[seed] != -1 )
+			continue;
+
+		int iCluster = data.clusters.AddToTail();
+		Cluster_t &cluster = data.clusters[iCluster];
+		cluster.iFirstNode = data.clusterNodes.Count();
+		cluster.vCenter = vec3_origin;
+
+		Vector vSeed = m_pNetwork->GetNode( seed )->GetPosition( hull );
+
+		data.nodeCluster[seed] = iCluster;
+		data.clusterNodes.AddToTail( seed );
+
+		for ( int iNext = cluster.iFirstNode; iNext < data.clusterNodes.Count(); iNext++ )
+		{
+			CAI_Node *pNode = m_pNetwork->GetNode( data.clusterNodes[iNext] );
+			cluster.vCenter += pNode->GetPosition( hull );
+
+			for ( int link = 0; link < pNode->NumLinks(); link++ )
+			{
+				if ( data.clusterNodes.Count() - cluster.iFirstNode >= AI_CLUSTER_MAX_NODES )
+					break;
+
+				CAI_Link *pLink = pNode->GetLinkByIndex( link );
+				int destID = pLink->DestNodeID( pNode->GetId() );
+				if ( data.nodeCluster[destID] != -1 || !IsInternalLink( hull, pLink ) )
+					continue;
+
+				Vector vDelta = m_pNetwork->GetNode( destID )->GetPosition( hull ) - vSeed;
+				if ( fabs( vDelta.x ) > AI_CLUSTER_CELL_SIZE || fabs( vDelta.y ) > AI_CLUSTER_CELL_SIZE || fabs( vDelta.z ) > AI_CLUSTER_CELL_SIZE )
+					continue;
+
+				data.nodeCluster[destID] = iCluster;
+				data.clusterNodes.AddToTail( destID );
+			}
+		}
+
+		cluster.nNodes = data.clusterNodes.Count() - cluster.iFirstNode;
+		cluster.vCenter /= cluster.nNodes;
+	}
+
+	// ---------------------------------
+	// Edges, from every link that leaves a cluster. Links are shared by both
+	// of their nodes, so each one is seen once from each side, which gives
+	// one edge per direction.
+	// ---------------------------------
+	CUtlVector<int> order;
+	for ( int iCluster = 0; iCluster < data.clusters.Count(); iCluster++ )
+	{
+		Cluster_t &cluster = data.clusters[iCluster];
+		cluster.iFirstEdge = data.edges.Count();
+
+		order.RemoveAll();
+		for ( int i = 0; i < cluster.nNodes; i++ )
+		{
+			CAI_Node *pNode = m_pNetwork->GetNode( data.clusterNodes[cluster.iFirstNode + i] );
+			for ( int link = 0; link < pNode->NumLinks(); link++ )
+			{
+				CAI_Link *pLink = pNode->GetLinkByIndex( link );
+				int destID = pLink->DestNodeID( pNode->GetId() );
+				if ( data.nodeCluster[destID] == iCluster || !pLink->m_iAcceptedMoveTypes[hull] )
+					continue;
+
+				// Sort key: destination cluster, then position in the cluster's node list
+				order.AddToTail( data.nodeCluster[destID] * ( AI_CLUSTER_MAX_NODES * AI_MAX_NODE_LINKS ) + i * AI_MAX_NODE_LINKS + link );
+			}
+		}
+		order.Sort( ClusterLinkCompare );
+
+		for ( int i = 0; i < order.Count(); i++ )
+		{
+			int iDestCluster = order[i] / ( AI_CLUSTER_MAX_NODES * AI_MAX_NODE_LINKS );
+			int iNode = data.clusterNodes[cluster.iFirstNode + ( order[i] / AI_MAX_NODE_LINKS ) % AI_CLUSTER_MAX_NODES];
+			CAI_Node *pNode = m_pNetwork->GetNode( iNode );
+
+			if ( cluster.iFirstEdge == data.edges.Count() || data.edges.Tail().iDestCluster != iDestCluster )
+			{
+				ClusterEdge_t &edge = data.edges[data.edges.AddToTail()];
+				edge.iDestCluster = iDestCluster;
+				edge.flCost = ( data.clusters[iDestCluster].vCenter - cluster.vCenter ).Length();
+				edge.iFirstLink = data.edgeLinks.Count();
+				edge.nLinks = 0;
+				edge.staticMoveTypes = 0;
+				edge.bDynamic = false;
+			}
+
+			ClusterLink_t &clusterLink = data.edgeLinks[data.edgeLinks.AddToTail()];
+			clusterLink.pLink = pNode->GetLinkByIndex( order[i] % AI_MAX_NODE_LINKS );
+			clusterLink.iFromNode = iNode;
+			data.edges.Tail().nLinks++;
+		}
+
+		cluster.nEdges = data.edges.Count() - cluster.iFirstEdge;
+	}
+
+	data.bBuilt = true;
+	data.iLinkStateSerial = -1;
+
+	DevMsg( 2, "AI node graph: %d nodes in %d clusters, %d cluster edges for hull %s\n", nNodes, data.clusters.Count(), data.edges.Count(), NAI_Hull::Name( hull ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Caches which edges are open without asking the NPC
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::UpdateLinkState( Hull_t hull )
+{
+	HullClusters_t &data = m_Hulls[hull];
+
+	for ( int i = 0; i < data.edges.Count(); i++ )
+	{
+		ClusterEdge_t &edge = data.edges[i];
+		edge.staticMoveTypes = 0;
+		edge.bDynamic = false;
+
+		for ( int j = 0; j < edge.nLinks; j++ )
+		{
+			CAI_Link *pLink = data.edgeLinks[edge.iFirstLink + j].pLink;
+			if ( pLink->m_pDynamicLink )
+			{
+				edge.bDynamic = true;
+			}
+			else if ( !( pLink->m_LinkInfo & bits_LINK_OFF ) )
+			{
+				edge.staticMoveTypes |= pLink->m_iAcceptedMoveTypes[hull];
+			}
+		}
+	}
+
+	data.iLinkStateSerial = m_iLinkStateSerial;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkClusters::IsEdgeUsable( CAI_Pathfinder *pPathfinder, Hull_t hull, HullClusters_t &data, const ClusterEdge_t &edge, int moveMask ) const
+{
+	if ( edge.staticMoveTypes & moveMask )
+		return true;
+
+	if ( edge.bDynamic )
+	{
+		for ( int j = 0; j < edge.nLinks; j++ )
+		{
+			const ClusterLink_t &clusterLink = data.edgeLinks[edge.iFirstLink + j];
+			if ( clusterLink.pLink->m_pDynamicLink &&
+				 ( clusterLink.pLink->m_iAcceptedMoveTypes[hull] & moveMask ) &&
+				 pPathfinder->IsLinkEnabled( clusterLink.pLink, clusterLink.iFromNode ) )
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Searches the cluster graph and marks the nodes of every cluster on
+//			the best cluster route in pCorridor
+//-----------------------------------------------------------------------------
+
+CAI_NetworkClusters::CorridorResult_t CAI_NetworkClusters::FindCorridor( CAI_Pathfinder *pPathfinder, Hull_t hull, int capabilities, int startID, int endID, CVarBitVec *pCorridor )
+{
+	HullClusters_t &data = m_Hulls[hull];
+	if ( !data.bBuilt || data.nodeCluster.Count() != m_pNetwork->NumNodes() )
+	{
+		Build( hull );
+	}
+
+	if ( data.iLinkStateSerial != m_iLinkStateSerial )
+	{
+		UpdateLinkState( hull );
+	}
+
+	int iStartCluster = data.nodeCluster[startID];
+	int iEndCluster = data.nodeCluster[endID];
+	if ( iStartCluster == iEndCluster )
+		return CORRIDOR_ALL;
+
+	int nClusters = data.clusters.Count();
+	if ( m_ClusterSearch.Count() < nClusters )
+	{
+		int nOld = m_ClusterSearch.Count();
+		m_ClusterG.SetCount( nClusters );
+		m_ClusterParent.SetCount( nClusters );
+		m_ClusterSearch.SetCount( nClusters );
+		for ( int i = nOld; i < nClusters; i++ )
+		{
+			m_ClusterSearch[i] = 0;
+		}
+	}
+
+	// Search stamps save clearing the scratch arrays for every route
+	if ( ++m_iSearchSerial == 0 )
+	{
+		for ( int i = 0; i < m_ClusterSearch.Count(); i++ )
+		{
+			m_ClusterSearch[i] = 0;
+		}
+		m_iSearchSerial = 1;
+	}
+
+	// Jump links can be used without the jump capability through HINT_JUMP_OVERRIDE
+	int moveMask = capabilities | bits_CAP_MOVE_JUMP;
+	const Vector &vGoal = data.clusters[iEndCluster].vCenter;
+
+	CUtlPriorityQueue<AI_ClusterOpen_t> openList( 0, 64, ClusterOpenIsLowerPriority );
+
+	m_ClusterSearch[iStartCluster] = m_iSearchSerial;
+	m_ClusterG[iStartCluster] = 0;
+	m_ClusterParent[iStartCluster] = -1;
+
+	AI_ClusterOpen_t start = { iStartCluster, ( vGoal - data.clusters[iStartCluster].vCenter ).Length() };
+	openList.Insert( start );
+
+	bool bFound = false;
+	while ( openList.Count() )
+	{
+		AI_ClusterOpen_t current = openList.ElementAtHead();
+		openList.RemoveAtHead();
+
+		if ( current.iCluster == iEndCluster )
+		{
+			bFound = true;
+			break;
+		}
+
+		const Cluster_t &cluster = data.clusters[current.iCluster];
+		float flG = m_ClusterG[current.iCluster];
+
+		// Stale queue entry, this cluster was reached more cheaply since
+		if ( current.flF > flG + ( vGoal - cluster.vCenter ).Length() + 0.1f )
+			continue;
+
+		for ( int i = 0; i < cluster.nEdges; i++ )
+		{
+			const ClusterEdge_t &edge = data.edges[cluster.iFirstEdge + i];
+			float flNewG = flG + edge.flCost;
+
+			if ( m_ClusterSearch[edge.iDestCluster] == m_iSearchSerial && m_ClusterG[edge.iDestCluster] <= flNewG )
+				continue;
+
+			if ( !IsEdgeUsable( pPathfinder, hull, data, edge, moveMask ) )
+				continue;
+
+			m_ClusterSearch[edge.iDestCluster] = m_iSearchSerial;
+			m_ClusterG[edge.iDestCluster] = flNewG;
+			m_ClusterParent[edge.iDestCluster] = current.iCluster;
+
+			AI_ClusterOpen_t next = { edge.iDestCluster, flNewG + ( vGoal - data.clusters[edge.iDestCluster].vCenter ).Length() };
+			openList.Insert( next );
+		}
+	}
+
+	if ( !bFound )
+		return CORRIDOR_NONE;
+
+	for ( int iCluster = iEndCluster; iCluster != -1; iCluster = m_ClusterParent[iCluster] )
+	{
+		const Cluster_t &cluster = data.clusters[iCluster];
+		for ( int i = 0; i < cluster.nNodes; i++ )
+		{
+			pCorridor->Set( data.clusterNodes[cluster.iFirstNode + i] );
+		}
+	}
+
+	return CORRIDOR_FOUND;
+}
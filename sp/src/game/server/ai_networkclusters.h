@@ -0,0 +1,113 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Cluster graph over the AI node graph, used to narrow pathfinding
+//
+//=============================================================================//
+
+#ifndef AI_NETWORKCLUSTERS_H
+#define AI_NETWORKCLUSTERS_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "ai_hull.h"
+#include "utlvector.h"
+
+class CAI_Network;
+class CAI_Link;
+class CAI_Pathfinder;
+class CVarBitVec;
+
+//-----------------------------------------------------------------------------
+// CAI_NetworkClusters
+//
+// Purpose: For each hull, groups nodes into clusters. The nodes in a cluster
+//			share a zone and a cell, and are connected by plain ground or fly
+//			links. Dynamic, jump and climb links always join two clusters.
+//
+//			A route first searches the small cluster graph. The node search
+//			then only expands nodes inside the clusters along that route.
+//			Every node step still goes through CAI_Pathfinder::IsLinkUsable.
+//			The cluster search only rejects links that IsLinkUsable would
+//			also reject, so when it finds no route, none exists.
+//-----------------------------------------------------------------------------
+
+class CAI_NetworkClusters
+{
+public:
+	CAI_NetworkClusters( CAI_Network *pNetwork );
+
+	enum CorridorResult_t
+	{
+		CORRIDOR_NONE,		// no route can exist between the two nodes
+		CORRIDOR_FOUND,		// pCorridor holds the nodes to search
+		CORRIDOR_ALL,		// clusters can't narrow this search
+	};
+
+	CorridorResult_t FindCorridor( CAI_Pathfinder *pPathfinder, Hull_t hull, int capabilities, int startID, int endID, CVarBitVec *pCorridor );
+
+	// Nodes or links were added, or links changed move types or dynamic links
+	void			Invalidate();
+
+	// A dynamic link was switched on or off
+	void			OnLinkStateChanged()		{ m_iLinkStateSerial++; }
+
+	int				NumClusters( Hull_t hull ) const	{ return m_Hulls[hull].clusters.Count(); }
+
+private:
+	struct Cluster_t
+	{
+		Vector			vCenter;
+		int				iFirstNode;		// into clusterNodes
+		int				nNodes;
+		int				iFirstEdge;		// into edges
+		int				nEdges;
+	};
+
+	struct ClusterLink_t
+	{
+		CAI_Link *		pLink;
+		int				iFromNode;
+	};
+
+	struct ClusterEdge_t
+	{
+		int				iDestCluster;
+		float			flCost;
+		int				iFirstLink;		// into edgeLinks
+		int				nLinks;
+		int				staticMoveTypes;	// move types of the links without a dynamic link that are on
+		bool			bDynamic;			// some links are dynamic, which are tested per NPC
+	};
+
+	struct HullClusters_t
+	{
+		HullClusters_t() : bBuilt( false ), iLinkStateSerial( -1 ) {}
+
+		bool						bBuilt;
+		int							iLinkStateSerial;
+		CUtlVector<int>				nodeCluster;
+		CUtlVector<int>				clusterNodes;
+		CUtlVector<Cluster_t>		clusters;
+		CUtlVector<ClusterEdge_t>	edges;
+		CUtlVector<ClusterLink_t>	edgeLinks;
+	};
+
+	void			Build( Hull_t hull );
+	void			UpdateLinkState( Hull_t hull );
+	bool			IsInternalLink( Hull_t hull, CAI_Link *pLink ) const;
+	bool			IsEdgeUsable( CAI_Pathfinder *pPathfinder, Hull_t hull, HullClusters_t &data, const ClusterEdge_t &edge, int moveMask ) const;
+
+	CAI_Network *	m_pNetwork;
+	HullClusters_t	m_Hulls[NUM_HULLS];
+	int				m_iLinkStateSerial;
+
+	// Scratch for the cluster search
+	CUtlVector<float>	m_ClusterG;
+	CUtlVector<int>		m_ClusterParent;
+	CUtlVector<int>		m_ClusterSearch;
+	int					m_iSearchSerial;
+};
+
+#endif // AI_NETWORKCLUSTERS_H
@@ -15,6 +15,8 @@
 
 #include "ai_networkmanager.h"
 #include "ai_network.h"
+#include "ai_networkclusters.h"
+#include "ai_nodevisibility.h"
 #include "ai_node.h"
 #include "ai_navigator.h"
 #include "ai_link.h"
@@ -25,6 +27,7 @@
 #include "ndebugoverlay.h"
 #include "ai_hint.h"
 #include "tier0/icommandline.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -32,6 +35,55 @@
 // Increment this to force rebuilding of all networks
 #define	 AINET_VERSION_NUMBER	37
 
+//-----------------------------------------------------------------------------
+// .ain layout
+//
+// Legacy files are a stream of fields that are parsed one at a time. Current
+// files start with an AINFileHeader_t, followed by flat arrays of nodes, links
+// and Hammer IDs, each at the offset the header gives, then the optional node
+// visibility table. The loader reads those arrays in place in the file buffer.
+// The legacy reader is kept for old files and for the 360, whose files are
+// byte swapped on write. The legacy format never carries node visibility.
+//-----------------------------------------------------------------------------
+
+#define AIN_FILE_ID			MAKEID( 'A', 'I', 'N', 'F' )
+#define AIN_FILE_VERSION	2
+
+struct AINFileHeader_t
+{
+	int				id;					// AIN_FILE_ID
+	int				fileVersion;		// AIN_FILE_VERSION, the layout of this file
+	int				networkVersion;		// AINET_VERSION_NUMBER, how the graph was built
+	int				mapVersion;
+	int				numHulls;
+	int				numNodes;
+	int				numLinks;
+	int				nodeOffset;			// AINFileNode_t[numNodes]
+	int				linkOffset;			// AINFileLink_t[numLinks]
+	int				editorIdOffset;		// int[numNodes]
+	int				visibilityOffset;	// CAI_NodeVisibility rows, see CAI_NodeVisibility::Write()
+	int				visibilitySize;		// 0 if the graph was built without node visibility
+	float			visibilityRange;
+};
+
+struct AINFileNode_t
+{
+	float			origin[3];
+	float			yaw;
+	float			vOffset[NUM_HULLS];
+	int				nodeInfo;
+	short			zone;
+	byte			type;
+	byte			unused;
+};
+
+struct AINFileLink_t
+{
+	short			srcID;
+	short			destID;
+	byte			acceptedMoveTypes[NUM_HULLS];	// per hull connectivity
+};
+
 //-----------------------------------------------------------------------------
 
 int g_DebugConnectNode1 = -1;
@@ -257,8 +309,62 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 	Q_strncat( szNrpFilename, STRING( gpGlobals->mapname ), sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
 	Q_strncat( szNrpFilename, IsX360() ? ".360.ain" : ".ain", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS  );
 
+	// -------------------------------
+	// Check the WC lookup table
+	// -------------------------------
+	CUtlMap<int, int> wcIDs;
+	SetDefLessFunc(wcIDs);
+	bool bCheckForProblems = false;
+	for (int node = 0; node < m_pNetwork->m_iNumNodes; node++)
+	{
+		int iPreviousNodeBinding = wcIDs.Find( GetEditOps()->m_pNodeIndexTable[node] );
+		if ( iPreviousNodeBinding != wcIDs.InvalidIndex() )
+		{
+			if ( !bCheckForProblems )
+			{
+				DevWarning( "******* MAP CONTAINS DUPLICATE HAMMER NODE IDS! CHECK FOR PROBLEMS IN HAMMER TO CORRECT *******\n" );
+				bCheckForProblems = true;
+			}
+			DevWarning( "   AI node %d is associated with Hammer node %d, but %d is already bound to node %d\n", node, GetEditOps()->m_pNodeIndexTable[node], GetEditOps()->m_pNodeIndexTable[node], wcIDs[iPreviousNodeBinding] );
+		}
+		else
+		{
+			wcIDs.Insert( GetEditOps()->m_pNodeIndexTable[node], node );
+		}
+	}
+
 	CUtlBuffer buf;
+	if ( IsX360() )
+	{
+		WriteLegacyNetworkGraph( buf );
+	}
+	else
+	{
+		WriteFlatNetworkGraph( buf );
+	}
+
+	// -------------------------------
+	// Write the file out
+	// -------------------------------
+
+	FileHandle_t fh = filesystem->Open( szNrpFilename, "wb" );
+	if ( !fh )
+	{
+		DevWarning( 2, "Couldn't create %s!\n", szNrpFilename );
+		return;
+	}
+
+	filesystem->Write( buf.Base(), buf.TellPut(), fh );
+	filesystem->Close(fh);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:  Writes the graph as a stream of fields, the way it was always
+//			 written before AINFileHeader_t
+//-----------------------------------------------------------------------------
 
+void CAI_NetworkManager::WriteLegacyNetworkGraph( CUtlBuffer &buf )
+{
 	// ---------------------------
 	// Save the version number
 	// ---------------------------
@@ -325,41 +431,128 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 	// -------------------------------
 	// Dump WC lookup table
 	// -------------------------------
-	CUtlMap<int, int> wcIDs;
-	SetDefLessFunc(wcIDs);
-	bool bCheckForProblems = false;
 	for (node = 0; node < m_pNetwork->m_iNumNodes; node++)
 	{
-		int iPreviousNodeBinding = wcIDs.Find( GetEditOps()->m_pNodeIndexTable[node] );
-		if ( iPreviousNodeBinding != wcIDs.InvalidIndex() )
+		buf.PutInt( GetEditOps()->m_pNodeIndexTable[node] );
+	}
+}
+
+static void PadNetworkGraph( CUtlBuffer &buf, int offset )
+{
+	while ( buf.TellPut() < offset )
+	{
+		buf.PutChar( 0 );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:  Writes the graph as a header and flat arrays, see AINFileHeader_t
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkManager::WriteFlatNetworkGraph( CUtlBuffer &buf )
+{
+	int numNodes = m_pNetwork->m_iNumNodes;
+	int numLinks = 0;
+	int node;
+
+	for ( node = 0; node < numNodes; node++ )
+	{
+		CAI_Node *pNode = m_pNetwork->GetNode(node);
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
 		{
-			if ( !bCheckForProblems )
-			{
-				DevWarning( "******* MAP CONTAINS DUPLICATE HAMMER NODE IDS! CHECK FOR PROBLEMS IN HAMMER TO CORRECT *******\n" );
-				bCheckForProblems = true;
-			}
-			DevWarning( "   AI node %d is associated with Hammer node %d, but %d is already bound to node %d\n", node, GetEditOps()->m_pNodeIndexTable[node], GetEditOps()->m_pNodeIndexTable[node], wcIDs[iPreviousNodeBinding] );
+			// Only count if link source
+			if ( node == pNode->GetLinkByIndex(link)->m_iSrcID )
+				numLinks++;
 		}
-		else
+	}
+
+	AINFileHeader_t header;
+	header.id = AIN_FILE_ID;
+	header.fileVersion = AIN_FILE_VERSION;
+	header.networkVersion = AINET_VERSION_NUMBER;
+	header.mapVersion = gpGlobals->mapversion;
+	header.numHulls = NUM_HULLS;
+	header.numNodes = numNodes;
+	header.numLinks = numLinks;
+	header.nodeOffset = (int)AlignValue( sizeof( AINFileHeader_t ), 4 );
+	header.linkOffset = (int)AlignValue( header.nodeOffset + numNodes * sizeof( AINFileNode_t ), 4 );
+	header.editorIdOffset = (int)AlignValue( header.linkOffset + numLinks * sizeof( AINFileLink_t ), 4 );
+
+	CUtlBuffer visibilityBuf;
+	CAI_NodeVisibility *pVisibility = m_pNetwork->GetVisibility();
+	if ( pVisibility->IsBuilt() )
+	{
+		pVisibility->Write( visibilityBuf );
+	}
+	header.visibilityOffset = (int)AlignValue( header.editorIdOffset + numNodes * sizeof( int ), 4 );
+	header.visibilitySize = visibilityBuf.TellPut();
+	header.visibilityRange = pVisibility->GetRange();
+
+	buf.EnsureCapacity( header.visibilityOffset + header.visibilitySize );
+	buf.Put( &header, sizeof( header ) );
+
+	// -------------------------------
+	// Nodes
+	// -------------------------------
+	PadNetworkGraph( buf, header.nodeOffset );
+	for ( node = 0; node < numNodes; node++ )
+	{
+		CAI_Node *pNode = m_pNetwork->GetNode(node);
+		Assert( pNode->GetZone() != AI_NODE_ZONE_UNKNOWN );
+
+		AINFileNode_t fileNode;
+		memset( &fileNode, 0, sizeof( fileNode ) );
+		fileNode.origin[0] = pNode->GetOrigin().x;
+		fileNode.origin[1] = pNode->GetOrigin().y;
+		fileNode.origin[2] = pNode->GetOrigin().z;
+		fileNode.yaw = pNode->GetYaw();
+		memcpy( fileNode.vOffset, pNode->m_flVOffset, sizeof( fileNode.vOffset ) );
+		fileNode.nodeInfo = pNode->m_eNodeInfo;
+		fileNode.zone = pNode->GetZone();
+		fileNode.type = pNode->GetType();
+
+		buf.Put( &fileNode, sizeof( fileNode ) );
+	}
+
+	// -------------------------------
+	// Links, in the same order the legacy format uses
+	// -------------------------------
+	PadNetworkGraph( buf, header.linkOffset );
+	for ( node = 0; node < numNodes; node++ )
+	{
+		CAI_Node *pNode = m_pNetwork->GetNode(node);
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
 		{
-			wcIDs.Insert( GetEditOps()->m_pNodeIndexTable[node], node );
+			CAI_Link *pLink = pNode->GetLinkByIndex(link);
+			if ( node == pLink->m_iSrcID )
+			{
+				AINFileLink_t fileLink;
+				fileLink.srcID = pLink->m_iSrcID;
+				fileLink.destID = pLink->m_iDestID;
+				memcpy( fileLink.acceptedMoveTypes, pLink->m_iAcceptedMoveTypes, sizeof( fileLink.acceptedMoveTypes ) );
+
+				buf.Put( &fileLink, sizeof( fileLink ) );
+			}
 		}
-		buf.PutInt( GetEditOps()->m_pNodeIndexTable[node] );
 	}
 
 	// -------------------------------
-	// Write the file out
+	// WC lookup table
 	// -------------------------------
-
-	FileHandle_t fh = filesystem->Open( szNrpFilename, "wb" );
-	if ( !fh )
+	PadNetworkGraph( buf, header.editorIdOffset );
+	if ( numNodes )
 	{
-		DevWarning( 2, "Couldn't create %s!\n", szNrpFilename );
-		return;
+		buf.Put( GetEditOps()->m_pNodeIndexTable, numNodes * sizeof( int ) );
 	}
 
-	filesystem->Write( buf.Base(), buf.TellPut(), fh );
-	filesystem->Close(fh);
+	// -------------------------------
+	// Node visibility
+	// -------------------------------
+	PadNetworkGraph( buf, header.visibilityOffset );
+	if ( header.visibilitySize )
+	{
+		buf.Put( visibilityBuf.Base(), header.visibilitySize );
+	}
 }
 
 /* Keep this around for debugging
@@ -471,72 +664,181 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 */
 
 //-----------------------------------------------------------------------------
-// Purpose:  Only called if network has changed since last time level
-//			 was loaded
+// Purpose:  Whether a graph built against mapVersion may be used with the
+//			 map that is loading
 //-----------------------------------------------------------------------------
 
-void CAI_NetworkManager::LoadNetworkGraph( void )
+static bool IsNetworkGraphMapVersionCurrent( int mapVersion )
 {
-	// ---------------------------------------------------
-	// If I'm in edit mode don't load, always recalculate
-	// ---------------------------------------------------
-	DevMsg( "Loading AI graph\n" );
-	if (engine->IsInEditMode())
+	if ( mapVersion == gpGlobals->mapversion || g_ai_norebuildgraph.GetBool() )
+		return true;
+
+	const char *pGameDir = CommandLine()->ParmValue( "-game", "hl2" );		
+	char szLoweredGameDir[256];
+	Q_strncpy( szLoweredGameDir, pGameDir, sizeof( szLoweredGameDir ) );
+	Q_strlower( szLoweredGameDir );
+
+	// hack for shipped ep1 and hl2 maps
+	// they were rebuilt a week after they were actually shipped so allow the slightly
+	// older node graphs to load for these maps
+	if ( !V_stricmp( szLoweredGameDir, "hl2" ) || !V_stricmp( szLoweredGameDir, "episodic" ) )
+		return true;
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:  Loads a graph written as a header and flat arrays. Everything is
+//			 validated before any node is created, and the arrays are read in
+//			 place in the file buffer.
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkManager::LoadFlatNetworkGraph( CUtlBuffer &buf, const char *pszFileName )
+{
+	const int nFileSize = buf.TellPut();
+	if ( nFileSize < (int)sizeof( AINFileHeader_t ) )
 	{
-		DevMsg( "Not loading AI due to edit mode\n" );
-		return;
+		DevWarning( "AI node graph %s is corrupt (truncated header)\n", pszFileName );
+		return false;
 	}
 
-	if ( !g_pGameRules->FAllowNPCs() )
+	const AINFileHeader_t *pHeader = (const AINFileHeader_t *)buf.Base();
+
+	if ( pHeader->fileVersion != AIN_FILE_VERSION || pHeader->networkVersion != AINET_VERSION_NUMBER || pHeader->numHulls != NUM_HULLS )
 	{
-		DevMsg( "Not loading AI due to games rules\n" );
-		return;
+		DevMsg( "AI node graph %s is out of date\n", pszFileName );
+		return false;
 	}
 
-	DevMsg( "Step 1 loading\n" );
+	if ( !IsNetworkGraphMapVersionCurrent( pHeader->mapVersion ) )
+	{
+		DevMsg( "AI node graph %s is out of date (map version changed)\n", pszFileName );
+		return false;
+	}
 
-	// -----------------------------
-	// Make sure directories have been made
-	// -----------------------------
-	char szNrpFilename[MAX_PATH];// text node report filename
-	Q_strncpy( szNrpFilename, "maps" ,sizeof(szNrpFilename));
-	filesystem->CreateDirHierarchy( szNrpFilename, "DEFAULT_WRITE_PATH" );
-	Q_strncat( szNrpFilename, "/graphs", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
-	filesystem->CreateDirHierarchy( szNrpFilename, "DEFAULT_WRITE_PATH" );
+	const int numNodes = pHeader->numNodes;
+	const int numLinks = pHeader->numLinks;
 
-	Q_strncat( szNrpFilename, "/", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
-	Q_strncat( szNrpFilename, STRING( gpGlobals->mapname ), sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
-	Q_strncat( szNrpFilename, IsX360() ? ".360.ain" : ".ain", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
+	if ( numNodes < 0 || numNodes > MAX_NODES || numLinks < 0 ||
+		 pHeader->nodeOffset < (int)sizeof( AINFileHeader_t ) || ( pHeader->nodeOffset & 3 ) ||
+		 pHeader->linkOffset < pHeader->nodeOffset || ( pHeader->linkOffset & 3 ) ||
+		 pHeader->editorIdOffset < pHeader->linkOffset || ( pHeader->editorIdOffset & 3 ) ||
+		 (int64)pHeader->nodeOffset + (int64)numNodes * sizeof( AINFileNode_t ) > pHeader->linkOffset ||
+		 (int64)pHeader->linkOffset + (int64)numLinks * sizeof( AINFileLink_t ) > pHeader->editorIdOffset ||
+		 (int64)pHeader->editorIdOffset + (int64)numNodes * sizeof( int ) > nFileSize ||
+		 pHeader->visibilitySize < 0 ||
+		 ( pHeader->visibilitySize && ( (int64)pHeader->visibilityOffset < (int64)pHeader->editorIdOffset + (int64)numNodes * sizeof( int ) ||
+										(int64)pHeader->visibilityOffset + (int64)pHeader->visibilitySize > nFileSize ) ) )
+	{
+		Error( "AI node graph %s is corrupt\n", pszFileName );
+		return false;
+	}
 
-	MEM_ALLOC_CREDIT();
+	const AINFileNode_t *pFileNodes = (const AINFileNode_t *)( (const byte *)buf.Base() + pHeader->nodeOffset );
+	const AINFileLink_t *pFileLinks = (const AINFileLink_t *)( (const byte *)buf.Base() + pHeader->linkOffset );
+	const int *pEditorIds = (const int *)( (const byte *)buf.Base() + pHeader->editorIdOffset );
 
-	// Read the file in one gulp
-	CUtlBuffer buf;
-	bool bHaveAIN = false;
-	if ( IsX360() && g_pQueuedLoader->IsMapLoading() )
+	int node, link;
+
+	// Count the links each node ends up with so the link lists are sized once
+	CUtlVector<unsigned short> linksPerNode;
+	linksPerNode.SetCount( numNodes );
+	if ( numNodes )
 	{
-		// .ain was loaded anonymously by bsp, should be ready
-		void *pData;
-		int nDataSize;
-		if ( g_pQueuedLoader->ClaimAnonymousJob( szNrpFilename, &pData, &nDataSize ) )
+		memset( linksPerNode.Base(), 0, numNodes * sizeof( unsigned short ) );
+	}
+	for ( link = 0; link < numLinks; link++ )
+	{
+		int srcID = pFileLinks[link].srcID;
+		int destID = pFileLinks[link].destID;
+		if ( srcID < 0 || srcID >= numNodes || destID < 0 || destID >= numNodes )
 		{
-			if ( nDataSize != 0 )
-			{
-				buf.Put( pData, nDataSize );
-				bHaveAIN = true;
-			}
-			filesystem->FreeOptimalReadBuffer( pData );
+			Error( "AI node graph %s is corrupt\n", pszFileName );
+			return false;
 		}
+		linksPerNode[srcID]++;
+		linksPerNode[destID]++;
 	}
-	
 
+	// ------------------------------------------------------------------------
+	// If in wc_edit mode allocate extra space for nodes that might be created
+	// ------------------------------------------------------------------------
+	int numNodeSlots = numNodes;
+	if ( engine->IsInEditMode() )
+	{
+		numNodeSlots = MAX( numNodeSlots, 1024 );
+	}
 
-	if ( !bHaveAIN && !filesystem->ReadFile( szNrpFilename, "game", buf ) )
+	m_pNetwork->m_pAInode = new CAI_Node*[MAX( numNodeSlots, 1 )];
+	memset( m_pNetwork->m_pAInode, 0, sizeof( CAI_Node* ) * MAX( numNodeSlots, 1 ) );
+
+	m_pNetwork->ReserveStorage( numNodes, numLinks );
+
+	// -------------------------------
+	// Nodes
+	// -------------------------------
+	for ( node = 0; node < numNodes; node++ )
 	{
-		DevWarning( 2, "Couldn't read %s!\n", szNrpFilename );
-		return;
+		const AINFileNode_t &fileNode = pFileNodes[node];
+
+		CAI_Node *new_node = m_pNetwork->AddNode( Vector( fileNode.origin[0], fileNode.origin[1], fileNode.origin[2] ), fileNode.yaw );
+
+		memcpy( new_node->m_flVOffset, fileNode.vOffset, sizeof( new_node->m_flVOffset ) );
+		new_node->m_eNodeType = (NodeType_e)fileNode.type;
+		new_node->m_eNodeInfo = fileNode.nodeInfo;
+		new_node->m_zone = fileNode.zone;
+		new_node->m_Links.EnsureCapacity( linksPerNode[node] );
+	}
+
+	// -------------------------------
+	// Links
+	// -------------------------------
+	for ( link = 0; link < numLinks; link++ )
+	{
+		const AINFileLink_t &fileLink = pFileLinks[link];
+
+		CAI_Link *pLink = m_pNetwork->CreateLink( fileLink.srcID, fileLink.destID );
+		if ( pLink )
+		{
+			memcpy( pLink->m_iAcceptedMoveTypes, fileLink.acceptedMoveTypes, sizeof( pLink->m_iAcceptedMoveTypes ) );
+		}
+	}
+
+	// -------------------------------
+	// WC lookup table
+	// -------------------------------
+	delete [] GetEditOps()->m_pNodeIndexTable;
+	GetEditOps()->m_pNodeIndexTable	= new int[MAX( m_pNetwork->m_iNumNodes, 1 )];
+	memset( GetEditOps()->m_pNodeIndexTable, 0, sizeof( int ) *MAX( m_pNetwork->m_iNumNodes, 1 ) );
+	if ( m_pNetwork->m_iNumNodes )
+	{
+		memcpy( GetEditOps()->m_pNodeIndexTable, pEditorIds, sizeof( int ) * m_pNetwork->m_iNumNodes );
+	}
+
+	// -------------------------------
+	// Node visibility
+	// -------------------------------
+	m_pNetwork->GetVisibility()->Purge();
+	if ( pHeader->visibilitySize )
+	{
+		const byte *pVisibility = (const byte *)buf.Base() + pHeader->visibilityOffset;
+		if ( !m_pNetwork->GetVisibility()->Read( pVisibility, pHeader->visibilitySize, numNodes, pHeader->visibilityRange ) )
+		{
+			// The graph itself is fine, tactical queries just trace everything
+			DevWarning( "AI node graph %s has a corrupt node visibility table, ignoring it\n", pszFileName );
+		}
 	}
 
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:  Loads a graph written as a stream of fields, see
+//			 WriteLegacyNetworkGraph()
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkManager::LoadLegacyNetworkGraph( CUtlBuffer &buf, const char *pszFileName )
+{
 	DevMsg( "Checking version\n" );
 
 	// ---------------------------
@@ -544,8 +846,8 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 	// ---------------------------
 	if ( buf.GetChar() == 'V' && buf.GetChar() == 'e' && buf.GetChar() == 'r' )
 	{
-		DevMsg( "AI node graph %s is out of date\n", szNrpFilename );
-		return;
+		DevMsg( "AI node graph %s is out of date\n", pszFileName );
+		return false;
 	}
 	
 	DevMsg( "Passed first ver check\n" );
@@ -558,35 +860,17 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 
 	if ( version != AINET_VERSION_NUMBER)
 	{
-		DevMsg( "AI node graph %s is out of date\n", szNrpFilename );
-		return;
+		DevMsg( "AI node graph %s is out of date\n", pszFileName );
+		return false;
 	}
 
 	int mapversion = buf.GetInt();
 	DevMsg( "Map version %d\n", mapversion );
 
-	if ( mapversion != gpGlobals->mapversion && !g_ai_norebuildgraph.GetBool() )
+	if ( !IsNetworkGraphMapVersionCurrent( mapversion ) )
 	{
-		bool bOK = false;
-		
-		const char *pGameDir = CommandLine()->ParmValue( "-game", "hl2" );		
-		char szLoweredGameDir[256];
-		Q_strncpy( szLoweredGameDir, pGameDir, sizeof( szLoweredGameDir ) );
-		Q_strlower( szLoweredGameDir );
-
-		// hack for shipped ep1 and hl2 maps
-		// they were rebuilt a week after they were actually shipped so allow the slightly
-		// older node graphs to load for these maps
-		if ( !V_stricmp( szLoweredGameDir, "hl2" ) || !V_stricmp( szLoweredGameDir, "episodic" ) )
-		{
-			bOK = true;
-		}
-		
-		if ( !bOK )
-		{
-			DevMsg( "AI node graph %s is out of date (map version changed)\n", szNrpFilename );
-			return;
-		}
+		DevMsg( "AI node graph %s is out of date (map version changed)\n", pszFileName );
+		return false;
 	}
 
 	DevMsg( "Done version checks\n" );
@@ -598,11 +882,11 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 
 	if ( numNodes > MAX_NODES || numNodes < 0 )
 	{
-		Error( "AI node graph %s is corrupt\n", szNrpFilename );
+		Error( "AI node graph %s is corrupt\n", pszFileName );
 		DevMsg( "%s", (const char *)buf.Base() );
 		DevMsg( "\n" );
 		Assert( 0 );
-		return;
+		return false;
 	}
 	
 	DevMsg( "Finishing load\n" );
@@ -676,6 +960,94 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		GetEditOps()->m_pNodeIndexTable[node] = buf.GetInt();
 	}
 
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:  Only called if network has changed since last time level
+//			 was loaded
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkManager::LoadNetworkGraph( void )
+{
+	// ---------------------------------------------------
+	// If I'm in edit mode don't load, always recalculate
+	// ---------------------------------------------------
+	DevMsg( "Loading AI graph\n" );
+	if (engine->IsInEditMode())
+	{
+		DevMsg( "Not loading AI due to edit mode\n" );
+		return;
+	}
+
+	if ( !g_pGameRules->FAllowNPCs() )
+	{
+		DevMsg( "Not loading AI due to games rules\n" );
+		return;
+	}
+
+	DevMsg( "Step 1 loading\n" );
+
+	// -----------------------------
+	// Make sure directories have been made
+	// -----------------------------
+	char szNrpFilename[MAX_PATH];// text node report filename
+	Q_strncpy( szNrpFilename, "maps" ,sizeof(szNrpFilename));
+	filesystem->CreateDirHierarchy( szNrpFilename, "DEFAULT_WRITE_PATH" );
+	Q_strncat( szNrpFilename, "/graphs", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
+	filesystem->CreateDirHierarchy( szNrpFilename, "DEFAULT_WRITE_PATH" );
+
+	Q_strncat( szNrpFilename, "/", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
+	Q_strncat( szNrpFilename, STRING( gpGlobals->mapname ), sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
+	Q_strncat( szNrpFilename, IsX360() ? ".360.ain" : ".ain", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS );
+
+	MEM_ALLOC_CREDIT();
+
+	// Read the file in one gulp
+	CUtlBuffer buf;
+	bool bHaveAIN = false;
+	if ( IsX360() && g_pQueuedLoader->IsMapLoading() )
+	{
+		// .ain was loaded anonymously by bsp, should be ready
+		void *pData;
+		int nDataSize;
+		if ( g_pQueuedLoader->ClaimAnonymousJob( szNrpFilename, &pData, &nDataSize ) )
+		{
+			if ( nDataSize != 0 )
+			{
+				buf.Put( pData, nDataSize );
+				bHaveAIN = true;
+			}
+			filesystem->FreeOptimalReadBuffer( pData );
+		}
+	}
+	
+
+
+	if ( !bHaveAIN && !filesystem->ReadFile( szNrpFilename, "game", buf ) )
+	{
+		DevWarning( 2, "Couldn't read %s!\n", szNrpFilename );
+		return;
+	}
+
+	double flStartTime = Plat_FloatTime();
+
+	bool bLoaded;
+	if ( buf.TellPut() >= (int)sizeof( int ) && *(const int *)buf.Base() == AIN_FILE_ID )
+	{
+		bLoaded = LoadFlatNetworkGraph( buf, szNrpFilename );
+	}
+	else
+	{
+		bLoaded = LoadLegacyNetworkGraph( buf, szNrpFilename );
+	}
+
+	if ( !bLoaded )
+		return;
+
+	DevMsg( "Loaded AI node graph %s (%d nodes) in %.2f ms\n", szNrpFilename, m_pNetwork->m_iNumNodes, ( Plat_FloatTime() - flStartTime ) * 1000.0 );
+
+	int node;
 	
 #if 1
 	CUtlRBTree<int> usedIds;
@@ -2299,6 +2671,11 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 		}
 	}
 
+	pNetwork->GetClusters()->Invalidate();
+
+	// Nodes moved, and there's no time to retrace in the editor
+	pNetwork->GetVisibility()->Purge();
+
 	g_pAINetworkManager->FixupHints();
 
 	EndBuild();
@@ -2317,6 +2694,7 @@ void CAI_NetworkBuilder::EndBuild()
 {
 	m_NeighborsTable.SetSize(0);
 	m_DidSetNeighborsTable.Resize(0);
+	m_VisibilityTable.Purge();
 	CAI_TestHull::ReturnTestHull();
 }
 
@@ -2325,6 +2703,8 @@ void CAI_NetworkBuilder::EndBuild()
 //			 was loaded
 //-----------------------------------------------------------------------------
 
+ConVar ai_node_build_visibility( "ai_node_build_visibility", "0", 0, "Trace eye visibility between ground nodes when building the node graph and save it in the .ain. The cover and line of sight searches don't use it: it only knows the world, and their traces start from the weapon or eye of the NPC rather than the node eyes." );
+ConVar ai_node_build_visibility_range( "ai_node_build_visibility_range", "2048", 0, "Ground nodes further apart than this aren't given node visibility" );
 
 void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 {
@@ -2375,10 +2755,19 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		m_NeighborsTable[i].Resize( nNodes );
 		m_NeighborsTable[i].ClearAll();
 	}
+	if ( ShouldBuildThreaded() )
+	{
+		CFastTimer traceTimer;
+		traceTimer.Start();
+		PrecomputeVisibility( pNetwork );
+		traceTimer.End();
+		DevMsg( "...node visibility traced against the world on %d threads. %f seconds\n", g_pThreadPool->NumThreads() + 1, traceTimer.GetDuration().GetSeconds() );
+	}
 	for (i = 0; i < nNodes; i++)
 	{	
 		InitNeighbors( pNetwork, ppNodes[i] );
 	}
+	m_VisibilityTable.Purge();
 	timer.End();
 	DevMsg( "...done initializing node neighbors. %f seconds\n", timer.GetDuration().GetSeconds() );
 
@@ -2415,8 +2804,25 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 	timer.Start();
 	InitZones( pNetwork);
 	timer.End();
-	masterTimer.End();
+
+	// Links were rebuilt in place, so the clusters can't tell on their own
+	pNetwork->GetClusters()->Invalidate();
 	DevMsg( "...done determining zones. %f seconds\n", timer.GetDuration().GetSeconds() );
+
+	// ------------------------------
+	// Eye visibility for tactical queries
+	// ------------------------------
+	pNetwork->GetVisibility()->Purge();
+	if ( ai_node_build_visibility.GetBool() )
+	{
+		DevMsg( "Tracing node visibility...\n" );
+		timer.Start();
+		pNetwork->GetVisibility()->Build( ai_node_build_visibility_range.GetFloat() );
+		timer.End();
+		DevMsg( "...done tracing node visibility. %f seconds\n", timer.GetDuration().GetSeconds() );
+	}
+
+	masterTimer.End();
 	DevMsg( "...done building AI node graph, %f seconds\n", masterTimer.GetDuration().GetSeconds() );
 
 	g_pAINetworkManager->FixupHints();
@@ -2427,6 +2833,161 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		UTIL_Remove( pHelper );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The line of sight tests used to decide whether two nodes can see
+//			each other. With bWorldOnly only the world and static props are
+//			traced, without running any entity code, so that is safe to call
+//			from the thread pool. It hits a subset of what the full test hits,
+//			so a pair it finds blocked is blocked for the full test too.
+//-----------------------------------------------------------------------------
+static bool IsNodeLineClear( const Vector &vecStart, const Vector &vecEnd, bool bWorldOnly )
+{
+	trace_t	tr;
+	if ( bWorldOnly )
+	{
+		CTraceFilterWorldAndPropsOnly filter;
+		Ray_t ray;
+		ray.Init( vecStart, vecEnd );
+		enginetrace->TraceRay( ray, MASK_NPCWORLDSTATIC, &filter, &tr );
+	}
+	else
+	{
+		AI_TraceLine( vecStart, vecEnd, MASK_NPCWORLDSTATIC, NULL, COLLISION_GROUP_NONE, &tr );
+	}
+
+	return ( !tr.startsolid && tr.fraction == 1.0 );
+}
+
+static bool NodesHaveLineOfSight( const Vector &srcPos, const Vector &destPos, bool bWorldOnly = false )
+{
+	// Bottom to bottom, top to top, top to bottom, then bottom to top
+	return IsNodeLineClear( srcPos, destPos, bWorldOnly ) ||
+		   IsNodeLineClear( srcPos + Vector( 0, 0, 70 ), destPos + Vector( 0, 0, 70 ), bWorldOnly ) ||
+		   IsNodeLineClear( srcPos + Vector( 0, 0, 70 ), destPos, bWorldOnly ) ||
+		   IsNodeLineClear( srcPos, destPos + Vector( 0, 0, 70 ), bWorldOnly );
+}
+
+//-----------------------------------------------------------------------------
+// Threaded build
+//
+// The most numerous traces in a build are the line of sight tests in
+// InitVisibility(). They are run up front on the thread pool against the world
+// and static props only, which runs no entity code. A pair the world blocks is
+// blocked for the full test as well, so InitNeighbors() only traces the pairs
+// the world left clear, on the main thread, with the usual entity filter. The
+// connection tests in InitLinks() go through the move probe and entity filters
+// and stay on the main thread. The graph comes out identical to a serial build;
+// ai_node_build_threaded_verify checks that.
+//-----------------------------------------------------------------------------
+
+ConVar ai_node_build_threaded( "ai_node_build_threaded", "1", 0, "Trace node graph visibility against the world on the thread pool before the serial build" );
+ConVar ai_node_build_threaded_verify( "ai_node_build_threaded_verify", "0", 0, "Also trace every pair the threaded node graph build found blocked the serial way, and report any that differ" );
+
+bool CAI_NetworkBuilder::ShouldBuildThreaded() const
+{
+	return ai_node_build_threaded.GetBool() && g_pThreadPool && g_pThreadPool->NumThreads() > 0;
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::PrecomputeVisibility( CAI_Network *pNetwork )
+{
+	int nNodes = pNetwork->NumNodes();
+
+	m_VisibilityTable.SetSize( nNodes );
+	CUtlVector<int> rows;
+	rows.EnsureCapacity( nNodes );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		m_VisibilityTable[i].Resize( nNodes );
+		m_VisibilityTable[i].ClearAll();
+		if ( pNetwork->GetNode( i )->GetType() != NODE_DELETED )
+			rows.AddToTail( i );
+	}
+
+	m_pBuildNetwork = pNetwork;
+	ParallelProcess( "CAI_NetworkBuilder::PrecomputeVisibility", rows.Base(), rows.Count(), this, &CAI_NetworkBuilder::ComputeVisibilityRow );
+	m_pBuildNetwork = NULL;
+
+	if ( ai_node_build_threaded_verify.GetBool() )
+	{
+		VerifyVisibility( pNetwork );
+	}
+}
+
+//-------------------------------------
+// Marks which higher numbered nodes the world leaves in sight of one node,
+// for every pair InitVisibility() could get as far as tracing
+//-------------------------------------
+
+void CAI_NetworkBuilder::ComputeVisibilityRow( int &iNode )
+{
+	CAI_Network *pNetwork = m_pBuildNetwork;
+	CAI_Node *pNode = pNetwork->GetNode( iNode );
+	Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
+
+	for ( int testnode = iNode + 1; testnode < pNetwork->NumNodes(); testnode++ )
+	{
+		CAI_Node *testNode = pNetwork->GetNode( testnode );
+		if ( !IsVisibilityCandidate( pNode, testNode ) )
+			continue;
+
+		if ( NodesHaveLineOfSight( srcPos, testNode->GetPosition(HULL_SMALL_CENTERED), true ) )
+		{
+			m_VisibilityTable[iNode].Set( testnode );
+		}
+	}
+}
+
+//-------------------------------------
+
+bool CAI_NetworkBuilder::IsVisibilityCandidate( CAI_Node *pNode, CAI_Node *testNode )
+{
+	if ( testNode->GetType() == NODE_DELETED )
+		return false;
+
+	// Duplicates get deleted rather than traced
+	if ( testNode->GetOrigin() == pNode->GetOrigin() && testNode->GetType() != NODE_CLIMB )
+		return false;
+
+	float flDistToCheckNode = ( testNode->GetOrigin() - pNode->GetOrigin() ).LengthSqr(); 
+	return ( flDistToCheckNode <= ( ( testNode->GetType() == NODE_AIR ) ? MAX_AIR_NODE_LINK_DIST_SQ : MAX_NODE_LINK_DIST_SQ ) );
+}
+
+//-------------------------------------
+// Traces every pair the thread pool found blocked with the full serial test.
+// Any that the serial test finds visible would have changed the graph.
+//-------------------------------------
+
+void CAI_NetworkBuilder::VerifyVisibility( CAI_Network *pNetwork )
+{
+	int nChecked = 0;
+	int nMismatched = 0;
+	for ( int iNode = 0; iNode < pNetwork->NumNodes(); iNode++ )
+	{
+		CAI_Node *pNode = pNetwork->GetNode( iNode );
+		if ( pNode->GetType() == NODE_DELETED )
+			continue;
+
+		Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
+		for ( int testnode = iNode + 1; testnode < pNetwork->NumNodes(); testnode++ )
+		{
+			CAI_Node *testNode = pNetwork->GetNode( testnode );
+			if ( m_VisibilityTable[iNode].IsBitSet( testnode ) || !IsVisibilityCandidate( pNode, testNode ) )
+				continue;
+
+			nChecked++;
+			if ( NodesHaveLineOfSight( srcPos, testNode->GetPosition(HULL_SMALL_CENTERED) ) )
+			{
+				nMismatched++;
+				DevWarning( "Threaded node build found %d-%d blocked, but the serial build sees it\n", iNode, testnode );
+			}
+		}
+	}
+
+	DevMsg( "...verified %d blocked node pairs against a serial trace, %d differ\n", nChecked, nMismatched );
+}
+
 //------------------------------------------------------------------------------
 // Purpose : Forces testing of a connection between src and dest IDs for all dynamic links
 //			 	
@@ -2782,56 +3343,16 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 		// position using the smallest hull to make sure were not in geometry
 		Vector destPos = pNetwork->GetNode( testnode )->GetPosition(HULL_SMALL_CENTERED);
 
-		trace_t	tr;
-		tr.m_pEnt = NULL;
-
-		// Try several line of sight checks
-
-		bool isVisible = false;
-
-		// ------------------
-		//  Bottom to bottom
-		// ------------------
-		AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-		if (!tr.startsolid && tr.fraction == 1.0)
-		{
-			isVisible = true;
-		}
-
-		// ------------------
-		//  Top to top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Top to Bottom
-		// ------------------
-		if (!isVisible)
+		// Pairs the thread pool found the world blocks need no more tracing,
+		// see PrecomputeVisibility()
+		bool isVisible;
+		if ( m_VisibilityTable.Count() && testnode > pNode->m_iID && !m_VisibilityTable[pNode->m_iID].IsBitSet( testnode ) )
 		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
+			isVisible = false;
 		}
-
-		// ------------------
-		//  Bottom to Top
-		// ------------------
-		if (!isVisible)
+		else
 		{
-			AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
+			isVisible = NodesHaveLineOfSight( srcPos, destPos );
 		}
 
 		// ------------------
@@ -19,6 +19,7 @@ class CAI_Network;
 class CAI_Node;
 class CAI_Link;
 class CAI_TestHull;
+class CUtlBuffer;
 
 //-----------------------------------------------------------------------------
 // CAI_NetworkManager
@@ -69,6 +70,10 @@ private:
 	void			DelayedInit();
 	void			RebuildThink();
 	void			SaveNetworkGraph( void) ;	
+	void			WriteFlatNetworkGraph( CUtlBuffer &buf );
+	void			WriteLegacyNetworkGraph( CUtlBuffer &buf );
+	bool			LoadFlatNetworkGraph( CUtlBuffer &buf, const char *pszFileName );
+	bool			LoadLegacyNetworkGraph( CUtlBuffer &buf, const char *pszFileName );
 	static bool		IsAIFileCurrent( const char *szMapName );		
 	static bool		IsTextFileNewer(const char *szMapName);
 	
@@ -120,9 +125,19 @@ private:
 	void 			BeginBuild();
 	void			EndBuild();
 
+	// Threaded build
+	bool			ShouldBuildThreaded() const;
+	void			PrecomputeVisibility( CAI_Network *pNetwork );
+	void			ComputeVisibilityRow( int &iNode );
+	bool			IsVisibilityCandidate( CAI_Node *pNode, CAI_Node *testNode );
+	void			VerifyVisibility( CAI_Network *pNetwork );
+
 	CUtlVector<CVarBitVec>	m_NeighborsTable;
 	CVarBitVec				m_DidSetNeighborsTable;
 	CAI_TestHull *			m_pTestHull;
+
+	CUtlVector<CVarBitVec>	m_VisibilityTable;		// node to higher numbered node, set if the world doesn't block it
+	CAI_Network *			m_pBuildNetwork;
 };
 
 extern CAI_NetworkBuilder g_AINetworkBuilder;
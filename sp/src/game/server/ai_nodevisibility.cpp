@@ -0,0 +1,246 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Precomputed eye height visibility between AI nodes
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_nodevisibility.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "ai_debug_shared.h"
+#include "utlbuffer.h"
+#include "vstdlib/jobthread.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+
+CAI_NodeVisibility::CAI_NodeVisibility( CAI_Network *pNetwork )
+ :	m_pNetwork( pNetwork ),
+	m_nNodes( 0 ),
+	m_nRowWords( 0 ),
+	m_flRange( 0 )
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_NodeVisibility::Purge()
+{
+	m_nNodes = 0;
+	m_nRowWords = 0;
+	m_flRange = 0;
+	m_Bits.Purge();
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_NodeVisibility::IsTableNode( int iNode ) const
+{
+	return ( iNode >= 0 && iNode < m_nNodes && m_pNetwork->GetNode( iNode )->GetType() == NODE_GROUND );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Traces the eyes of every pair of ground nodes that are within
+//			flRange of each other. Each row only traces the higher numbered
+//			nodes, so the rows can be filled on the thread pool, and the
+//			lower half is mirrored in afterwards.
+//-----------------------------------------------------------------------------
+
+void CAI_NodeVisibility::Build( float flRange )
+{
+	Purge();
+
+	int nNodes = m_pNetwork->NumNodes();
+	if ( !nNodes || flRange <= 0 )
+		return;
+
+	m_nNodes = nNodes;
+	m_nRowWords = ( nNodes + 31 ) / 32;
+	m_flRange = flRange;
+	m_Bits.SetCount( m_nNodes * m_nRowWords );
+	memset( m_Bits.Base(), 0, m_Bits.Count() * sizeof( uint32 ) );
+
+	CUtlVector<int> rows;
+	rows.EnsureCapacity( nNodes );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		if ( IsTableNode( i ) )
+			rows.AddToTail( i );
+	}
+
+	if ( !rows.Count() )
+	{
+		Purge();
+		return;
+	}
+
+	ParallelProcess( "CAI_NodeVisibility::Build", rows.Base(), rows.Count(), this, &CAI_NodeVisibility::ComputeRow );
+
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		const uint32 *pRow = GetRow( i );
+		for ( int j = i + 1; j < nNodes; j++ )
+		{
+			if ( pRow[j >> 5] & ( 1u << ( j & 31 ) ) )
+			{
+				GetRow( j )[i >> 5] |= ( 1u << ( i & 31 ) );
+			}
+		}
+	}
+}
+
+//-------------------------------------
+
+void CAI_NodeVisibility::ComputeRow( int &iNode )
+{
+	const Vector &vecOrigin = m_pNetwork->GetNode( iNode )->GetOrigin();
+	Vector vecEye = vecOrigin + Vector( 0, 0, AI_NODE_VIS_EYE_HEIGHT );
+	uint32 *pRow = GetRow( iNode );
+	float flRangeSqr = m_flRange * m_flRange;
+
+	// Only the world and static props, so this is safe on the thread pool
+	CTraceFilterWorldAndPropsOnly filter;
+	trace_t tr;
+
+	for ( int iOther = iNode + 1; iOther < m_nNodes; iOther++ )
+	{
+		if ( !IsTableNode( iOther ) )
+			continue;
+
+		const Vector &vecOtherOrigin = m_pNetwork->GetNode( iOther )->GetOrigin();
+		if ( ( vecOtherOrigin - vecOrigin ).LengthSqr() > flRangeSqr )
+			continue;
+
+		AI_TraceLine( vecEye, vecOtherOrigin + Vector( 0, 0, AI_NODE_VIS_EYE_HEIGHT ), MASK_BLOCKLOS, &filter, &tr );
+		if ( !tr.startsolid && tr.fraction == 1.0 )
+		{
+			pRow[iOther >> 5] |= ( 1u << ( iOther & 31 ) );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the rows back to back as one stream of bytes. A zero byte
+//			is followed by the number of zero bytes in its run, up to 255.
+//			Every other byte is written as it is. Most pairs are blocked or
+//			out of range, so the rows are mostly long runs of zeros.
+//-----------------------------------------------------------------------------
+
+void CAI_NodeVisibility::Write( CUtlBuffer &buf ) const
+{
+	const byte *pRaw = (const byte *)m_Bits.Base();
+	int nRaw = m_Bits.Count() * sizeof( uint32 );
+
+	int i = 0;
+	while ( i < nRaw )
+	{
+		if ( pRaw[i] )
+		{
+			buf.PutUnsignedChar( pRaw[i] );
+			i++;
+			continue;
+		}
+
+		int nRun = 1;
+		while ( nRun < 255 && i + nRun < nRaw && !pRaw[i + nRun] )
+		{
+			nRun++;
+		}
+
+		buf.PutUnsignedChar( 0 );
+		buf.PutUnsignedChar( nRun );
+		i += nRun;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads rows written by Write(). Returns false, and leaves the table
+//			empty, if the data doesn't decode to exactly numNodes rows.
+//-----------------------------------------------------------------------------
+
+bool CAI_NodeVisibility::Read( const byte *pData, int nBytes, int numNodes, float flRange )
+{
+	Purge();
+
+	if ( numNodes <= 0 || numNodes > m_pNetwork->NumNodes() || !( flRange > 0 ) )
+		return false;
+
+	m_nNodes = numNodes;
+	m_nRowWords = ( numNodes + 31 ) / 32;
+	m_flRange = flRange;
+	m_Bits.SetCount( m_nNodes * m_nRowWords );
+
+	byte *pRaw = (byte *)m_Bits.Base();
+	int nRaw = m_Bits.Count() * sizeof( uint32 );
+	int iRaw = 0;
+
+	int i = 0;
+	while ( i < nBytes && iRaw < nRaw )
+	{
+		byte value = pData[i++];
+		if ( value )
+		{
+			pRaw[iRaw++] = value;
+			continue;
+		}
+
+		if ( i == nBytes )
+			break;
+
+		int nRun = pData[i++];
+		if ( !nRun || iRaw + nRun > nRaw )
+			break;
+
+		memset( pRaw + iRaw, 0, nRun );
+		iRaw += nRun;
+	}
+
+	if ( i != nBytes || iRaw != nRaw )
+	{
+		Purge();
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+CAI_NodeVisibility::Visibility_t CAI_NodeVisibility::GetVisibility( int iNode, int iOtherNode ) const
+{
+	if ( !IsTableNode( iNode ) || !IsTableNode( iOtherNode ) )
+		return NODEVIS_UNKNOWN;
+
+	if ( iNode == iOtherNode )
+		return NODEVIS_VISIBLE;
+
+	if ( ( m_pNetwork->GetNode( iOtherNode )->GetOrigin() - m_pNetwork->GetNode( iNode )->GetOrigin() ).LengthSqr() > m_flRange * m_flRange )
+		return NODEVIS_UNKNOWN;
+
+	return ( GetRow( iNode )[iOtherNode >> 5] & ( 1u << ( iOtherNode & 31 ) ) ) ? NODEVIS_VISIBLE : NODEVIS_BLOCKED;
+}
+
+//-----------------------------------------------------------------------------
+
+int CAI_NodeVisibility::FindEyeNode( const Vector &vecOrigin, const Vector &vecEyePos )
+{
+	if ( !IsBuilt() )
+		return NO_NODE;
+
+	int iNode = m_pNetwork->NearestNodeToPoint( vecOrigin, false );
+	if ( !IsTableNode( iNode ) )
+		return NO_NODE;
+
+	const Vector &vecNodeOrigin = m_pNetwork->GetNode( iNode )->GetOrigin();
+	if ( ( vecEyePos.AsVector2D() - vecNodeOrigin.AsVector2D() ).LengthSqr() > AI_NODE_VIS_TOLERANCE * AI_NODE_VIS_TOLERANCE )
+		return NO_NODE;
+
+	if ( !IsEyeOffsetInTolerance( vecEyePos.z - vecNodeOrigin.z ) )
+		return NO_NODE;
+
+	return iNode;
+}
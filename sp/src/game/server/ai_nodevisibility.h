@@ -0,0 +1,86 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Precomputed eye height visibility between AI nodes
+//
+//=============================================================================//
+
+#ifndef AI_NODEVISIBILITY_H
+#define AI_NODEVISIBILITY_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+
+class CAI_Network;
+class CUtlBuffer;
+
+// Eyes are traced at this height above the origin of each ground node
+#define AI_NODE_VIS_EYE_HEIGHT		64.0f
+
+// How far an eye may be from a node's eye before the table no longer applies
+#define AI_NODE_VIS_TOLERANCE		32.0f
+
+//-----------------------------------------------------------------------------
+// CAI_NodeVisibility
+//
+// Purpose: For every pair of ground nodes within range of each other, whether
+//			the world blocks the line between their eyes. Only world geometry
+//			and static props are traced, so doors, physics objects and NPCs
+//			are never in the table.
+//
+//			The table is optional. It is built with the graph when
+//			ai_node_build_visibility is set, and saved in the .ain as run
+//			length encoded rows. Pairs that are out of range, nodes that
+//			aren't on the ground and nodes added after the graph was loaded
+//			are NODEVIS_UNKNOWN, and callers trace those as they always have.
+//-----------------------------------------------------------------------------
+
+class CAI_NodeVisibility
+{
+public:
+	CAI_NodeVisibility( CAI_Network *pNetwork );
+
+	enum Visibility_t
+	{
+		NODEVIS_UNKNOWN,	// not in the table, trace instead
+		NODEVIS_BLOCKED,	// the world blocks the eyes of the two nodes
+		NODEVIS_VISIBLE,	// the eyes see each other past the world
+	};
+
+	// Traces every pair of ground nodes in range on the thread pool
+	void			Build( float flRange );
+	void			Purge();
+	bool			IsBuilt() const			{ return ( m_nNodes > 0 ); }
+	float			GetRange() const		{ return m_flRange; }
+
+	// .ain section, see Write() for the encoding
+	void			Write( CUtlBuffer &buf ) const;
+	bool			Read( const byte *pData, int nBytes, int numNodes, float flRange );
+
+	Visibility_t	GetVisibility( int iNode, int iOtherNode ) const;
+
+	// The ground node whose eye is within AI_NODE_VIS_TOLERANCE of an eye
+	// standing at vecOrigin, or NO_NODE
+	int				FindEyeNode( const Vector &vecOrigin, const Vector &vecEyePos );
+
+	// Whether an eye this far above a node's origin is close enough to the
+	// traced eye for the table to stand in for a trace
+	static bool		IsEyeOffsetInTolerance( float flEyeOffset )	{ return ( fabsf( flEyeOffset - AI_NODE_VIS_EYE_HEIGHT ) <= AI_NODE_VIS_TOLERANCE ); }
+
+private:
+	bool			IsTableNode( int iNode ) const;
+	void			ComputeRow( int &iNode );
+
+	uint32 *		GetRow( int iNode )				{ return m_Bits.Base() + iNode * m_nRowWords; }
+	const uint32 *	GetRow( int iNode ) const		{ return m_Bits.Base() + iNode * m_nRowWords; }
+
+	CAI_Network *	m_pNetwork;
+	int				m_nNodes;			// nodes in the table, later nodes are unknown
+	int				m_nRowWords;
+	float			m_flRange;
+	CUtlVector<uint32> m_Bits;			// m_nNodes rows of m_nRowWords
+};
+
+#endif // AI_NODEVISIBILITY_H
@@ -14,6 +14,7 @@
 #include "ai_basenpc.h"
 #include "ai_node.h"
 #include "ai_network.h"
+#include "ai_networkclusters.h"
 #include "ai_waypoint.h"
 #include "ai_link.h"
 #include "ai_routedist.h"
@@ -33,6 +34,257 @@
 const float MAX_LOCAL_NAV_DIST_GROUND[2] = { (50*12), (25*12) };
 const float MAX_LOCAL_NAV_DIST_FLY[2] = { (750*12), (750*12) };
 
+ConVar ai_path_clusters( "ai_path_clusters", "1", FCVAR_NONE, "Narrow node route searches to the clusters along a route through the cluster graph" );
+
+//-----------------------------------------------------------------------------
+// CAI_PathCache
+//
+// NPCs in a wave mostly route to the same goal node. Once NPCs of one hull and
+// movement ask for the same goal twice within ai_path_cache_ticks, a single
+// search outward from the goal gives every node its next step toward it, and
+// later requests just follow that tree.
+//
+// The tree only uses what every NPC shares: the links' move types and the
+// default movement cost. Each NPC still checks its route with IsLinkUsable()
+// and its own MovementCost(), and falls back on its own search when the tree
+// doesn't suit it.
+//-----------------------------------------------------------------------------
+
+ConVar ai_path_cache( "ai_path_cache", "1", FCVAR_NONE, "Share routes to a goal node between NPCs through a tree searched out from the goal" );
+ConVar ai_path_cache_ticks( "ai_path_cache_ticks", "1", FCVAR_NONE, "Number of ticks a shared route tree is kept" );
+
+#define AI_PATH_CACHE_MAX_TREES	16
+
+struct AIPathCacheStats_t
+{
+	int		nRequests;		// routes asked of the cache
+	int		nHits;			// routes served from a tree
+	int		nRejected;		// a tree existed, but didn't suit the NPC
+	int		nTreesBuilt;
+	int64	nExpanded;		// nodes expanded by every node search, cached or not
+};
+
+struct AIPathTreeOpen_t
+{
+	int		iNode;
+	float	flCost;
+};
+
+static bool PathTreeOpenIsLowerPriority( const AIPathTreeOpen_t &lhs, const AIPathTreeOpen_t &rhs )
+{
+	return ( lhs.flCost > rhs.flCost );
+}
+
+class CAI_PathCache : public CAutoGameSystem
+{
+public:
+	CAI_PathCache()
+	 :	CAutoGameSystem( "CAI_PathCache" )
+	{
+		ResetStats();
+	}
+
+	struct Tree_t
+	{
+		int					iGoal;
+		int					hull;
+		int					moveTypes;
+		int					iTick;
+		int					nRequests;
+		bool				bBuilt;
+		CUtlVector<int>		next;			// next node toward the goal, NO_NODE if it can't be reached
+		CUtlVector<float>	cost;			// default movement cost from the node to the goal
+	};
+
+	virtual void LevelShutdownPostEntity()
+	{
+		m_Trees.PurgeAndDeleteElements();
+	}
+
+	const Tree_t *GetTree( CAI_Network *pNetwork, Hull_t hull, int moveTypes, int iGoal );
+
+	void OnNodesExpanded( int nNodes )	{ m_Stats.nExpanded += nNodes; }
+	void OnHit()						{ m_Stats.nHits++; }
+	void OnRejected()					{ m_Stats.nRejected++; }
+
+	void ResetStats()
+	{
+		memset( &m_Stats, 0, sizeof( m_Stats ) );
+		m_flStatsStartTime = Plat_FloatTime();
+	}
+
+	void PrintStats();
+
+private:
+	void Build( CAI_Network *pNetwork, Tree_t *pTree );
+
+	CUtlVector<Tree_t *>	m_Trees;
+	AIPathCacheStats_t		m_Stats;
+	double					m_flStatsStartTime;
+};
+
+static CAI_PathCache g_AI_PathCache;
+
+//-------------------------------------
+
+const CAI_PathCache::Tree_t *CAI_PathCache::GetTree( CAI_Network *pNetwork, Hull_t hull, int moveTypes, int iGoal )
+{
+	m_Stats.nRequests++;
+
+	int iTick = gpGlobals->tickcount;
+	int nLifeTicks = MAX( ai_path_cache_ticks.GetInt(), 1 );
+
+	Tree_t *pTree = NULL;
+	int iOldest = -1;
+	for ( int i = m_Trees.Count() - 1; i >= 0; i-- )
+	{
+		Tree_t *pCandidate = m_Trees[i];
+		if ( iTick - pCandidate->iTick >= nLifeTicks || iTick < pCandidate->iTick )
+		{
+			delete pCandidate;
+			m_Trees.FastRemove( i );
+			continue;
+		}
+
+		if ( pCandidate->iGoal == iGoal && pCandidate->hull == hull && pCandidate->moveTypes == moveTypes )
+		{
+			pTree = pCandidate;
+		}
+	}
+
+	if ( !pTree )
+	{
+		if ( m_Trees.Count() >= AI_PATH_CACHE_MAX_TREES )
+		{
+			for ( int i = 0; i < m_Trees.Count(); i++ )
+			{
+				if ( iOldest == -1 || m_Trees[i]->iTick < m_Trees[iOldest]->iTick )
+					iOldest = i;
+			}
+			delete m_Trees[iOldest];
+			m_Trees.FastRemove( iOldest );
+		}
+
+		pTree = new Tree_t;
+		pTree->iGoal = iGoal;
+		pTree->hull = hull;
+		pTree->moveTypes = moveTypes;
+		pTree->iTick = iTick;
+		pTree->nRequests = 0;
+		pTree->bBuilt = false;
+		m_Trees.AddToTail( pTree );
+	}
+
+	pTree->nRequests++;
+
+	if ( !pTree->bBuilt || pTree->next.Count() != pNetwork->NumNodes() )
+	{
+		// A lone request is cheaper to search directly
+		if ( pTree->nRequests < 2 )
+			return NULL;
+
+		Build( pNetwork, pTree );
+	}
+
+	return pTree;
+}
+
+//-------------------------------------
+
+void CAI_PathCache::Build( CAI_Network *pNetwork, Tree_t *pTree )
+{
+	int nNodes = pNetwork->NumNodes();
+	Hull_t hull = (Hull_t)pTree->hull;
+
+	pTree->next.SetCount( nNodes );
+	pTree->cost.SetCount( nNodes );
+	for ( int node = 0; node < nNodes; node++ )
+	{
+		pTree->next[node] = NO_NODE;
+		pTree->cost[node] = FLT_MAX;
+	}
+
+	CUtlPriorityQueue<AIPathTreeOpen_t> openList( 0, 64, PathTreeOpenIsLowerPriority );
+
+	pTree->cost[pTree->iGoal] = 0;
+	AIPathTreeOpen_t goal = { pTree->iGoal, 0 };
+	openList.Insert( goal );
+
+	int nExpanded = 0;
+	while ( openList.Count() )
+	{
+		AIPathTreeOpen_t current = openList.ElementAtHead();
+		openList.RemoveAtHead();
+
+		if ( current.flCost > pTree->cost[current.iNode] )
+			continue;
+
+		nExpanded++;
+
+		CAI_Node *pNode = pNetwork->GetNode( current.iNode );
+		Vector vNode = pNode->GetPosition( hull );
+
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
+		{
+			CAI_Link *pLink = pNode->GetLinkByIndex( link );
+			if ( pLink->m_LinkInfo & bits_LINK_OFF )
+				continue;
+
+			int moveType = pLink->m_iAcceptedMoveTypes[hull] & pTree->moveTypes;
+			if ( !moveType )
+				continue;
+
+			// Same as CAI_Navigator::MovementCost() before NPC overrides
+			int iOther = pLink->DestNodeID( current.iNode );
+			float flCost = ( pNetwork->GetNode( iOther )->GetPosition( hull ) - vNode ).Length();
+			if ( moveType == bits_CAP_MOVE_JUMP || moveType == bits_CAP_MOVE_CLIMB )
+			{
+				flCost *= 2.0;
+			}
+
+			flCost += current.flCost;
+			if ( flCost < pTree->cost[iOther] )
+			{
+				pTree->cost[iOther] = flCost;
+				pTree->next[iOther] = current.iNode;
+
+				AIPathTreeOpen_t next = { iOther, flCost };
+				openList.Insert( next );
+			}
+		}
+	}
+
+	pTree->bBuilt = true;
+	m_Stats.nTreesBuilt++;
+	m_Stats.nExpanded += nExpanded;
+}
+
+//-------------------------------------
+
+void CAI_PathCache::PrintStats()
+{
+	double flElapsed = MAX( Plat_FloatTime() - m_flStatsStartTime, 0.001 );
+	int nAnswered = m_Stats.nHits + m_Stats.nRejected;
+
+	Msg( "Shared path cache (%s): %d trees live\n", ai_path_cache.GetBool() ? "on" : "off", m_Trees.Count() );
+	Msg( "  %d requests, %d hits, %d rejected, %d trees built\n", m_Stats.nRequests, m_Stats.nHits, m_Stats.nRejected, m_Stats.nTreesBuilt );
+	Msg( "  hit rate %.1f%% of requests, %.1f%% of requests with a tree\n",
+		 ( m_Stats.nRequests ) ? 100.0 * m_Stats.nHits / m_Stats.nRequests : 0.0,
+		 ( nAnswered ) ? 100.0 * m_Stats.nHits / nAnswered : 0.0 );
+	Msg( "  %.0f search nodes expanded per second over %.1f seconds\n", m_Stats.nExpanded / flElapsed, flElapsed );
+}
+
+CON_COMMAND( ai_path_cache_stats, "Print shared path cache hit rate and search nodes expanded per second. Pass \"reset\" to clear the counters." )
+{
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		g_AI_PathCache.ResetStats();
+		return;
+	}
+
+	g_AI_PathCache.PrintStats();
+}
+
 //-----------------------------------------------------------------------------
 // CAI_Pathfinder
 //
@@ -287,6 +539,48 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	m_nPerfStatPB++;
 #endif
 
+	if ( ai_path_cache.GetBool() && !engine->IsInEditMode() )
+	{
+		AI_Waypoint_t *pRoute = FindCachedPath( startID, endID );
+		if ( pRoute )
+			return pRoute;
+	}
+
+	if ( ai_path_clusters.GetBool() && !engine->IsInEditMode() )
+	{
+		CVarBitVec corridor( GetNetwork()->NumNodes() );
+
+		switch ( GetNetwork()->GetClusters()->FindCorridor( this, GetHullType(), CapabilitiesGet(), startID, endID, &corridor ) )
+		{
+		case CAI_NetworkClusters::CORRIDOR_NONE:
+			return NULL;
+
+		case CAI_NetworkClusters::CORRIDOR_FOUND:
+			{
+				AI_Waypoint_t *pRoute = FindBestPathInNodes( startID, endID, &corridor );
+				if ( pRoute )
+					return pRoute;
+
+				// Something inside a cluster, like a stale link or an unusable
+				// node, blocked the corridor. Fall back on the whole graph.
+				break;
+			}
+
+		default:
+			break;
+		}
+	}
+
+	return FindBestPathInNodes( startID, endID, NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Build a path between two nodes, only expanding nodes that are set
+//			in pAllowedNodes if it's given
+//-----------------------------------------------------------------------------
+
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathInNodes(int startID, int endID, const CVarBitVec *pAllowedNodes) 
+{
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
@@ -319,6 +613,7 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 		int smallestID = CAI_Network::FindBSSmallest(&openBS,nodeF,nNodes);
 	
 		openBS.Clear(smallestID);
+		g_AI_PathCache.OnNodesExpanded( 1 );
 
 		CAI_Node *pSmallestNode = pAInode[smallestID];
 		
@@ -344,6 +639,9 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 			int moveType = nodeLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
 			int testID	 = nodeLink->DestNodeID(smallestID);
 
+			if ( pAllowedNodes && !pAllowedNodes->IsBitSet(testID) )
+				continue;
+
 			Vector r1 = pSmallestNode->GetPosition(GetHullType());
 			Vector r2 = pAInode[testID]->GetPosition(GetHullType());
 			float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
@@ -369,6 +667,81 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	return NULL;   
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Follows the shared tree toward endID, checking each step the way
+//			FindBestPathInNodes() would. Returns NULL if there is no tree yet
+//			or the NPC can't, or wouldn't, take its route.
+//-----------------------------------------------------------------------------
+
+AI_Waypoint_t *CAI_Pathfinder::FindCachedPath(int startID, int endID)
+{
+	const CAI_PathCache::Tree_t *pTree = g_AI_PathCache.GetTree( GetNetwork(), GetHullType(), CapabilitiesGet() & AI_MOVE_TYPE_BITS, endID );
+	if ( !pTree )
+		return NULL;
+
+	if ( pTree->next[startID] == NO_NODE )
+	{
+		// Links the tree leaves out, like jump overrides, may still get there
+		g_AI_PathCache.OnRejected();
+		return NULL;
+	}
+
+	int nNodes = GetNetwork()->NumNodes();
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+
+	// The search checks the goal like every other node it expands
+	if ( GetOuter()->IsUnusableNode( endID, pAInode[endID]->GetHint() ) )
+	{
+		g_AI_PathCache.OnRejected();
+		return NULL;
+	}
+
+	int *nodeP = (int *)stackalloc( nNodes * sizeof(int) );		// Node parent 
+
+	nodeP[startID] = NO_NODE;
+
+	float flCost = 0;
+	int nSteps = 0;
+	for ( int iNode = startID; iNode != endID; )
+	{
+		int iNext = pTree->next[iNode];
+		CAI_Link *pLink = ( iNext != NO_NODE ) ? pAInode[iNode]->HasLink( iNext ) : NULL;
+
+		if ( !pLink || ++nSteps > nNodes ||
+			 GetOuter()->IsUnusableNode( iNode, pAInode[iNode]->GetHint() ) ||
+			 !IsLinkUsable( pLink, iNode ) )
+		{
+			g_AI_PathCache.OnRejected();
+			return NULL;
+		}
+
+		int moveType = pLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+		Vector r1 = pAInode[iNode]->GetPosition(GetHullType());
+		Vector r2 = pAInode[iNext]->GetPosition(GetHullType());
+		float dist = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
+
+		if ( dist == FLT_MAX )
+		{
+			g_AI_PathCache.OnRejected();
+			return NULL;
+		}
+
+		flCost += dist;
+		nodeP[iNext] = iNode;
+		iNode = iNext;
+	}
+
+	// An NPC that weighs moves its own way may well prefer another route
+	if ( flCost > pTree->cost[startID] * 1.25f + 1.0f )
+	{
+		g_AI_PathCache.OnRejected();
+		return NULL;
+	}
+
+	g_AI_PathCache.OnHit();
+	return MakeRouteFromParents( nodeP, endID );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Find a short random path of at least pathLength distance.  If
 //			vDirection is given random path will expand in the given direction,
@@ -588,15 +961,12 @@ AI_Waypoint_t* CAI_Pathfinder::FindShortRandomPath(int startID, float minPathLen
 }
 
 //------------------------------------------------------------------------------
-// Purpose : Returns true is link us usable by the given NPC from the
-//			 startID node.
+// Purpose : Returns true if the link is switched on for the given NPC from
+//			 the startID node
 //------------------------------------------------------------------------------
 
-bool CAI_Pathfinder::IsLinkUsable(CAI_Link *pLink, int startID)
+bool CAI_Pathfinder::IsLinkEnabled(CAI_Link *pLink, int startID)
 {
-	// --------------------------------------------------------------------------
-	// Skip if link turned off
-	// --------------------------------------------------------------------------
 #ifdef MAPBASE
 	if (pLink->m_pDynamicLink)
 	{
@@ -631,6 +1001,22 @@ bool CAI_Pathfinder::IsLinkUsable(CAI_Link *pLink, int startID)
 	}
 #endif
 
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Purpose : Returns true is link us usable by the given NPC from the
+//			 startID node.
+//------------------------------------------------------------------------------
+
+bool CAI_Pathfinder::IsLinkUsable(CAI_Link *pLink, int startID)
+{
+	// --------------------------------------------------------------------------
+	// Skip if link turned off
+	// --------------------------------------------------------------------------
+	if (!IsLinkEnabled(pLink, startID))
+		return false;
+
 	// --------------------------------------------------------------------------			
 	//  Get the destination nodeID
 	// --------------------------------------------------------------------------			
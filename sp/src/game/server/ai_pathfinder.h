@@ -21,6 +21,7 @@ struct AI_Waypoint_t;
 class CAI_Link;
 class CAI_Network;
 class CAI_Node;
+class CVarBitVec;
 
 
 //-----------------------------------------------------------------------------
@@ -68,6 +69,7 @@ public:
 	// --------------------------------
 
 	bool			IsLinkUsable(CAI_Link *pLink, int startID);
+	bool			IsLinkEnabled(CAI_Link *pLink, int startID);	// Only whether the link is switched on for this NPC, no side effects
 
 	// --------------------------------
 	
@@ -116,6 +118,8 @@ private:
 
 	//---------------------------------
 	
+	AI_Waypoint_t*	FindBestPathInNodes(int startID, int endID, const CVarBitVec *pAllowedNodes);
+	AI_Waypoint_t*	FindCachedPath(int startID, int endID);
 	AI_Waypoint_t*	MakeRouteFromParents(int *parentArray, int endID);
 	AI_Waypoint_t*	CreateNodeWaypoint( Hull_t hullType, int nodeID, int nodeFlags = 0 );
 	
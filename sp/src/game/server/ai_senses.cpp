@@ -39,6 +39,430 @@ const float AI_MISC_SEARCH_TIME  = 0.45;
 
 CAI_SensedObjectsManager g_AI_SensedObjectsManager;
 
+//-----------------------------------------------------------------------------
+// Purpose: Shared broadphase for NPC-vs-NPC sight. Every NPC looking in a tick
+//			used to walk the whole AI list; instead the list is bucketed into a
+//			2D hashed grid once per tick and each looker only visits the cells
+//			overlapping its look distance. Candidates come back in AI list order
+//			so the seen lists are built exactly as before.
+//-----------------------------------------------------------------------------
+
+ConVar ai_senses_grid( "ai_senses_grid", "1", FCVAR_NONE, "Use a per-tick spatial grid to gather NPC sight candidates" );
+
+#define AI_SENSING_GRID_CELL_SIZE	512.0f
+#define AI_SENSING_GRID_BUCKETS		1024	// power of two
+#define AI_SENSING_GRID_MAX_CELLS	256		// beyond this a query just takes everything
+
+// NPCs keep moving during the tick the grid was filed in, so queries reach a
+// little further than asked and the exact distance test does the rest
+#define AI_SENSING_GRID_SLACK		128.0f
+
+class CAI_SensingGrid
+{
+public:
+	CAI_SensingGrid()
+	 :	m_iBuildTick( -1 ),
+		m_iBuildChanges( -1 ),
+		m_iQueryStamp( 0 )
+	{
+		memset( m_BucketQueryStamp, 0, sizeof( m_BucketQueryStamp ) );
+	}
+
+	void GatherCandidates( const Vector &origin, float flRadius, CUtlVector<int> *pResult );
+
+private:
+	void Build();
+
+	static int CellCoord( float flValue )	{ return (int)floorf( flValue * ( 1.0f / AI_SENSING_GRID_CELL_SIZE ) ); }
+	static int Bucket( int x, int y )		{ return ( ( x * 73856093 ) ^ ( y * 19349663 ) ) & ( AI_SENSING_GRID_BUCKETS - 1 ); }
+
+	int				m_iBuildTick;
+	int				m_iBuildChanges;
+
+	int				m_BucketHead[AI_SENSING_GRID_BUCKETS];
+	int				m_BucketQueryStamp[AI_SENSING_GRID_BUCKETS];
+	int				m_iQueryStamp;
+	CUtlVector<int>	m_NextInBucket;		// indexed like g_AI_Manager.AccessAIs()
+	CUtlVector<int>	m_NoDistanceCull;	// NPCs that are always candidates
+};
+
+static CAI_SensingGrid g_AI_SensingGrid;
+
+//-------------------------------------
+
+void CAI_SensingGrid::Build()
+{
+	AI_PROFILE_SCOPE( CAI_SensingGrid_Build );
+
+	m_iBuildTick = gpGlobals->tickcount;
+	m_iBuildChanges = g_AI_Manager.GetChangeCount();
+
+	for ( int i = 0; i < AI_SENSING_GRID_BUCKETS; i++ )
+	{
+		m_BucketHead[i] = -1;
+	}
+
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	int nAIs = g_AI_Manager.NumAIs();
+
+	m_NextInBucket.SetCount( nAIs );
+	m_NoDistanceCull.RemoveAll();
+
+	// File back to front so each bucket chain reads in ascending AI order
+	for ( int i = nAIs - 1; i >= 0; i-- )
+	{
+		m_NextInBucket[i] = -1;
+
+		if ( ppAIs[i]->ShouldNotDistanceCull() )
+		{
+			m_NoDistanceCull.AddToHead( i );
+			continue;
+		}
+
+		const Vector &vecOrigin = ppAIs[i]->GetAbsOrigin();
+		int iBucket = Bucket( CellCoord( vecOrigin.x ), CellCoord( vecOrigin.y ) );
+		m_NextInBucket[i] = m_BucketHead[iBucket];
+		m_BucketHead[iBucket] = i;
+	}
+}
+
+//-------------------------------------
+
+static int AISensingIndexLessFunc( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+void CAI_SensingGrid::GatherCandidates( const Vector &origin, float flRadius, CUtlVector<int> *pResult )
+{
+	pResult->RemoveAll();
+
+	if ( m_iBuildTick != gpGlobals->tickcount || m_iBuildChanges != g_AI_Manager.GetChangeCount() )
+	{
+		Build();
+	}
+
+	float flReach = fabs( flRadius ) + AI_SENSING_GRID_SLACK;
+	int xMin = CellCoord( origin.x - flReach ), xMax = CellCoord( origin.x + flReach );
+	int yMin = CellCoord( origin.y - flReach ), yMax = CellCoord( origin.y + flReach );
+
+	if ( (int64)( xMax - xMin + 1 ) * ( yMax - yMin + 1 ) > AI_SENSING_GRID_MAX_CELLS )
+	{
+		int nAIs = g_AI_Manager.NumAIs();
+		pResult->EnsureCapacity( nAIs );
+		for ( int i = 0; i < nAIs; i++ )
+		{
+			pResult->AddToTail( i );
+		}
+		return;
+	}
+
+	pResult->AddVectorToTail( m_NoDistanceCull );
+
+	// Several cells can share a hashed bucket; stamp buckets so none is walked twice
+	if ( ++m_iQueryStamp == 0 )
+	{
+		memset( m_BucketQueryStamp, 0, sizeof( m_BucketQueryStamp ) );
+		m_iQueryStamp = 1;
+	}
+
+	for ( int x = xMin; x <= xMax; x++ )
+	{
+		for ( int y = yMin; y <= yMax; y++ )
+		{
+			int iBucket = Bucket( x, y );
+			if ( m_BucketQueryStamp[iBucket] == m_iQueryStamp )
+				continue;
+			m_BucketQueryStamp[iBucket] = m_iQueryStamp;
+
+			for ( int i = m_BucketHead[iBucket]; i != -1; i = m_NextInBucket[i] )
+			{
+				pResult->AddToTail( i );
+			}
+		}
+	}
+
+	pResult->Sort( AISensingIndexLessFunc );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Line of sight scheduler for sensing. Looks submit (looker, target)
+//			pairs instead of tracing inline. The result is the looker's own
+//			FVisible(), which many NPCs override (turrets, snipers, gunships),
+//			so pairs are keyed by direction: A looking at B never answers B
+//			looking at A. A result is reused for a few ticks by later looks
+//			from the same looker. If a trace budget is set, pairs over it are
+//			queued for the start of the next frame, and the looker keeps what it
+//			knew until then, even if the target has since gone out of sight.
+//			The budget is off by default for that reason.
+//-----------------------------------------------------------------------------
+
+ConVar ai_sense_los_queue( "ai_sense_los_queue", "1", FCVAR_NONE, "Schedule and share sensing line of sight traces" );
+ConVar ai_sense_los_cache_ticks( "ai_sense_los_cache_ticks", "2", FCVAR_NONE, "Ticks a sensing line of sight result is reused for" );
+ConVar ai_sense_los_budget_traces( "ai_sense_los_budget_traces", "0", FCVAR_NONE, "Sensing line of sight traces allowed per frame before deferring (0 = no limit). Deferred looks reuse the last result until the trace runs." );
+ConVar ai_sense_los_budget_ms( "ai_sense_los_budget_ms", "0", FCVAR_NONE, "Milliseconds of sensing line of sight traces allowed per frame before deferring (0 = no limit). Deferred looks reuse the last result until the trace runs." );
+
+struct AISenseLOSStats_t
+{
+	int nRequested;		// visibility queries made by looks
+	int nCached;		// answered by the same looker's trace from this or a recent tick
+	int nTraced;		// traces actually run
+	int nDeferred;		// over budget, pushed to the next frame
+};
+
+class CAI_SensingLOSQueue : public CAutoGameSystemPerFrame
+{
+public:
+	CAI_SensingLOSQueue()
+	 :	CAutoGameSystemPerFrame( "CAI_SensingLOSQueue" ),
+		m_Results( DefLessFunc( uint64 ) ),
+		m_flFrameTraceTime( 0 ),
+		m_flLastFrameTraceTime( 0 )
+	{
+		memset( &m_Frame, 0, sizeof( m_Frame ) );
+		memset( &m_LastFrame, 0, sizeof( m_LastFrame ) );
+		memset( &m_Total, 0, sizeof( m_Total ) );
+	}
+
+	virtual void LevelShutdownPostEntity();
+	virtual void FrameUpdatePreEntityThink();
+
+	bool IsVisible( CAI_BaseNPC *pLooker, CBaseEntity *pTarget, const CAI_Senses *pSenses );
+
+	void ResetStats()		{ memset( &m_Total, 0, sizeof( m_Total ) ); }
+	void PrintStats();
+
+private:
+	struct LOSResult_t
+	{
+		int		iTick;
+		bool	bVisible;
+		bool	bPending;
+	};
+
+	struct LOSRequest_t
+	{
+		EHANDLE	hLooker;
+		EHANDLE	hTarget;
+		uint64	key;
+	};
+
+	static bool CanShare( CAI_BaseNPC *pLooker, CBaseEntity *pTarget );
+	static uint64 PairKey( CBaseEntity *pLooker, CBaseEntity *pTarget );
+
+	bool HasBudget() const;
+	bool Trace( CBaseCombatCharacter *pLooker, CBaseEntity *pTarget );
+
+	CUtlMap<uint64, LOSResult_t, int>	m_Results;
+	CUtlVector<LOSRequest_t>		m_Pending;
+
+	float				m_flFrameTraceTime;
+	float				m_flLastFrameTraceTime;
+	AISenseLOSStats_t	m_Frame;
+	AISenseLOSStats_t	m_LastFrame;
+	AISenseLOSStats_t	m_Total;
+};
+
+static CAI_SensingLOSQueue g_AI_SensingLOSQueue;
+
+//-------------------------------------
+
+bool CAI_SensingLOSQueue::CanShare( CAI_BaseNPC *pLooker, CBaseEntity *pTarget )
+{
+	if ( !pTarget->MyCombatCharacterPointer() )
+		return false;
+
+#ifdef MAPBASE
+	return pLooker->ShouldUseVisibilityCache( pTarget );
+#elif defined(HL2_DLL)
+	return pLooker->Classify() != CLASS_BULLSEYE && pTarget->Classify() != CLASS_BULLSEYE;
+#else
+	return true;
+#endif
+}
+
+uint64 CAI_SensingLOSQueue::PairKey( CBaseEntity *pLooker, CBaseEntity *pTarget )
+{
+	uint64 looker = (unsigned)pLooker->GetRefEHandle().ToInt();
+	uint64 target = (unsigned)pTarget->GetRefEHandle().ToInt();
+	return ( looker << 32 ) | target;
+}
+
+//-------------------------------------
+
+bool CAI_SensingLOSQueue::HasBudget() const
+{
+	if ( ai_sense_los_budget_traces.GetInt() > 0 && m_Frame.nTraced >= ai_sense_los_budget_traces.GetInt() )
+		return false;
+
+	if ( ai_sense_los_budget_ms.GetFloat() > 0 && m_flFrameTraceTime * 1000.0f >= ai_sense_los_budget_ms.GetFloat() )
+		return false;
+
+	return true;
+}
+
+bool CAI_SensingLOSQueue::Trace( CBaseCombatCharacter *pLooker, CBaseEntity *pTarget )
+{
+	double flStart = Plat_FloatTime();
+	bool bVisible = pLooker->FVisible( pTarget );
+	m_flFrameTraceTime += (float)( Plat_FloatTime() - flStart );
+
+	m_Frame.nTraced++;
+	m_Total.nTraced++;
+	return bVisible;
+}
+
+//-------------------------------------
+
+bool CAI_SensingLOSQueue::IsVisible( CAI_BaseNPC *pLooker, CBaseEntity *pTarget, const CAI_Senses *pSenses )
+{
+	if ( !ai_sense_los_queue.GetBool() )
+		return pLooker->FVisible( pTarget );
+
+	m_Frame.nRequested++;
+	m_Total.nRequested++;
+
+	if ( !CanShare( pLooker, pTarget ) )
+		return Trace( pLooker, pTarget );
+
+	uint64 key = PairKey( pLooker, pTarget );
+	int iResult = m_Results.Find( key );
+	bool bFallback;
+
+	if ( iResult != m_Results.InvalidIndex() )
+	{
+		LOSResult_t &result = m_Results[iResult];
+		int nAge = gpGlobals->tickcount - result.iTick;
+
+		if ( nAge == 0 || nAge <= ai_sense_los_cache_ticks.GetInt() )
+		{
+			m_Frame.nCached++;
+			m_Total.nCached++;
+			return result.bVisible;
+		}
+
+		// Expired, but still a better guess than nothing if we have to wait
+		bFallback = result.bVisible;
+	}
+	else
+	{
+		bFallback = pSenses->DidSeeEntity( pTarget );
+	}
+
+	if ( !HasBudget() )
+	{
+		if ( iResult == m_Results.InvalidIndex() )
+		{
+			LOSResult_t result = { -1, bFallback, false };
+			iResult = m_Results.Insert( key, result );
+		}
+
+		if ( !m_Results[iResult].bPending )
+		{
+			m_Results[iResult].bPending = true;
+
+			LOSRequest_t request;
+			request.hLooker = pLooker;
+			request.hTarget = pTarget;
+			request.key = key;
+			m_Pending.AddToTail( request );
+		}
+
+		m_Frame.nDeferred++;
+		m_Total.nDeferred++;
+		return bFallback;
+	}
+
+	bool bVisible = Trace( pLooker, pTarget );
+
+	if ( iResult == m_Results.InvalidIndex() )
+	{
+		LOSResult_t result = { gpGlobals->tickcount, bVisible, false };
+		m_Results.Insert( key, result );
+	}
+	else
+	{
+		m_Results[iResult].iTick = gpGlobals->tickcount;
+		m_Results[iResult].bVisible = bVisible;
+	}
+
+	return bVisible;
+}
+
+//-------------------------------------
+
+void CAI_SensingLOSQueue::FrameUpdatePreEntityThink()
+{
+	m_LastFrame = m_Frame;
+	m_flLastFrameTraceTime = m_flFrameTraceTime;
+	memset( &m_Frame, 0, sizeof( m_Frame ) );
+	m_flFrameTraceTime = 0;
+
+	// Service last frame's overflow first, oldest request first
+	int nServiced = 0;
+	for ( ; nServiced < m_Pending.Count() && HasBudget(); nServiced++ )
+	{
+		LOSRequest_t &request = m_Pending[nServiced];
+		int iResult = m_Results.Find( request.key );
+		if ( iResult == m_Results.InvalidIndex() )
+			continue;
+
+		CBaseEntity *pLooker = request.hLooker;
+		CBaseEntity *pTarget = request.hTarget;
+		if ( !pLooker || !pTarget || !pLooker->MyCombatCharacterPointer() )
+		{
+			m_Results.RemoveAt( iResult );
+			continue;
+		}
+
+		m_Results[iResult].bVisible = Trace( pLooker->MyCombatCharacterPointer(), pTarget );
+		m_Results[iResult].iTick = gpGlobals->tickcount;
+		m_Results[iResult].bPending = false;
+	}
+	m_Pending.RemoveMultipleFromHead( nServiced );
+
+	// Drop results nobody can use anymore. Dead entities' handles never match again,
+	// so their entries age out here too.
+	int nMaxAge = ai_sense_los_cache_ticks.GetInt() + 1;
+	int i = m_Results.FirstInorder();
+	while ( i != m_Results.InvalidIndex() )
+	{
+		int iNext = m_Results.NextInorder( i );
+		if ( !m_Results[i].bPending && gpGlobals->tickcount - m_Results[i].iTick > nMaxAge )
+		{
+			m_Results.RemoveAt( i );
+		}
+		i = iNext;
+	}
+}
+
+void CAI_SensingLOSQueue::LevelShutdownPostEntity()
+{
+	m_Results.Purge();
+	m_Pending.Purge();
+}
+
+//-------------------------------------
+
+void CAI_SensingLOSQueue::PrintStats()
+{
+	Msg( "Sensing LOS queue (%s): %d results cached, %d pending\n", ai_sense_los_queue.GetBool() ? "on" : "off", m_Results.Count(), m_Pending.Count() );
+	Msg( "            requested    cached    traced  deferred\n" );
+	Msg( "last frame  %9d %9d %9d %9d  (%.3f ms tracing)\n", m_LastFrame.nRequested, m_LastFrame.nCached, m_LastFrame.nTraced, m_LastFrame.nDeferred, m_flLastFrameTraceTime * 1000.0f );
+	Msg( "total       %9d %9d %9d %9d\n", m_Total.nRequested, m_Total.nCached, m_Total.nTraced, m_Total.nDeferred );
+}
+
+CON_COMMAND( ai_sense_los_stats, "Print sensing line of sight counters. Pass \"reset\" to clear the totals." )
+{
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		g_AI_SensingLOSQueue.ResetStats();
+		return;
+	}
+
+	g_AI_SensingLOSQueue.PrintStats();
+}
+
 //-----------------------------------------------------------------------------
 
 #pragma pack(push)
@@ -362,7 +786,10 @@ bool CAI_Senses::Look( CBaseEntity *pSightEnt )
 	if ( WaitingUntilSeen( pSightEnt ) )
 		return false;
 	
-	if ( ShouldSeeEntity( pSightEnt ) && CanSeeEntity( pSightEnt ) )
+	// The trace goes through the sensing queue, which may answer from a shared or
+	// recent result, or fall back on what was seen last time while the trace waits
+	if ( ShouldSeeEntity( pSightEnt ) && GetOuter()->FInViewCone( pSightEnt ) && 
+		 g_AI_SensingLOSQueue.IsVisible( GetOuter(), pSightEnt, this ) )
 	{
 		return SeeEntity( pSightEnt );
 	}
@@ -460,13 +887,45 @@ int CAI_Senses::LookForNPCs( int iDistance )
 
 			CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
 			
-			for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
+			if ( ai_senses_grid.GetBool() )
 			{
-				if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
+				static CUtlVector<int> candidates;
+				g_AI_SensingGrid.GatherCandidates( origin, iDistance, &candidates );
+
+				// OnSeeEntity() may spawn or kill NPCs, which shuffles the indices,
+				// so hold on to the candidates themselves and skip any that die
+				CUtlVectorFixedGrowable<CHandle<CAI_BaseNPC>, 64> candidateNPCs;
+				candidateNPCs.EnsureCapacity( candidates.Count() );
+				for ( int iCandidate = 0; iCandidate < candidates.Count(); iCandidate++ )
 				{
-					if ( Look( ppAIs[i] ) )
+					candidateNPCs.AddToTail( ppAIs[ candidates[iCandidate] ] );
+				}
+
+				for ( int iCandidate = 0; iCandidate < candidateNPCs.Count(); iCandidate++ )
+				{
+					CAI_BaseNPC *pNPC = candidateNPCs[iCandidate];
+					if ( !pNPC || pNPC->IsMarkedForDeletion() )
+						continue;
+
+					if ( pNPC != GetOuter() && ( pNPC->ShouldNotDistanceCull() || origin.DistToSqr(pNPC->GetAbsOrigin()) < distSq ) )
 					{
-						nSeen++;
+						if ( Look( pNPC ) )
+						{
+							nSeen++;
+						}
+					}
+				}
+			}
+			else
+			{
+				for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
+				{
+					if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
+					{
+						if ( Look( ppAIs[i] ) )
+						{
+							nSeen++;
+						}
 					}
 				}
 			}
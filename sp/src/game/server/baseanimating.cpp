@@ -27,6 +27,7 @@
 #include "datacache/idatacache.h"
 #include "smoke_trail.h"
 #include "props.h"
+#include "vstdlib/jobthread.h"
 #ifdef MAPBASE
 #include "ai_speech.h"
 #include "gib.h"
@@ -38,6 +39,12 @@
 
 ConVar ai_sequence_debug( "ai_sequence_debug", "0" );
 
+// NPCs whose bone cache had to be rebuilt since the last ThreadedBoneSetup. They're likely
+// to be traced against again, so their bones are set up together at the start of the next tick.
+static CUtlVector<CBaseAnimating *> g_PreviousBoneSetups;
+static unsigned int g_iPreviousBoneCounter = 1;
+static bool g_bInThreadedBoneSetup;
+
 class CIKSaveRestoreOps : public CClassPtrSaveRestoreOps
 {
 	// save data type interface
@@ -351,6 +358,7 @@ CBaseAnimating::CBaseAnimating()
 	m_nNewSequenceParity = 0;
 	m_nResetEventsParity = 0;
 	m_boneCacheHandle = 0;
+	m_iMostRecentBoneSetupRequest = 0;
 	m_pStudioHdr = NULL;
 	m_fadeMinDist = 0;
 	m_fadeMaxDist = 0;
@@ -360,6 +368,11 @@ CBaseAnimating::CBaseAnimating()
 
 CBaseAnimating::~CBaseAnimating()
 {
+	if ( m_iMostRecentBoneSetupRequest == g_iPreviousBoneCounter )
+	{
+		g_PreviousBoneSetups.FindAndFastRemove( this );
+	}
+
 	Studio_DestroyBoneCache( m_boneCacheHandle );
 	delete m_pIk;
 	UnlockStudioHdr();
@@ -1890,6 +1903,7 @@ void CBaseAnimating::BuildMatricesWithBoneMerge(
 
 ConVar sv_pvsskipanimation( "sv_pvsskipanimation", "1", FCVAR_ARCHIVE, "Skips SetupBones when npc's are outside the PVS" );
 ConVar ai_setupbones_debug( "ai_setupbones_debug", "0", 0, "Shows that bones that are setup every think" );
+ConVar sv_threaded_bone_setup( "sv_threaded_bone_setup", "0", 0, "Set up the bones of NPCs traced against last tick in parallel at the start of each tick" );
 
 
 
@@ -2813,18 +2827,25 @@ void CBaseAnimating::UnlockStudioHdr()
 // Purpose: return the index to the shared bone cache
 // Output :
 //-----------------------------------------------------------------------------
-CBoneCache *CBaseAnimating::GetBoneCache( void )
+static int BoneCacheMask()
 {
-	CStudioHdr *pStudioHdr = GetModelPtr( );
-	Assert(pStudioHdr);
-
-	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
 	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
 
 	// TF queries these bones to position weapons when players are killed
 #if defined( TF_DLL )
 	boneMask |= BONE_USED_BY_BONE_MERGE;
 #endif
+	return boneMask;
+}
+
+CBoneCache *CBaseAnimating::GetBoneCache( void )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+	Assert(pStudioHdr);
+
+	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
+	int boneMask = BoneCacheMask();
+
 	if ( pcache )
 	{
 		if ( pcache->IsValid( gpGlobals->curtime ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime)
@@ -2842,19 +2863,33 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 		}
 	}
 
+	if ( sv_threaded_bone_setup.GetBool() && !g_bInThreadedBoneSetup && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter && CanUseThreadedBoneSetup() )
+	{
+		m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
+		Assert( g_PreviousBoneSetups.Find( this ) == -1 );
+		g_PreviousBoneSetups.AddToTail( this );
+	}
+
 	matrix3x4_t bonetoworld[MAXSTUDIOBONES];
 	SetupBones( bonetoworld, boneMask );
 
+	return StoreBoneCache( pcache, bonetoworld, boneMask );
+}
+
+CBoneCache *CBaseAnimating::StoreBoneCache( CBoneCache *pcache, matrix3x4_t *pBoneToWorld, int boneMask )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+
 	if ( pcache )
 	{
 		// still in memory but out of date, refresh the bones.
-		pcache->UpdateBones( bonetoworld, pStudioHdr->numbones(), gpGlobals->curtime );
+		pcache->UpdateBones( pBoneToWorld, pStudioHdr->numbones(), gpGlobals->curtime );
 	}
 	else
 	{
 		bonecacheparams_t params;
 		params.pStudioHdr = pStudioHdr;
-		params.pBoneToWorld = bonetoworld;
+		params.pBoneToWorld = pBoneToWorld;
 		params.curtime = gpGlobals->curtime;
 		params.boneMask = boneMask;
 
@@ -2865,6 +2900,130 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 	return pcache;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Only NPCs are batched. Bone merge reads the parent's cache and IK
+//			traces against the world, so neither can run on a worker thread.
+//-----------------------------------------------------------------------------
+bool CBaseAnimating::CanUseThreadedBoneSetup()
+{
+	if ( !MyNPCPointer() || IsMarkedForDeletion() )
+		return false;
+
+	if ( GetMoveParent() || m_pIk || !GetModelPtr() )
+		return false;
+
+	return !CanSkipAnimation();
+}
+
+struct BoneSetupJob_t
+{
+	CBaseAnimating	*pAnimating;
+	int				iFirstBone;		// into g_ThreadedBoneToWorld
+};
+
+static CUtlVector<BoneSetupJob_t> g_ThreadedBoneSetupJobs;
+static CUtlVector<matrix3x4_t> g_ThreadedBoneToWorld;
+
+static void SetupBonesOnBaseAnimating( BoneSetupJob_t &job )
+{
+	job.pAnimating->SetupBones( g_ThreadedBoneToWorld.Base() + job.iFirstBone, BoneCacheMask() );
+}
+
+static void PreThreadedBoneSetup()
+{
+	mdlcache->BeginLock();
+}
+
+static void PostThreadedBoneSetup()
+{
+	mdlcache->EndLock();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets up the bones of the NPCs queued last tick on the thread pool.
+//			Only SetupBones runs in parallel. The bone caches are created on
+//			the main thread afterwards, since creating one can evict another.
+//-----------------------------------------------------------------------------
+void CBaseAnimating::ThreadedBoneSetup()
+{
+	VPROF_BUDGET( "CBaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_SERVER_ANIM );
+
+	CUtlVector<BoneSetupJob_t> &jobs = g_ThreadedBoneSetupJobs;
+	jobs.RemoveAll();
+
+	if ( sv_threaded_bone_setup.GetBool() && !ai_setupbones_debug.GetBool() )
+	{
+		int nMatrices = 0;
+		for ( int i = 0; i < g_PreviousBoneSetups.Count(); i++ )
+		{
+			CBaseAnimating *pAnimating = g_PreviousBoneSetups[i];
+			CBoneCache *pcache = Studio_GetBoneCache( pAnimating->m_boneCacheHandle );
+			if ( ( pcache && pcache->IsValid( gpGlobals->curtime ) && pcache->m_timeValid <= gpGlobals->curtime ) || !pAnimating->CanUseThreadedBoneSetup() )
+				continue;
+
+			// Bring the abs transform up to date here, the workers only read it
+			pAnimating->GetAbsOrigin();
+			pAnimating->GetAbsAngles();
+
+			BoneSetupJob_t &job = jobs[jobs.AddToTail()];
+			job.pAnimating = pAnimating;
+			job.iFirstBone = nMatrices;
+			nMatrices += pAnimating->GetModelPtr()->numbones();
+		}
+
+		if ( jobs.Count() > 1 )
+		{
+			g_ThreadedBoneToWorld.SetCount( nMatrices );
+
+			g_bInThreadedBoneSetup = true;
+
+			ParallelProcess( "CBaseAnimating::ThreadedBoneSetup", jobs.Base(), jobs.Count(), &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+
+			g_bInThreadedBoneSetup = false;
+
+			int boneMask = BoneCacheMask();
+			for ( int i = 0; i < jobs.Count(); i++ )
+			{
+				CBaseAnimating *pAnimating = jobs[i].pAnimating;
+				CBoneCache *pcache = Studio_GetBoneCache( pAnimating->m_boneCacheHandle );
+				if ( pcache && ( pcache->m_boneMask & boneMask ) != boneMask )
+				{
+					Studio_DestroyBoneCache( pAnimating->m_boneCacheHandle );
+					pAnimating->m_boneCacheHandle = 0;
+					pcache = NULL;
+				}
+
+				pAnimating->StoreBoneCache( pcache, g_ThreadedBoneToWorld.Base() + jobs[i].iFirstBone, boneMask );
+			}
+		}
+	}
+
+	g_iPreviousBoneCounter++;
+	g_PreviousBoneSetups.RemoveAll();
+}
+
+class CThreadedBoneSetupSystem : public CAutoGameSystemPerFrame
+{
+public:
+	CThreadedBoneSetupSystem() : CAutoGameSystemPerFrame( "CThreadedBoneSetupSystem" )
+	{
+	}
+
+	virtual void FrameUpdatePreEntityThink()
+	{
+		CBaseAnimating::ThreadedBoneSetup();
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		g_PreviousBoneSetups.Purge();
+		g_ThreadedBoneSetupJobs.Purge();
+		g_ThreadedBoneToWorld.Purge();
+	}
+};
+
+static CThreadedBoneSetupSystem g_ThreadedBoneSetupSystem;
+
 
 void CBaseAnimating::InvalidateBoneCache( void )
 {
@@ -3057,6 +3216,104 @@ void CBaseAnimating::GetSkeleton( CStudioHdr *pStudioHdr, Vector pos[], Quaterni
 	boneSetup.CalcBoneAdj( pos, q, GetEncodedControllerArray() );
 }
 
+//-----------------------------------------------------------------------------
+// Times the bone setup of many copies of one model, each playing a random
+// sequence with a second sequence layered at half weight, with and without
+// anim_simdblend. No entities are created.
+//-----------------------------------------------------------------------------
+struct SetupBonesBenchmarkModel_t
+{
+	int		nSequence;
+	int		nLayerSequence;
+	float	flCycle;
+	float	flPoseParameter[MAXSTUDIOPOSEPARAM];
+};
+
+static double RunSetupBonesBenchmark( CStudioHdr *pStudioHdr, const CUtlVector<SetupBonesBenchmarkModel_t> &models, int nFrames )
+{
+	Vector pos[MAXSTUDIOBONES];
+	Quaternion q[MAXSTUDIOBONES];
+	matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+
+	double flStart = Plat_FloatTime();
+	for ( int iFrame = 0; iFrame < nFrames; iFrame++ )
+	{
+		float flFrameCycle = (float)iFrame / nFrames;
+		for ( int i = 0; i < models.Count(); i++ )
+		{
+			const SetupBonesBenchmarkModel_t &model = models[i];
+			float flCycle = fmodf( model.flCycle + flFrameCycle, 1.0f );
+
+			IBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, model.flPoseParameter );
+			boneSetup.InitPose( pos, q );
+			boneSetup.AccumulatePose( pos, q, model.nSequence, flCycle, 1.0f, gpGlobals->curtime, NULL );
+			boneSetup.AccumulatePose( pos, q, model.nLayerSequence, flCycle, 0.5f, gpGlobals->curtime, NULL );
+			Studio_BuildMatrices( pStudioHdr, vec3_angle, vec3_origin, pos, q, -1, 1.0f, boneToWorld, BONE_USED_BY_ANYTHING );
+		}
+	}
+	return Plat_FloatTime() - flStart;
+}
+
+CON_COMMAND_F( anim_setupbones_benchmark, "Times SetupBones with and without anim_simdblend.\n\tArguments: [model] [models] [frames]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	const char *pszModel = ( args.ArgC() > 1 ) ? args[1] : "models/combine_soldier.mdl";
+	int nModels = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 200;
+	int nFrames = ( args.ArgC() > 3 ) ? atoi( args[3] ) : 20;
+	nModels = MAX( nModels, 1 );
+	nFrames = MAX( nFrames, 1 );
+
+	int nModelIndex = modelinfo->GetModelIndex( pszModel );
+	const model_t *pModel = ( nModelIndex >= 0 ) ? modelinfo->GetModel( nModelIndex ) : NULL;
+	if ( !pModel || modelinfo->GetModelType( pModel ) != mod_studio )
+	{
+		Warning( "%s isn't a precached studio model\n", pszModel );
+		return;
+	}
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	CStudioHdr studioHdr( modelinfo->GetStudiomodel( pModel ), mdlcache );
+	if ( !studioHdr.IsValid() || studioHdr.GetNumSeq() <= 0 )
+	{
+		Warning( "%s has no sequences\n", pszModel );
+		return;
+	}
+
+	CUtlVector<SetupBonesBenchmarkModel_t> models;
+	models.SetCount( nModels );
+	for ( int i = 0; i < nModels; i++ )
+	{
+		SetupBonesBenchmarkModel_t &model = models[i];
+		model.nSequence = RandomInt( 0, studioHdr.GetNumSeq() - 1 );
+		model.nLayerSequence = RandomInt( 0, studioHdr.GetNumSeq() - 1 );
+		model.flCycle = RandomFloat( 0.0f, 1.0f );
+		for ( int j = 0; j < MAXSTUDIOPOSEPARAM; j++ )
+		{
+			model.flPoseParameter[j] = RandomFloat( 0.0f, 1.0f );
+		}
+	}
+
+	ConVarRef anim_simdblend( "anim_simdblend" );
+	bool bWasUsingSIMD = anim_simdblend.GetBool();
+
+	double flTime[2];
+	for ( int iMode = 0; iMode < 2; iMode++ )
+	{
+		anim_simdblend.SetValue( iMode );
+		flTime[iMode] = RunSetupBonesBenchmark( &studioHdr, models, nFrames );
+	}
+
+	anim_simdblend.SetValue( bWasUsingSIMD );
+
+	int nSetups = nModels * nFrames;
+	Msg( "%s: %d bones, %d models, %d frames\n", pszModel, studioHdr.numbones(), nModels, nFrames );
+	Msg( "  one bone at a time: %.3f us/SetupBones\n", flTime[0] * 1000000.0 / nSetups );
+	Msg( "  four at a time:     %.3f us/SetupBones\n", flTime[1] * 1000000.0 / nSetups );
+}
+
 int CBaseAnimating::DrawDebugTextOverlays(void) 
 {
 	int text_offset = BaseClass::DrawDebugTextOverlays();
@@ -281,6 +281,7 @@ public:
 	virtual bool TestHitboxes( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	class CBoneCache *GetBoneCache( void );
 	void InvalidateBoneCache();
+	static void ThreadedBoneSetup();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
 	virtual int DrawDebugTextOverlays( void );
 	
@@ -420,6 +421,9 @@ public:
 	QAngle	GetStepAngles( void ) const;
 
 private:
+	class CBoneCache	*StoreBoneCache( class CBoneCache *pcache, matrix3x4_t *pBoneToWorld, int boneMask );
+	bool				CanUseThreadedBoneSetup();
+
 	bool				m_bSequenceFinished;// flag set when StudioAdvanceFrame moves across a frame boundry
 	bool				m_bSequenceLoops;	// true if the sequence loops
 	bool				m_bResetSequenceInfoOnLoad; // true if a ResetSequenceInfo was queued up during dynamic load
@@ -450,6 +454,7 @@ private:
 
 	memhandle_t		m_boneCacheHandle;
 	unsigned short	m_fBoneCacheFlags;		// Used for bone cache state on model
+	unsigned int	m_iMostRecentBoneSetupRequest;	// tick counter of the last ThreadedBoneSetup queueing
 
 protected:
 	CNetworkVar( float, m_fadeMinDist );	// Point at which fading is absolute
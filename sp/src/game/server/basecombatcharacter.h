@@ -462,6 +462,7 @@ public:
 #ifdef MAPBASE
 	virtual bool		RemoveClassRelationship( Class_T nClass );
 #endif
+	void				RemoveAllRelationships()	{ m_Relationship.RemoveAll(); }
 
 	virtual void		ChangeTeam( int iTeamNum );
 
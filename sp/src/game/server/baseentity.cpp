@@ -640,8 +640,23 @@ HSCRIPT CBaseEntity::ScriptGetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	gEntList.ReportEntityNameChanged( this );
 }
 
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.ReportEntityNameChanged( this );
+}
+
+#ifdef MAPBASE_VSCRIPT
+void CBaseEntity::SetNameAsCStr( const char *newName )
+{
+	m_iName = AllocPooledString(newName);
+	gEntList.ReportEntityNameChanged( this );
+}
+#endif
+
 void CBaseEntity::SetModelIndex( int index )
 {
 	if ( IsDynamicModelIndex( index ) && !(GetBaseAnimating() && m_bDynamicModelAllowed) )
@@ -3796,6 +3811,9 @@ int CBaseEntity::Restore( IRestore &restore )
 	// loops through the data description list, restoring each data desc block in order
 	int status = RestoreDataDescBlock( restore, GetDataDescMap() );
 
+	// The name and classname were written straight into the fields
+	gEntList.ReportEntityNameChanged( this );
+
 	// ---------------------------------------------------------------
 	// HACKHACK: We don't know the space of these vectors until now
 	// if they are worldspace, fix them up.
@@ -2260,18 +2260,6 @@ inline const char *CBaseEntity::GetPreTemplateName()
 	return szStrippedName;
 }
 
-inline void CBaseEntity::SetName( string_t newName )
-{
-	m_iName = newName;
-}
-
-#ifdef MAPBASE_VSCRIPT
-inline void CBaseEntity::SetNameAsCStr( const char *newName )
-{
-	m_iName = AllocPooledString(newName);
-}
-#endif
-
 inline bool CBaseEntity::NameMatches( const char *pszNameOrWildcard )
 {
 	if ( IDENT_STRINGS(m_iName, pszNameOrWildcard) )
@@ -84,6 +84,7 @@ OUTPUTS:
 #include "tier1/strtools.h"
 #include "datacache/imdlcache.h"
 #include "env_debughistory.h"
+#include "world.h"
 #ifdef MAPBASE
 #include "mapbase/variant_tools.h"
 #include "mapbase/matchers.h"
@@ -686,7 +687,13 @@ DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 128, CUtlMemoryPool::G
 
 CEventQueue g_EventQueue;
 
-CEventQueue::CEventQueue()
+CEventQueue::CEventQueue() :
+	m_FireTimeBuckets( 0, 0, FireTimeBucketLessFunc ),
+	m_TargetIndex( DefLessFunc( int ) ),
+	m_CallerIndex( DefLessFunc( int ) )
+#ifdef MAPBASE_VSCRIPT
+	, m_LiveEvents( 0, 0, DefLessFunc( EventQueuePrioritizedEvent_t * ) )
+#endif
 {
 	m_Events.m_flFireTime = -FLT_MAX;
 	m_Events.m_pNext = NULL;
@@ -694,6 +701,11 @@ CEventQueue::CEventQueue()
 	Init();
 }
 
+bool CEventQueue::FireTimeBucketLessFunc( const FireTimeBucket_t &lhs, const FireTimeBucket_t &rhs )
+{
+	return lhs.m_flFireTime < rhs.m_flFireTime;
+}
+
 CEventQueue::~CEventQueue()
 {
 	Clear();
@@ -813,6 +825,13 @@ void CEventQueue::Clear( void )
 	}
 
 	m_Events.m_pNext = NULL;
+
+	m_FireTimeBuckets.RemoveAll();
+	m_TargetIndex.RemoveAll();
+	m_CallerIndex.RemoveAll();
+#ifdef MAPBASE_VSCRIPT
+	m_LiveEvents.RemoveAll();
+#endif
 }
 
 void CEventQueue::Dump( void )
@@ -924,14 +943,25 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
 {
-	// loop through the actions looking for a place to insert
+	// Events are kept sorted by fire time, with events of equal fire time kept in
+	// the order they were added. Rather than walking the list for the insertion point,
+	// look up the last event queued for the closest fire time at or before this one.
+	FireTimeBucket_t search;
+	search.m_flFireTime = newEvent->m_flFireTime;
+	search.m_pTail = newEvent;
+
 	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	int iBucket = m_FireTimeBuckets.Find( search );
+	if ( iBucket != m_FireTimeBuckets.InvalidIndex() )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
-		{
-			break;
-		}
+		pe = m_FireTimeBuckets[iBucket].m_pTail;
+		m_FireTimeBuckets[iBucket].m_pTail = newEvent;
+	}
+	else
+	{
+		iBucket = m_FireTimeBuckets.Insert( search );
+		int iPrevBucket = m_FireTimeBuckets.PrevInorder( iBucket );
+		pe = ( iPrevBucket != m_FireTimeBuckets.InvalidIndex() ) ? m_FireTimeBuckets[iPrevBucket].m_pTail : &m_Events;
 	}
 
 	Assert( pe );
@@ -944,16 +974,120 @@ void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
 	{
 		newEvent->m_pNext->m_pPrev = newEvent;
 	}
+
+	LinkToIndex( m_TargetIndex, newEvent->m_pEntTarget, newEvent, &EventQueuePrioritizedEvent_t::m_TargetLink );
+	LinkToIndex( m_CallerIndex, newEvent->m_pCaller, newEvent, &EventQueuePrioritizedEvent_t::m_CallerLink );
+
+#ifdef MAPBASE_VSCRIPT
+	m_LiveEvents.Insert( newEvent );
+#endif
 }
 
 void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
 {
 	Assert( pe->m_pPrev );
+
+	// if this was the last event for its fire time, hand that role to the previous event or drop the bucket
+	FireTimeBucket_t search;
+	search.m_flFireTime = pe->m_flFireTime;
+	search.m_pTail = pe;
+
+	int iBucket = m_FireTimeBuckets.Find( search );
+	Assert( iBucket != m_FireTimeBuckets.InvalidIndex() );
+	if ( iBucket != m_FireTimeBuckets.InvalidIndex() && m_FireTimeBuckets[iBucket].m_pTail == pe )
+	{
+		if ( pe->m_pPrev != &m_Events && pe->m_pPrev->m_flFireTime == pe->m_flFireTime )
+		{
+			m_FireTimeBuckets[iBucket].m_pTail = pe->m_pPrev;
+		}
+		else
+		{
+			m_FireTimeBuckets.RemoveAt( iBucket );
+		}
+	}
+
 	pe->m_pPrev->m_pNext = pe->m_pNext;
 	if ( pe->m_pNext )
 	{
 		pe->m_pNext->m_pPrev = pe->m_pPrev;
 	}
+
+	UnlinkFromIndex( m_TargetIndex, pe->m_pEntTarget, pe, &EventQueuePrioritizedEvent_t::m_TargetLink );
+	UnlinkFromIndex( m_CallerIndex, pe->m_pCaller, pe, &EventQueuePrioritizedEvent_t::m_CallerLink );
+
+#ifdef MAPBASE_VSCRIPT
+	m_LiveEvents.Remove( pe );
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Chains an event onto the list of events sharing the same entity handle.
+//			Events without a valid handle aren't indexed.
+//-----------------------------------------------------------------------------
+void CEventQueue::LinkToIndex( EventIndex_t &index, const EHANDLE &hEntity, EventQueuePrioritizedEvent_t *pe, EventIndexLink_t pLink )
+{
+	EventQueueIndexLink_t &link = pe->*pLink;
+	link.m_pPrev = NULL;
+	link.m_pNext = NULL;
+
+	if ( !hEntity.IsValid() )
+		return;
+
+	int i = index.Find( hEntity.ToInt() );
+	if ( i == index.InvalidIndex() )
+	{
+		index.Insert( hEntity.ToInt(), pe );
+		return;
+	}
+
+	// push onto the front of the chain
+	EventQueuePrioritizedEvent_t *pHead = index[i];
+	link.m_pNext = pHead;
+	(pHead->*pLink).m_pPrev = pe;
+	index[i] = pe;
+}
+
+void CEventQueue::UnlinkFromIndex( EventIndex_t &index, const EHANDLE &hEntity, EventQueuePrioritizedEvent_t *pe, EventIndexLink_t pLink )
+{
+	if ( !hEntity.IsValid() )
+		return;
+
+	EventQueueIndexLink_t &link = pe->*pLink;
+	if ( link.m_pNext )
+	{
+		(link.m_pNext->*pLink).m_pPrev = link.m_pPrev;
+	}
+
+	if ( link.m_pPrev )
+	{
+		(link.m_pPrev->*pLink).m_pNext = link.m_pNext;
+	}
+	else
+	{
+		// this was the head of the chain
+		int i = index.Find( hEntity.ToInt() );
+		Assert( i != index.InvalidIndex() && index[i] == pe );
+		if ( link.m_pNext )
+		{
+			index[i] = link.m_pNext;
+		}
+		else
+		{
+			index.RemoveAt( i );
+		}
+	}
+
+	link.m_pPrev = NULL;
+	link.m_pNext = NULL;
+}
+
+EventQueuePrioritizedEvent_t *CEventQueue::FirstInIndex( const EventIndex_t &index, CBaseEntity *pEntity )
+{
+	int i = index.Find( pEntity->GetRefEHandle().ToInt() );
+	if ( i == index.InvalidIndex() )
+		return NULL;
+
+	return index[i];
 }
 
 
@@ -1027,26 +1161,13 @@ void CEventQueue::ServiceEvents( void )
 			}
 			else
 			{
-				const CEntInfo *pInfo = gEntList.FirstEntInfo();
-
-				for ( ;pInfo; pInfo = pInfo->m_pNext )
+				// Regular names go through the entity list's name index
+				CBaseEntity *ent = NULL;
+				while ( (ent = gEntList.FindEntityByName( ent, szName )) != NULL )
 				{
-					CBaseEntity *ent = (CBaseEntity *)pInfo->m_pEntity;
-					if ( !ent )
-					{
-						DevWarning( "NULL entity in global entity list!\n" );
-						continue;
-					}
-
-					if ( !ent->GetEntityName() )
-						continue;
-
-					if ( ent->NameMatches( szName ) )
-					{
-						// pump the action into the target
-						ent->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
-						targetFound = true;
-					}
+					// pump the action into the target
+					ent->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+					targetFound = true;
 				}
 			}
 #else
@@ -1155,7 +1276,7 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pCur = FirstInIndex( m_CallerIndex, pCaller );
 
 	while (pCur != NULL)
 	{
@@ -1172,7 +1293,7 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_CallerLink.m_pNext;
 
 		if (bDelete)
 		{
@@ -1193,7 +1314,7 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pCur = FirstInIndex( m_TargetIndex, pTarget );
 
 	while (pCur != NULL)
 	{
@@ -1208,7 +1329,7 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_TargetLink.m_pNext;
 
 		if (bDelete)
 		{
@@ -1228,7 +1349,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pCur = FirstInIndex( m_TargetIndex, pTarget );
 
 	while (pCur != NULL)
 	{
@@ -1241,17 +1362,89 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 				return true;
 		}
 
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_TargetLink.m_pNext;
 	}
 
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Event queue stress test. Queues a large number of events spread over a period
+// of time and reports the cost of queueing them and of servicing them each tick.
+//-----------------------------------------------------------------------------
+#define EVENTQUEUE_STRESS_INPUT "__EventQueueStress"
+
+static bool		s_bEventQueueStressActive = false;
+static int		s_nEventQueueStressTicks = 0;
+static double	s_flEventQueueStressTotalTime = 0;
+static double	s_flEventQueueStressMaxTime = 0;
+
+void CC_EventQueueStress( const CCommand &args )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	CBaseEntity *pWorld = GetWorldEntity();
+	if ( !pWorld )
+		return;
+
+	int nEvents = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 100000;
+	float flSpread = ( args.ArgC() > 2 ) ? atof( args[2] ) : 10.0f;
+	nEvents = MAX( nEvents, 1 );
+	flSpread = MAX( flSpread, 0.0f );
+
+	variant_t emptyVariant;
+
+	// queue the events with the world as both target and caller, so lookups by either are exercised
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nEvents; i++ )
+	{
+		g_EventQueue.AddEvent( pWorld, EVENTQUEUE_STRESS_INPUT, emptyVariant, RandomFloat( 0.0f, flSpread ), NULL, pWorld );
+	}
+	double flAddTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < 1000; i++ )
+	{
+		g_EventQueue.HasEventPending( pWorld, EVENTQUEUE_STRESS_INPUT );
+	}
+	double flLookupTime = Plat_FloatTime() - flStart;
+
+	Msg( "Queued %d events in %.2f ms (%.3f us/event), 1000 HasEventPending calls in %.3f ms\n",
+		nEvents, flAddTime * 1000.0, flAddTime * 1000000.0 / nEvents, flLookupTime * 1000.0 );
+
+	s_bEventQueueStressActive = true;
+	s_nEventQueueStressTicks = 0;
+	s_flEventQueueStressTotalTime = 0;
+	s_flEventQueueStressMaxTime = 0;
+}
+static ConCommand eventqueue_stress( "eventqueue_stress", CC_EventQueueStress, "Queues a large number of events and reports the per-tick cost of servicing them.\n\tArguments: [event count] [spread in seconds]", FCVAR_CHEAT );
+
 void ServiceEventQueue( void )
 {
 	VPROF("ServiceEventQueue()");
 
+	if ( !s_bEventQueueStressActive )
+	{
+		g_EventQueue.ServiceEvents();
+		return;
+	}
+
+	double flStart = Plat_FloatTime();
 	g_EventQueue.ServiceEvents();
+	double flTime = Plat_FloatTime() - flStart;
+
+	s_nEventQueueStressTicks++;
+	s_flEventQueueStressTotalTime += flTime;
+	s_flEventQueueStressMaxTime = MAX( s_flEventQueueStressMaxTime, flTime );
+
+	CBaseEntity *pWorld = GetWorldEntity();
+	if ( !pWorld || !g_EventQueue.HasEventPending( pWorld, EVENTQUEUE_STRESS_INPUT ) )
+	{
+		Msg( "Event queue stress test finished: %d ticks, %.3f ms average, %.3f ms max service time per tick\n",
+			s_nEventQueueStressTicks, s_flEventQueueStressTotalTime * 1000.0 / MAX( s_nEventQueueStressTicks, 1 ), s_flEventQueueStressMaxTime * 1000.0 );
+		s_bEventQueueStressActive = false;
+	}
 }
 
 
@@ -1297,17 +1490,12 @@ bool CEventQueue::RemoveEvent( intptr_t event )
 
 	EventQueuePrioritizedEvent_t *pe = reinterpret_cast<EventQueuePrioritizedEvent_t*>(event); // INT_TO_POINTER
 
-	for ( EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext; pCur; pCur = pCur->m_pNext )
-	{
-		if ( pCur == pe )
-		{
-			RemoveEvent(pCur);
-			delete pCur;
-			return true;
-		}
-	}
+	if ( m_LiveEvents.Find( pe ) == m_LiveEvents.InvalidIndex() )
+		return false;
 
-	return false;
+	RemoveEvent(pe);
+	delete pe;
+	return true;
 }
 
 float CEventQueue::GetTimeLeft( intptr_t event )
@@ -1317,15 +1505,10 @@ float CEventQueue::GetTimeLeft( intptr_t event )
 
 	EventQueuePrioritizedEvent_t *pe = reinterpret_cast<EventQueuePrioritizedEvent_t*>(event); // INT_TO_POINTER
 
-	for ( EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext; pCur; pCur = pCur->m_pNext )
-	{
-		if ( pCur == pe )
-		{
-			return (pCur->m_flFireTime - gpGlobals->curtime);
-		}
-	}
+	if ( m_LiveEvents.Find( pe ) == m_LiveEvents.InvalidIndex() )
+		return 0.f;
 
-	return 0.f;
+	return (pe->m_flFireTime - gpGlobals->curtime);
 }
 #endif // MAPBASE_VSCRIPT
 
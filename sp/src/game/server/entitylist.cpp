@@ -11,10 +11,13 @@
 #include "igamesystem.h"
 #include "collisionutils.h"
 #include "UtlSortVector.h"
+#include "utldict.h"
+#include "utlstring.h"
 #include "tier0/vprof.h"
 #include "mapentities.h"
 #include "client.h"
 #include "ai_initutils.h"
+#include "ai_hint.h"
 #include "globalstate.h"
 #include "datacache/imdlcache.h"
 
@@ -283,6 +286,550 @@ void SimThink_EntityChanged( CBaseEntity *pEntity )
 	g_SimThinkManager.EntityChanged( pEntity );
 }
 
+//-----------------------------------------------------------------------------
+// Entities are always appended to the global entity list, so stamping each one
+// with a rising number as it's added lets the search indices below return their
+// results in list order.
+//-----------------------------------------------------------------------------
+static unsigned int s_nNextListOrder = 1;
+static unsigned int s_nListOrder[NUM_ENT_ENTRIES];
+
+// Entities that are set aside to be used again (see HideEntityFromSearches)
+static bool s_bHiddenFromSearches[NUM_ENT_ENTRIES];
+
+static inline CBaseEntity *EntityInSlot( int iSlot )
+{
+	return (CBaseEntity *)gEntList.GetEntInfoPtrByIndex( iSlot )->m_pEntity;
+}
+
+static inline unsigned int ListOrderAfter( CBaseEntity *pStartEntity )
+{
+	return pStartEntity ? s_nListOrder[pStartEntity->GetRefEHandle().GetEntryIndex()] : 0;
+}
+
+// Index of the first slot in a list order sorted vector that was added after nListOrder
+static int UpperBoundListOrder( const CUtlVector<int> &slots, unsigned int nListOrder )
+{
+	int nLow = 0;
+	int nHigh = slots.Count();
+	while ( nLow < nHigh )
+	{
+		int nMid = ( nLow + nHigh ) / 2;
+		if ( s_nListOrder[slots[nMid]] <= nListOrder )
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid;
+		}
+	}
+	return nLow;
+}
+
+//-----------------------------------------------------------------------------
+// Indexes entities by targetname and classname so searches for a name don't have
+// to walk and string compare the whole entity list. Exact names go straight to
+// their bucket; wildcards are tested once per distinct name rather than once per
+// entity, and the matching buckets are remembered until a name is added or goes
+// away. Each bucket keeps its entities in the same order as the global entity
+// list, which keeps pStartEntity continuation identical to a full walk.
+//-----------------------------------------------------------------------------
+enum entitynameindex_t
+{
+	ENTITY_INDEX_TARGETNAME = 0,
+	ENTITY_INDEX_CLASSNAME,
+
+	NUM_ENTITY_NAME_INDICES
+};
+
+ConVar ent_name_index( "ent_name_index", "1", 0, "Use the targetname/classname index for entity searches instead of walking the entity list." );
+
+class CEntityNameIndex
+{
+public:
+	CEntityNameIndex()
+	{
+		for ( int i = 0; i < NUM_ENTITY_NAME_INDICES; i++ )
+		{
+			for ( int j = 0; j < NUM_ENT_ENTRIES; j++ )
+			{
+				m_iszIndexed[i][j] = NULL_STRING;
+				m_iBucket[i][j] = m_Buckets[i].InvalidIndex();
+			}
+
+			m_Wildcard[i].bValid = false;
+			m_Wildcard[i].bCursorsValid = false;
+		}
+	}
+
+	void AddEntity( CBaseEntity *pEntity, int iSlot )
+	{
+		UpdateEntity( pEntity, iSlot );
+	}
+
+	void RemoveEntity( int iSlot )
+	{
+		for ( int i = 0; i < NUM_ENTITY_NAME_INDICES; i++ )
+		{
+			Unlink( i, iSlot );
+			m_iszIndexed[i][iSlot] = NULL_STRING;
+		}
+	}
+
+	void UpdateEntity( CBaseEntity *pEntity, int iSlot )
+	{
+		Relink( ENTITY_INDEX_TARGETNAME, iSlot, pEntity->GetEntityName() );
+		Relink( ENTITY_INDEX_CLASSNAME, iSlot, pEntity->m_iClassname );
+	}
+
+	// Returns false if the query can't be answered by the index and the caller should walk the list.
+	bool Find( int iIndex, CBaseEntity *pStartEntity, const char *szName, IEntityFindFilter *pFilter, CBaseEntity **ppResult )
+	{
+		*ppResult = NULL;
+
+		// Regular expressions may be case sensitive, which the buckets aren't
+		if ( szName[0] == '@' && szName[1] == '/' )
+			return false;
+
+		unsigned int nStartOrder = ListOrderAfter( pStartEntity );
+
+		if ( !strchr( szName, '*' ) && !strchr( szName, '?' ) )
+		{
+			int iBucket = m_Buckets[iIndex].Find( szName );
+			if ( iBucket == m_Buckets[iIndex].InvalidIndex() )
+				return true;
+
+			const CUtlVector<int> &slots = *m_Buckets[iIndex][iBucket];
+			for ( int i = UpperBoundListOrder( slots, nStartOrder ); i < slots.Count(); i++ )
+			{
+				CBaseEntity *pEntity = EntityInSlot( slots[i] );
+				if ( pFilter && !pFilter->ShouldFindEntity( pEntity ) )
+					continue;
+
+				*ppResult = pEntity;
+				return true;
+			}
+
+			return true;
+		}
+
+		// Wildcard search. Iterating a search usually asks for the entity after the
+		// last one found, in which case the cursors carry on where they stopped.
+		wildcardsearch_t &search = m_Wildcard[iIndex];
+		PrepareWildcardSearch( iIndex, szName, nStartOrder );
+
+		// Merge the matching buckets back into list order
+		while ( true )
+		{
+			int iBest = -1;
+			unsigned int nBestOrder = 0;
+			for ( int i = 0; i < search.cursors.Count(); i++ )
+			{
+				const bucketcursor_t &cursor = search.cursors[i];
+				if ( cursor.iCursor >= cursor.pSlots->Count() )
+					continue;
+
+				unsigned int nOrder = s_nListOrder[ cursor.pSlots->Element( cursor.iCursor ) ];
+				if ( iBest == -1 || nOrder < nBestOrder )
+				{
+					iBest = i;
+					nBestOrder = nOrder;
+				}
+			}
+
+			if ( iBest == -1 )
+			{
+				search.bCursorsValid = false;
+				return true;
+			}
+
+			CBaseEntity *pEntity = EntityInSlot( search.cursors[iBest].pSlots->Element( search.cursors[iBest].iCursor ) );
+			search.cursors[iBest].iCursor++;
+			search.nCursorOrder = nBestOrder;
+
+			if ( pFilter && !pFilter->ShouldFindEntity( pEntity ) )
+			{
+				// The filter may have renamed something
+				PrepareWildcardSearch( iIndex, szName, nBestOrder );
+				continue;
+			}
+
+			*ppResult = pEntity;
+			return true;
+		}
+	}
+
+private:
+	struct bucketcursor_t
+	{
+		const CUtlVector<int> *pSlots;
+		int iCursor;
+	};
+
+	// The buckets the last wildcard matched, and where the last search got to in each
+	struct wildcardsearch_t
+	{
+		CUtlString pattern;
+		CUtlVector<int> buckets;
+		bool bValid;
+
+		CUtlVector<bucketcursor_t> cursors;
+		unsigned int nCursorOrder;
+		bool bCursorsValid;
+	};
+
+	void PrepareWildcardSearch( int iIndex, const char *szName, unsigned int nStartOrder )
+	{
+		wildcardsearch_t &search = m_Wildcard[iIndex];
+		if ( !search.bValid || Q_strcmp( search.pattern.Get(), szName ) )
+		{
+			// Every entity in a bucket has the same name give or take case, which
+			// wildcards ignore, so testing the first entity of each bucket is enough.
+			search.pattern = szName;
+			search.buckets.RemoveAll();
+			for ( int iBucket = m_Buckets[iIndex].First(); iBucket != m_Buckets[iIndex].InvalidIndex(); iBucket = m_Buckets[iIndex].Next( iBucket ) )
+			{
+				CBaseEntity *pFirst = EntityInSlot( m_Buckets[iIndex][iBucket]->Element( 0 ) );
+				bool bMatches = ( iIndex == ENTITY_INDEX_TARGETNAME ) ? pFirst->NameMatches( szName ) : pFirst->ClassMatches( szName );
+				if ( bMatches )
+				{
+					search.buckets.AddToTail( iBucket );
+				}
+			}
+
+			search.bValid = true;
+			search.bCursorsValid = false;
+		}
+
+		if ( search.bCursorsValid && search.nCursorOrder == nStartOrder )
+			return;
+
+		search.cursors.RemoveAll();
+		for ( int i = 0; i < search.buckets.Count(); i++ )
+		{
+			const CUtlVector<int> &slots = *m_Buckets[iIndex][search.buckets[i]];
+			int iCursor = UpperBoundListOrder( slots, nStartOrder );
+			if ( iCursor < slots.Count() )
+			{
+				bucketcursor_t &cursor = search.cursors[search.cursors.AddToTail()];
+				cursor.pSlots = &slots;
+				cursor.iCursor = iCursor;
+			}
+		}
+
+		search.nCursorOrder = nStartOrder;
+		search.bCursorsValid = true;
+	}
+
+	void Relink( int iIndex, int iSlot, string_t iszName )
+	{
+		bool bLinked = ( m_iBucket[iIndex][iSlot] != m_Buckets[iIndex].InvalidIndex() );
+
+		// Nameless entities are never found by name, but every entity is found by classname
+		bool bShouldLink = ( iszName != NULL_STRING || iIndex == ENTITY_INDEX_CLASSNAME );
+
+		if ( bLinked == bShouldLink && ( !bLinked || IDENT_STRINGS( m_iszIndexed[iIndex][iSlot], iszName ) ) )
+			return;
+
+		Unlink( iIndex, iSlot );
+		m_iszIndexed[iIndex][iSlot] = iszName;
+
+		if ( !bShouldLink )
+			return;
+
+		MEM_ALLOC_CREDIT();
+		int iBucket = m_Buckets[iIndex].Find( STRING(iszName) );
+		if ( iBucket == m_Buckets[iIndex].InvalidIndex() )
+		{
+			iBucket = m_Buckets[iIndex].Insert( STRING(iszName), new CUtlVector<int> );
+			m_Wildcard[iIndex].bValid = false;
+		}
+		m_Wildcard[iIndex].bCursorsValid = false;
+
+		CUtlVector<int> &slots = *m_Buckets[iIndex][iBucket];
+		slots.InsertBefore( UpperBoundListOrder( slots, s_nListOrder[iSlot] ), iSlot );
+		m_iBucket[iIndex][iSlot] = iBucket;
+	}
+
+	void Unlink( int iIndex, int iSlot )
+	{
+		int iBucket = m_iBucket[iIndex][iSlot];
+		if ( iBucket == m_Buckets[iIndex].InvalidIndex() )
+			return;
+
+		CUtlVector<int> &slots = *m_Buckets[iIndex][iBucket];
+		int i = UpperBoundListOrder( slots, s_nListOrder[iSlot] ) - 1;
+		Assert( i >= 0 && slots[i] == iSlot );
+		slots.Remove( i );
+		m_Wildcard[iIndex].bCursorsValid = false;
+
+		if ( !slots.Count() )
+		{
+			delete m_Buckets[iIndex][iBucket];
+			m_Buckets[iIndex].RemoveAt( iBucket );
+			m_Wildcard[iIndex].bValid = false;
+		}
+
+		m_iBucket[iIndex][iSlot] = m_Buckets[iIndex].InvalidIndex();
+	}
+
+	// The name each slot is currently filed under, and the bucket it's in
+	string_t m_iszIndexed[NUM_ENTITY_NAME_INDICES][NUM_ENT_ENTRIES];
+	int m_iBucket[NUM_ENTITY_NAME_INDICES][NUM_ENT_ENTRIES];
+
+	// Entity slots by (case-insensitive) name, in list order. The vectors are
+	// allocated separately because CUtlDict copies its elements.
+	CUtlDict< CUtlVector<int> *, int > m_Buckets[NUM_ENTITY_NAME_INDICES];
+
+	wildcardsearch_t m_Wildcard[NUM_ENTITY_NAME_INDICES];
+};
+
+static CEntityNameIndex g_EntityNameIndex;
+
+//-----------------------------------------------------------------------------
+// A loose uniform grid over entity origins, used by the radius searches. Each
+// entity is filed under the cell holding its origin; entities whose bounds reach
+// further than a cell from their origin go in a separate list that every search
+// visits. Moved entities are only re-filed when the next search happens.
+//-----------------------------------------------------------------------------
+#define ENTITY_GRID_CELL_SIZE	256.0f
+#define ENTITY_GRID_BUCKETS		4096					// power of two, cells are hashed into these
+#define ENTITY_GRID_OVERSIZED	ENTITY_GRID_BUCKETS		// bucket for entities larger than a cell
+#define ENTITY_GRID_MAX_CELLS	256						// searches covering more cells than this walk the list
+#define ENTITY_GRID_NONE		-1
+
+ConVar ent_spatial_grid( "ent_spatial_grid", "1", 0, "Use the spatial grid for radius entity searches instead of walking the entity list." );
+
+class CEntitySpatialGrid
+{
+public:
+	CEntitySpatialGrid()
+	{
+		for ( int i = 0; i < ARRAYSIZE(m_iBucketHead); i++ )
+		{
+			m_iBucketHead[i] = ENTITY_GRID_NONE;
+		}
+
+		for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+		{
+			m_iBucket[i] = ENTITY_GRID_NONE;
+			m_bDirty[i] = false;
+		}
+
+		m_nGeneration = 0;
+		m_nCandidateGeneration = 0;
+		m_bHaveCandidates = false;
+	}
+
+	void AddEntity( int iSlot )
+	{
+		m_iBucket[iSlot] = ENTITY_GRID_NONE;
+		MarkEntityDirty( iSlot );
+	}
+
+	void RemoveEntity( int iSlot )
+	{
+		Unlink( iSlot );
+		m_bDirty[iSlot] = false;
+		m_nGeneration++;
+	}
+
+	void MarkEntityDirty( int iSlot )
+	{
+		if ( m_bDirty[iSlot] )
+			return;
+
+		m_bDirty[iSlot] = true;
+		m_DirtySlots.AddToTail( iSlot );
+	}
+
+	// Gathers, in list order, the entities that may be within flRadius of vecCenter.
+	// If bUseBounds is set an entity qualifies if any part of its bounds may be in
+	// range, otherwise only its origin is considered. Returns false if the search
+	// covers too much of the map for the grid to help.
+	bool GatherCandidates( const Vector &vecCenter, float flRadius, bool bUseBounds )
+	{
+		Flush();
+
+		if ( m_bHaveCandidates && m_nCandidateGeneration == m_nGeneration && m_bCandidatesUseBounds == bUseBounds &&
+			m_flCandidateRadius == flRadius && m_vecCandidateCenter == vecCenter )
+		{
+			// Same search as last time (usually the caller iterating through the results)
+			return true;
+		}
+
+		float flReach = fabs( flRadius ) + ( bUseBounds ? ENTITY_GRID_CELL_SIZE : 0.0f );
+		if ( !( flReach * 2.0f <= ENTITY_GRID_CELL_SIZE * ( ENTITY_GRID_MAX_CELLS / 4 ) ) )
+			return false;
+
+		int x0 = CellCoord( vecCenter.x - flReach );
+		int x1 = CellCoord( vecCenter.x + flReach );
+		int y0 = CellCoord( vecCenter.y - flReach );
+		int y1 = CellCoord( vecCenter.y + flReach );
+		if ( ( x1 - x0 + 1 ) * ( y1 - y0 + 1 ) > ENTITY_GRID_MAX_CELLS )
+			return false;
+
+		m_Candidates.RemoveAll();
+		for ( int x = x0; x <= x1; x++ )
+		{
+			for ( int y = y0; y <= y1; y++ )
+			{
+				AddBucketToCandidates( BucketForCell( x, y ) );
+			}
+		}
+		AddBucketToCandidates( ENTITY_GRID_OVERSIZED );
+
+		// Cells can share a bucket, so sort and drop the duplicates
+		m_Candidates.Sort( ListOrderLessFunc );
+		for ( int i = m_Candidates.Count() - 1; i > 0; i-- )
+		{
+			if ( m_Candidates[i] == m_Candidates[i-1] )
+			{
+				m_Candidates.Remove( i );
+			}
+		}
+
+		m_bHaveCandidates = true;
+		m_nCandidateGeneration = m_nGeneration;
+		m_bCandidatesUseBounds = bUseBounds;
+		m_flCandidateRadius = flRadius;
+		m_vecCandidateCenter = vecCenter;
+		return true;
+	}
+
+	const CUtlVector<int> &Candidates() const { return m_Candidates; }
+
+private:
+	static int ListOrderLessFunc( const int *pLeft, const int *pRight )
+	{
+		unsigned int nLeft = s_nListOrder[*pLeft];
+		unsigned int nRight = s_nListOrder[*pRight];
+		return ( nLeft < nRight ) ? -1 : ( ( nLeft > nRight ) ? 1 : 0 );
+	}
+
+	static int CellCoord( float flCoord )
+	{
+		flCoord = clamp( flCoord, -2.0f * MAX_COORD_FLOAT, 2.0f * MAX_COORD_FLOAT );
+		return (int)floorf( flCoord * ( 1.0f / ENTITY_GRID_CELL_SIZE ) );
+	}
+
+	static int BucketForCell( int x, int y )
+	{
+		return ( ( x * 73856093 ) ^ ( y * 19349663 ) ) & ( ENTITY_GRID_BUCKETS - 1 );
+	}
+
+	void AddBucketToCandidates( int iBucket )
+	{
+		for ( int iSlot = m_iBucketHead[iBucket]; iSlot != ENTITY_GRID_NONE; iSlot = m_iNext[iSlot] )
+		{
+			m_Candidates.AddToTail( iSlot );
+		}
+	}
+
+	// Re-files every entity that moved or changed size since the last search
+	void Flush()
+	{
+		if ( !m_DirtySlots.Count() )
+			return;
+
+		for ( int i = 0; i < m_DirtySlots.Count(); i++ )
+		{
+			int iSlot = m_DirtySlots[i];
+			if ( !m_bDirty[iSlot] )
+				continue;
+
+			m_bDirty[iSlot] = false;
+
+			CBaseEntity *pEntity = EntityInSlot( iSlot );
+			if ( !pEntity )
+				continue;
+
+			// Furthest any part of the collision bounds can be from the origin
+			CCollisionProperty *pCollision = pEntity->CollisionProp();
+			float flExtent = pCollision->OBBCenter().Length() + pCollision->BoundingRadius();
+
+			int iBucket;
+			if ( flExtent > ENTITY_GRID_CELL_SIZE )
+			{
+				iBucket = ENTITY_GRID_OVERSIZED;
+			}
+			else
+			{
+				const Vector &vecOrigin = pEntity->GetAbsOrigin();
+				iBucket = BucketForCell( CellCoord( vecOrigin.x ), CellCoord( vecOrigin.y ) );
+			}
+
+			if ( iBucket != m_iBucket[iSlot] )
+			{
+				Unlink( iSlot );
+				Link( iSlot, iBucket );
+			}
+		}
+
+		m_DirtySlots.RemoveAll();
+		m_nGeneration++;
+	}
+
+	void Link( int iSlot, int iBucket )
+	{
+		m_iPrev[iSlot] = ENTITY_GRID_NONE;
+		m_iNext[iSlot] = m_iBucketHead[iBucket];
+		if ( m_iNext[iSlot] != ENTITY_GRID_NONE )
+		{
+			m_iPrev[m_iNext[iSlot]] = iSlot;
+		}
+		m_iBucketHead[iBucket] = iSlot;
+		m_iBucket[iSlot] = iBucket;
+	}
+
+	void Unlink( int iSlot )
+	{
+		int iBucket = m_iBucket[iSlot];
+		if ( iBucket == ENTITY_GRID_NONE )
+			return;
+
+		if ( m_iPrev[iSlot] != ENTITY_GRID_NONE )
+		{
+			m_iNext[m_iPrev[iSlot]] = m_iNext[iSlot];
+		}
+		else
+		{
+			m_iBucketHead[iBucket] = m_iNext[iSlot];
+		}
+
+		if ( m_iNext[iSlot] != ENTITY_GRID_NONE )
+		{
+			m_iPrev[m_iNext[iSlot]] = m_iPrev[iSlot];
+		}
+
+		m_iBucket[iSlot] = ENTITY_GRID_NONE;
+	}
+
+	int m_iBucketHead[ENTITY_GRID_BUCKETS + 1];
+
+	// Per entity slot bucket chains
+	int m_iBucket[NUM_ENT_ENTRIES];
+	int m_iNext[NUM_ENT_ENTRIES];
+	int m_iPrev[NUM_ENT_ENTRIES];
+
+	bool m_bDirty[NUM_ENT_ENTRIES];
+	CUtlVector<int> m_DirtySlots;
+
+	// Bumped whenever anything is re-filed, added or removed
+	unsigned int m_nGeneration;
+
+	// The last search, kept so iterating through its results doesn't gather them again
+	CUtlVector<int> m_Candidates;
+	bool m_bHaveCandidates;
+	unsigned int m_nCandidateGeneration;
+	bool m_bCandidatesUseBounds;
+	float m_flCandidateRadius;
+	Vector m_vecCandidateCenter;
+};
+
+static CEntitySpatialGrid g_EntitySpatialGrid;
+
 static CBaseEntityClassList *s_pClassLists = NULL;
 CBaseEntityClassList::CBaseEntityClassList()
 {
@@ -458,6 +1005,59 @@ void CGlobalEntityList::ReportEntityFlagsChanged( CBaseEntity *pEntity, unsigned
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Keeps the name index in sync after an entity's targetname or
+//			classname may have changed.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::ReportEntityNameChanged( CBaseEntity *pEntity )
+{
+	const CBaseHandle &eh = pEntity->GetRefEHandle();
+	if ( !eh.IsValid() )
+		return;
+
+	g_EntityNameIndex.UpdateEntity( pEntity, eh.GetEntryIndex() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lets the spatial grid and the AI hint grids know an entity's
+//			origin or bounds changed.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::ReportEntityPositionChanged( CBaseEntity *pEntity )
+{
+	const CBaseHandle &eh = pEntity->GetRefEHandle();
+	if ( !eh.IsValid() )
+		return;
+
+	if ( !s_bHiddenFromSearches[eh.GetEntryIndex()] )
+	{
+		g_EntitySpatialGrid.MarkEntityDirty( eh.GetEntryIndex() );
+	}
+	CAI_HintManager::OnEntityPositionChanged( pEntity );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps an entity that is set aside to be used again, but not
+//			deleted, out of the spatial grid and the sphere searches.
+//			Searches by name should be kept away from it by giving it a
+//			classname nothing looks for.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::HideEntityFromSearches( CBaseEntity *pEntity, bool bHide )
+{
+	const CBaseHandle &eh = pEntity->GetRefEHandle();
+	if ( !eh.IsValid() || s_bHiddenFromSearches[eh.GetEntryIndex()] == bHide )
+		return;
+
+	s_bHiddenFromSearches[eh.GetEntryIndex()] = bHide;
+	if ( bHide )
+	{
+		g_EntitySpatialGrid.RemoveEntity( eh.GetEntryIndex() );
+	}
+	else
+	{
+		g_EntitySpatialGrid.AddEntity( eh.GetEntryIndex() );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Used to confirm a pointer is a pointer to an entity, useful for
 //			asserts.
@@ -488,6 +1088,17 @@ CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName )
 #endif
 {
+	if ( ent_name_index.GetBool() )
+	{
+		CBaseEntity *pResult;
+#ifdef MAPBASE
+		if ( g_EntityNameIndex.Find( ENTITY_INDEX_CLASSNAME, pStartEntity, szName, pFilter, &pResult ) )
+#else
+		if ( g_EntityNameIndex.Find( ENTITY_INDEX_CLASSNAME, pStartEntity, szName, NULL, &pResult ) )
+#endif
+			return pResult;
+	}
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -655,6 +1266,13 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	if ( ent_name_index.GetBool() )
+	{
+		CBaseEntity *pResult;
+		if ( g_EntityNameIndex.Find( ENTITY_INDEX_TARGETNAME, pStartEntity, szName, pFilter, &pResult ) )
+			return pResult;
+	}
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -747,8 +1365,31 @@ CBaseEntity	*CGlobalEntityList::FindEntityByTarget( CBaseEntity *pStartEntity, c
 //			vecCenter - 
 //			flRadius - 
 //-----------------------------------------------------------------------------
+static bool IsEntityInSphere( CBaseEntity *ent, const Vector &vecCenter, float flRadius )
+{
+	if ( !ent->edict() || s_bHiddenFromSearches[ent->GetRefEHandle().GetEntryIndex()] )
+		return false;
+
+	Vector vecRelativeCenter;
+	ent->CollisionProp()->WorldToCollisionSpace( vecCenter, &vecRelativeCenter );
+	return IsBoxIntersectingSphere( ent->CollisionProp()->OBBMins(), ent->CollisionProp()->OBBMaxs(), vecRelativeCenter, flRadius );
+}
+
 CBaseEntity *CGlobalEntityList::FindEntityInSphere( CBaseEntity *pStartEntity, const Vector &vecCenter, float flRadius )
 {
+	if ( ent_spatial_grid.GetBool() && g_EntitySpatialGrid.GatherCandidates( vecCenter, flRadius, true ) )
+	{
+		const CUtlVector<int> &candidates = g_EntitySpatialGrid.Candidates();
+		for ( int i = UpperBoundListOrder( candidates, ListOrderAfter( pStartEntity ) ); i < candidates.Count(); i++ )
+		{
+			CBaseEntity *ent = EntityInSlot( candidates[i] );
+			if ( IsEntityInSphere( ent, vecCenter, flRadius ) )
+				return ent;
+		}
+
+		return NULL;
+	}
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -760,12 +1401,7 @@ CBaseEntity *CGlobalEntityList::FindEntityInSphere( CBaseEntity *pStartEntity, c
 			continue;
 		}
 
-		if ( !ent->edict() )
-			continue;
-
-		Vector vecRelativeCenter;
-		ent->CollisionProp()->WorldToCollisionSpace( vecCenter, &vecRelativeCenter );
-		if ( !IsBoxIntersectingSphere( ent->CollisionProp()->OBBMins(),	ent->CollisionProp()->OBBMaxs(), vecRelativeCenter, flRadius ) )
+		if ( !IsEntityInSphere( ent, vecCenter, flRadius ) )
 			continue;
 
 		return ent;
@@ -880,6 +1516,27 @@ CBaseEntity *CGlobalEntityList::FindEntityByClassnameNearest( const char *szName
 		flMaxDist2 = MAX_TRACE_LENGTH * MAX_TRACE_LENGTH;
 	}
 
+	if ( ent_spatial_grid.GetBool() && g_EntitySpatialGrid.GatherCandidates( vecSrc, sqrt( flMaxDist2 ), false ) )
+	{
+		const CUtlVector<int> &candidates = g_EntitySpatialGrid.Candidates();
+		for ( int i = 0; i < candidates.Count(); i++ )
+		{
+			CBaseEntity *pSearch = EntityInSlot( candidates[i] );
+			if ( !pSearch->edict() || !pSearch->ClassMatches( szName ) )
+				continue;
+
+			float flDist2 = (pSearch->GetAbsOrigin() - vecSrc).LengthSqr();
+
+			if (flMaxDist2 > flDist2)
+			{
+				pEntity = pSearch;
+				flMaxDist2 = flDist2;
+			}
+		}
+
+		return pEntity;
+	}
+
 	CBaseEntity *pSearch = NULL;
 	while ((pSearch = gEntList.FindEntityByClassname( pSearch, szName )) != NULL)
 	{
@@ -920,6 +1577,26 @@ CBaseEntity *CGlobalEntityList::FindEntityByClassnameWithin( CBaseEntity *pStart
 		return gEntList.FindEntityByClassname( pEntity, szName );
 	}
 
+	if ( ent_spatial_grid.GetBool() && g_EntitySpatialGrid.GatherCandidates( vecSrc, flRadius, false ) )
+	{
+		const CUtlVector<int> &candidates = g_EntitySpatialGrid.Candidates();
+		for ( int i = UpperBoundListOrder( candidates, ListOrderAfter( pStartEntity ) ); i < candidates.Count(); i++ )
+		{
+			pEntity = EntityInSlot( candidates[i] );
+			if ( !pEntity->edict() || !pEntity->ClassMatches( szName ) )
+				continue;
+
+			float flDist2 = (pEntity->GetAbsOrigin() - vecSrc).LengthSqr();
+
+			if (flMaxDist2 > flDist2)
+			{
+				return pEntity;
+			}
+		}
+
+		return NULL;
+	}
+
 	while ((pEntity = gEntList.FindEntityByClassname( pEntity, szName )) != NULL)
 	{
 		if ( !pEntity->edict() )
@@ -1175,6 +1852,10 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
+	s_nListOrder[handle.GetEntryIndex()] = s_nNextListOrder++;
+	s_bHiddenFromSearches[handle.GetEntryIndex()] = false;
+	g_EntityNameIndex.AddEntity( pBaseEnt, handle.GetEntryIndex() );
+	g_EntitySpatialGrid.AddEntity( handle.GetEntryIndex() );
 	//DevMsg(2,"Created %s\n", pBaseEnt->GetClassname() );
 	for ( i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1205,6 +1886,9 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	g_EntityNameIndex.RemoveEntity( handle.GetEntryIndex() );
+	g_EntitySpatialGrid.RemoveEntity( handle.GetEntryIndex() );
+
 	m_iNumEnts--;
 }
 
@@ -1714,3 +2398,106 @@ CON_COMMAND(report_simthinklist, "Lists all simulating/thinking entities")
 	list.ReportEntityList();
 }
 
+
+
+//-----------------------------------------------------------------------------
+// Compares the spatial grid against walking the entity list for sphere searches,
+// after padding the level out with the requested number of extra entities.
+//-----------------------------------------------------------------------------
+
+// The extra entities need edicts, or FindEntityInSphere() would never return
+// them, but they're never sent to clients
+class CSpatialBenchmarkPoint : public CPointEntity
+{
+	DECLARE_CLASS( CSpatialBenchmarkPoint, CPointEntity );
+public:
+	void Spawn( void )
+	{
+		BaseClass::Spawn();
+		AddEffects( EF_NODRAW );
+	}
+
+	int UpdateTransmitState( void )
+	{
+		return SetTransmitState( FL_EDICT_DONTSEND );
+	}
+};
+
+LINK_ENTITY_TO_CLASS( spatial_benchmark_point, CSpatialBenchmarkPoint );
+
+#define SPATIAL_BENCHMARK_FREE_EDICTS	128	// edicts left for the game
+
+static void RunSphereSearches( const CUtlVector<Vector> &centers, float flRadius, bool bUseGrid, double *pflTime, int *pnFound )
+{
+	bool bWasUsingGrid = ent_spatial_grid.GetBool();
+	ent_spatial_grid.SetValue( bUseGrid );
+
+	*pnFound = 0;
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < centers.Count(); i++ )
+	{
+		CBaseEntity *pEntity = NULL;
+		while ( (pEntity = gEntList.FindEntityInSphere( pEntity, centers[i], flRadius )) != NULL )
+		{
+			(*pnFound)++;
+		}
+	}
+	*pflTime = Plat_FloatTime() - flStart;
+
+	ent_spatial_grid.SetValue( bWasUsingGrid );
+}
+
+CON_COMMAND_F( ent_spatial_benchmark, "Times sphere entity searches with and without the spatial grid.\n\tArguments: [extra entities] [searches] [radius]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nExtraEntities = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 1500;
+	int nSearches = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 1000;
+	float flRadius = ( args.ArgC() > 3 ) ? atof( args[3] ) : 256.0f;
+	nSearches = MAX( nSearches, 1 );
+
+	// Leave room for whatever the game spawns while we're padded out
+	int nMaxExtra = MAX_EDICTS - engine->GetEntityCount() - SPATIAL_BENCHMARK_FREE_EDICTS;
+	if ( nExtraEntities > nMaxExtra )
+	{
+		nExtraEntities = MAX( nMaxExtra, 0 );
+		Warning( "Only room for %d extra entities\n", nExtraEntities );
+	}
+
+	CUtlVector<CBaseEntity *> extraEntities;
+	for ( int i = 0; i < nExtraEntities; i++ )
+	{
+		CBaseEntity *pEntity = CreateEntityByName( "spatial_benchmark_point" );
+		if ( !pEntity )
+			break;
+
+		pEntity->SetAbsOrigin( Vector( RandomFloat( -8192, 8192 ), RandomFloat( -8192, 8192 ), RandomFloat( -512, 512 ) ) );
+		DispatchSpawn( pEntity );
+		extraEntities.AddToTail( pEntity );
+	}
+
+	CUtlVector<Vector> centers;
+	for ( int i = 0; i < nSearches; i++ )
+	{
+		centers.AddToTail( Vector( RandomFloat( -8192, 8192 ), RandomFloat( -8192, 8192 ), RandomFloat( -512, 512 ) ) );
+	}
+
+	double flListTime, flGridTime;
+	int nListFound, nGridFound;
+	RunSphereSearches( centers, flRadius, false, &flListTime, &nListFound );
+	RunSphereSearches( centers, flRadius, true, &flGridTime, &nGridFound );
+
+	Msg( "%d entities, %d searches of radius %.0f\n", gEntList.NumberOfEntities(), nSearches, flRadius );
+	Msg( "  entity list:  %.3f us/search (%d found)\n", flListTime * 1000000.0 / nSearches, nListFound );
+	Msg( "  spatial grid: %.3f us/search (%d found)\n", flGridTime * 1000000.0 / nSearches, nGridFound );
+	if ( nListFound != nGridFound )
+	{
+		Warning( "Spatial grid results don't match the entity list!\n" );
+	}
+
+	for ( int i = 0; i < extraEntities.Count(); i++ )
+	{
+		UTIL_Remove( extraEntities[i] );
+	}
+}
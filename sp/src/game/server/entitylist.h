@@ -117,6 +117,9 @@ public:
 	void RemoveListenerEntity( IEntityListener *pListener );
 
 	void ReportEntityFlagsChanged( CBaseEntity *pEntity, unsigned int flagsOld, unsigned int flagsNow );
+	void ReportEntityNameChanged( CBaseEntity *pEntity );
+	void ReportEntityPositionChanged( CBaseEntity *pEntity );
+	void HideEntityFromSearches( CBaseEntity *pEntity, bool bHide );
 
 	// entity is about to be removed, notify the listeners
 	void NotifyCreateEntity( CBaseEntity *pEnt );
@@ -15,6 +15,17 @@
 #endif
 
 #include "mempool.h"
+#include "utlrbtree.h"
+#include "utlmap.h"
+
+struct EventQueuePrioritizedEvent_t;
+
+// Intrusive links used to chain together all the events that share a target or a caller
+struct EventQueueIndexLink_t
+{
+	EventQueuePrioritizedEvent_t *m_pNext;
+	EventQueuePrioritizedEvent_t *m_pPrev;
+};
 
 struct EventQueuePrioritizedEvent_t
 {
@@ -31,6 +42,10 @@ struct EventQueuePrioritizedEvent_t
 	EventQueuePrioritizedEvent_t *m_pNext;
 	EventQueuePrioritizedEvent_t *m_pPrev;
 
+	// per-target (m_pEntTarget) and per-caller (m_pCaller) chains, not saved
+	EventQueueIndexLink_t m_TargetLink;
+	EventQueueIndexLink_t m_CallerLink;
+
 	DECLARE_SIMPLE_DATADESC();
 
 	DECLARE_FIXEDSIZE_ALLOCATOR( PrioritizedEvent_t );
@@ -82,9 +97,33 @@ private:
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
 
+	typedef CUtlMap<int, EventQueuePrioritizedEvent_t *> EventIndex_t;
+	typedef EventQueueIndexLink_t EventQueuePrioritizedEvent_t::*EventIndexLink_t;
+
+	static void LinkToIndex( EventIndex_t &index, const EHANDLE &hEntity, EventQueuePrioritizedEvent_t *pe, EventIndexLink_t pLink );
+	static void UnlinkFromIndex( EventIndex_t &index, const EHANDLE &hEntity, EventQueuePrioritizedEvent_t *pe, EventIndexLink_t pLink );
+	static EventQueuePrioritizedEvent_t *FirstInIndex( const EventIndex_t &index, CBaseEntity *pEntity );
+
+	// The last queued event for each distinct fire time, used to find the insertion
+	// point in the sorted list without walking it.
+	struct FireTimeBucket_t
+	{
+		float m_flFireTime;
+		EventQueuePrioritizedEvent_t *m_pTail;
+	};
+	static bool FireTimeBucketLessFunc( const FireTimeBucket_t &lhs, const FireTimeBucket_t &rhs );
+
 	DECLARE_SIMPLE_DATADESC();
 	EventQueuePrioritizedEvent_t m_Events;
 	int m_iListCount;
+
+	CUtlRBTree<FireTimeBucket_t, int> m_FireTimeBuckets;
+	EventIndex_t m_TargetIndex;
+	EventIndex_t m_CallerIndex;
+#ifdef MAPBASE_VSCRIPT
+	// Events handed out to scripts, so handles can be validated without walking the queue
+	CUtlRBTree<EventQueuePrioritizedEvent_t *, int> m_LiveEvents;
+#endif
 };
 
 extern CEventQueue g_EventQueue;
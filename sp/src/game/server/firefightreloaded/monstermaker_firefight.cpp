@@ -23,6 +23,8 @@
 ConVar sk_initialspawnertime("sk_initialspawnertime", "5", FCVAR_CHEAT);
 ConVar sk_spawnrareenemies("sk_spawnrareenemies", "1", FCVAR_ARCHIVE);
 ConVar sk_spawnerhidefromplayer("sk_spawnerhidefromplayer", "1", FCVAR_ARCHIVE);
+ConVar sk_spawnerbudget("sk_spawnerbudget", "4", FCVAR_NONE, "Most NPCs the firefight spawners may spawn in one tick. The rest wait for the next tick. 0 is no limit.");
+ConVar sk_spawnerpool("sk_spawnerpool", "0", FCVAR_NONE, "Most dead NPCs of each type the firefight spawners keep to spawn again, instead of deleting them and creating new ones. 0 turns the pool off.");
 //ConVar sk_spawnerminclientstospawn("sk_spawnerminclientstospawn", "2", FCVAR_NOTIFY);
 
 const char *g_CombineSoldierWeapons[] =
@@ -95,6 +97,171 @@ static void DispatchActivate( CBaseEntity *pEntity )
 	mdlcache->SetAsyncLoad( MDLCACHE_ANIMBLOCK, bAsyncAnims );
 }
 
+//-----------------------------------------------------------------------------
+// Spawn budget, shared by every firefight spawner. A wave that would spawn
+// more NPCs than sk_spawnerbudget in one tick is spread over the next ticks.
+//-----------------------------------------------------------------------------
+static int g_nSpawnBudgetTick = -1;
+static int g_nSpawnsThisTick = 0;
+
+static bool UseSpawnBudget()
+{
+	if (sk_spawnerbudget.GetInt() <= 0)
+		return true;
+
+	if (g_nSpawnBudgetTick != gpGlobals->tickcount)
+	{
+		g_nSpawnBudgetTick = gpGlobals->tickcount;
+		g_nSpawnsThisTick = 0;
+	}
+
+	if (g_nSpawnsThisTick >= sk_spawnerbudget.GetInt())
+		return false;
+
+	g_nSpawnsThisTick++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Dead NPC pool, shared by every firefight spawner. The spawners' dead common
+// NPCs are kept hidden instead of deleted, up to sk_spawnerpool of each
+// classname, and spawned again in place of new NPCs of the same classname.
+//-----------------------------------------------------------------------------
+// Classname of the kept NPCs, so searches by classname don't find them
+#define DEAD_NPC_POOL_CLASSNAME "npc_maker_firefight_pooled"
+
+struct DeadNPCPoolEntry_t
+{
+	CHandle<CAI_BaseNPC> hNPC;
+	string_t iszClassname;
+};
+
+static CUtlVector<DeadNPCPoolEntry_t> g_DeadNPCPool;
+
+static int FindDeadNPC(CBaseEntity *pEntity)
+{
+	for (int i = g_DeadNPCPool.Count() - 1; i >= 0; i--)
+	{
+		if (g_DeadNPCPool[i].hNPC == pEntity)
+			return i;
+	}
+
+	return -1;
+}
+
+bool CNPCMakerFirefight::ReleaseDeadNPC(CBaseEntity *pEntity)
+{
+	int i = FindDeadNPC(pEntity);
+	if (i == -1)
+		return false;
+
+	g_DeadNPCPool.FastRemove(i);
+	return true;
+}
+
+bool CNPCMakerFirefight::PoolDeadNPC(CBaseEntity *pEntity)
+{
+	if (sk_spawnerpool.GetInt() <= 0 || gEntList.IsClearingEntities())
+		return false;
+
+	// Only dead common NPCs that a spawner still owns
+	CAI_BaseNPC *pNPC = pEntity->MyNPCPointer();
+	if (!pNPC || pNPC->IsAlive() || pNPC->m_isRareEntity || pNPC->GetAIIndex() == -1)
+		return false;
+
+	if (!dynamic_cast<CNPCMakerFirefight *>(pNPC->GetOwnerEntity()))
+		return false;
+
+	Assert(FindDeadNPC(pNPC) == -1);
+
+	int nSameClass = 0;
+	for (int i = g_DeadNPCPool.Count() - 1; i >= 0; i--)
+	{
+		if (!g_DeadNPCPool[i].hNPC)
+		{
+			g_DeadNPCPool.FastRemove(i);
+			continue;
+		}
+
+		if (g_DeadNPCPool[i].iszClassname == pNPC->m_iClassname)
+			nSameClass++;
+	}
+
+	if (nSameClass >= sk_spawnerpool.GetInt())
+		return false;
+
+	int iEntry = g_DeadNPCPool.AddToTail();
+	g_DeadNPCPool[iEntry].hNPC = pNPC;
+	g_DeadNPCPool[iEntry].iszClassname = pNPC->m_iClassname;
+
+	pNPC->RemoveForReuse();
+	pNPC->SetClassname(DEAD_NPC_POOL_CLASSNAME);
+	return true;
+}
+
+static CAI_BaseNPC *TakeDeadNPC(const char *pszClassname)
+{
+	for (int i = g_DeadNPCPool.Count() - 1; i >= 0; i--)
+	{
+		CAI_BaseNPC *pNPC = g_DeadNPCPool[i].hNPC;
+		if (!pNPC || pNPC->IsMarkedForDeletion())
+		{
+			g_DeadNPCPool.FastRemove(i);
+			continue;
+		}
+
+		if (!Q_strcmp(STRING(g_DeadNPCPool[i].iszClassname), pszClassname))
+		{
+			pNPC->SetClassname(STRING(g_DeadNPCPool[i].iszClassname));
+			g_DeadNPCPool.FastRemove(i);
+			pNPC->RestoreForReuse();
+			return pNPC;
+		}
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// How long creating, spawning and activating each NPC took
+//-----------------------------------------------------------------------------
+static int g_nSpawnStatCount = 0;
+static int g_nSpawnStatDeferred = 0;
+static double g_flSpawnStatTotal = 0.0;
+static double g_flSpawnStatMax = 0.0;
+static int g_nSpawnStatReused = 0;
+static double g_flSpawnStatReusedTotal = 0.0;
+
+CON_COMMAND(sk_spawnerstats, "Show how long firefight spawners take to spawn each NPC. 'sk_spawnerstats reset' clears the numbers.")
+{
+	if (args.ArgC() > 1 && !Q_stricmp(args[1], "reset"))
+	{
+		g_nSpawnStatCount = 0;
+		g_nSpawnStatDeferred = 0;
+		g_flSpawnStatTotal = 0.0;
+		g_flSpawnStatMax = 0.0;
+		g_nSpawnStatReused = 0;
+		g_flSpawnStatReusedTotal = 0.0;
+		return;
+	}
+
+	Msg("%d NPCs spawned, %.3f ms average, %.3f ms worst, %d spawns put off to a later tick (sk_spawnerbudget %d)\n",
+		g_nSpawnStatCount,
+		g_nSpawnStatCount ? g_flSpawnStatTotal * 1000.0 / g_nSpawnStatCount : 0.0,
+		g_flSpawnStatMax * 1000.0,
+		g_nSpawnStatDeferred,
+		sk_spawnerbudget.GetInt());
+
+	int nCreated = g_nSpawnStatCount - g_nSpawnStatReused;
+	Msg("%d created, %.3f ms average, %d reused from the dead NPC pool, %.3f ms average (sk_spawnerpool %d, %d waiting)\n",
+		nCreated,
+		nCreated ? (g_flSpawnStatTotal - g_flSpawnStatReusedTotal) * 1000.0 / nCreated : 0.0,
+		g_nSpawnStatReused,
+		g_nSpawnStatReused ? g_flSpawnStatReusedTotal * 1000.0 / g_nSpawnStatReused : 0.0,
+		sk_spawnerpool.GetInt(),
+		g_DeadNPCPool.Count());
+}
+
 LINK_ENTITY_TO_CLASS(npc_maker_firefight, CNPCMakerFirefight);
 
 //-------------------------------------
@@ -114,6 +281,8 @@ BEGIN_DATADESC(CNPCMakerFirefight)
 
 	DEFINE_FIELD(	m_nLiveChildren,		FIELD_INTEGER ),
 	DEFINE_FIELD(	m_nLiveRareNPCs,		FIELD_INTEGER ),
+	DEFINE_FIELD(	m_nPendingNPCs,			FIELD_INTEGER ),
+	DEFINE_FIELD(	m_nPendingRareNPCs,		FIELD_INTEGER ),
 
 	// Inputs
 	DEFINE_INPUTFUNC( FIELD_VOID,	"Spawn",	InputSpawnNPC ),
@@ -132,6 +301,7 @@ BEGIN_DATADESC(CNPCMakerFirefight)
 
 	// Function Pointers
 	DEFINE_THINKFUNC( MakerThink ),
+	DEFINE_THINKFUNC( PendingSpawnThink ),
 
 	DEFINE_FIELD( m_hIgnoreEntity, FIELD_EHANDLE ),
 	DEFINE_KEYFIELD( m_iszIngoreEnt, FIELD_STRING, "IgnoreEntity" ), 
@@ -154,6 +324,8 @@ void CNPCMakerFirefight::Spawn(void)
 	SetSolid( SOLID_NONE );
 	m_nLiveChildren		= 0;
 	m_nLiveRareNPCs		= 0;
+	m_nPendingNPCs		= 0;
+	m_nPendingRareNPCs	= 0;
 	Precache();
 
 	m_spawnflags |= SF_NPCMAKER_FADE;
@@ -279,6 +451,28 @@ void CNPCMakerFirefight::MakerThink(void)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Makes the NPCs that didn't fit in an earlier tick's spawn budget.
+//-----------------------------------------------------------------------------
+void CNPCMakerFirefight::PendingSpawnThink(void)
+{
+	int nPendingNPCs = m_nPendingNPCs;
+	int nPendingRareNPCs = m_nPendingRareNPCs;
+	m_nPendingNPCs = 0;
+	m_nPendingRareNPCs = 0;
+
+	// MakeNPC puts back whatever still doesn't fit
+	while (nPendingRareNPCs-- > 0)
+	{
+		MakeNPC(CanMakeRareNPC());
+	}
+
+	while (nPendingNPCs-- > 0)
+	{
+		MakeNPC();
+	}
+}
+
 //-----------------------------------------------------------------------------
 // A not-very-robust check to see if a human hull could fit at this location.
 // used to validate spawn destinations.
@@ -453,6 +647,25 @@ void CNPCMakerFirefight::MakeNPC(bool rareNPC)
 {
 	if (!CanMakeNPC())
 		return;
+
+	if (!UseSpawnBudget())
+	{
+		if (rareNPC)
+		{
+			m_nPendingRareNPCs++;
+		}
+		else
+		{
+			m_nPendingNPCs++;
+		}
+		g_nSpawnStatDeferred++;
+
+		SetContextThink(&CNPCMakerFirefight::PendingSpawnThink, gpGlobals->curtime, "PendingSpawnThink");
+		return;
+	}
+
+	double flSpawnStart = Plat_FloatTime();
+	bool bReused = false;
 	
 	if (rareNPC)
 	{
@@ -535,7 +748,15 @@ void CNPCMakerFirefight::MakeNPC(bool rareNPC)
 		int randomChoice = rand() % nNPCs;
 		const char* pRandomName = g_charNPCSCommon[randomChoice];
 
-		CAI_BaseNPC* pent = (CAI_BaseNPC*)CreateEntityByName(pRandomName);
+		CAI_BaseNPC* pent = TakeDeadNPC(pRandomName);
+		if (pent)
+		{
+			bReused = true;
+		}
+		else
+		{
+			pent = (CAI_BaseNPC*)CreateEntityByName(pRandomName);
+		}
 
 		if (!pent)
 		{
@@ -628,6 +849,16 @@ void CNPCMakerFirefight::MakeNPC(bool rareNPC)
 
 	m_nLiveChildren++;// count this NPC
 	g_iNPCLimit++;
+
+	double flSpawnTime = Plat_FloatTime() - flSpawnStart;
+	g_nSpawnStatCount++;
+	g_flSpawnStatTotal += flSpawnTime;
+	g_flSpawnStatMax = MAX(g_flSpawnStatMax, flSpawnTime);
+	if (bReused)
+	{
+		g_nSpawnStatReused++;
+		g_flSpawnStatReusedTotal += flSpawnTime;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -707,6 +938,11 @@ void CNPCMakerFirefight::Disable(void)
 {
 	m_bDisabled = true;
 	SetThink ( NULL );
+
+	// Drop the spawns that were waiting on the budget
+	m_nPendingNPCs = 0;
+	m_nPendingRareNPCs = 0;
+	SetContextThink(NULL, TICK_NEVER_THINK, "PendingSpawnThink");
 }
 
 
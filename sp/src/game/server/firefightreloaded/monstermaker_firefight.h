@@ -32,6 +32,7 @@ public:
 	void Precache(void);
 	virtual int	ObjectCaps( void ) { return BaseClass::ObjectCaps() & ~FCAP_ACROSS_TRANSITION; }
 	void MakerThink( void );
+	void PendingSpawnThink( void );
 	bool HumanHullFits( const Vector &vecLocation );
 	bool CanMakeNPC( bool bIgnoreSolidEntities = false );
 	bool CanMakeRareNPC();
@@ -60,6 +61,12 @@ public:
 
 	virtual bool IsDepleted( void );
 
+	// Keeps a dead NPC from one of the spawners instead of letting UTIL_Remove() delete it
+	static bool PoolDeadNPC( CBaseEntity *pEntity );
+	// Drops a kept NPC from the pool when something deletes it for good. Returns
+	// true if it was kept, so it has already been through UpdateOnRemove().
+	static bool ReleaseDeadNPC( CBaseEntity *pEntity );
+
 	DECLARE_DATADESC();
 	
 	float		m_flSpawnFrequency;		// delay (in secs) between spawns
@@ -73,6 +80,8 @@ public:
 	int		m_nMaxLiveChildren;	// max number of NPCs that this maker may have out at one time.
 	int		m_nLiveRareNPCs;
 	int		m_nMaxLiveRareNPCs;
+	int		m_nPendingNPCs;		// spawns put off because sk_spawnerbudget ran out this tick
+	int		m_nPendingRareNPCs;
 
 	bool	m_bDisabled;
 
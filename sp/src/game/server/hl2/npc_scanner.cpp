@@ -2131,17 +2131,15 @@ void CNPC_CScanner::AttackFlash(void)
 void CNPC_CScanner::BlindFlashTarget( CBaseEntity *pTarget )
 {
 	// Tell all the striders this person is here!
-	CAI_BaseNPC **	ppAIs 	= g_AI_Manager.AccessAIs();
-	int 			nAIs 	= g_AI_Manager.NumAIs();
-	
 	if( IsStriderScout() )
 	{
+		int				iStriderClass = g_AI_Manager.FindAIClass( "npc_strider" );
+		CAI_BaseNPC **	ppAIs 	= g_AI_Manager.AccessAIsOfClass( iStriderClass );
+		int 			nAIs 	= g_AI_Manager.NumAIsOfClass( iStriderClass );
+
 		for ( int i = 0; i < nAIs; i++ )
 		{
-			if( FClassnameIs( ppAIs[ i ], "npc_strider" ) )
-			{
-				ppAIs[ i ]->UpdateEnemyMemory( pTarget, pTarget->GetAbsOrigin(), this );
-			}
+			ppAIs[ i ]->UpdateEnemyMemory( pTarget, pTarget->GetAbsOrigin(), this );
 		}
 	}
 
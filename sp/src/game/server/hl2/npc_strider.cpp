@@ -2102,11 +2102,12 @@ void CNPC_Strider::InputSetCannonTarget( inputdata_t &inputdata )
 		if ( m_hCannonTarget == pTarget )
 			return;
 			
-		CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+		int iClass = GetAIClass();
+		CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIsOfClass( iClass );
 		CNPC_Strider *pStrider;
-		for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
+		for ( int i = 0; i < g_AI_Manager.NumAIsOfClass( iClass ); i++ )
 		{
-			if ( ppAIs[i] != this && ppAIs[i]->ClassMatches( GetClassname() ) )
+			if ( ppAIs[i] != this )
 			{
 				pStrider = (CNPC_Strider *)(ppAIs[i]);
 				if ( pStrider->GetCannonTarget() == pTarget )
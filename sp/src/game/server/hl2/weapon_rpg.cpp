@@ -1667,17 +1667,13 @@ void CWeaponRPG::PrimaryAttack( void )
 
 	if( hl2_episodic.GetBool() )
 	{
-		CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
-		int nAIs = g_AI_Manager.NumAIs();
-
-		string_t iszStriderClassname = AllocPooledString( "npc_strider" );
+		int iStriderClass = g_AI_Manager.FindAIClass( "npc_strider" );
+		CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIsOfClass( iStriderClass );
+		int nAIs = g_AI_Manager.NumAIsOfClass( iStriderClass );
 
 		for ( int i = 0; i < nAIs; i++ )
 		{
-			if( ppAIs[ i ]->m_iClassname == iszStriderClassname )
-			{
-				ppAIs[ i ]->DispatchInteraction( g_interactionPlayerLaunchedRPG, NULL, m_hMissile );
-			}
+			ppAIs[ i ]->DispatchInteraction( g_interactionPlayerLaunchedRPG, NULL, m_hMissile );
 		}
 	}
 }
@@ -24,7 +24,9 @@ public:
 	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd ) = 0;
 	virtual void	FinishLagCompensation( CBasePlayer *player ) = 0;
 
+	// CAI_Manager slots, which NPC histories are kept by
 	virtual void	RemoveNpcData(int index) = 0;
+	virtual void	MoveNpcData(int from, int to) = 0;
 };
 
 extern ILagCompensationManager *lagcompensation;
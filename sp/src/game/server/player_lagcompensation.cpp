@@ -214,13 +214,13 @@ class CLagCompensationManager : public CAutoGameSystemPerFrame, public ILagCompe
 public:
 	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_flTeleportDistanceSqr( 64 *64 )
 	{
-		m_bNeedsAIUpdate = true;
 	}
 
 	// IServerSystem stuff
 	virtual void Shutdown()
 	{
 		ClearHistory();
+		m_EntityTrack.PurgeAndDeleteElements();
 	}
 
 	virtual void LevelShutdownPostEntity()
@@ -239,8 +239,40 @@ public:
 
 	void RemoveNpcData(int index) // clear specific NPC's history 
 	{
-		CUtlFixedLinkedList< LagRecord > *track = &m_EntityTrack[index];
-		track->Purge();
+		if ( m_EntityTrack.IsValidIndex( index ) )
+		{
+			m_EntityTrack[index]->Purge();
+		}
+		if ( index >= 0 && index < m_RestoreEntity.GetNumBits() )
+		{
+			m_RestoreEntity.Clear( index );
+		}
+	}
+
+	void MoveNpcData(int from, int to) // CAI_Manager moved the NPC at "from" into the hole at "to"
+	{
+		RemoveNpcData( to );
+		if ( !m_EntityTrack.IsValidIndex( from ) )
+			return;
+
+		GetEntityTrack( to );
+		V_swap( m_EntityTrack[from], m_EntityTrack[to] );
+
+		// An NPC can be removed while a player is lag compensated, so carry along what to restore
+		if ( from < m_RestoreEntity.GetNumBits() && to < m_RestoreEntity.GetNumBits() )
+		{
+			if ( m_RestoreEntity.Get( from ) )
+			{
+				m_RestoreEntity.Set( to );
+				m_RestoreEntity.Clear( from );
+			}
+			else
+			{
+				m_RestoreEntity.Clear( to );
+			}
+			m_EntityRestoreData[to] = m_EntityRestoreData[from];
+			m_EntityChangeData[to] = m_EntityChangeData[from];
+		}
 	}
 
 private:
@@ -251,30 +283,38 @@ private:
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
 			m_PlayerTrack[i].Purge();
-		for (int j = 0; j<MAX_AIS; j++)
-			m_EntityTrack[j].Purge();
+		for (int j = 0; j<m_EntityTrack.Count(); j++)
+			m_EntityTrack[j]->Purge();
 	}
 
-	void UpdateAIIndexes();
+	CUtlFixedLinkedList< LagRecord > *GetEntityTrack( int index )
+	{
+		while ( m_EntityTrack.Count() <= index )
+		{
+			m_EntityTrack.AddToTail( new CUtlFixedLinkedList< LagRecord > );
+		}
+		return m_EntityTrack[index];
+	}
 
 	// keep a list of lag records for each player
 	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
-	CUtlFixedLinkedList< LagRecord >	m_EntityTrack[MAX_AIS];
+
+	// and for each NPC, by its CAI_Manager index. Each list is allocated on its
+	// own so MoveNpcData only has to swap pointers.
+	CUtlVector< CUtlFixedLinkedList< LagRecord > * >	m_EntityTrack;
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
-	CBitVec<MAX_AIS>		m_RestoreEntity;
+	CVarBitVec				m_RestoreEntity;		// sized to the AI count when lag compensation starts
 	bool					m_bNeedToRestore;
 	
 	LagRecord				m_RestoreData[ MAX_PLAYERS ];	// player data before we moved him back
 	LagRecord				m_ChangeData[ MAX_PLAYERS ];	// player data where we moved him back
-	LagRecord				m_EntityRestoreData[MAX_AIS];
-	LagRecord				m_EntityChangeData[MAX_AIS];
+	CUtlVector< LagRecord >	m_EntityRestoreData;
+	CUtlVector< LagRecord >	m_EntityChangeData;
 
 	CBasePlayer				*m_pCurrentPlayer;	// The player we are doing lag compensation for
 
-	bool					m_bNeedsAIUpdate;
-
 	float					m_flTeleportDistanceSqr;
 };
 
@@ -287,11 +327,6 @@ ILagCompensationManager *lagcompensation = &g_LagCompensationManager;
 //-----------------------------------------------------------------------------
 void CLagCompensationManager::FrameUpdatePostEntityThink()
 {
-	if (m_bNeedsAIUpdate)
-		UpdateAIIndexes(); // only bother if we haven't had one yet 
-	else // setting this true here ensures that the update happens at the start of the next frame 
-		m_bNeedsAIUpdate = true;
-
 	if ( (gpGlobals->maxClients <= 1) || !sv_unlag.GetBool() )
 	{
 		ClearHistory();
@@ -387,7 +422,7 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	for (int i = 0; i < nAIs; i++)
 	{
 		CAI_BaseNPC *pNPC = ppAIs[i];
-		CUtlFixedLinkedList< LagRecord > *track = &m_EntityTrack[i - 1];
+		CUtlFixedLinkedList< LagRecord > *track = GetEntityTrack(i);
 
 		if (!pNPC)
 		{
@@ -461,46 +496,6 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	m_pCurrentPlayer = NULL;
 }
 
-void CLagCompensationManager::UpdateAIIndexes()
-{
-	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
-	int nAIs = g_AI_Manager.NumAIs();
-
-	for (int i = 0; i < nAIs; i++)
-	{
-		CAI_BaseNPC *pNPC = ppAIs[i];
-		if (pNPC && pNPC->GetAIIndex() != i) // index of NPC has changed
-		{// move their data to their new index, probably wanting to delete the old track record
-			int oldIndex = pNPC->GetAIIndex();
-			int newIndex = i;
-
-			//Msg("Lag compensation record adjusting, moving from index %i to %i\n",oldIndex,newIndex);
-
-			CUtlFixedLinkedList< LagRecord > *track = &m_EntityTrack[oldIndex];
-			CUtlFixedLinkedList< LagRecord > *oldTrack = &m_EntityTrack[newIndex];
-
-			m_EntityTrack[oldIndex] = *oldTrack;
-			m_EntityTrack[newIndex] = *track;
-			if (oldTrack->Count() > 0) // there's data in the auld yin, probably from someone newly dead,
-			{// but if not we'll swap them round so that the old one can then fix their AI index
-				//Msg("Index %i already contains data!\n",newIndex);
-				for (int j = 0; j<nAIs; j++)
-				{
-					CAI_BaseNPC *pConflictingNPC = ppAIs[j];
-					if (pConflictingNPC && pConflictingNPC->GetAIIndex() == newIndex)
-					{// found the conflicting NPC, swap them into the old index
-						pConflictingNPC->SetAIIndex(oldIndex); // presumably they'll fix themselves further down the loop
-						Warning("Lag compensation adjusting entity index, swapping with an existing entity! (%i & %i)\n", oldIndex, newIndex);
-						break;
-					}
-				}
-			}
-
-			pNPC->SetAIIndex(newIndex);
-		}
-	}
-}
-
 // Called during player movement to set up/restore after lag compensation
 void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd )
 {
@@ -513,17 +508,10 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		return;
 	}
 
-	// sort out any changes to the AI indexing 
-	if (m_bNeedsAIUpdate) // to be called once per frame... must happen BEFORE lag compensation - 
-	{// if that happens, that is. if not its called at the end of the frame 
-		m_bNeedsAIUpdate = false;
-		UpdateAIIndexes();
-	}
-
 	// Assume no players or entities need to be restored 
 
 	m_RestorePlayer.ClearAll();
-	m_RestoreEntity.ClearAll();
+	m_RestoreEntity.Resize( g_AI_Manager.NumAIs(), true );
 	m_bNeedToRestore = false;
 
 	m_pCurrentPlayer = player;
@@ -540,8 +528,10 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 	VPROF_BUDGET( "StartLagCompensation", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 	Q_memset( m_RestoreData, 0, sizeof( m_RestoreData ) );
 	Q_memset( m_ChangeData, 0, sizeof( m_ChangeData ) );
-	Q_memset(m_EntityRestoreData, 0, sizeof(m_EntityRestoreData));
-	Q_memset(m_EntityChangeData, 0, sizeof(m_EntityChangeData));
+	m_EntityRestoreData.SetCount(m_RestoreEntity.GetNumBits());
+	m_EntityChangeData.SetCount(m_RestoreEntity.GetNumBits());
+	Q_memset(m_EntityRestoreData.Base(), 0, m_EntityRestoreData.Count() * sizeof(LagRecord));
+	Q_memset(m_EntityChangeData.Base(), 0, m_EntityChangeData.Count() * sizeof(LagRecord));
 
 	// Get true latency
 
@@ -749,29 +739,22 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 				CAI_BaseNPC *pHitEntity = dynamic_cast<CAI_BaseNPC *>(tr.m_pEnt);
 				if (pHitEntity)
 				{
-					CAI_BaseNPC *pNPC = NULL;
-					CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
-					int nAIs = g_AI_Manager.NumAIs();
-					for (int i = 0; i < nAIs; i++) // we'll have to find this entity's index though :(
-					{
-						pNPC = ppAIs[i];
-						if (pNPC == pHitEntity)
-							break;
-					}
+					int iHitIndex = pHitEntity->GetAIIndex();
+
 					// If we haven't backtracked this player, do it now
 					// this deliberately ignores WantsLagCompensationOnEntity.
-					if (pNPC && !m_RestoreEntity.Get(pNPC->GetAIIndex()))
+					if (iHitIndex >= 0 && iHitIndex < m_RestoreEntity.GetNumBits() && !m_RestoreEntity.Get(iHitIndex))
 					{
 						// prevent recursion - save a copy of m_RestoreEntity,
 						// pretend that this player is off-limits
 
 						// Temp turn this flag on
-						m_RestoreEntity.Set(pNPC->GetAIIndex());
+						m_RestoreEntity.Set(iHitIndex);
 
 						BacktrackEntity(pHitEntity, flTargetTime);
 
 						// Remove the temp flag
-						m_RestoreEntity.Clear(pNPC->GetAIIndex());
+						m_RestoreEntity.Clear(iHitIndex);
 					}
 				}
 			}
@@ -966,7 +949,12 @@ void CLagCompensationManager::BacktrackEntity(CAI_BaseNPC *pEntity, float flTarg
 
 	// get track history of this entity
 	int index = pEntity->GetAIIndex();
-	CUtlFixedLinkedList< LagRecord > *track = &m_EntityTrack[index];
+
+	// NPCs created since lag compensation started have nothing to restore into
+	if (index < 0 || index >= m_RestoreEntity.GetNumBits() || !m_EntityTrack.IsValidIndex(index))
+		return;
+
+	CUtlFixedLinkedList< LagRecord > *track = m_EntityTrack[index];
 
 	// check if we have at leat one entry
 	if (track->Count() <= 0)
@@ -1093,29 +1081,22 @@ void CLagCompensationManager::BacktrackEntity(CAI_BaseNPC *pEntity, float flTarg
 				CAI_BaseNPC *pHitEntity = dynamic_cast<CAI_BaseNPC *>(tr.m_pEnt);
 				if (pHitEntity)
 				{
-					CAI_BaseNPC *pNPC = NULL;
-					CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
-					int nAIs = g_AI_Manager.NumAIs();
-					for (int i = 0; i < nAIs; i++) // we'll have to find this entity's index though :(
-					{
-						pNPC = ppAIs[i];
-						if (pNPC == pHitEntity)
-							break;
-					}
+					int iHitIndex = pHitEntity->GetAIIndex();
+
 					// If we haven't backtracked this player, do it now
 					// this deliberately ignores WantsLagCompensationOnEntity.
-					if (pNPC && !m_RestoreEntity.Get(pNPC->GetAIIndex()))
+					if (iHitIndex >= 0 && iHitIndex < m_RestoreEntity.GetNumBits() && !m_RestoreEntity.Get(iHitIndex))
 					{
 						// prevent recursion - save a copy of m_RestoreEntity,
 						// pretend that this player is off-limits
 
 						// Temp turn this flag on
-						m_RestoreEntity.Set(pNPC->GetAIIndex());
+						m_RestoreEntity.Set(iHitIndex);
 
 						BacktrackEntity(pHitEntity, flTargetTime);
 
 						// Remove the temp flag
-						m_RestoreEntity.Clear(pNPC->GetAIIndex());
+						m_RestoreEntity.Clear(iHitIndex);
 					}
 				}
 			}
@@ -1403,7 +1384,7 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 
 	// also iterate all monsters
 	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
-	int nAIs = g_AI_Manager.NumAIs();
+	int nAIs = MIN(g_AI_Manager.NumAIs(), m_RestoreEntity.GetNumBits());
 
 	for (int i = 0; i < nAIs; i++)
 	{
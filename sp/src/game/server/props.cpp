@@ -3007,6 +3007,7 @@ void CPhysicsProp::Spawn( )
 	{
 #ifdef MAPBASE
 		m_iClassname = gm_isz_class_PropPhysics;
+		gEntList.ReportEntityNameChanged( this );
 #else
 		SetClassname( "prop_physics" );
 #endif
@@ -3022,6 +3023,7 @@ void CPhysicsProp::Spawn( )
 	if ( EntIsClass( this, gm_isz_class_PropPhysicsOverride ) )
 	{
 		m_iClassname = gm_isz_class_PropPhysics;
+		gEntList.ReportEntityNameChanged( this );
 	}
 #else
 	if ( FClassnameIs( this, "prop_physics_override") )
@@ -40,6 +40,9 @@
 #include "fmtstr.h"
 #endif
 
+#ifdef FR_DLL
+#include "firefightreloaded/monstermaker_firefight.h"
+#endif
 #ifdef PORTAL
 #include "PortalSimulation.h"
 //#include "Portal_PhysicsEnvironmentMgr.h"
@@ -514,11 +517,24 @@ void UTIL_Remove( IServerNetworkable *oldObj )
 		return;
 	}
 
+	CBaseEntity *pBaseEnt = oldObj->GetBaseEntity();
+	bool bRemoved = false;
+
+#ifdef FR_DLL
+	// Firefight spawners may keep their dead NPCs to spawn again. A kept NPC
+	// has already been removed from everything, it just wasn't deleted.
+	if ( pBaseEnt )
+	{
+		bRemoved = CNPCMakerFirefight::ReleaseDeadNPC( pBaseEnt );
+		if ( !bRemoved && CNPCMakerFirefight::PoolDeadNPC( pBaseEnt ) )
+			return;
+	}
+#endif
+
 	// mark it for deletion	
 	pProp->MarkForDeletion( );
 
-	CBaseEntity *pBaseEnt = oldObj->GetBaseEntity();
-	if ( pBaseEnt )
+	if ( pBaseEnt && !bRemoved )
 	{
 #ifdef PORTAL //make sure entities are in the primary physics environment for the portal mod, this code should be safe even if the entity is in neither extra environment
 		CPortalSimulator::Pre_UTIL_Remove( pBaseEnt );
@@ -579,9 +595,14 @@ void UTIL_RemoveImmediate( CBaseEntity *oldObj )
 
 	oldObj->AddEFlags( EFL_KILLME );	// Make sure to ignore further calls into here or UTIL_Remove.
 
-	g_bReceivedChainedUpdateOnRemove = false;
-	oldObj->UpdateOnRemove();
-	Assert( g_bReceivedChainedUpdateOnRemove );
+#ifdef FR_DLL
+	if ( !CNPCMakerFirefight::ReleaseDeadNPC( oldObj ) )
+#endif
+	{
+		g_bReceivedChainedUpdateOnRemove = false;
+		oldObj->UpdateOnRemove();
+		Assert( g_bReceivedChainedUpdateOnRemove );
+	}
 
 	// Entities shouldn't reference other entities in their destructors
 	//  that type of code should only occur in an UpdateOnRemove call
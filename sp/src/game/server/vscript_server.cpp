@@ -952,6 +952,8 @@ bool VScriptServerInit()
 			{
 #ifdef MAPBASE_VSCRIPT
 				CGMsg( 0, CON_GROUP_VSCRIPT, "VSCRIPT SERVER: Started VScript virtual machine using script language '%s'\n", g_pScriptVM->GetLanguageName() );
+
+				VScriptSetupCompileCache();
 #else
 				Log( "VSCRIPT: Started VScript virtual machine using script language '%s'\n", g_pScriptVM->GetLanguageName() );
 #endif
@@ -458,6 +458,7 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 	if ( FStrEq( szKeyName, "targetname" ) )
 	{
 		m_iName = AllocPooledString( szValue );
+		gEntList.ReportEntityNameChanged( this );
 		return true;
 	}
 
@@ -467,7 +468,11 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 		for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
 		{
 			if ( ::ParseKeyvalue(this, dmap->dataDesc, dmap->dataNumFields, szKeyName, szValue) )
+			{
+				// the classname can be set through its keyfield
+				gEntList.ReportEntityNameChanged( this );
 				return true;
+			}
 		}
 	}
 	else
@@ -497,7 +502,8 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 			{
 				if ( printKeyHits )
 					Msg( "(%s) key: %-16s value: %s\n", debugName, szKeyName, szValue );
-				
+
+				gEntList.ReportEntityNameChanged( this );
 				return true;
 			}
 		}
@@ -1356,6 +1356,11 @@ void CCollisionProperty::UpdateServerPartitionMask( )
 //-----------------------------------------------------------------------------
 void CCollisionProperty::MarkPartitionHandleDirty()
 {
+#ifndef CLIENT_DLL
+	// the entity list's spatial grid needs every change, even to the world
+	gEntList.ReportEntityPositionChanged( m_pOuter );
+#endif
+
 	// don't bother with the world
 	if ( m_pOuter->entindex() == 0 )
 		return;
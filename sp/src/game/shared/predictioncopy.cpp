@@ -21,6 +21,7 @@
 #include "predictioncopy.h"
 #include "engine/ivmodelinfo.h"
 #include "tier1/fmtstr.h"
+#include "tier1/utlmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1373,6 +1374,247 @@ void CPredictionCopy::DetermineWatchField( const char *operation, int entindex,
 	m_pWatchField = FindFieldByName( pwatchvar.GetString(), dmap );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: A plain copy walks the data description of the entity field by
+//			field. A plan is the list of byte ranges that walk ends up
+//			copying for one class, copy type and pair of offset layouts, with
+//			ranges that are next to each other in both source and destination
+//			merged into one memcpy. Strings are still copied up to their
+//			terminator. Classes with a field the walk would assert or warn on
+//			get no plan and keep walking.
+//-----------------------------------------------------------------------------
+static ConVar pred_copy_plans( "cl_pred_copy_plans", "1", 0, "Copy predicted entities with compiled plans of their prediction descriptions" );
+
+// Size of an op that copies a null-terminated string
+#define PREDCOPY_STRING		-1
+
+struct PredictionCopyOp_t
+{
+	int		destOffset;
+	int		srcOffset;
+	int		size;
+};
+
+class CPredictionCopyPlan
+{
+public:
+	enum
+	{
+		PLAN_NOT_BUILT = 0,
+		PLAN_COMPILED,
+		PLAN_WALK,		// has fields only the walk handles
+	};
+
+	CPredictionCopyPlan() : m_nState( PLAN_NOT_BUILT ) {}
+
+	void	Build( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex );
+	void	Execute( void *pDest, void const *pSrc ) const;
+
+	int		m_nState;
+	CUtlVector<PredictionCopyOp_t> m_Ops;
+
+private:
+	bool	Compile_R( int chain_count, typedescription_t *pFields, int fieldCount, int destBase, int srcBase );
+
+	int		m_nType;
+	int		m_nDestOffsetIndex;
+	int		m_nSrcOffsetIndex;
+};
+
+//-------------------------------------
+
+// Follows CPredictionCopy::CopyFields, including which fields the override
+// chains skip, but records the ranges instead of copying them
+bool CPredictionCopyPlan::Compile_R( int chain_count, typedescription_t *pFields, int fieldCount, int destBase, int srcBase )
+{
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			pField->override_field->override_count = chain_count;
+		}
+
+		if ( pField->override_count == chain_count )
+			continue;
+
+		if ( pField->fieldType != FIELD_EMBEDDED )
+		{
+			if ( flags & FTYPEDESC_PRIVATE )
+				continue;
+
+			if ( m_nType == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+
+			if ( m_nType == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+		}
+
+		int destOffset = destBase + pField->fieldOffset[ m_nDestOffsetIndex ];
+		int srcOffset = srcBase + pField->fieldOffset[ m_nSrcOffsetIndex ];
+		int fieldSize = pField->fieldSize;
+		int size;
+
+		switch ( pField->fieldType )
+		{
+		case FIELD_EMBEDDED:
+			// The walk follows pointers in the unpacked layout, which a list
+			// of fixed offsets can't
+			if ( ( flags & FTYPEDESC_PTR ) && ( m_nSrcOffsetIndex == PC_DATA_NORMAL || m_nDestOffsetIndex == PC_DATA_NORMAL ) )
+				return false;
+
+			if ( !Compile_R( chain_count, pField->td->dataDesc, pField->td->dataNumFields, destOffset, srcOffset ) )
+				return false;
+			continue;
+
+		case FIELD_FLOAT:		size = sizeof( float ) * fieldSize;		break;
+		case FIELD_VECTOR:		size = sizeof( Vector ) * fieldSize;	break;
+		case FIELD_QUATERNION:	size = sizeof( Quaternion ) * fieldSize; break;
+		case FIELD_COLOR32:		size = 4 * fieldSize;					break;
+		case FIELD_BOOLEAN:		size = sizeof( bool ) * fieldSize;		break;
+		case FIELD_INTEGER:		size = sizeof( int ) * fieldSize;		break;
+		case FIELD_SHORT:		size = sizeof( short ) * fieldSize;		break;
+		case FIELD_CHARACTER:	size = fieldSize;						break;
+		case FIELD_EHANDLE:		size = sizeof( EHANDLE ) * fieldSize;	break;
+		case FIELD_STRING:		size = PREDCOPY_STRING;					break;
+
+		case FIELD_VOID:
+			continue;
+
+		default:
+			return false;
+		}
+
+		if ( !size )
+			continue;
+
+		PredictionCopyOp_t op;
+		op.destOffset = destOffset;
+		op.srcOffset = srcOffset;
+		op.size = size;
+		m_Ops.AddToTail( op );
+	}
+
+	return true;
+}
+
+//-------------------------------------
+
+static int PredictionCopyOpLessFunc( const PredictionCopyOp_t *pLeft, const PredictionCopyOp_t *pRight )
+{
+	// Strings go last, after every fixed range
+	bool bLeftString = ( pLeft->size == PREDCOPY_STRING );
+	bool bRightString = ( pRight->size == PREDCOPY_STRING );
+	if ( bLeftString != bRightString )
+		return bLeftString ? 1 : -1;
+
+	return pLeft->destOffset - pRight->destOffset;
+}
+
+//-------------------------------------
+
+void CPredictionCopyPlan::Build( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	m_nType = type;
+	m_nDestOffsetIndex = destOffsetIndex;
+	m_nSrcOffsetIndex = srcOffsetIndex;
+	m_Ops.RemoveAll();
+
+	// A chain count of its own, so the override marks match a fresh walk
+	int chain_count = ++g_nChainCount;
+
+	// Leaf class first, then base classes, same as TransferData_R
+	for ( datamap_t *pMap = dmap; pMap; pMap = pMap->baseMap )
+	{
+		if ( !Compile_R( chain_count, pMap->dataDesc, pMap->dataNumFields, 0, 0 ) )
+		{
+			m_Ops.Purge();
+			m_nState = PLAN_WALK;
+			return;
+		}
+	}
+
+	m_Ops.Sort( PredictionCopyOpLessFunc );
+
+	int nRuns = 0;
+	for ( int i = 0; i < m_Ops.Count(); i++ )
+	{
+		const PredictionCopyOp_t &op = m_Ops[ i ];
+		if ( nRuns && op.size != PREDCOPY_STRING )
+		{
+			PredictionCopyOp_t &run = m_Ops[ nRuns - 1 ];
+			if ( run.size != PREDCOPY_STRING &&
+				run.destOffset + run.size == op.destOffset &&
+				run.srcOffset + run.size == op.srcOffset )
+			{
+				run.size += op.size;
+				continue;
+			}
+		}
+
+		m_Ops[ nRuns++ ] = op;
+	}
+
+	m_Ops.SetCountNonDestructively( nRuns );
+	m_nState = PLAN_COMPILED;
+}
+
+//-------------------------------------
+
+void CPredictionCopyPlan::Execute( void *pDest, void const *pSrc ) const
+{
+	char *pOut = (char *)pDest;
+	const char *pIn = (const char *)pSrc;
+
+	for ( int i = 0; i < m_Ops.Count(); i++ )
+	{
+		const PredictionCopyOp_t &op = m_Ops[ i ];
+		const char *pInData = pIn + op.srcOffset;
+		int size = ( op.size == PREDCOPY_STRING ) ? Q_strlen( pInData ) + 1 : op.size;
+		memcpy( pOut + op.destOffset, pInData, size );
+	}
+}
+
+//-------------------------------------
+
+struct PredictionCopyPlans_t
+{
+	// [ copy type ][ dest offset index ][ src offset index ]
+	CPredictionCopyPlan plans[ 3 ][ TD_OFFSET_COUNT ][ TD_OFFSET_COUNT ];
+};
+
+static CUtlMap<datamap_t *, PredictionCopyPlans_t *> g_PredictionCopyPlans( DefLessFunc( datamap_t * ) );
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the plan for copying dmap, or NULL if it has to be walked
+//-----------------------------------------------------------------------------
+static const CPredictionCopyPlan *GetPredictionCopyPlan( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	if ( type < PC_EVERYTHING || type > PC_NETWORKED_ONLY )
+		return NULL;
+
+	// Packed offsets are filled in the first time an entity of the class
+	// allocates its prediction frames
+	if ( ( destOffsetIndex == TD_OFFSET_PACKED || srcOffsetIndex == TD_OFFSET_PACKED ) && !dmap->packed_offsets_computed )
+		return NULL;
+
+	unsigned short i = g_PredictionCopyPlans.Find( dmap );
+	if ( i == g_PredictionCopyPlans.InvalidIndex() )
+	{
+		i = g_PredictionCopyPlans.Insert( dmap, new PredictionCopyPlans_t );
+	}
+
+	CPredictionCopyPlan *pPlan = &g_PredictionCopyPlans[ i ]->plans[ type ][ destOffsetIndex ][ srcOffsetIndex ];
+	if ( pPlan->m_nState == CPredictionCopyPlan::PLAN_NOT_BUILT )
+	{
+		pPlan->Build( dmap, type, destOffsetIndex, srcOffsetIndex );
+	}
+
+	return ( pPlan->m_nState == CPredictionCopyPlan::PLAN_COMPILED ) ? pPlan : NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *operation - 
@@ -1391,6 +1633,17 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
+	// Plans only copy, so anything that compares, reports or watches walks
+	if ( pred_copy_plans.GetBool() && m_bPerformCopy && !m_bErrorCheck && !m_bReportErrors && !m_bDescribeFields && !m_pWatchField )
+	{
+		const CPredictionCopyPlan *pPlan = GetPredictionCopyPlan( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+		if ( pPlan )
+		{
+			pPlan->Execute( m_pDest, m_pSrc );
+			return m_nErrorCount;
+		}
+	}
+
 	TransferData_R( g_nChainCount, dmap );
 
 	return m_nErrorCount;
@@ -2020,6 +2273,107 @@ CON_COMMAND_F( cl_pred_track, "<entindex> <fieldname>:  Track changes to entity
 	g_pChangeTracker->SetupTracking( ent, args[2] );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Copies each predicted entity into a packed frame and back, the way
+//			SaveData and RestoreData do for every command that is predicted
+//-----------------------------------------------------------------------------
+static double PredictionCopyBenchmark( CUtlVector<C_BaseEntity *> &entities, CUtlVector<char *> &frames, int nCommands )
+{
+	double flStart = Plat_FloatTime();
+
+	for ( int iCommand = 0; iCommand < nCommands; iCommand++ )
+	{
+		for ( int i = 0; i < entities.Count(); i++ )
+		{
+			C_BaseEntity *pEntity = entities[i];
+
+			CPredictionCopy save( PC_EVERYTHING, frames[i], PC_DATA_PACKED, pEntity, PC_DATA_NORMAL );
+			save.TransferData( "", pEntity->entindex(), pEntity->GetPredDescMap() );
+
+			CPredictionCopy restore( PC_EVERYTHING, pEntity, PC_DATA_NORMAL, frames[i], PC_DATA_PACKED );
+			restore.TransferData( "", pEntity->entindex(), pEntity->GetPredDescMap() );
+		}
+	}
+
+	return Plat_FloatTime() - flStart;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times copying the predicted entities by walking their fields and
+//			with compiled plans, and checks both write the same packed frames
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( cl_pred_copy_benchmark, "Times predicted entity copies with and without compiled plans. Usage: cl_pred_copy_benchmark [commands]", FCVAR_CHEAT )
+{
+	int nCommands = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 1000;
+	nCommands = clamp( nCommands, 1, 100000 );
+
+	CUtlVector<C_BaseEntity *> entities;
+	CUtlVector<int> frameSizes;
+	CUtlVector<char *> frames[2];
+
+	for ( C_BaseEntity *pEntity = ClientEntityList().FirstBaseEntity(); pEntity; pEntity = ClientEntityList().NextBaseEntity( pEntity ) )
+	{
+		// Entities that are predicted have already laid out their packed frames
+		datamap_t *pMap = pEntity->GetPredDescMap();
+		if ( !pEntity->GetPredictable() || !pMap || !pMap->packed_offsets_computed )
+			continue;
+
+		int nFrameSize = MAX( pMap->packed_size, 4 );
+		entities.AddToTail( pEntity );
+		frameSizes.AddToTail( nFrameSize );
+
+		for ( int iMode = 0; iMode < 2; iMode++ )
+		{
+			char *pFrame = new char[ nFrameSize ];
+			memset( pFrame, 0, nFrameSize );
+			frames[iMode].AddToTail( pFrame );
+		}
+	}
+
+	if ( !entities.Count() )
+	{
+		Msg( "cl_pred_copy_benchmark:  No predicted entities\n" );
+		return;
+	}
+
+	bool bUsePlans = pred_copy_plans.GetBool();
+
+	double flTime[2];
+	for ( int iMode = 0; iMode < 2; iMode++ )
+	{
+		pred_copy_plans.SetValue( iMode );
+		flTime[iMode] = PredictionCopyBenchmark( entities, frames[iMode], nCommands );
+	}
+
+	pred_copy_plans.SetValue( bUsePlans );
+
+	int nDiffer = 0;
+	for ( int i = 0; i < entities.Count(); i++ )
+	{
+		if ( memcmp( frames[0][i], frames[1][i], frameSizes[i] ) )
+		{
+			nDiffer++;
+		}
+
+		delete [] frames[0][i];
+		delete [] frames[1][i];
+	}
+
+	double flScale = 1000000.0 / nCommands;
+	Msg( "cl_pred_copy_benchmark:  %d predicted entities, %d commands, a save and a restore of each per command\n", entities.Count(), nCommands );
+	Msg( "  fields:  %.3f usec per command\n", flTime[0] * flScale );
+	Msg( "  plans:   %.3f usec per command (%.2fx)\n", flTime[1] * flScale, ( flTime[1] > 0 ) ? flTime[0] / flTime[1] : 0.0 );
+
+	if ( nDiffer )
+	{
+		Warning( "  %d packed frames differ between fields and plans\n", nDiffer );
+	}
+	else
+	{
+		Msg( "  packed frames match\n" );
+	}
+}
+
 #endif
 
 #if defined( CLIENT_DLL ) && defined( COPY_CHECK_STRESSTEST )
@@ -24,6 +24,7 @@
 #include "vphysics/object_hash.h"
 #include "datacache/imdlcache.h"
 #include "tier0/vprof.h"
+#include "vstdlib/random.h"
 
 #if !defined( CLIENT_DLL )
 
@@ -182,6 +183,247 @@ inputfunc_t *UTIL_FunctionFromName( datamap_t *pMap, const char *pName )
 	return NULL;
 }
 
+//-----------------------------------------------------------------------------
+//
+// CSaveRestorePlan
+//
+// Purpose:	WriteFields() and ReadFields() work out what to do with every
+//			field of every object they touch: the type switch, the empty
+//			test, and a hash of the field name into the symbol table. A plan
+//			does the per field work once for a table of fields. Plain fields,
+//			whose saved bytes are just their memory, are written as a header
+//			and a memcpy and read back with a memcpy. A run of them that sits
+//			back to back in memory is tested for being empty, or cleared
+//			before a restore, as one block. Field symbols are looked up once
+//			per save or restore, see CSave::m_PlanSymbols.
+//
+//			The records written are the same as the field by field path
+//			writes, so saves load the same with or without plans.
+//-----------------------------------------------------------------------------
+
+#if !defined( CLIENT_DLL )
+static ConVar saverestore_plans( "sv_saverestore_plans", "1", 0, "Save and restore objects with compiled plans of their data descriptions" );
+#else
+static ConVar saverestore_plans( "cl_saverestore_plans", "1", 0, "Save and restore objects with compiled plans of their data descriptions" );
+#endif
+
+struct SaveRestorePlanField_t
+{
+	// Copy of the description the plan was built from
+	const char *		fieldName;
+	int					fieldType;
+	int					fieldOffset;
+	int					fieldSize;
+	int					flags;
+	int					fieldSizeInBytes;
+	ISaveRestoreOps *	pSaveRestoreOps;
+	datamap_t *			td;
+
+	int					nCopyBytes;		// bytes saved as they are in memory, 0 if the field isn't plain
+	int					iCopyRunEnd;	// one past the last plain field back to back with this one
+	int					nCopyRunBytes;
+
+	int					nZeroBytes;		// bytes cleared before a restore, 0 if it's emptied some other way
+	int					iZeroRunEnd;
+	int					nZeroRunBytes;
+};
+
+//-------------------------------------
+
+class CSaveRestorePlan
+{
+public:
+	CSaveRestorePlan( typedescription_t *pFields, int fieldCount );
+
+	bool			Matches( typedescription_t *pFields, int fieldCount ) const;
+
+	int				Count() const								{ return m_Fields.Count(); }
+	const SaveRestorePlanField_t &operator[]( int i ) const		{ return m_Fields[i]; }
+
+	int				FirstSymbolSlot() const						{ return m_iFirstSymbolSlot; }
+	static int		NumSymbolSlots()							{ return gm_nSymbolSlots; }
+
+	bool			IsVolatile() const							{ return m_bVolatile; }
+	void			SetVolatile()								{ m_bVolatile = true; }
+
+private:
+	CUtlVector<SaveRestorePlanField_t> m_Fields;
+	int				m_iFirstSymbolSlot;
+	bool			m_bVolatile;
+
+	static int		gm_nSymbolSlots;
+};
+
+int CSaveRestorePlan::gm_nSymbolSlots;
+
+//-------------------------------------
+
+CSaveRestorePlan::CSaveRestorePlan( typedescription_t *pFields, int fieldCount )
+ :	m_iFirstSymbolSlot( gm_nSymbolSlots ),
+	m_bVolatile( false )
+{
+	gm_nSymbolSlots += fieldCount;
+
+	m_Fields.SetCount( fieldCount );
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[i];
+		SaveRestorePlanField_t &field = m_Fields[i];
+
+		field.fieldName = pField->fieldName;
+		field.fieldType = pField->fieldType;
+		field.fieldOffset = pField->fieldOffset[ TD_OFFSET_NORMAL ];
+		field.fieldSize = pField->fieldSize;
+		field.flags = pField->flags;
+		field.fieldSizeInBytes = pField->fieldSizeInBytes;
+		field.pSaveRestoreOps = pField->pSaveRestoreOps;
+		field.td = pField->td;
+
+		field.nCopyBytes = 0;
+		field.nZeroBytes = 0;
+
+		// Fields with the wrong FIELD_ type stay on the field by field path, which warns about them
+		int nBytes = pField->fieldSize * gSizes[pField->fieldType];
+		if ( !( pField->flags & FTYPEDESC_SAVE ) || nBytes <= 0 || nBytes != pField->fieldSizeInBytes )
+			continue;
+
+		switch ( pField->fieldType )
+		{
+		case FIELD_FLOAT:
+		case FIELD_VECTOR:
+		case FIELD_QUATERNION:
+		case FIELD_INTEGER:
+		case FIELD_BOOLEAN:
+		case FIELD_SHORT:
+		case FIELD_CHARACTER:
+		case FIELD_COLOR32:
+			if ( nBytes <= SHRT_MAX )
+			{
+				field.nCopyBytes = nBytes;
+			}
+			break;
+		}
+
+		switch ( pField->fieldType )
+		{
+		case FIELD_VOID:
+		case FIELD_EMBEDDED:
+		case FIELD_CUSTOM:
+		case FIELD_EHANDLE:
+			break;
+
+		default:
+			// Global fields are only emptied when the restore isn't global
+			if ( !( pField->flags & FTYPEDESC_GLOBAL ) )
+			{
+				field.nZeroBytes = nBytes;
+			}
+			break;
+		}
+	}
+
+	// Join fields into runs from the back, so each field knows the run from it onward
+	for ( int i = fieldCount - 1; i >= 0; i-- )
+	{
+		SaveRestorePlanField_t &field = m_Fields[i];
+		SaveRestorePlanField_t *pNext = ( i + 1 < fieldCount ) ? &m_Fields[i + 1] : NULL;
+
+		field.iCopyRunEnd = i + 1;
+		field.nCopyRunBytes = field.nCopyBytes;
+		if ( field.nCopyBytes && pNext && pNext->nCopyBytes && pNext->fieldOffset == field.fieldOffset + field.nCopyBytes )
+		{
+			field.iCopyRunEnd = pNext->iCopyRunEnd;
+			field.nCopyRunBytes += pNext->nCopyRunBytes;
+		}
+
+		field.iZeroRunEnd = i + 1;
+		field.nZeroRunBytes = field.nZeroBytes;
+		if ( field.nZeroBytes && pNext && pNext->nZeroBytes && pNext->fieldOffset == field.fieldOffset + field.nZeroBytes )
+		{
+			field.iZeroRunEnd = pNext->iZeroRunEnd;
+			field.nZeroRunBytes += pNext->nZeroRunBytes;
+		}
+	}
+}
+
+//-------------------------------------
+
+bool CSaveRestorePlan::Matches( typedescription_t *pFields, int fieldCount ) const
+{
+	if ( fieldCount != m_Fields.Count() )
+		return false;
+
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		const typedescription_t *pField = &pFields[i];
+		const SaveRestorePlanField_t &field = m_Fields[i];
+
+		if ( pField->fieldName != field.fieldName ||
+			 pField->fieldType != field.fieldType ||
+			 pField->fieldOffset[ TD_OFFSET_NORMAL ] != field.fieldOffset ||
+			 pField->fieldSize != field.fieldSize ||
+			 pField->flags != field.flags ||
+			 pField->fieldSizeInBytes != field.fieldSizeInBytes ||
+			 pField->pSaveRestoreOps != field.pSaveRestoreOps ||
+			 pField->td != field.td )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//-------------------------------------
+// Purpose: Finds or builds the plan for a table of fields. Plans are keyed by
+//			the address of the table. The UtlVector and UtlMap save ops build
+//			their tables on the stack, so a table that doesn't match the plan
+//			at its address marks the address volatile, and everything there
+//			goes down the field by field path from then on.
+
+static CUtlMap<typedescription_t *, CSaveRestorePlan *> g_SaveRestorePlans( DefLessFunc( typedescription_t * ) );
+
+static CSaveRestorePlan *GetSaveRestorePlan( typedescription_t *pFields, int fieldCount )
+{
+	if ( !saverestore_plans.GetBool() || !pFields || fieldCount <= 0 )
+		return NULL;
+
+	unsigned short i = g_SaveRestorePlans.Find( pFields );
+	if ( i != g_SaveRestorePlans.InvalidIndex() )
+	{
+		CSaveRestorePlan *pPlan = g_SaveRestorePlans[i];
+		if ( pPlan->IsVolatile() )
+			return NULL;
+
+		if ( !pPlan->Matches( pFields, fieldCount ) )
+		{
+			pPlan->SetVolatile();
+			return NULL;
+		}
+
+		return pPlan;
+	}
+
+	CSaveRestorePlan *pPlan = new CSaveRestorePlan( pFields, fieldCount );
+	g_SaveRestorePlans.Insert( pFields, pPlan );
+	return pPlan;
+}
+
+//-------------------------------------
+// Purpose: The symbols a save or restore has seen for the fields of a plan
+
+static short *AccessPlanSymbols( CUtlVector<short> &symbols, const CSaveRestorePlan *pPlan )
+{
+	int nSlots = CSaveRestorePlan::NumSymbolSlots();
+	if ( symbols.Count() < nSlots )
+	{
+		int iFirstNew = symbols.AddMultipleToTail( nSlots - symbols.Count() );
+		memset( symbols.Base() + iFirstNew, 0xff, ( nSlots - iFirstNew ) * sizeof(short) );
+	}
+
+	return symbols.Base() + pPlan->FirstSymbolSlot();
+}
+
 //-----------------------------------------------------------------------------
 //
 // CSave
@@ -359,6 +601,11 @@ void CSave::Log( const char *pName, fieldtype_t fieldType, void *value, int coun
 }
 
 //-------------------------------------
+// Purpose: Whether the engine will compress and write this save on its own
+//			thread. The game still has to have written everything into the
+//			save data by the time its Save() returns, since the engine takes
+//			the buffer straight after, so only work the game writes somewhere
+//			else (like the achievement global state) can be handed off.
 
 bool CSave::IsAsync()
 {
@@ -812,6 +1059,38 @@ bool CSave::WriteField( const char *pname, void *pData, datamap_t *pRootMap, typ
 	return WriteGameField( pname, pData, pRootMap, pField );
 }
 
+//-------------------------------------
+// Purpose: Writes a plain field of a plan, the same record WriteField() writes
+
+void CSave::WritePlanField( const CSaveRestorePlan *pPlan, int iField, const char *pData )
+{
+	if ( !m_pData )
+		return;
+
+	const SaveRestorePlanField_t &field = (*pPlan)[iField];
+	short &symbol = AccessPlanSymbols( m_PlanSymbols, pPlan )[iField];
+	if ( symbol == -1 )
+	{
+		symbol = m_pData->FindCreateSymbol( field.fieldName );
+	}
+
+	if ( m_pData->BytesAvailable() < (int)sizeof(SaveRestoreRecordHeader_t) + field.nCopyBytes )
+	{
+		// Let the field by field path report the overflow
+		BufferField( field.fieldName, field.nCopyBytes, pData );
+		return;
+	}
+
+	SaveRestoreRecordHeader_t header;
+	header.size = field.nCopyBytes;
+	header.symbol = symbol;
+
+	char *pDest = m_pData->AccessCurPos();
+	memcpy( pDest, &header, sizeof(header) );
+	memcpy( pDest + sizeof(header), pData, field.nCopyBytes );
+	m_pData->MoveCurPos( sizeof(header) + field.nCopyBytes );
+}
+
 //-------------------------------------
 
 int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields, int fieldCount )
@@ -835,10 +1114,34 @@ int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRo
 	__dcbt( 512, pDest );
 #endif
 
+	const CSaveRestorePlan *pPlan = GetSaveRestorePlan( pFields, fieldCount );
+
 	for ( int i = 0; i < fieldCount; i++ )
 	{
 		pTest = &pFields[ i ];
 		void *pOutputData = ( (char *)pBaseData + pTest->fieldOffset[ TD_OFFSET_NORMAL ] );
+
+		if ( pPlan && (*pPlan)[i].nCopyBytes )
+		{
+			const SaveRestorePlanField_t &field = (*pPlan)[i];
+
+			// Nothing in the run from here on is saved if it's all empty
+			if ( field.iCopyRunEnd > i + 1 && DataEmpty( (const char *)pOutputData, field.nCopyRunBytes ) )
+			{
+				i = field.iCopyRunEnd - 1;
+				continue;
+			}
+
+			if ( DataEmpty( (const char *)pOutputData, field.nCopyBytes ) )
+				continue;
+
+#ifdef _DEBUG
+			Log( pname, (fieldtype_t)field.fieldType, pOutputData, field.fieldSize );
+#endif
+			WritePlanField( pPlan, i, (const char *)pOutputData );
+			count++;
+			continue;
+		}
 			
 		if ( !ShouldSaveField( pOutputData, pTest ) )
 			continue;
@@ -1522,6 +1825,37 @@ typedescription_t *CRestore::FindField( const char *pszFieldName, typedescriptio
 	return NULL;
 }
 
+//-------------------------------------
+// Purpose: FindField() for the fields of a plan. Fields are matched by the
+//			symbols this restore has already seen for them, and only looked
+//			up by name the first time.
+
+typedescription_t *CRestore::FindPlanField( int symbol, typedescription_t *pFields, const CSaveRestorePlan *pPlan, int *pCookie )
+{
+	int fieldCount = pPlan->Count();
+	int &fieldNumber = *pCookie;
+	short *pSymbols = AccessPlanSymbols( m_PlanSymbols, pPlan );
+
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		int iTest = fieldNumber;
+
+		++fieldNumber;
+		if ( fieldNumber == fieldCount )
+			fieldNumber = 0;
+
+		if ( pSymbols[iTest] == symbol )
+			return &pFields[iTest];
+	}
+
+	typedescription_t *pField = FindField( m_pData->StringFromSymbol( symbol ), pFields, fieldCount, pCookie );
+	if ( pField )
+	{
+		pSymbols[pField - pFields] = symbol;
+	}
+	return pField;
+}
+
 //-------------------------------------
 
 bool CRestore::ShouldEmptyField( typedescription_t *pField )
@@ -1541,6 +1875,13 @@ bool CRestore::ShouldEmptyField( typedescription_t *pField )
 
 void CRestore::EmptyFields( void *pBaseData, typedescription_t *pFields, int fieldCount )
 {
+	const CSaveRestorePlan *pPlan = GetSaveRestorePlan( pFields, fieldCount );
+	if ( pPlan )
+	{
+		EmptyPlanFields( pBaseData, pFields, pPlan );
+		return;
+	}
+
 	int i;
 	for ( i = 0; i < fieldCount; i++ )
 	{
@@ -1548,47 +1889,76 @@ void CRestore::EmptyFields( void *pBaseData, typedescription_t *pFields, int fie
 		if ( !ShouldEmptyField( pField ) )
 			continue;
 
-		void *pFieldData = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
-		switch( pField->fieldType )
+		EmptyField( pBaseData, pField );
+	}
+}
+
+//-------------------------------------
+
+void CRestore::EmptyPlanFields( void *pBaseData, typedescription_t *pFields, const CSaveRestorePlan *pPlan )
+{
+	for ( int i = 0; i < pPlan->Count(); i++ )
+	{
+		const SaveRestorePlanField_t &field = (*pPlan)[i];
+		if ( field.nZeroBytes )
 		{
-		case FIELD_CUSTOM:
-			{
-				SaveRestoreFieldInfo_t fieldInfo =
-				{
-					pFieldData,
-					pBaseData,
-					pField
-				};
-				pField->pSaveRestoreOps->MakeEmpty( fieldInfo );
-			}
-			break;
+			memset( (char *)pBaseData + field.fieldOffset, 0, field.nZeroRunBytes );
+			i = field.iZeroRunEnd - 1;
+			continue;
+		}
 
-		case FIELD_EMBEDDED:
+		typedescription_t *pField = &pFields[i];
+		if ( !ShouldEmptyField( pField ) )
+			continue;
+
+		EmptyField( pBaseData, pField );
+	}
+}
+
+//-------------------------------------
+
+void CRestore::EmptyField( void *pBaseData, typedescription_t *pField )
+{
+	void *pFieldData = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+	switch( pField->fieldType )
+	{
+	case FIELD_CUSTOM:
+		{
+			SaveRestoreFieldInfo_t fieldInfo =
 			{
-				if ( (pField->flags & FTYPEDESC_PTR) && !*((void **)pFieldData) )
-					break;
+				pFieldData,
+				pBaseData,
+				pField
+			};
+			pField->pSaveRestoreOps->MakeEmpty( fieldInfo );
+		}
+		break;
 
-				int nFieldCount = pField->fieldSize;
-				char *pFieldMemory = (char *)( ( !(pField->flags & FTYPEDESC_PTR) ) ? pFieldData : *((void **)pFieldData) );
-				while ( --nFieldCount >= 0 )
-				{
-					EmptyFields( pFieldMemory, pField->td->dataDesc, pField->td->dataNumFields );
-					pFieldMemory += pField->fieldSizeInBytes;
-				}
-			}
-			break;
+	case FIELD_EMBEDDED:
+		{
+			if ( (pField->flags & FTYPEDESC_PTR) && !*((void **)pFieldData) )
+				break;
 
-		default:
-			// NOTE: If you hit this assertion, you've got a bug where you're using 
-			// the wrong field type for your field
-			if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+			int nFieldCount = pField->fieldSize;
+			char *pFieldMemory = (char *)( ( !(pField->flags & FTYPEDESC_PTR) ) ? pFieldData : *((void **)pFieldData) );
+			while ( --nFieldCount >= 0 )
 			{
-				Warning("WARNING! Field %s is using the wrong FIELD_ type!\nFix this or you'll see a crash.\n", pField->fieldName );
-				Assert( 0 );
+				EmptyFields( pFieldMemory, pField->td->dataDesc, pField->td->dataNumFields );
+				pFieldMemory += pField->fieldSizeInBytes;
 			}
-			memset( pFieldData, (pField->fieldType != FIELD_EHANDLE) ? 0 : 0xFF, pField->fieldSize * gSizes[pField->fieldType] );
-			break;
 		}
+		break;
+
+	default:
+		// NOTE: If you hit this assertion, you've got a bug where you're using 
+		// the wrong field type for your field
+		if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+		{
+			Warning("WARNING! Field %s is using the wrong FIELD_ type!\nFix this or you'll see a crash.\n", pField->fieldName );
+			Assert( 0 );
+		}
+		memset( pFieldData, (pField->fieldType != FIELD_EHANDLE) ? 0 : 0xFF, pField->fieldSize * gSizes[pField->fieldType] );
+		break;
 	}
 }
 
@@ -1648,7 +2018,11 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	lastName = symName;
 
 	// Clear out base data
-	EmptyFields( pBaseData, pFields, fieldCount );
+	const CSaveRestorePlan *pPlan = GetSaveRestorePlan( pFields, fieldCount );
+	if ( pPlan )
+		EmptyPlanFields( pBaseData, pFields, pPlan );
+	else
+		EmptyFields( pBaseData, pFields, fieldCount );
 	
 	// Skip over the struct name
 	int i;
@@ -1660,10 +2034,25 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	{
 		ReadHeader( &header );
 
-		typedescription_t *pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, &searchCookie);
+		typedescription_t *pField;
+		if ( pPlan )
+			pField = FindPlanField( header.symbol, pFields, pPlan, &searchCookie );
+		else
+			pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, &searchCookie);
+
 		if ( pField && ShouldReadField( pField ) )
 		{
-			ReadField( header, ((char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ]), pRootMap, pField );
+			char *pDest = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+			int nCopyBytes = ( pPlan ) ? (*pPlan)[pField - pFields].nCopyBytes : 0;
+			if ( nCopyBytes && nCopyBytes == header.size )
+			{
+				// Plain field saved at its current size, the same bytes ReadField() would copy
+				BufferReadBytes( pDest, header.size );
+			}
+			else
+			{
+				ReadField( header, pDest, pRootMap, pField );
+			}
 		}
 		else
 		{
@@ -3440,3 +3829,247 @@ int CreateEntityTransitionList( CSaveRestoreData *pSaveData, int levelMask )
 	return movedCount;
 }
 #endif
+
+#if !defined( CLIENT_DLL )
+
+//-----------------------------------------------------------------------------
+// Purpose: A stand in for an entity, with a mix of the fields entities save
+//-----------------------------------------------------------------------------
+
+class CSaveBenchmarkBase
+{
+public:
+	DECLARE_SIMPLE_DATADESC();
+
+	string_t	m_iClassname;
+	string_t	m_iName;
+	Vector		m_vecOrigin;
+	QAngle		m_angRotation;
+	Vector		m_vecVelocity;
+	int			m_fFlags;
+	int			m_iHealth;
+	int			m_iMaxHealth;
+	char		m_lifeState;
+	char		m_takedamage;
+	bool		m_bDormant;
+	color32		m_clrRender;
+	float		m_flNextThink;
+	EHANDLE		m_hOwnerEntity;
+};
+
+BEGIN_SIMPLE_DATADESC( CSaveBenchmarkBase )
+	DEFINE_FIELD( m_iClassname, FIELD_STRING ),
+	DEFINE_FIELD( m_iName, FIELD_STRING ),
+	DEFINE_FIELD( m_vecOrigin, FIELD_VECTOR ),
+	DEFINE_FIELD( m_angRotation, FIELD_VECTOR ),
+	DEFINE_FIELD( m_vecVelocity, FIELD_VECTOR ),
+	DEFINE_FIELD( m_fFlags, FIELD_INTEGER ),
+	DEFINE_FIELD( m_iHealth, FIELD_INTEGER ),
+	DEFINE_FIELD( m_iMaxHealth, FIELD_INTEGER ),
+	DEFINE_FIELD( m_lifeState, FIELD_CHARACTER ),
+	DEFINE_FIELD( m_takedamage, FIELD_CHARACTER ),
+	DEFINE_FIELD( m_bDormant, FIELD_BOOLEAN ),
+	DEFINE_FIELD( m_clrRender, FIELD_COLOR32 ),
+	DEFINE_FIELD( m_flNextThink, FIELD_TIME ),
+	DEFINE_FIELD( m_hOwnerEntity, FIELD_EHANDLE ),
+END_DATADESC()
+
+//-------------------------------------
+
+class CSaveBenchmarkEntity : public CSaveBenchmarkBase
+{
+public:
+	DECLARE_SIMPLE_DATADESC();
+
+	int			m_nSequence;
+	float		m_flCycle;
+	float		m_flPlaybackRate;
+	float		m_flPoseParameter[8];
+	short		m_nSkin;
+	short		m_nBody;
+	bool		m_bSequenceLoops;
+	char		m_szState[16];
+	float		m_flFieldOfView;
+	Vector		m_vecLastPosition;
+	float		m_flLastDamageTime;
+	EHANDLE		m_hEnemy;
+	string_t	m_iszSquad;
+	int			m_afCapability;
+};
+
+BEGIN_SIMPLE_DATADESC_( CSaveBenchmarkEntity, CSaveBenchmarkBase )
+	DEFINE_FIELD( m_nSequence, FIELD_INTEGER ),
+	DEFINE_FIELD( m_flCycle, FIELD_FLOAT ),
+	DEFINE_FIELD( m_flPlaybackRate, FIELD_FLOAT ),
+	DEFINE_AUTO_ARRAY( m_flPoseParameter, FIELD_FLOAT ),
+	DEFINE_FIELD( m_nSkin, FIELD_SHORT ),
+	DEFINE_FIELD( m_nBody, FIELD_SHORT ),
+	DEFINE_FIELD( m_bSequenceLoops, FIELD_BOOLEAN ),
+	DEFINE_AUTO_ARRAY( m_szState, FIELD_CHARACTER ),
+	DEFINE_FIELD( m_flFieldOfView, FIELD_FLOAT ),
+	DEFINE_FIELD( m_vecLastPosition, FIELD_POSITION_VECTOR ),
+	DEFINE_FIELD( m_flLastDamageTime, FIELD_TIME ),
+	DEFINE_FIELD( m_hEnemy, FIELD_EHANDLE ),
+	DEFINE_FIELD( m_iszSquad, FIELD_STRING ),
+	DEFINE_FIELD( m_afCapability, FIELD_INTEGER ),
+END_DATADESC()
+
+//-------------------------------------
+
+static void SaveBenchmarkResetData( CSaveRestoreData *pSaveData, char **pTokens, int nTokens )
+{
+	memset( pTokens, 0, nTokens * sizeof(char *) );
+	pSaveData->Seek( 0 );
+}
+
+//-------------------------------------
+
+static double SaveBenchmarkWrite( CSaveRestoreData *pSaveData, char **pTokens, int nTokens, CUtlVector<CSaveBenchmarkEntity> &entities, int nPasses )
+{
+	double flStart = Plat_FloatTime();
+
+	for ( int iPass = 0; iPass < nPasses; iPass++ )
+	{
+		SaveBenchmarkResetData( pSaveData, pTokens, nTokens );
+
+		CSave save( pSaveData );
+		for ( int i = 0; i < entities.Count(); i++ )
+		{
+			save.WriteAll( &entities[i], &CSaveBenchmarkEntity::m_DataMap );
+		}
+	}
+
+	return Plat_FloatTime() - flStart;
+}
+
+//-------------------------------------
+
+static double SaveBenchmarkRead( CSaveRestoreData *pSaveData, CUtlVector<CSaveBenchmarkEntity> &entities, int nPasses )
+{
+	double flStart = Plat_FloatTime();
+
+	for ( int iPass = 0; iPass < nPasses; iPass++ )
+	{
+		pSaveData->Seek( 0 );
+
+		CRestore restore( pSaveData );
+		for ( int i = 0; i < entities.Count(); i++ )
+		{
+			restore.ReadAll( &entities[i], &CSaveBenchmarkEntity::m_DataMap );
+		}
+	}
+
+	return Plat_FloatTime() - flStart;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves and restores a world of stand in entities field by field and
+//			with compiled plans, and checks both write and restore the same
+//-----------------------------------------------------------------------------
+
+CON_COMMAND_F( saverestore_benchmark, "Times save and restore with and without compiled plans. Usage: saverestore_benchmark [entities] [passes]", FCVAR_CHEAT )
+{
+	int nEntities = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 5000;
+	int nPasses = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 10;
+	nEntities = clamp( nEntities, 1, 100000 );
+	nPasses = clamp( nPasses, 1, 1000 );
+
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	CUtlVector<CSaveBenchmarkEntity> entities;
+	entities.SetCount( nEntities );
+	for ( int i = 0; i < nEntities; i++ )
+	{
+		CSaveBenchmarkEntity &entity = entities[i];
+		memset( &entity, 0, sizeof(entity) );
+		entity.m_hOwnerEntity = NULL;
+		entity.m_hEnemy = NULL;
+
+		// Roughly a third of the world is NPCs, the rest is props that sit still
+		bool bNPC = ( random.RandomInt( 0, 2 ) == 0 );
+		entity.m_iClassname = AllocPooledString( bNPC ? "npc_combine_s" : "prop_physics" );
+		if ( random.RandomInt( 0, 3 ) == 0 )
+		{
+			entity.m_iName = AllocPooledString( UTIL_VarArgs( "benchmark_%d", i ) );
+		}
+		entity.m_vecOrigin.Init( random.RandomFloat( -4096, 4096 ), random.RandomFloat( -4096, 4096 ), random.RandomFloat( -512, 512 ) );
+		entity.m_angRotation.Init( 0, random.RandomFloat( -180, 180 ), 0 );
+		entity.m_iHealth = entity.m_iMaxHealth = random.RandomInt( 1, 100 );
+		entity.m_clrRender.r = entity.m_clrRender.g = entity.m_clrRender.b = entity.m_clrRender.a = 255;
+
+		if ( bNPC )
+		{
+			entity.m_vecVelocity.Init( random.RandomFloat( -200, 200 ), random.RandomFloat( -200, 200 ), 0 );
+			entity.m_fFlags = FL_NPC;
+			entity.m_takedamage = DAMAGE_YES;
+			entity.m_flNextThink = gpGlobals->curtime + random.RandomFloat( 0, 1 );
+			entity.m_nSequence = random.RandomInt( 0, 64 );
+			entity.m_flCycle = random.RandomFloat( 0, 1 );
+			entity.m_flPlaybackRate = 1.0f;
+			for ( int j = 0; j < ARRAYSIZE( entity.m_flPoseParameter ); j++ )
+			{
+				entity.m_flPoseParameter[j] = random.RandomFloat( 0, 1 );
+			}
+			entity.m_bSequenceLoops = true;
+			Q_strncpy( entity.m_szState, "combat", sizeof(entity.m_szState) );
+			entity.m_flFieldOfView = 0.5f;
+			entity.m_vecLastPosition = entity.m_vecOrigin;
+			entity.m_iszSquad = AllocPooledString( "overwatch" );
+			entity.m_afCapability = random.RandomInt( 0, 0xffff );
+		}
+	}
+
+	const int nTokens = 0xfff;
+	int nBufferBytes = nEntities * 1024 + 64 * 1024;
+	char *pMemory = new char[sizeof(CSaveRestoreData) + nBufferBytes];
+	char **pTokens = new char *[nTokens];
+	memset( pTokens, 0, nTokens * sizeof(char *) );
+
+	CSaveRestoreData *pSaveData = MakeSaveRestoreData( pMemory );
+	pSaveData->Init( pMemory + sizeof(CSaveRestoreData), nBufferBytes );
+	pSaveData->InitSymbolTable( pTokens, nTokens );
+	pSaveData->levelInfo.time = gpGlobals->curtime;
+	pSaveData->levelInfo.vecLandmarkOffset = vec3_origin;
+	pSaveData->levelInfo.fUseLandmark = false;
+
+	bool bUsePlans = saverestore_plans.GetBool();
+
+	double flWriteTime[2];
+	double flReadTime[2];
+	CUtlVector<char> written[2];
+	CUtlVector<char> rewritten[2];
+	CUtlVector<CSaveBenchmarkEntity> restored;
+	restored.SetCount( nEntities );
+
+	for ( int iMode = 0; iMode < 2; iMode++ )
+	{
+		saverestore_plans.SetValue( iMode );
+
+		flWriteTime[iMode] = SaveBenchmarkWrite( pSaveData, pTokens, nTokens, entities, nPasses );
+		written[iMode].CopyArray( pSaveData->GetBuffer(), pSaveData->GetCurPos() );
+
+		flReadTime[iMode] = SaveBenchmarkRead( pSaveData, restored, nPasses );
+
+		// Write what was restored field by field, so both restores can be compared
+		saverestore_plans.SetValue( 0 );
+		SaveBenchmarkWrite( pSaveData, pTokens, nTokens, restored, 1 );
+		rewritten[iMode].CopyArray( pSaveData->GetBuffer(), pSaveData->GetCurPos() );
+	}
+
+	saverestore_plans.SetValue( bUsePlans );
+
+	delete [] pTokens;
+	delete [] pMemory;
+
+	bool bSameWrite = ( written[0].Count() == written[1].Count() && !memcmp( written[0].Base(), written[1].Base(), written[0].Count() ) );
+	bool bSameRead = ( rewritten[0].Count() == rewritten[1].Count() && !memcmp( rewritten[0].Base(), rewritten[1].Base(), rewritten[0].Count() ) );
+
+	double flEntities = (double)nEntities * nPasses;
+	Msg( "%d entities, %d passes, %d bytes per pass\n", nEntities, nPasses, written[0].Count() );
+	Msg( "  field by field: save %.0f entities/sec, restore %.0f entities/sec\n", flEntities / MAX( flWriteTime[0], 1e-6 ), flEntities / MAX( flReadTime[0], 1e-6 ) );
+	Msg( "  compiled plans: save %.0f entities/sec, restore %.0f entities/sec\n", flEntities / MAX( flWriteTime[1], 1e-6 ), flEntities / MAX( flReadTime[1], 1e-6 ) );
+	Msg( "  saved data %s, restored data %s\n", bSameWrite ? "matches" : "DIFFERS", bSameRead ? "matches" : "DIFFERS" );
+}
+
+#endif	// !defined( CLIENT_DLL )
@@ -28,6 +28,7 @@ struct edict_t;
 struct datamap_t;
 class CBaseEntity;
 struct interval_t;
+class CSaveRestorePlan;
 
 //-----------------------------------------------------------------------------
 //
@@ -151,6 +152,7 @@ private:
 
 	int				DoWriteAll( const void *pLeafObject, datamap_t *pLeafMap, datamap_t *pCurMap );
 	bool 			WriteField( const char *pname, void *pData, datamap_t *pRootMap, typedescription_t *pField );
+	void			WritePlanField( const CSaveRestorePlan *pPlan, int iField, const char *pData );
 	
 	bool 			WriteBasicField( const char *pname, void *pData, datamap_t *pRootMap, typedescription_t *pField );
 	
@@ -174,6 +176,9 @@ private:
 	// Stream data
 	CSaveRestoreSegment *m_pData;
 	
+	// Symbols of the fields of every plan used by this save, -1 until first written
+	CUtlVector<short>	m_PlanSymbols;
+
 	// Game data
 	CGameSaveRestoreInfo *m_pGameInfo;
 
@@ -276,6 +281,7 @@ private:
 	int				DoReadAll( void *pLeafObject, datamap_t *pLeafMap, datamap_t *pCurMap );
 	
 	typedescription_t *FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, int *pIterator );
+	typedescription_t *FindPlanField( int symbol, typedescription_t *pFields, const CSaveRestorePlan *pPlan, int *pIterator );
 	void			ReadField( const SaveRestoreRecordHeader_t &header, void *pDest, datamap_t *pRootMap, typedescription_t *pField );
 	
 	void 			ReadBasicField( const SaveRestoreRecordHeader_t &header, void *pDest, datamap_t *pRootMap, typedescription_t *pField );
@@ -306,6 +312,8 @@ private:
 
 	bool			ShouldReadField( typedescription_t *pField );
 	bool 			ShouldEmptyField( typedescription_t *pField );
+	void			EmptyField( void *pBaseData, typedescription_t *pField );
+	void			EmptyPlanFields( void *pBaseData, typedescription_t *pFields, const CSaveRestorePlan *pPlan );
 
 	//---------------------------------
 	// Game info methods
@@ -320,6 +328,9 @@ private:
 	// Stream data
 	CSaveRestoreSegment *m_pData;
 
+	// Symbols of the fields of every plan used by this restore, -1 until first read
+	CUtlVector<short>	m_PlanSymbols;
+
 	// Game data
 	CGameSaveRestoreInfo *	m_pGameInfo;
 	int						m_global;		// Restoring a global entity?
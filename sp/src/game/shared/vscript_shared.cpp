@@ -274,3 +274,51 @@ CON_COMMAND_SHARED( script_dump_all, "Dump the state of the VM to the console" )
 	}
 	g_pScriptVM->DumpState();
 }
+
+#ifdef MAPBASE_VSCRIPT
+//-----------------------------------------------------------------------------
+// Compiled script cache. The cache is in the VM, but the VM library is linked
+// into both DLLs, so its settings and stats are registered here.
+//-----------------------------------------------------------------------------
+static void ScriptCompileCacheChanged( IConVar *pConVar, const char *pOldString, float flOldValue )
+{
+	VScriptSetupCompileCache();
+}
+
+#ifdef CLIENT_DLL
+ConVar script_compile_cache( "script_compile_cache_client", "256", FCVAR_NONE, "Number of compiled scripts the client VM keeps for reuse (0 = don't cache)", ScriptCompileCacheChanged );
+#else
+ConVar script_compile_cache( "script_compile_cache", "256", FCVAR_NONE, "Number of compiled scripts the server VM keeps for reuse (0 = don't cache)", ScriptCompileCacheChanged );
+#endif
+
+void VScriptSetupCompileCache()
+{
+	if ( g_pScriptVM )
+	{
+		g_pScriptVM->SetCompileCacheSize( script_compile_cache.GetInt() );
+	}
+}
+
+CON_COMMAND_SHARED( script_compile_cache_stats, "Prints compiled script cache hits and misses. Pass 'reset' to clear the counters." )
+{
+	if ( !g_pScriptVM )
+	{
+		CGWarning( 0, CON_GROUP_VSCRIPT, "Scripting disabled or no server running\n" );
+		return;
+	}
+
+	if ( !V_stricmp( args[1], "reset" ) )
+	{
+		g_pScriptVM->ResetCompileCacheStats();
+		return;
+	}
+
+	ScriptCompileCacheStats_t stats;
+	g_pScriptVM->GetCompileCacheStats( &stats );
+
+	int nLookups = stats.nHits + stats.nMisses;
+	Msg( "Compiled script cache: %d cached, %d hits, %d misses (%.1f%% hit rate), %d evicted\n",
+		stats.nScripts, stats.nHits, stats.nMisses,
+		nLookups ? 100.0f * stats.nHits / nLookups : 0.0f, stats.nEvictions );
+}
+#endif
@@ -34,6 +34,9 @@ bool IsEntityCreationAllowedInScripts( void );
 #ifdef MAPBASE_VSCRIPT
 void RegisterSharedScriptConstants();
 void RegisterSharedScriptFunctions();
+
+// Applies script_compile_cache to g_pScriptVM
+void VScriptSetupCompileCache();
 #endif
 
 #endif // VSCRIPT_SHARED_H
@@ -220,6 +220,12 @@ public:
 #define RTE_FLAGS_FAST_TREE_GENERATION 1
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_REFERENCE_TREE_GENERATION 8				// build the kd-tree with RefineNode, single threaded
+#define RTE_FLAGS_DISABLE_WIDE_TRACING 16					// Trace8Rays always uses the 4-wide SSE kernel
+
+#define MAILBOX_HASH_SIZE 256
+#define MAX_TREE_DEPTH 21
+#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -232,9 +238,11 @@ class RayStream
 {
 	friend class RayTracingEnvironment;
 
-	RayTracingSingleResult *PendingStreamOutputs[8][4];
+	// rays are binned by direction sign mask, 8 per bin so that a full bin can go through
+	// Trace8Rays
+	RayTracingSingleResult *PendingStreamOutputs[8][8];
 	int n_in_stream[8];
-	FourRays PendingRays[8];
+	FourRays PendingRays[8][2];
 
 public:
 	RayStream(void)
@@ -294,8 +302,9 @@ public:
 										const Vector &color);
 
 
-	// SetupAccelerationStructure to prepare for tracing
-	void SetupAccelerationStructure(void);
+	// SetupAccelerationStructure to prepare for tracing. nThreads<1 uses every logical
+	// processor.
+	void SetupAccelerationStructure( int nThreads = -1 );
 
 
 	// lowest level intersection routine - fire 4 rays through the scene. all 4 rays must pass the
@@ -310,6 +319,17 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// fire 8 rays, passed as two FourRays. When the cpu supports AVX and all 8 rays have the
+	// same direction signs, they are traced together by the 8-wide kernel. Otherwise each half
+	// goes through Trace4Rays. Either way, hits nearer than TMax are the ones Trace4Rays finds.
+	// ppCallbacks, if not NULL, holds one callback per half.
+	void Trace8Rays(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+					RayTracingResult rslt_out[2],
+					int32 skip_id=-1, ITransparentTriangleCallback *const *ppCallbacks = NULL);
+
+	// true if this cpu and os can run the 8-wide AVX kernel
+	static bool HasWideTracing(void);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -330,7 +350,7 @@ public:
 					 
 	/// raytracing stream - lets you trace an array of rays by feeding them to this function.
 	/// results will not be returned until FinishStream is called. This function handles sorting
-	/// the rays by direction, tracing them 4 at a time, and de-interleaving the results.
+	/// the rays by direction, tracing them 8 at a time, and de-interleaving the results.
 
 	void AddToRayStream(RayStream &s,
 						Vector const &start,Vector const &end,RayTracingSingleResult *rslt_out);
@@ -344,6 +364,12 @@ public:
 
 	int MakeLeafNode(int first_tri, int last_tri);
 
+	// the 8-wide kernel behind Trace8Rays. All 8 rays must have DirectionSignMask, and the cpu
+	// must pass HasWideTracing.
+	void Trace8RaysAVX(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+					   int DirectionSignMask, RayTracingResult rslt_out[2],
+					   int32 skip_id, ITransparentTriangleCallback *const *ppCallbacks);
+
 
 	float CalculateCostsOfSplit(
 		int split_plane,int32 const *tri_list,int ntris,
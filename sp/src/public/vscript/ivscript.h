@@ -795,6 +795,16 @@ enum ScriptStatus_t
 	SCRIPT_RUNNING,
 };
 
+#ifdef MAPBASE_VSCRIPT
+struct ScriptCompileCacheStats_t
+{
+	int nScripts;		// compiled scripts held by the VM
+	int nHits;
+	int nMisses;
+	int nEvictions;
+};
+#endif
+
 class IScriptVM
 {
 public:
@@ -940,6 +950,15 @@ public:
 
 	virtual bool RaiseException( const char *pszExceptionText ) = 0;
 
+#ifdef MAPBASE_VSCRIPT
+	//----------------------------------------------------------------------------
+	// Compiled script cache. A size of 0 turns the cache off.
+	//----------------------------------------------------------------------------
+	virtual void SetCompileCacheSize( int nMaxScripts ) = 0;
+	virtual void GetCompileCacheStats( ScriptCompileCacheStats_t *pStats ) = 0;
+	virtual void ResetCompileCacheStats() = 0;
+#endif
+
 	//----------------------------------------------------------------------------
 	// Call API
 	//
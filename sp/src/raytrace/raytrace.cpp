@@ -1,10 +1,14 @@
 //========= Copyright Valve Corporation, All rights reserved. ============//
 // $Id$
 
+// before anything defines the min and max macros
+#include <algorithm>
+
 #include "raytrace.h"
 #include <filesystem_tools.h>
 #include <cmdlib.h>
 #include <stdio.h>
+#include "tier0/threadtools.h"
 
 static bool SameSign(float a, float b)
 {
@@ -257,10 +261,6 @@ int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float spli
 	return PLANECHECK_STRADDLING;
 }
 
-#define MAILBOX_HASH_SIZE 256
-#define MAX_TREE_DEPTH 21
-#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
-
 struct NodeToVisit {
 	CacheOptimizedKDNode const *node;
 	fltx4 TMin;
@@ -346,6 +346,25 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
+void RayTracingEnvironment::Trace8Rays(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+									   RayTracingResult rslt_out[2],
+									   int32 skip_id, ITransparentTriangleCallback *const *ppCallbacks)
+{
+	if ( !( Flags & RTE_FLAGS_DISABLE_WIDE_TRACING ) && HasWideTracing() )
+	{
+		int msk=rays[0].CalculateDirectionSignMask();
+		if ( ( msk!=-1 ) && ( msk==rays[1].CalculateDirectionSignMask() ) )
+		{
+			Trace8RaysAVX(rays,TMin,TMax,msk,rslt_out,skip_id,ppCallbacks);
+			return;
+		}
+	}
+	// the halves point different ways, or there is no avx
+	for(int h=0;h<2;h++)
+		Trace4Rays(rays[h],TMin[h],TMax[h],&rslt_out[h],skip_id,ppCallbacks ? ppCallbacks[h] : NULL);
+}
+
+
 void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 TMax,
 									   int DirectionSignMask, RayTracingResult *rslt_out,
 									   int32 skip_id, ITransparentTriangleCallback *pCallback)
@@ -876,7 +895,473 @@ void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int
 }
 
 
-void RayTracingEnvironment::SetupAccelerationStructure(void)
+//-----------------------------------------------------------------------------
+// Parallel kd-tree builder
+//
+// Builds the same kind of tree as RefineNode, with the same cost model and
+// termination rules. There are two differences:
+//
+//  - Nodes with more than KDBUILD_EXACT_SWEEP_TRIS triangles pick a split
+//    plane from a binned SAH estimate, then cost it exactly. Smaller nodes
+//    cost every triangle bound on every axis exactly. That is a superset of
+//    the vertices RefineNode samples: between two bounds the cost is linear,
+//    so it is lowest at one of them.
+//  - The top of the tree is split on the calling thread until the remaining
+//    subtrees are small enough to spread over the threads. Each subtree is
+//    then built on its own thread into its own node and index lists. The
+//    lists are spliced into OptimizedKDTree and TriangleIndexList in a fixed
+//    order, so the tree doesn't depend on thread timing.
+//
+// Triangle bounds are cached up front. Unlike RefineNode, this doesn't label
+// triangles through m_nTmpData, because subtrees on different threads can
+// share a straddling triangle.
+//-----------------------------------------------------------------------------
+
+#define KDBUILD_BINS				64
+#define KDBUILD_EXACT_SWEEP_TRIS	1024						// nodes this small cost every candidate
+#define KDBUILD_MIN_TASK_TRIS		2048						// smallest subtree handed to a thread
+
+struct KDSplit_t
+{
+	int axis;
+	float classify_value;									// where the triangles were classified
+	float split_value;										// plane stored in the node (may be grown)
+	float cost;
+	int nleft, nright, nboth;
+};
+
+struct KDBuildTask_t
+{
+	int node_number;										// node in OptimizedKDTree to fill in
+	CUtlVector<int32> tris;
+	Vector MinBound;
+	Vector MaxBound;
+	int depth;
+
+	// the subtree, built by a worker. node 0 is node_number, child and triangle
+	// indices are local to these lists until spliced
+	CUtlVector<CacheOptimizedKDNode> nodes;
+	CUtlVector<int32> tri_indices;
+};
+
+struct KDBuildScratch_t
+{
+	CUtlVector<float> mins;
+	CUtlVector<float> maxs;
+	CUtlVector<float> planar;
+};
+
+class CKDTreeBuilder
+{
+public:
+	CKDTreeBuilder( RayTracingEnvironment &env ) : m_Env( env ) {}
+
+	void Build( int32 const *tri_list, int ntris, int nThreads );
+
+private:
+	inline int Classify( int32 tri, int axis, float split_value ) const;
+	float CostOfSplit( int axis, float split_value, Vector const &MinBound, Vector const &MaxBound,
+					   int nleft, int nright, int nboth ) const;
+	void EvaluateSplit( int axis, float split_value, int32 const *tri_list, int ntris,
+						Vector const &MinBound, Vector const &MaxBound, KDSplit_t &out ) const;
+	void FindBinnedSplit( int axis, int32 const *tri_list, int ntris,
+						  Vector const &MinBound, Vector const &MaxBound, KDSplit_t &best ) const;
+	void FindExactSplit( int axis, int32 const *tri_list, int ntris,
+						 Vector const &MinBound, Vector const &MaxBound, KDSplit_t &best,
+						 KDBuildScratch_t &scratch ) const;
+
+	void BuildNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &tri_indices,
+					int node_number, int32 const *tri_list, int ntris,
+					Vector MinBound, Vector MaxBound, int depth, KDBuildScratch_t &scratch,
+					CUtlVector<KDBuildTask_t *> *pTasks );
+
+	void SpliceTask( KDBuildTask_t const &task );
+
+	static unsigned WorkerThread( void *pParam );
+	void RunTasks();
+
+	RayTracingEnvironment &m_Env;
+	CUtlVector<Vector> m_TriMins;
+	CUtlVector<Vector> m_TriMaxs;
+
+	int m_nTaskTris;
+	CUtlVector<KDBuildTask_t *> m_Tasks;					// in tree order
+	CUtlVector<KDBuildTask_t *> m_TaskSchedule;				// largest first
+	CInterlockedInt m_nNextTask;
+};
+
+inline int CKDTreeBuilder::Classify( int32 tri, int axis, float split_value ) const
+{
+	// same rules as CacheOptimizedTriangle::ClassifyAgainstAxisSplit
+	float minc = m_TriMins[tri][axis];
+	float maxc = m_TriMaxs[tri][axis];
+	if (minc>=split_value)
+		return PLANECHECK_POSITIVE;
+	if (maxc<=split_value)
+		return PLANECHECK_NEGATIVE;
+	if (minc==maxc)
+		return PLANECHECK_POSITIVE;
+	return PLANECHECK_STRADDLING;
+}
+
+float CKDTreeBuilder::CostOfSplit( int axis, float split_value, Vector const &MinBound, Vector const &MaxBound,
+								   int nleft, int nright, int nboth ) const
+{
+	// same formula as RayTracingEnvironment::CalculateCostsOfSplit
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[axis]=split_value;
+	RightMins[axis]=split_value;
+	float SA_L=BoxSurfaceArea(LeftMins,LeftMaxes);
+	float SA_R=BoxSurfaceArea(RightMins,RightMaxes);
+	float ISA=1.0/BoxSurfaceArea(MinBound,MaxBound);
+	return COST_OF_TRAVERSAL+COST_OF_INTERSECTION*(nboth+
+		(SA_L*ISA*(nleft))+(SA_R*ISA*(nright)));
+}
+
+void CKDTreeBuilder::EvaluateSplit( int axis, float split_value, int32 const *tri_list, int ntris,
+									Vector const &MinBound, Vector const &MaxBound, KDSplit_t &out ) const
+{
+	out.axis=axis;
+	out.classify_value=split_value;
+	out.nleft=out.nright=out.nboth=0;
+	float min_coord=1.0e23,max_coord=-1.0e23;
+	for(int t=0;t<ntris;t++)
+	{
+		min_coord=min(min_coord,m_TriMins[tri_list[t]][axis]);
+		max_coord=max(max_coord,m_TriMaxs[tri_list[t]][axis]);
+		switch(Classify(tri_list[t],axis,split_value))
+		{
+			case PLANECHECK_NEGATIVE: out.nleft++; break;
+			case PLANECHECK_POSITIVE: out.nright++; break;
+			case PLANECHECK_STRADDLING: out.nboth++; break;
+		}
+	}
+
+	// "grow" an empty half, as CalculateCostsOfSplit does
+	if (out.nleft && (out.nboth==0) && (out.nright==0))
+		split_value=max_coord;
+	if (out.nright && (out.nboth==0) && (out.nleft==0))
+		split_value=min_coord;
+	out.split_value=split_value;
+	out.cost=CostOfSplit(axis,split_value,MinBound,MaxBound,out.nleft,out.nright,out.nboth);
+}
+
+void CKDTreeBuilder::FindBinnedSplit( int axis, int32 const *tri_list, int ntris,
+									  Vector const &MinBound, Vector const &MaxBound, KDSplit_t &best ) const
+{
+	float lo=MinBound[axis];
+	float hi=MaxBound[axis];
+	if (hi<=lo)
+		return;
+
+	int min_bins[KDBUILD_BINS];
+	int max_bins[KDBUILD_BINS];
+	memset(min_bins,0,sizeof(min_bins));
+	memset(max_bins,0,sizeof(max_bins));
+	float scale=KDBUILD_BINS/(hi-lo);
+	for(int t=0;t<ntris;t++)
+	{
+		// clamp before converting, triangles can reach well outside the node
+		float fmin=clamp((m_TriMins[tri_list[t]][axis]-lo)*scale,0.0f,KDBUILD_BINS-1.0f);
+		float fmax=clamp((m_TriMaxs[tri_list[t]][axis]-lo)*scale,0.0f,KDBUILD_BINS-1.0f);
+		min_bins[(int) fmin]++;
+		max_bins[(int) fmax]++;
+	}
+
+	// estimate the cost at each bin boundary. a triangle whose max is in a bin
+	// below the boundary is on the left, one whose min is at or above it is on
+	// the right
+	int nright=ntris;
+	int nleft=0;
+	float best_estimate=1.0e23;
+	float best_value=0;
+	for(int b=1;b<KDBUILD_BINS;b++)
+	{
+		nleft+=max_bins[b-1];
+		nright-=min_bins[b-1];
+		float value=lo+b*(hi-lo)/KDBUILD_BINS;
+		float estimate=CostOfSplit(axis,value,MinBound,MaxBound,nleft,nright,ntris-nleft-nright);
+		if (estimate<best_estimate)
+		{
+			best_estimate=estimate;
+			best_value=value;
+		}
+	}
+
+	if (best_estimate<1.0e23)
+	{
+		KDSplit_t trial;
+		EvaluateSplit(axis,best_value,tri_list,ntris,MinBound,MaxBound,trial);
+		if (trial.cost<best.cost)
+			best=trial;
+	}
+}
+
+void CKDTreeBuilder::FindExactSplit( int axis, int32 const *tri_list, int ntris,
+									 Vector const &MinBound, Vector const &MaxBound, KDSplit_t &best,
+									 KDBuildScratch_t &scratch ) const
+{
+	scratch.mins.SetCount(ntris);
+	scratch.maxs.SetCount(ntris);
+	scratch.planar.RemoveAll();
+	for(int t=0;t<ntris;t++)
+	{
+		float minc=m_TriMins[tri_list[t]][axis];
+		float maxc=m_TriMaxs[tri_list[t]][axis];
+		scratch.mins[t]=minc;
+		scratch.maxs[t]=maxc;
+		if (minc==maxc)
+			scratch.planar.AddToTail(minc);
+	}
+	float *mins=scratch.mins.Base();
+	float *maxs=scratch.maxs.Base();
+	float *planar=scratch.planar.Base();
+	int nplanar=scratch.planar.Count();
+	std::sort(mins,mins+ntris);
+	std::sort(maxs,maxs+ntris);
+	std::sort(planar,planar+nplanar);
+
+	for(int side=0;side<2;side++)
+	{
+		float const *candidates=side ? maxs : mins;
+		for(int c=0;c<ntris;c++)
+		{
+			float split_value=candidates[c];
+			if ((c>0) && (split_value==candidates[c-1]))
+				continue;
+			if ((split_value>MaxBound[axis]) || (split_value<MinBound[axis]))
+				continue;
+
+			// positive: min >= split. negative: max <= split, except planar
+			// triangles on the plane, which are positive
+			KDSplit_t trial;
+			trial.axis=axis;
+			trial.classify_value=split_value;
+			trial.nright=ntris-(int) (std::lower_bound(mins,mins+ntris,split_value)-mins);
+			int n_on_plane=(int) (std::upper_bound(planar,planar+nplanar,split_value)-
+								  std::lower_bound(planar,planar+nplanar,split_value));
+			trial.nleft=(int) (std::upper_bound(maxs,maxs+ntris,split_value)-maxs)-n_on_plane;
+			trial.nboth=ntris-trial.nleft-trial.nright;
+
+			if (trial.nleft && (trial.nboth==0) && (trial.nright==0))
+				split_value=maxs[ntris-1];
+			if (trial.nright && (trial.nboth==0) && (trial.nleft==0))
+				split_value=mins[0];
+			trial.split_value=split_value;
+			trial.cost=CostOfSplit(axis,split_value,MinBound,MaxBound,trial.nleft,trial.nright,trial.nboth);
+			if (trial.cost<best.cost)
+				best=trial;
+		}
+	}
+}
+
+void CKDTreeBuilder::BuildNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &tri_indices,
+								int node_number, int32 const *tri_list, int ntris,
+								Vector MinBound, Vector MaxBound, int depth, KDBuildScratch_t &scratch,
+								CUtlVector<KDBuildTask_t *> *pTasks )
+{
+	if (pTasks && (ntris<=m_nTaskTris))
+	{
+		// leave this subtree for a worker
+		KDBuildTask_t *pTask=new KDBuildTask_t;
+		pTask->node_number=node_number;
+		pTask->tris.CopyArray(tri_list,ntris);
+		pTask->MinBound=MinBound;
+		pTask->MaxBound=MaxBound;
+		pTask->depth=depth;
+		pTasks->AddToTail(pTask);
+		return;
+	}
+
+	KDSplit_t best;
+	best.cost=1.0e23;
+	if (ntris>=3)											// never split empty lists
+	{
+		for(int axis=0;axis<3;axis++)
+		{
+			KDSplit_t trial;
+			EvaluateSplit(axis,0.5*(MinBound[axis]+MaxBound[axis]),tri_list,ntris,MinBound,MaxBound,trial);
+			if (trial.cost<best.cost)
+				best=trial;
+
+			if (ntris<=KDBUILD_EXACT_SWEEP_TRIS)
+				FindExactSplit(axis,tri_list,ntris,MinBound,MaxBound,best,scratch);
+			else
+				FindBinnedSplit(axis,tri_list,ntris,MinBound,MaxBound,best);
+		}
+	}
+
+	float cost_of_no_split=COST_OF_INTERSECTION*ntris;
+	if ( (ntris<3) || (cost_of_no_split<=best.cost) || NEVER_SPLIT || (depth>MAX_TREE_DEPTH))
+	{
+		nodes[node_number].Children=KDNODE_STATE_LEAF+(tri_indices.Count()<<2);
+		nodes[node_number].SetNumberOfTrianglesInLeafNode(ntris);
+#ifdef DEBUG_RAYTRACE
+		nodes[node_number].vecMins = MinBound;
+		nodes[node_number].vecMaxs = MaxBound;
+#endif
+		tri_indices.AddMultipleToTail(ntris,tri_list);
+		return;
+	}
+
+	// left, then straddling, then right, as RefineNode lays them out
+	int split_plane=best.axis;
+	int32 *new_triangle_list=new int32[ntris];
+	int n_left_output=0;
+	int n_both_output=0;
+	int n_right_output=0;
+	for(int t=0;t<ntris;t++)
+	{
+		switch(Classify(tri_list[t],split_plane,best.classify_value))
+		{
+			case PLANECHECK_NEGATIVE:
+				new_triangle_list[n_left_output++]=tri_list[t];
+				break;
+			case PLANECHECK_POSITIVE:
+				n_right_output++;
+				new_triangle_list[ntris-n_right_output]=tri_list[t];
+				break;
+			case PLANECHECK_STRADDLING:
+				new_triangle_list[best.nleft+n_both_output]=tri_list[t];
+				n_both_output++;
+				break;
+		}
+	}
+	Assert( (n_left_output==best.nleft) && (n_right_output==best.nright) && (n_both_output==best.nboth) );
+
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[split_plane]=best.split_value;
+	RightMins[split_plane]=best.split_value;
+
+	int left_child=nodes.Count();
+	int right_child=left_child+1;
+	nodes[node_number].Children=split_plane+(left_child<<2);
+	nodes[node_number].SplittingPlaneValue=best.split_value;
+#ifdef DEBUG_RAYTRACE
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
+#endif
+	nodes.AddMultipleToTail(2);
+
+	if ( (ntris<20) && ((best.nleft==0) || (best.nright==0)) )
+		depth+=100;
+	BuildNode(nodes,tri_indices,left_child,new_triangle_list,best.nleft+best.nboth,
+			  LeftMins,LeftMaxes,depth+1,scratch,pTasks);
+	BuildNode(nodes,tri_indices,right_child,new_triangle_list+best.nleft,best.nright+best.nboth,
+			  RightMins,RightMaxes,depth+1,scratch,pTasks);
+	delete[] new_triangle_list;
+}
+
+void CKDTreeBuilder::SpliceTask( KDBuildTask_t const &task )
+{
+	// local node 0 goes in the slot the top of the tree left for it, and the
+	// rest are appended, which keeps each pair of children adjacent
+	int node_base=m_Env.OptimizedKDTree.Count()-1;
+	int tri_base=m_Env.TriangleIndexList.Count();
+	for(int i=0;i<task.nodes.Count();i++)
+	{
+		CacheOptimizedKDNode node=task.nodes[i];
+		if (node.NodeType()==KDNODE_STATE_LEAF)
+			node.Children=KDNODE_STATE_LEAF+((node.TriangleIndexStart()+tri_base)<<2);
+		else
+			node.Children=node.NodeType()+((node.LeftChild()+node_base)<<2);
+
+		if (i==0)
+			m_Env.OptimizedKDTree[task.node_number]=node;
+		else
+			m_Env.OptimizedKDTree.AddToTail(node);
+	}
+	m_Env.TriangleIndexList.AddMultipleToTail(task.tri_indices.Count(),task.tri_indices.Base());
+}
+
+unsigned CKDTreeBuilder::WorkerThread( void *pParam )
+{
+	CKDTreeBuilder *pBuilder=(CKDTreeBuilder *) pParam;
+	pBuilder->RunTasks();
+	return 0;
+}
+
+void CKDTreeBuilder::RunTasks()
+{
+	KDBuildScratch_t scratch;
+	for(;;)
+	{
+		int i=m_nNextTask++;
+		if (i>=m_TaskSchedule.Count())
+			break;
+		KDBuildTask_t *pTask=m_TaskSchedule[i];
+		pTask->nodes.AddToTail();
+		BuildNode(pTask->nodes,pTask->tri_indices,0,pTask->tris.Base(),pTask->tris.Count(),
+				  pTask->MinBound,pTask->MaxBound,pTask->depth,scratch,NULL);
+		pTask->tris.Purge();
+	}
+}
+
+static bool TaskIsLarger( KDBuildTask_t *const &a, KDBuildTask_t *const &b )
+{
+	return a->tris.Count()>b->tris.Count();
+}
+
+void CKDTreeBuilder::Build( int32 const *tri_list, int ntris, int nThreads )
+{
+	if (nThreads<1)
+		nThreads=GetCPUInformation()->m_nLogicalProcessors;
+	nThreads=max(nThreads,1);
+
+	m_TriMins.SetCount(m_Env.OptimizedTriangleList.Count());
+	m_TriMaxs.SetCount(m_Env.OptimizedTriangleList.Count());
+	for(int i=0;i<m_Env.OptimizedTriangleList.Count();i++)
+	{
+		CacheOptimizedTriangle const &tri=m_Env.OptimizedTriangleList[i];
+		m_TriMins[i]=tri.Vertex(0);
+		m_TriMaxs[i]=tri.Vertex(0);
+		for(int v=1;v<3;v++)
+		{
+			VectorMin(m_TriMins[i],tri.Vertex(v),m_TriMins[i]);
+			VectorMax(m_TriMaxs[i],tri.Vertex(v),m_TriMaxs[i]);
+		}
+	}
+
+	// aim for several subtrees per thread so that the threads finish together
+	m_nTaskTris=max(KDBUILD_MIN_TASK_TRIS,ntris/(8*nThreads));
+	bool bThreaded=(nThreads>1) && (ntris>m_nTaskTris);
+
+	KDBuildScratch_t scratch;
+	BuildNode(m_Env.OptimizedKDTree,m_Env.TriangleIndexList,0,tri_list,ntris,
+			  m_Env.m_MinBound,m_Env.m_MaxBound,0,scratch,bThreaded ? &m_Tasks : NULL);
+	if (!m_Tasks.Count())
+		return;
+
+	m_TaskSchedule.CopyArray(m_Tasks.Base(),m_Tasks.Count());
+	std::sort(m_TaskSchedule.Base(),m_TaskSchedule.Base()+m_TaskSchedule.Count(),TaskIsLarger);
+	m_nNextTask=0;
+
+	CUtlVector<ThreadHandle_t> threads;
+	for(int i=1;i<min(nThreads,m_Tasks.Count());i++)
+		threads.AddToTail(CreateSimpleThread(WorkerThread,this));
+	RunTasks();
+	for(int i=0;i<threads.Count();i++)
+	{
+		ThreadJoin(threads[i]);
+		ReleaseThreadHandle(threads[i]);
+	}
+
+	for(int i=0;i<m_Tasks.Count();i++)
+	{
+		SpliceTask(*m_Tasks[i]);
+		delete m_Tasks[i];
+	}
+	m_Tasks.Purge();
+}
+
+
+void RayTracingEnvironment::SetupAccelerationStructure( int nThreads )
 {
 	CacheOptimizedKDNode root;
 	OptimizedKDTree.AddToTail(root);
@@ -885,7 +1370,13 @@ void RayTracingEnvironment::SetupAccelerationStructure(void)
 		root_triangle_list[t]=t;
 	CalculateTriangleListBounds(root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,
 								m_MaxBound);
-	RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	if (Flags & RTE_FLAGS_REFERENCE_TREE_GENERATION)
+		RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	else
+	{
+		CKDTreeBuilder builder(*this);
+		builder.Build(root_triangle_list,OptimizedTriangleList.Count(),nThreads);
+	}
 	delete[] root_triangle_list;
 
 	// now, convert all triangles to "intersection format"
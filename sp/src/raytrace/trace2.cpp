@@ -307,21 +307,39 @@ inline void RayTracingEnvironment::FlushStreamEntry(RayStream &s,int msk)
 {
 	assert(msk>=0);
 	assert(msk<8);
-	fltx4 tmax=s.PendingRays[msk].direction.length();
-	fltx4 scl=ReciprocalSaturateSIMD(tmax);
-	s.PendingRays[msk].direction*=scl;					// normalize
-	RayTracingResult tmpresult;
-	Trace4Rays(s.PendingRays[msk],Four_Zeros,tmax,msk,&tmpresult);
+	// a bin holding 4 or fewer rays only needs its first half traced
+	int nhalves=(s.n_in_stream[msk]>4)?2:1;
+	fltx4 tmax[2];
+	RayTracingResult tmpresult[2];
+	for(int h=0;h<nhalves;h++)
+	{
+		tmax[h]=s.PendingRays[msk][h].direction.length();
+		fltx4 scl=ReciprocalSaturateSIMD(tmax[h]);
+		s.PendingRays[msk][h].direction*=scl;				// normalize
+	}
+	// every ray in the bin shares msk, so the 8-wide kernel can be called directly
+	if ((nhalves==2) && !(Flags & RTE_FLAGS_DISABLE_WIDE_TRACING) && HasWideTracing())
+	{
+		fltx4 tmin[2]={Four_Zeros,Four_Zeros};
+		Trace8RaysAVX(s.PendingRays[msk],tmin,tmax,msk,tmpresult,-1,NULL);
+	}
+	else
+	{
+		for(int h=0;h<nhalves;h++)
+			Trace4Rays(s.PendingRays[msk][h],Four_Zeros,tmax[h],msk,&tmpresult[h]);
+	}
 	// now, write out results
-	for(int r=0;r<4;r++)
+	for(int r=0;r<4*nhalves;r++)
 	{
+		RayTracingResult const &rslt=tmpresult[r>>2];
+		int lane=r&3;
 		RayTracingSingleResult *out=s.PendingStreamOutputs[msk][r];
-		out->ray_length=SubFloat( tmax, r );
-		out->surface_normal.x=tmpresult.surface_normal.X(r);
-		out->surface_normal.y=tmpresult.surface_normal.Y(r);
-		out->surface_normal.z=tmpresult.surface_normal.Z(r);
-		out->HitID=tmpresult.HitIds[r];
-		out->HitDistance=SubFloat( tmpresult.HitDistance, r );
+		out->ray_length=SubFloat( tmax[r>>2], lane );
+		out->surface_normal.x=rslt.surface_normal.X(lane);
+		out->surface_normal.y=rslt.surface_normal.Y(lane);
+		out->surface_normal.z=rslt.surface_normal.Z(lane);
+		out->HitID=rslt.HitIds[lane];
+		out->HitDistance=SubFloat( rslt.HitDistance, lane );
 	}
 	s.n_in_stream[msk]=0;
 }
@@ -336,20 +354,21 @@ void RayTracingEnvironment::AddToRayStream(RayStream &s,
 	assert(msk>=0);
 	assert(msk<8);
 	int pos=s.n_in_stream[msk];
-	assert(pos<4);
-	s.PendingRays[msk].origin.X(pos)=start.x;
-	s.PendingRays[msk].origin.Y(pos)=start.y;
-	s.PendingRays[msk].origin.Z(pos)=start.z;
-	s.PendingRays[msk].direction.X(pos)=delta.x;
-	s.PendingRays[msk].direction.Y(pos)=delta.y;
-	s.PendingRays[msk].direction.Z(pos)=delta.z;
+	assert(pos<8);
+	FourRays &half=s.PendingRays[msk][pos>>2];
+	int lane=pos&3;
+	half.origin.X(lane)=start.x;
+	half.origin.Y(lane)=start.y;
+	half.origin.Z(lane)=start.z;
+	half.direction.X(lane)=delta.x;
+	half.direction.Y(lane)=delta.y;
+	half.direction.Z(lane)=delta.z;
 	s.PendingStreamOutputs[msk][pos]=rslt_out;
-	if (pos==3)
+	s.n_in_stream[msk]++;
+	if (pos==7)
 	{
 		FlushStreamEntry(s,msk);
 	}
-	else
-		s.n_in_stream[msk]++;
 }
 
 void RayTracingEnvironment::FinishRayStream(RayStream &s)
@@ -360,14 +379,18 @@ void RayTracingEnvironment::FinishRayStream(RayStream &s)
 		if (cnt)
 		{
 			// fill in unfilled entries with dups of first
-			for(int c=cnt;c<4;c++)
+			FourRays const &first=s.PendingRays[msk][0];
+			int nfill=(cnt>4)?8:4;
+			for(int c=cnt;c<nfill;c++)
 			{
-				s.PendingRays[msk].origin.X(c) = s.PendingRays[msk].origin.X(0);
-				s.PendingRays[msk].origin.Y(c) = s.PendingRays[msk].origin.Y(0);
-				s.PendingRays[msk].origin.Z(c) = s.PendingRays[msk].origin.Z(0);
-				s.PendingRays[msk].direction.X(c) = s.PendingRays[msk].direction.X(0);
-				s.PendingRays[msk].direction.Y(c) = s.PendingRays[msk].direction.Y(0);
-				s.PendingRays[msk].direction.Z(c) = s.PendingRays[msk].direction.Z(0);
+				FourRays &half=s.PendingRays[msk][c>>2];
+				int lane=c&3;
+				half.origin.X(lane) = first.origin.X(0);
+				half.origin.Y(lane) = first.origin.Y(0);
+				half.origin.Z(lane) = first.origin.Z(0);
+				half.direction.X(lane) = first.direction.X(0);
+				half.direction.Y(lane) = first.direction.Y(0);
+				half.direction.Z(lane) = first.direction.Z(0);
 				s.PendingStreamOutputs[msk][c]=s.PendingStreamOutputs[msk][0];
 			}
 			FlushStreamEntry(s,msk);
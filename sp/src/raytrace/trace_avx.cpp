@@ -0,0 +1,345 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id:$
+//
+// 8-wide version of Trace4Rays, for cpus with AVX. This file is built without any
+// instruction set switches; only the functions marked AVX_TARGET use AVX, and they are only
+// called after HasWideTracing has checked the cpu.
+
+// the intrinsic headers have to come before the valve headers redefine min/max
+#if defined( _WIN32 ) && !defined( _X360 )
+#include <intrin.h>
+#include <immintrin.h>
+#define RAYTRACE_AVX 1
+#define AVX_TARGET
+#elif ( defined( __i386__ ) || defined( __x86_64__ ) ) && \
+	( defined( __clang__ ) || ( __GNUC__ > 4 ) || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) )
+// older gcc's only expose the avx intrinsics when the whole file is built with -mavx
+#include <cpuid.h>
+#include <immintrin.h>
+#define RAYTRACE_AVX 1
+#define AVX_TARGET __attribute__(( target( "avx" ) ))
+#endif
+
+#include "raytrace.h"
+
+#ifndef MAPBASE
+extern int n_intersection_calculations;
+#endif
+
+
+static bool CPUHasAVX( void )
+{
+#if defined( RAYTRACE_AVX ) && defined( _WIN32 )
+	int info[4];
+	__cpuid( info, 1 );
+	// the cpu has to support avx, and the os has to save the ymm registers
+	if ( !( info[2] & ( 1 << 27 ) ) || !( info[2] & ( 1 << 28 ) ) )
+		return false;
+	return ( _xgetbv( 0 ) & 6 ) == 6;
+#elif defined( RAYTRACE_AVX )
+	unsigned int eax, ebx, ecx, edx;
+	if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+		return false;
+	if ( !( ecx & bit_OSXSAVE ) || !( ecx & bit_AVX ) )
+		return false;
+	unsigned int xcr0_lo, xcr0_hi;
+	__asm__ __volatile__( "xgetbv" : "=a" ( xcr0_lo ), "=d" ( xcr0_hi ) : "c" ( 0 ) );
+	return ( xcr0_lo & 6 ) == 6;
+#else
+	return false;
+#endif
+}
+
+bool RayTracingEnvironment::HasWideTracing( void )
+{
+	static int s_nHasAVX = -1;
+	if ( s_nHasAVX < 0 )
+		s_nHasAVX = CPUHasAVX() ? 1 : 0;
+	return s_nHasAVX != 0;
+}
+
+
+#ifdef RAYTRACE_AVX
+
+struct NodeToVisit8 {
+	CacheOptimizedKDNode const *node;
+	float TMin[8];
+	float TMax[8];
+};
+
+static FORCEINLINE AVX_TARGET __m256 Combine8( const fltx4 &lo, const fltx4 &hi )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+}
+
+static FORCEINLINE AVX_TARGET fltx4 Half8( const __m256 &a, int h )
+{
+	return h ? _mm256_extractf128_ps( a, 1 ) : _mm256_castps256_ps128( a );
+}
+
+static FORCEINLINE AVX_TARGET __m256 SetHalf8( const __m256 &a, const fltx4 &v, int h )
+{
+	return h ? _mm256_insertf128_ps( a, v, 1 ) : _mm256_insertf128_ps( a, v, 0 );
+}
+
+static FORCEINLINE AVX_TARGET bool IsAnyNegative8( const __m256 &a )
+{
+	return _mm256_movemask_ps( a ) != 0;
+}
+
+// same steps as ReciprocalSaturateSIMD, so the results match the 4-wide kernel
+static FORCEINLINE AVX_TARGET __m256 ReciprocalSaturate8( const __m256 &a )
+{
+	__m256 zero_mask = _mm256_cmp_ps( a, _mm256_setzero_ps(), _CMP_EQ_OQ );
+	__m256 a_safe = _mm256_or_ps( a, _mm256_and_ps( _mm256_set1_ps( FLT_EPSILON ), zero_mask ) );
+	__m256 ret = _mm256_rcp_ps( a_safe );
+	return _mm256_sub_ps( _mm256_add_ps( ret, ret ), _mm256_mul_ps( a_safe, _mm256_mul_ps( ret, ret ) ) );
+}
+
+// this is Trace4Rays, step for step, on 8 lanes. The two halves keep their own transparent
+// triangle callbacks.
+AVX_TARGET void RayTracingEnvironment::Trace8RaysAVX(const FourRays rays[2], const fltx4 TMin4[2], const fltx4 TMax4[2],
+													 int DirectionSignMask, RayTracingResult rslt_out[2],
+													 int32 skip_id, ITransparentTriangleCallback *const *ppCallbacks)
+{
+	rays[0].Check();
+	rays[1].Check();
+
+	__m256 origin[3], direction[3], OneOverRayDir[3];
+	for(int c=0;c<3;c++)
+	{
+		origin[c]=Combine8(rays[0].origin[c],rays[1].origin[c]);
+		direction[c]=Combine8(rays[0].direction[c],rays[1].direction[c]);
+		OneOverRayDir[c]=ReciprocalSaturate8(direction[c]);
+	}
+
+	__m256 HitIds=_mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	__m256 HitDistance=_mm256_set1_ps(1.0e23f);
+	__m256 NormalX=_mm256_setzero_ps();
+	__m256 NormalY=_mm256_setzero_ps();
+	__m256 NormalZ=_mm256_setzero_ps();
+
+	const __m256 Epsilons=_mm256_set1_ps(1.0e-10f);
+	const __m256 NegativeEpsilons=_mm256_set1_ps(-1.0e-10f);
+	const __m256 Ones=_mm256_set1_ps(1.0f);
+
+	__m256 TMin=Combine8(TMin4[0],TMin4[1]);
+	__m256 TMax=Combine8(TMax4[0],TMax4[1]);
+
+	// now, clip rays against bounding box
+	for(int c=0;c<3;c++)
+	{
+		__m256 isect_min_t=
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(m_MinBound[c]),origin[c]),OneOverRayDir[c]);
+		__m256 isect_max_t=
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(m_MaxBound[c]),origin[c]),OneOverRayDir[c]);
+		TMin=_mm256_max_ps(TMin,_mm256_min_ps(isect_min_t,isect_max_t));
+		TMax=_mm256_min_ps(TMax,_mm256_max_ps(isect_min_t,isect_max_t));
+	}
+
+	if (IsAnyNegative8(_mm256_cmp_ps(TMin,TMax,_CMP_LE_OS)))	// else missed bounding box
+	{
+		int32 mailboxids[MAILBOX_HASH_SIZE];				// used to avoid redundant triangle tests
+		memset(mailboxids,0xff,sizeof(mailboxids));
+
+		int front_idx[3],back_idx[3];						// based on ray direction, whether to
+															// visit left or right node first
+		for(int c=0;c<3;c++)
+		{
+			back_idx[c]=(DirectionSignMask & (1<<c))?0:1;
+			front_idx[c]=1-back_idx[c];
+		}
+
+		NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+		CacheOptimizedKDNode const *CurNode=&(OptimizedKDTree[0]);
+		NodeToVisit8 *stack_ptr=&NodeQueue[MAX_NODE_STACK_LEN];
+		while(1)
+		{
+			while (CurNode->NodeType() != KDNODE_STATE_LEAF)	// traverse until next leaf
+			{
+				int split_plane_number=CurNode->NodeType();
+				CacheOptimizedKDNode const *FrontChild=&(OptimizedKDTree[CurNode->LeftChild()]);
+
+				__m256 dist_to_sep_plane=					// dist=(split-org)/dir
+					_mm256_mul_ps(
+						_mm256_sub_ps(_mm256_set1_ps(CurNode->SplittingPlaneValue),
+									  origin[split_plane_number]),OneOverRayDir[split_plane_number]);
+				__m256 active=_mm256_cmp_ps(TMin,TMax,_CMP_LE_OS);	// mask of which rays are active
+
+				// now, decide how to traverse children. can either do front,back, or do front and push
+				// back.
+				__m256 hits_front=_mm256_and_ps(active,_mm256_cmp_ps(dist_to_sep_plane,TMin,_CMP_GE_OS));
+				if (! IsAnyNegative8(hits_front))
+				{
+					// missed the front. only traverse back
+					CurNode=FrontChild+back_idx[split_plane_number];
+					TMin=_mm256_max_ps(TMin, dist_to_sep_plane);
+				}
+				else
+				{
+					__m256 hits_back=_mm256_and_ps(active,_mm256_cmp_ps(dist_to_sep_plane,TMax,_CMP_LE_OS));
+					if (! IsAnyNegative8(hits_back) )
+					{
+						// missed the back - only need to traverse front node
+						CurNode=FrontChild+front_idx[split_plane_number];
+						TMax=_mm256_min_ps(TMax, dist_to_sep_plane);
+					}
+					else
+					{
+						// at least some rays hit both nodes.
+						// must push far, traverse near
+						assert(stack_ptr>NodeQueue);
+						--stack_ptr;
+						stack_ptr->node=FrontChild+back_idx[split_plane_number];
+						_mm256_storeu_ps(stack_ptr->TMin,_mm256_max_ps(TMin,dist_to_sep_plane));
+						_mm256_storeu_ps(stack_ptr->TMax,TMax);
+						CurNode=FrontChild+front_idx[split_plane_number];
+						TMax=_mm256_min_ps(TMax,dist_to_sep_plane);
+					}
+				}
+			}
+			// hit a leaf! must do intersection check
+			int ntris=CurNode->NumberOfTrianglesInLeaf();
+			if (ntris)
+			{
+				int32 const *tlist=&(TriangleIndexList[CurNode->TriangleIndexStart()]);
+				do
+				{
+					int tnum=*(tlist++);
+					// check mailbox
+					int mbox_slot=tnum & (MAILBOX_HASH_SIZE-1);
+					TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+					if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
+					{
+#ifndef MAPBASE
+						n_intersection_calculations++;
+#endif
+						mailboxids[mbox_slot] = tnum;
+						// compute plane intersection
+						__m256 NX = _mm256_set1_ps( tri->m_flNx );
+						__m256 NY = _mm256_set1_ps( tri->m_flNy );
+						__m256 NZ = _mm256_set1_ps( tri->m_flNz );
+
+						__m256 DDotN = _mm256_mul_ps( direction[0], NX );
+						DDotN = _mm256_add_ps( _mm256_mul_ps( direction[1], NY ), DDotN );
+						DDotN = _mm256_add_ps( _mm256_mul_ps( direction[2], NZ ), DDotN );
+						// mask off zero or near zero (ray parallel to surface)
+						__m256 did_hit = _mm256_or_ps( _mm256_cmp_ps( DDotN, Epsilons, _CMP_GT_OS ),
+													   _mm256_cmp_ps( DDotN, NegativeEpsilons, _CMP_LT_OS ) );
+
+						__m256 ODotN = _mm256_mul_ps( origin[0], NX );
+						ODotN = _mm256_add_ps( _mm256_mul_ps( origin[1], NY ), ODotN );
+						ODotN = _mm256_add_ps( _mm256_mul_ps( origin[2], NZ ), ODotN );
+						__m256 numerator = _mm256_sub_ps( _mm256_set1_ps( tri->m_flD ), ODotN );
+
+						__m256 isect_t = _mm256_div_ps( numerator, DDotN );
+						// now, we have the distance to the plane. lets update our mask
+						did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, Epsilons, _CMP_GT_OS ) );
+						did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, HitDistance, _CMP_LT_OS ) );
+
+						if ( ! IsAnyNegative8( did_hit ) )
+							continue;
+
+						// now, check 3 edges
+						__m256 hitc1 = _mm256_add_ps( origin[tri->m_nCoordSelect0],
+													  _mm256_mul_ps( isect_t, direction[tri->m_nCoordSelect0] ) );
+						__m256 hitc2 = _mm256_add_ps( origin[tri->m_nCoordSelect1],
+													  _mm256_mul_ps( isect_t, direction[tri->m_nCoordSelect1] ) );
+
+						// do barycentric coordinate check
+						__m256 B0 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+						B0 = _mm256_add_ps(
+							B0, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
+						B0 = _mm256_add_ps(
+							B0, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[2] ) );
+
+						did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B0, Epsilons, _CMP_GE_OS ) );
+
+						__m256 B1 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+						B1 = _mm256_add_ps(
+							B1, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[4] ), hitc2 ) );
+						B1 = _mm256_add_ps(
+							B1, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[5] ) );
+
+						did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B1, Epsilons, _CMP_GE_OS ) );
+
+						__m256 B2 = _mm256_add_ps( B1, B0 );
+						did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B2, Ones, _CMP_LE_OS ) );
+
+						if ( ! IsAnyNegative8( did_hit ) )
+							continue;
+
+						// if the triangle is transparent, give each half to its own callback. See
+						// Trace4Rays for the order of the barycentric coordinates.
+						if ( ( tri->m_nFlags & FCACHETRI_TRANSPARENT ) && ppCallbacks )
+						{
+							__m256 b2 = _mm256_sub_ps( Ones, B2 );
+							for ( int h = 0; h < 2; h++ )
+							{
+								fltx4 hitMask = Half8( did_hit, h );
+								if ( !ppCallbacks[h] || !IsAnyNegative( hitMask ) )
+									continue;
+								fltx4 hB1 = Half8( B1, h );
+								fltx4 hb2 = Half8( b2, h );
+								fltx4 hB0 = Half8( B0, h );
+								if ( ppCallbacks[h]->VisitTriangle_ShouldContinue( *tri, rays[h], &hitMask, &hB1, &hb2, &hB0, tnum ) )
+								{
+									hitMask = Four_Zeros;
+								}
+								did_hit = SetHalf8( did_hit, hitMask, h );
+							}
+						}
+						// now, set the hit_id and closest_hit fields for any enabled rays
+						__m256 replicated_n = _mm256_castsi256_ps( _mm256_set1_epi32( tnum ) );
+						HitIds=_mm256_or_ps(_mm256_and_ps(replicated_n,did_hit),
+											_mm256_andnot_ps(did_hit,HitIds));
+						HitDistance=_mm256_or_ps(_mm256_and_ps(isect_t,did_hit),
+												 _mm256_andnot_ps(did_hit,HitDistance));
+						NormalX=_mm256_or_ps(_mm256_and_ps(NX,did_hit),_mm256_andnot_ps(did_hit,NormalX));
+						NormalY=_mm256_or_ps(_mm256_and_ps(NY,did_hit),_mm256_andnot_ps(did_hit,NormalY));
+						NormalZ=_mm256_or_ps(_mm256_and_ps(NZ,did_hit),_mm256_andnot_ps(did_hit,NormalZ));
+					}
+				} while (--ntris);
+				// now, check if all rays have terminated
+				__m256 raydone=_mm256_cmp_ps(TMax,HitDistance,_CMP_LE_OS);
+				if (! IsAnyNegative8(raydone))
+					break;
+			}
+
+			if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+				break;
+			// pop stack!
+			CurNode=stack_ptr->node;
+			TMin=_mm256_loadu_ps(stack_ptr->TMin);
+			TMax=_mm256_loadu_ps(stack_ptr->TMax);
+			stack_ptr++;
+		}
+	}
+
+	// split the results back into the two halves
+	for(int h=0;h<2;h++)
+	{
+		StoreAlignedSIMD((float *) rslt_out[h].HitIds,Half8(HitIds,h));
+		rslt_out[h].HitDistance=Half8(HitDistance,h);
+		rslt_out[h].surface_normal.x=Half8(NormalX,h);
+		rslt_out[h].surface_normal.y=Half8(NormalY,h);
+		rslt_out[h].surface_normal.z=Half8(NormalZ,h);
+	}
+
+	// the rest of the tools are built for sse, so avoid the avx->sse transition penalty
+	_mm256_zeroupper();
+}
+
+#else // RAYTRACE_AVX
+
+void RayTracingEnvironment::Trace8RaysAVX(const FourRays rays[2], const fltx4 TMin4[2], const fltx4 TMax4[2],
+										  int DirectionSignMask, RayTracingResult rslt_out[2],
+										  int32 skip_id, ITransparentTriangleCallback *const *ppCallbacks)
+{
+	// HasWideTracing is always false here, so this only runs if called directly
+	for(int h=0;h<2;h++)
+		Trace4Rays(rays[h],TMin4[h],TMax4[h],DirectionSignMask,&rslt_out[h],skip_id,
+				   ppCallbacks ? ppCallbacks[h] : NULL);
+}
+
+#endif // RAYTRACE_AVX
@@ -13,19 +13,17 @@
 
 #define	USED
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
 #include "cmdlib.h"
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
-
-#ifdef MAPBASE
-// This was suggested in that Source 2013 pull request that fixed Vrad.
-// I trust their judgement on this.
-#define	MAX_THREADS	32
-#else
-#define	MAX_THREADS	16
-#endif
+#include "tier0/threadtools.h"
 
 
 class CRunThreadsData
@@ -36,18 +34,132 @@ public:
 	RunThreadsFn m_Fn;
 };
 
-CRunThreadsData g_RunThreadsData[MAX_THREADS];
+CRunThreadsData g_RunThreadsData[MAX_TOOL_THREADS];
 
 
-int		dispatch;
 int		workcount;
 qboolean		pacifier;
 
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+ThreadHandle_t g_ThreadHandles[MAX_TOOL_THREADS];
+
+
+/*
+===================================================================
+
+WORK DISTRIBUTION
+
+RunThreadsOn() splits the work items into chunks and deals them round
+robin to one queue per thread. A thread takes chunks from the front of
+its own queue, lowest items first, and when that runs dry it steals
+single chunks from the back of the fullest queue left. Items still go
+out in roughly ascending order, which vvis counts on to reuse finished
+portals, but the threads no longer share one counter.
+
+===================================================================
+*/
+
+// Chunks per thread, more balances better, fewer locks less
+#define WORK_CHUNKS_PER_THREAD	32
+
+class CWorkThread
+{
+public:
+	// Queue of the chunks iThread + slot * numthreads, slot in [m_iFront, m_iBack)
+	CThreadFastMutex	m_Mutex;
+	volatile int		m_iFront;
+	volatile int		m_iBack;
+
+	// Chunk being worked on, only touched by the owning thread
+	int					m_iNext;
+	int					m_iEnd;
+
+	// Stats for the utilization report
+	int					m_nItems;
+	int					m_nSteals;
+	double				m_flStealTime;
+	double				m_flEndTime;
+
+	byte				m_Pad[64];			// keep neighbours off this cache line
+};
+
+static CWorkThread g_WorkThreads[MAX_TOOL_THREADS];
+static int g_nWorkChunkSize;
+static int g_nWorkThreads;
+static double g_flWorkStartTime;
+static CInterlockedInt g_nWorkDispatched;
+
+// 1 + the index of the RunThreadsOn thread this is, 0 for any other thread
+static CThreadLocalInt<> g_iWorkThread;
+
+
+static void SetupThreadWork( int nThreads, int nWorkCount )
+{
+	g_nWorkThreads = nThreads;
+	g_nWorkChunkSize = MAX( 1, nWorkCount / ( nThreads * WORK_CHUNKS_PER_THREAD ) );
+	g_nWorkDispatched = 0;
+	g_flWorkStartTime = Plat_FloatTime();
+
+	int nChunks = ( nWorkCount + g_nWorkChunkSize - 1 ) / g_nWorkChunkSize;
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		CWorkThread &thread = g_WorkThreads[i];
+		thread.m_iFront = 0;
+		thread.m_iBack = ( i < nChunks ) ? ( nChunks - i + nThreads - 1 ) / nThreads : 0;
+		thread.m_iNext = thread.m_iEnd = 0;
+		thread.m_nItems = 0;
+		thread.m_nSteals = 0;
+		thread.m_flStealTime = 0;
+		thread.m_flEndTime = g_flWorkStartTime;
+	}
+}
+
+
+static int PopWorkChunk( int iThread, bool bFromBack )
+{
+	CWorkThread &thread = g_WorkThreads[iThread];
+	if ( thread.m_iFront >= thread.m_iBack )
+		return -1;
+
+	int iSlot = -1;
+	thread.m_Mutex.Lock();
+	if ( thread.m_iFront < thread.m_iBack )
+	{
+		iSlot = ( bFromBack ) ? --thread.m_iBack : thread.m_iFront++;
+	}
+	thread.m_Mutex.Unlock();
+
+	return ( iSlot == -1 ) ? -1 : iThread + iSlot * g_nWorkThreads;
+}
+
+
+static int StealWorkChunk( int iThread )
+{
+	for (;;)
+	{
+		// Queues only ever shrink, so once they all read empty we're done
+		int iVictim = -1;
+		int nMostLeft = 0;
+		for ( int i = 0; i < g_nWorkThreads; i++ )
+		{
+			int nLeft = g_WorkThreads[i].m_iBack - g_WorkThreads[i].m_iFront;
+			if ( i != iThread && nLeft > nMostLeft )
+			{
+				iVictim = i;
+				nMostLeft = nLeft;
+			}
+		}
+
+		if ( iVictim == -1 )
+			return -1;
 
+		int iChunk = PopWorkChunk( iVictim, true );
+		if ( iChunk != -1 )
+			return iChunk;
+	}
+}
 
 
 /*
@@ -58,23 +170,81 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
+	int iThread = g_iWorkThread - 1;
+	if ( iThread < 0 || iThread >= g_nWorkThreads )
+		iThread = 0;
 
-	ThreadLock ();
+	CWorkThread &thread = g_WorkThreads[iThread];
 
-	if (dispatch == workcount)
+	if ( thread.m_iNext >= thread.m_iEnd )
 	{
-		ThreadUnlock ();
-		return -1;
+		int iChunk = PopWorkChunk( iThread, false );
+		if ( iChunk == -1 )
+		{
+			double flStart = Plat_FloatTime();
+			iChunk = StealWorkChunk( iThread );
+			double flEnd = Plat_FloatTime();
+			thread.m_flStealTime += flEnd - flStart;
+
+			if ( iChunk == -1 )
+			{
+				thread.m_flEndTime = flEnd;
+				return -1;
+			}
+			thread.m_nSteals++;
+		}
+
+		thread.m_iNext = iChunk * g_nWorkChunkSize;
+		thread.m_iEnd = MIN( thread.m_iNext + g_nWorkChunkSize, workcount );
+		g_nWorkDispatched += thread.m_iEnd - thread.m_iNext;
+
+		// The pacifier isn't thread safe, so only one thread drives it
+		if ( iThread == 0 )
+		{
+			UpdatePacifier( (float)g_nWorkDispatched / workcount );
+		}
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
+	thread.m_nItems++;
+	return thread.m_iNext++;
+}
+
+
+/*
+=============
+ReportThreadUtilization
+
+How much of the phase each thread spent on work items, as opposed to
+stealing or waiting for the others to finish.
+=============
+*/
+static void ReportThreadUtilization( double flElapsed )
+{
+	if ( g_nWorkThreads <= 1 || flElapsed <= 0 )
+		return;
+
+	float flMin = 100.0f, flMax = 0.0f, flTotal = 0.0f;
+	int nSteals = 0;
+
+	for ( int i = 0; i < g_nWorkThreads; i++ )
+	{
+		const CWorkThread &thread = g_WorkThreads[i];
+		float flBusy = 100.0f * ( thread.m_flEndTime - g_flWorkStartTime - thread.m_flStealTime ) / flElapsed;
+		flBusy = MAX( 0.0f, MIN( flBusy, 100.0f ) );
+
+		flMin = MIN( flMin, flBusy );
+		flMax = MAX( flMax, flBusy );
+		flTotal += flBusy;
+		nSteals += thread.m_nSteals;
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
+		if ( verbose )
+		{
+			Msg( "    thread %3d: %7d items, %5.1f%% busy, %d steals\n", i, thread.m_nItems, flBusy, thread.m_nSteals );
+		}
+	}
 
-	return r;
+	Msg( "    %d threads, %.1f%% average utilization (min %.1f%%, max %.1f%%), %d chunks of %d stolen\n",
+		g_nWorkThreads, flTotal / g_nWorkThreads, flMin, flMax, nSteals, g_nWorkChunkSize );
 }
 
 
@@ -107,43 +277,53 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 /*
 ===================================================================
 
-WIN32
+THREADS
 
 ===================================================================
 */
 
 int		numthreads = -1;
-CRITICAL_SECTION		crit;
+CThreadMutex			crit;
 static int enter;
 
 
-class CCritInit
-{
-public:
-	CCritInit()
-	{
-		InitializeCriticalSection (&crit);
-	}
-} g_CritInit;
-
-
-
 void SetLowPriority()
 {
+#ifdef _WIN32
 	SetPriorityClass( GetCurrentProcess(), IDLE_PRIORITY_CLASS );
+#else
+	setpriority( PRIO_PROCESS, 0, 19 );
+#endif
 }
 
 
-void ThreadSetDefault (void)
+static int GetProcessorCount()
 {
+#ifdef _WIN32
+	// GetSystemInfo only counts the processors in our own group, at most 64
+	typedef DWORD (WINAPI *GetActiveProcessorCountFn)( WORD );
+	GetActiveProcessorCountFn pfnGetActiveProcessorCount = (GetActiveProcessorCountFn)GetProcAddress( GetModuleHandle( "kernel32.dll" ), "GetActiveProcessorCount" );
+	if ( pfnGetActiveProcessorCount )
+		return pfnGetActiveProcessorCount( 0xffff );	// ALL_PROCESSOR_GROUPS
+
 	SYSTEM_INFO info;
+	GetSystemInfo (&info);
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+}
 
+
+void ThreadSetDefault (void)
+{
 	if (numthreads == -1)	// not set manually
 	{
-		GetSystemInfo (&info);
-		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+		numthreads = GetProcessorCount();
+		if (numthreads < 1)
 			numthreads = 1;
+		else if (numthreads > MAX_TOOL_THREADS)
+			numthreads = MAX_TOOL_THREADS;
 	}
 
 	Msg ("%i threads\n", numthreads);
@@ -154,7 +334,7 @@ void ThreadLock (void)
 {
 	if (!threaded)
 		return;
-	EnterCriticalSection (&crit);
+	crit.Lock();
 	if (enter)
 		Error ("Recursive ThreadLock\n");
 	enter = 1;
@@ -167,14 +347,15 @@ void ThreadUnlock (void)
 	if (!enter)
 		Error ("ThreadUnlock without lock\n");
 	enter = 0;
-	LeaveCriticalSection (&crit);
+	crit.Unlock();
 }
 
 
 // This runs in the thread and dispatches a RunThreadsFn call.
-DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
+static unsigned InternalRunThreadsFn( void *pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	g_iWorkThread = pData->m_iThread + 1;
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
 	return 0;
 }
@@ -194,33 +375,31 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 		g_RunThreadsData[i].m_pUserData = pUserData;
 		g_RunThreadsData[i].m_Fn = fn;
 
-		DWORD dwDummy;
-		g_ThreadHandles[i] = CreateThread(
-		   NULL,	// LPSECURITY_ATTRIBUTES lpsa,
-		   0,		// DWORD cbStack,
-		   InternalRunThreadsFn,	// LPTHREAD_START_ROUTINE lpStartAddr,
-		   &g_RunThreadsData[i],	// LPVOID lpvThreadParm,
-		   0,			// DWORD fdwCreate,
-		   &dwDummy );
+		g_ThreadHandles[i] = CreateSimpleThread( InternalRunThreadsFn, &g_RunThreadsData[i] );
 
+#ifdef _WIN32
 		if ( ePriority == k_eRunThreadsPriority_UseGlobalState )
 		{
 			if( g_bLowPriorityThreads )
-				SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
+				ThreadSetPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
 		}
 		else if ( ePriority == k_eRunThreadsPriority_Idle )
 		{
-			SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
+			ThreadSetPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
 		}
+#endif
 	}
 }
 
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
+	// WaitForMultipleObjects tops out at 64 handles, so join them one at a time
 	for ( int i=0; i < numthreads; i++ )
-		CloseHandle( g_ThreadHandles[i] );
+	{
+		ThreadJoin( g_ThreadHandles[i] );
+		ReleaseThreadHandle( g_ThreadHandles[i] );
+	}
 
 	threaded = false;
 }
@@ -236,7 +415,6 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	int		start, end;
 
 	start = Plat_FloatTime();
-	dispatch = 0;
 	workcount = workcnt;
 	StartPacifier("");
 	pacifier = showpacifier;
@@ -247,16 +425,24 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	return;
 #endif
 
+	if (numthreads == -1)
+		ThreadSetDefault ();
+	if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
+
+	SetupThreadWork( numthreads, workcnt );
 	
 	RunThreads_Start( fn, pUserData );
 	RunThreads_End();
 
+	double flElapsed = Plat_FloatTime() - g_flWorkStartTime;
 
 	end = Plat_FloatTime();
 	if (pacifier)
 	{
 		EndPacifier(false);
 		printf (" (%i)\n", end-start);
+		ReportThreadUtilization( flElapsed );
 	}
 }
 
@@ -0,0 +1,209 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Times kd-tree construction and Trace4Rays on the triangles of a BSP
+//
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "bsplib.h"
+#include "raytrace.h"
+#include "tier0/icommandline.h"
+#include "tier1/strtools.h"
+#include "vstdlib/random.h"
+
+#define DEFAULT_RAY_COUNT	(1<<20)
+#define RAY_SEED			1234
+
+static void PrintUsage()
+{
+	Msg( "Usage: raytracebench [options] <mapname>\n"
+		"  -threads #      : Number of threads for the kd-tree build (default: all\n"
+		"                    logical processors).\n"
+		"  -rays #         : Number of random rays to trace (default: %d).\n"
+		"  -compare        : Also build the tree with the original single threaded\n"
+		"                    builder and report both.\n", DEFAULT_RAY_COUNT );
+}
+
+static Vector FaceVertex( dface_t const &face, int vnum )
+{
+	int eIndex = dsurfedges[face.firstedge + vnum];
+	int point = ( eIndex < 0 ) ? dedges[-eIndex].v[1] : dedges[eIndex].v[0];
+	return dvertexes[point].point;
+}
+
+//-----------------------------------------------------------------------------
+// Brush faces only. Displacements and static props need vrad's managers to
+// be turned into triangles.
+//-----------------------------------------------------------------------------
+static void AddWorldFaces( RayTracingEnvironment &env )
+{
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		dface_t const &face = dfaces[i];
+		if ( face.dispinfo != -1 )
+			continue;
+
+		for ( int tri = 0; tri < face.numedges - 2; tri++ )
+		{
+			env.AddTriangle( i, FaceVertex( face, 0 ), FaceVertex( face, tri + 1 ), 
+				FaceVertex( face, tri + 2 ), Vector( 1, 1, 1 ) );
+		}
+	}
+}
+
+static float BoxArea( Vector const &mins, Vector const &maxs )
+{
+	Vector size = maxs - mins;
+	return 2.0f * ( size.x * size.y + size.x * size.z + size.y * size.z );
+}
+
+struct TreeStats_t
+{
+	int nNodes;
+	int nLeaves;
+	int nLeafTris;
+	int nMaxDepth;
+	double flNodesPerRay;			// surface area weighted, as the builder's cost model
+	double flTrisPerRay;
+};
+
+static void GatherTreeStats( RayTracingEnvironment const &env, int node, Vector mins, Vector maxs,
+							 float flInvRootArea, int depth, TreeStats_t &stats )
+{
+	CacheOptimizedKDNode const &kdnode = env.OptimizedKDTree[node];
+	float flRatio = BoxArea( mins, maxs ) * flInvRootArea;
+	stats.nNodes++;
+	stats.nMaxDepth = MAX( stats.nMaxDepth, depth );
+
+	if ( kdnode.NodeType() == KDNODE_STATE_LEAF )
+	{
+		stats.nLeaves++;
+		stats.nLeafTris += kdnode.NumberOfTrianglesInLeaf();
+		stats.flTrisPerRay += flRatio * kdnode.NumberOfTrianglesInLeaf();
+		return;
+	}
+
+	stats.flNodesPerRay += flRatio;
+
+	int axis = kdnode.NodeType();
+	Vector leftMaxs = maxs;
+	Vector rightMins = mins;
+	leftMaxs[axis] = kdnode.SplittingPlaneValue;
+	rightMins[axis] = kdnode.SplittingPlaneValue;
+	GatherTreeStats( env, kdnode.LeftChild(), mins, leftMaxs, flInvRootArea, depth + 1, stats );
+	GatherTreeStats( env, kdnode.RightChild(), rightMins, maxs, flInvRootArea, depth + 1, stats );
+}
+
+//-----------------------------------------------------------------------------
+// Traces the same random rays for every build, so the hit counts and the
+// distance sums should match between builders.
+//-----------------------------------------------------------------------------
+static void TraceRandomRays( RayTracingEnvironment &env, int nRays )
+{
+	RandomSeed( RAY_SEED );
+
+	Vector vecSize = env.m_MaxBound - env.m_MinBound;
+	fltx4 TMin = Four_Zeros;
+	fltx4 TMax = ReplicateX4( vecSize.Length() );
+
+	int nHits = 0;
+	double flHitDistance = 0;
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nRays; i += 4 )
+	{
+		FourRays rays;
+		for ( int j = 0; j < 4; j++ )
+		{
+			Vector origin( RandomFloat( env.m_MinBound.x, env.m_MaxBound.x ),
+				RandomFloat( env.m_MinBound.y, env.m_MaxBound.y ),
+				RandomFloat( env.m_MinBound.z, env.m_MaxBound.z ) );
+			Vector direction( RandomFloat( -1, 1 ), RandomFloat( -1, 1 ), RandomFloat( -1, 1 ) );
+			VectorNormalize( direction );
+			rays.origin.X( j ) = origin.x;
+			rays.origin.Y( j ) = origin.y;
+			rays.origin.Z( j ) = origin.z;
+			rays.direction.X( j ) = direction.x;
+			rays.direction.Y( j ) = direction.y;
+			rays.direction.Z( j ) = direction.z;
+		}
+
+		RayTracingResult result;
+		env.Trace4Rays( rays, TMin, TMax, &result );
+		for ( int j = 0; j < 4; j++ )
+		{
+			if ( result.HitIds[j] != -1 )
+			{
+				nHits++;
+				flHitDistance += SubFloat( result.HitDistance, j );
+			}
+		}
+	}
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	Msg( "  trace: %d rays in %.2f seconds, %.0f rays/sec (one thread)\n", nRays, flElapsed, nRays / MAX( flElapsed, 1e-6 ) );
+	Msg( "  hits:  %d, total hit distance %.1f\n", nHits, flHitDistance );
+}
+
+static void RunBenchmark( char const *pName, uint32 flags, int nThreads, int nRays )
+{
+	RayTracingEnvironment *pEnv = new RayTracingEnvironment;
+	pEnv->Flags |= flags | RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS | RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS;
+	AddWorldFaces( *pEnv );
+
+	double flStart = Plat_FloatTime();
+	pEnv->SetupAccelerationStructure( nThreads );
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	TreeStats_t stats;
+	memset( &stats, 0, sizeof( stats ) );
+	GatherTreeStats( *pEnv, 0, pEnv->m_MinBound, pEnv->m_MaxBound, 1.0f / BoxArea( pEnv->m_MinBound, pEnv->m_MaxBound ), 0, stats );
+
+	Msg( "%s:\n", pName );
+	Msg( "  build: %d triangles in %.2f seconds\n", pEnv->OptimizedTriangleList.Count(), flElapsed );
+	Msg( "  tree:  %d nodes, %d leaves, %.2f triangles per leaf, depth %d\n", stats.nNodes, stats.nLeaves,
+		stats.nLeaves ? (float)stats.nLeafTris / stats.nLeaves : 0.0f, stats.nMaxDepth );
+	Msg( "  cost:  %.2f nodes and %.2f triangles per ray (surface area estimate)\n", stats.flNodesPerRay, stats.flTrisPerRay );
+
+	TraceRandomRays( *pEnv, nRays );
+
+	delete pEnv;
+}
+
+int main( int argc, char **argv )
+{
+	CommandLine()->CreateCmdLine( argc, argv );
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 1.0f, false, false, false, false );
+	InstallSpewFunction();
+
+	if ( argc < 2 || argv[argc - 1][0] == '-' )
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	int nThreads = CommandLine()->ParmValue( "-threads", -1 );
+	int nRays = MAX( CommandLine()->ParmValue( "-rays", DEFAULT_RAY_COUNT ), 4 );
+	bool bCompare = CommandLine()->FindParm( "-compare" ) != 0;
+
+	char source[1024];
+	Q_StripExtension( argv[argc - 1], source, sizeof( source ) );
+	CmdLib_InitFileSystem( argv[argc - 1] );
+	Q_FileBase( source, source, sizeof( source ) );
+	strcpy( source, ExpandPath( source ) );
+
+	char targetPath[1024];
+	GetPlatformMapPath( source, targetPath, 0, sizeof( targetPath ) );
+	Msg( "reading %s\n", targetPath );
+	LoadBSPFile( targetPath );
+	if ( numfaces == 0 )
+		Error( "Empty map" );
+
+	RunBenchmark( "parallel builder", 0, nThreads, nRays );
+	if ( bCompare )
+	{
+		RunBenchmark( "reference builder", RTE_FLAGS_REFERENCE_TREE_GENERATION, 1, nRays );
+	}
+
+	CmdLib_Cleanup();
+	return 0;
+}
@@ -89,12 +89,67 @@ float Engine_WorldLightDistanceFalloff( const dworldlight_t *wl, const Vector& d
 }
 
 
+// Traces from vStart to up to 8 lights, one light per ray, and stores how much of each
+// light can see the point.
+static void TestEmitSurfaceLightBatch( const Vector &vStart, const int *pLights, int nLights, float *pVisibility )
+{
+	FourVectors vStart4[2], wlOrigin4[2];
+	vStart4[0].DuplicateVector ( vStart );
+	vStart4[1] = vStart4[0];
+
+	// pad a partial batch with the last light
+	for ( int i=0; i < 8; i++ )
+	{
+		const Vector &vOrigin = dworldlights[ pLights[ MIN( i, nLights - 1 ) ] ].origin;
+		wlOrigin4[i >> 2].X( i & 3 ) = vOrigin.x;
+		wlOrigin4[i >> 2].Y( i & 3 ) = vOrigin.y;
+		wlOrigin4[i >> 2].Z( i & 3 ) = vOrigin.z;
+	}
+
+	fltx4 fractionVisible[2];
+	if ( nLights > 4 )
+		TestLine8 ( vStart4, wlOrigin4, fractionVisible );
+	else
+		TestLine ( vStart4[0], wlOrigin4[0], &fractionVisible[0] );
+
+	for ( int i=0; i < nLights; i++ )
+		pVisibility[ pLights[i] ] = SubFloat( fractionVisible[i >> 2], i & 3 );
+}
+
+
 void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
 {
-	fltx4 fractionVisible;
+	// Find out which lights can see the point first. The lights are binned by the signs of
+	// their direction from vStart, so that each batch of 8 can go through the 8-wide tracer.
+	CUtlVector<float> lightVisibility;
+	lightVisibility.SetCount( *pNumworldlights );
+
+	int binLights[8][8];
+	int nBinLights[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	for ( int iLight=0; iLight < *pNumworldlights; iLight++ )
+	{
+		dworldlight_t *wl = &dworldlights[iLight];
 
-	FourVectors vStart4, wlOrigin4;
-	vStart4.DuplicateVector ( vStart );
+		// Should this light even go in the ambient cubes?
+		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
+			continue;
+
+		Vector vDelta = wl->origin - vStart;
+		int nBin = ( vDelta.x < 0 ? 1 : 0 ) | ( vDelta.y < 0 ? 2 : 0 ) | ( vDelta.z < 0 ? 4 : 0 );
+		binLights[nBin][nBinLights[nBin]++] = iLight;
+		if ( nBinLights[nBin] == 8 )
+		{
+			TestEmitSurfaceLightBatch( vStart, binLights[nBin], 8, lightVisibility.Base() );
+			nBinLights[nBin] = 0;
+		}
+	}
+
+	for ( int nBin=0; nBin < 8; nBin++ )
+	{
+		if ( nBinLights[nBin] )
+			TestEmitSurfaceLightBatch( vStart, binLights[nBin], nBinLights[nBin], lightVisibility.Base() );
+	}
 
 	for ( int iLight=0; iLight < *pNumworldlights; iLight++ )
 	{
@@ -107,9 +162,8 @@ void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
 		Assert( wl->type == emit_surface );
 
 		// Can this light see the point?
-		wlOrigin4.DuplicateVector ( wl->origin );
-		TestLine ( vStart4, wlOrigin4, &fractionVisible );
-		if ( !TestSignSIMD ( CmpGtSIMD ( fractionVisible, Four_Zeros ) ) )
+		float flVisibility = lightVisibility[iLight];
+		if ( !( flVisibility > 0 ) )
 			continue;
 
 		// Add this light's contribution.
@@ -120,7 +174,7 @@ void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
 		VectorNormalize( vDeltaNorm );
 		float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
 
-		float ratio = flDistanceScale * flAngleScale * SubFloat ( fractionVisible, 0 );
+		float ratio = flDistanceScale * flAngleScale * flVisibility;
 		if ( ratio == 0 )
 			continue;
 
@@ -1703,6 +1703,11 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 
 	DirectionalSampler_t sampler;
 
+	// the jittered samples all point about the same way, so they are traced in pairs
+	FourVectors pairStart[2], pairStop[2];
+	fltx4 pairFractionVisible[2];
+	int nPaired = 0;
+
 	for ( int d = 0; d < nsamples; d++ )
 	{
 		// determine visibility of skylight
@@ -1716,11 +1721,23 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 			ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
 			delta += ofs;
 		}
-		FourVectors delta4;
-		delta4.DuplicateVector ( delta );
-		delta4 += pos;
+		pairStart[nPaired] = pos;
+		pairStop[nPaired].DuplicateVector ( delta );
+		pairStop[nPaired] += pos;
+
+		if ( ++nPaired == 2 )
+		{
+			TestLine8_DoesHitSky ( pairStart, pairStop, pairFractionVisible, true, static_prop_index_to_ignore );
 
-		TestLine_DoesHitSky ( pos, delta4, &fractionVisible, true, static_prop_index_to_ignore );
+			totalFractionVisible = AddSIMD ( totalFractionVisible, pairFractionVisible[0] );
+			totalFractionVisible = AddSIMD ( totalFractionVisible, pairFractionVisible[1] );
+			nPaired = 0;
+		}
+	}
+
+	if ( nPaired )
+	{
+		TestLine_DoesHitSky ( pairStart[0], pairStop[0], &fractionVisible, true, static_prop_index_to_ignore );
 
 		totalFractionVisible = AddSIMD ( totalFractionVisible, fractionVisible );
 	}
@@ -1741,6 +1758,23 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 	}
 }
 
+// One sky direction for GatherSampleAmbientSkySSE, waiting to be traced
+struct SkySample_t
+{
+	FourVectors surfacePos;
+	FourVectors delta;
+	fltx4 dots[NUM_BUMP_VECTS+1];
+};
+
+static inline void AddAmbientSkySample( fltx4 *ambient_intensity, int normalCount, const fltx4 *dots, const fltx4 &fractionVisible )
+{
+	for ( int i = 0; i < normalCount; i++ )
+	{
+		fltx4 addedAmount = MulSIMD( fractionVisible, dots[i] );
+		ambient_intensity[i] = AddSIMD( ambient_intensity[i], addedAmount );
+	}
+}
+
 // Helper function - gathers light from ambient sky light
 void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 							   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
@@ -1754,7 +1788,6 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 	fltx4 sumdot = Four_Zeros;
 	fltx4 ambient_intensity[NUM_BUMP_VECTS+1];
 	fltx4 possibleHitCount[NUM_BUMP_VECTS+1];
-	fltx4 dots[NUM_BUMP_VECTS+1];
 
 	for ( int i = 0; i < normalCount; i++ )
 	{
@@ -1769,10 +1802,20 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 	else
 		nsky_samples *= g_flSkySampleScale;
 
+	// Directions whose components have the same signs are traced in pairs, so that they can
+	// take the 8-wide path. A direction waits in the slot for its sign mask until a partner
+	// turns up.
+	SkySample_t pending[8];
+	bool bPending[8] = { false, false, false, false, false, false, false, false };
+
 	for (int j = 0; j < nsky_samples; j++)
 	{
+		Vector vecDir = sampler.NextValue();
 		FourVectors anorm;
-		anorm.DuplicateVector( sampler.NextValue() );
+		anorm.DuplicateVector( vecDir );
+
+		SkySample_t sample;
+		fltx4 *dots = sample.dots;
 
 		if ( bIgnoreNormals )
 			dots[0] = ReplicateX4( CONSTANT_DOT );
@@ -1801,22 +1844,40 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 		}
 
 		// search back to see if we can hit a sky brush
-		FourVectors delta = anorm;
-		delta *= -MAX_TRACE_LENGTH;
-		delta += pos;
-		FourVectors surfacePos = pos;
+		sample.delta = anorm;
+		sample.delta *= -MAX_TRACE_LENGTH;
+		sample.delta += pos;
+		sample.surfacePos = pos;
 		FourVectors offset = anorm;
 		offset *= -flEpsilon;
-		surfacePos -= offset;
+		sample.surfacePos -= offset;
 
-		fltx4 fractionVisible = Four_Ones;
-		TestLine_DoesHitSky( surfacePos, delta, &fractionVisible, true, static_prop_index_to_ignore );
-		for ( int i = 0; i < normalCount; i++ )
+		int nSignMask = ( vecDir.x < 0.0f ? 1 : 0 ) | ( vecDir.y < 0.0f ? 2 : 0 ) | ( vecDir.z < 0.0f ? 4 : 0 );
+		if ( !bPending[nSignMask] )
 		{
-			fltx4 addedAmount = MulSIMD( fractionVisible, dots[i] );
-			ambient_intensity[i] = AddSIMD( ambient_intensity[i], addedAmount );
+			pending[nSignMask] = sample;
+			bPending[nSignMask] = true;
+			continue;
 		}
 
+		FourVectors start[2] = { pending[nSignMask].surfacePos, sample.surfacePos };
+		FourVectors stop[2] = { pending[nSignMask].delta, sample.delta };
+		fltx4 fractionVisible[2];
+		TestLine8_DoesHitSky( start, stop, fractionVisible, true, static_prop_index_to_ignore );
+		AddAmbientSkySample( ambient_intensity, normalCount, pending[nSignMask].dots, fractionVisible[0] );
+		AddAmbientSkySample( ambient_intensity, normalCount, sample.dots, fractionVisible[1] );
+		bPending[nSignMask] = false;
+	}
+
+	// trace the directions that never found a partner
+	for ( int nSignMask = 0; nSignMask < 8; nSignMask++ )
+	{
+		if ( !bPending[nSignMask] )
+			continue;
+
+		fltx4 fractionVisible = Four_Ones;
+		TestLine_DoesHitSky( pending[nSignMask].surfacePos, pending[nSignMask].delta, &fractionVisible, true, static_prop_index_to_ignore );
+		AddAmbientSkySample( ambient_intensity, normalCount, pending[nSignMask].dots, fractionVisible );
 	}
 
 	out.m_flFalloff = Four_Ones;
@@ -2493,8 +2554,10 @@ static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, i
 	SSE_sampleLightOutput_t out;
 
 	// Iterate over all direct lights and add them to the particular sample
-	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
-	{	    
+	for ( int iLight = 0; iLight < info.m_nLights; iLight++ )
+	{
+		directlight_t *dl = info.m_ppLights[iLight];
+
 		// is this lights cluster visible?
 		fltx4 dotMask = Four_Zeros;
 		bool skipLight = true;
@@ -2583,8 +2646,10 @@ static void ResampleLightAt4Points( SSE_SampleInfo_t& info, int lightStyleIndex,
 	}
 
 	// Iterate over all direct lights and add them to the particular sample
-	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
+	for ( int iLight = 0; iLight < info.m_nSupersampleLights; iLight++ )
 	{
+		directlight_t *dl = info.m_ppSupersampleLights[iLight];
+
 		if ((flags & AMBIENT_ONLY) && (dl->light.type != emit_skyambient))
 			continue;
 
@@ -3056,6 +3121,144 @@ static void InitSampleInfo( lightinfo_t const& l, int iThread, SSE_SampleInfo_t&
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Light culling stats, per thread so BuildFacelights doesn't need a lock
+//-----------------------------------------------------------------------------
+struct FaceLightStats_t
+{
+	int64	m_nFaces;
+	int64	m_nLights;
+	int64	m_nSupersampleLights;
+};
+
+static FaceLightStats_t s_FaceLightStats[MAX_TOOL_THREADS+1];
+
+//-----------------------------------------------------------------------------
+// Builds the lists of lights that can reach a face's samples.
+//
+// A light is only culled when GatherSampleLightSSE would give it a zero dot
+// at every point the face samples:
+//	- none of the face's sample clusters can see it (samples only; the
+//	  supersamples land in their own clusters, which ResampleLightAt4Points
+//	  still checks per point),
+//	- every point is past its hard falloff distance,
+//	- or it's behind a flat face, where every point uses the face normal.
+//
+// The lists keep the order of activelights, so the contributions are summed
+// in the same order whether or not a light was culled.
+//-----------------------------------------------------------------------------
+static void BuildFaceLightLists( lightinfo_t const& l, SSE_SampleInfo_t& info, 
+								 CUtlVector<directlight_t*> &lights, CUtlVector<directlight_t*> &supersampleLights )
+{
+	lights.RemoveAll();
+	supersampleLights.RemoveAll();
+
+	facelight_t *fl = info.m_pFaceLight;
+	if ( !g_bLightCulling || fl->numsamples == 0 )
+	{
+		for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+		{
+			lights.AddToTail( dl );
+			supersampleLights.AddToTail( dl );
+		}
+		return;
+	}
+
+	// Bound every point the face will sample. Supersamples stay inside their
+	// luxel, and all the points get pushed off the surface by the face normal.
+	Vector vecMins( FLT_MAX, FLT_MAX, FLT_MAX );
+	Vector vecMaxs( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	CUtlVector<int> clusters;
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		VectorMin( fl->sample[i].pos, vecMins, vecMins );
+		VectorMax( fl->sample[i].pos, vecMaxs, vecMaxs );
+
+		int cluster = ClusterFromPoint( fl->sample[i].pos );
+		if ( ( clusters.Count() == 0 || clusters.Tail() != cluster ) && !clusters.HasElement( cluster ) )
+			clusters.AddToTail( cluster );
+	}
+
+	Vector vecExtent;
+	for ( int i = 0; i < 3; i++ )
+	{
+		vecExtent[i] = 0.5f * ( fabs( l.luxelToWorldSpace[0][i] ) + fabs( l.luxelToWorldSpace[1][i] ) ) + 1.0f;
+	}
+	vecMins += l.facenormal - vecExtent;
+	vecMaxs += l.facenormal + vecExtent;
+
+	// Every point on a flat face uses the face normal
+	bool bFlat = l.isflat && !info.m_IsDispFace;
+	float flMinNormalDist = 0.0f;
+	if ( bFlat )
+	{
+		for ( int i = 0; i < 3; i++ )
+		{
+			flMinNormalDist += l.facenormal[i] * ( ( l.facenormal[i] > 0.0f ) ? vecMins[i] : vecMaxs[i] );
+		}
+	}
+
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		if ( dl->light.type == emit_point || dl->light.type == emit_surface || dl->light.type == emit_spotlight )
+		{
+			Vector vecSrc = ( dl->facenum == -1 ) ? dl->light.origin : vec3_origin;
+
+			// Past the hard falloff everywhere? The sample distance is an estimate, so leave some slack.
+			if ( dl->m_flEndFadeDistance > dl->m_flStartFadeDistance )
+			{
+				float flDistSqr = CalcSqrDistanceToAABB( vecMins, vecMaxs, vecSrc );
+				float flCull = dl->m_flEndFadeDistance * 1.01f + 1.0f;
+				if ( flDistSqr > flCull * flCull )
+					continue;
+			}
+
+			// Behind the face?
+			if ( bFlat && DotProduct( vecSrc, l.facenormal ) < flMinNormalDist - 1.0f )
+				continue;
+		}
+
+		supersampleLights.AddToTail( dl );
+
+		for ( int i = 0; i < clusters.Count(); i++ )
+		{
+			if ( PVSCheck( dl->pvs, clusters[i] ) )
+			{
+				lights.AddToTail( dl );
+				break;
+			}
+		}
+	}
+
+	FaceLightStats_t &stats = s_FaceLightStats[info.m_iThread];
+	stats.m_nFaces++;
+	stats.m_nLights += lights.Count();
+	stats.m_nSupersampleLights += supersampleLights.Count();
+}
+
+//-----------------------------------------------------------------------------
+// Prints how many lights BuildFacelights had to test per face
+//-----------------------------------------------------------------------------
+void ReportFaceLightCulling( float flElapsed )
+{
+	FaceLightStats_t total = { 0, 0, 0 };
+	for ( int i = 0; i < ARRAYSIZE( s_FaceLightStats ); i++ )
+	{
+		total.m_nFaces += s_FaceLightStats[i].m_nFaces;
+		total.m_nLights += s_FaceLightStats[i].m_nLights;
+		total.m_nSupersampleLights += s_FaceLightStats[i].m_nSupersampleLights;
+	}
+
+	if ( !g_bLightCulling || total.m_nFaces == 0 )
+	{
+		Msg( "Direct lighting: %.2f seconds, %d lights per face (no culling)\n", flElapsed, numdlights );
+		return;
+	}
+
+	Msg( "Direct lighting: %.2f seconds, %.1f of %d lights per face (%.1f when supersampling)\n", flElapsed,
+		(float)total.m_nLights / total.m_nFaces, numdlights, (float)total.m_nSupersampleLights / total.m_nFaces );
+}
+
 void BuildFacelights (int iThread, int facenum)
 {
 	int	i, j;
@@ -3106,6 +3309,14 @@ void BuildFacelights (int iThread, int facenum)
 	CalcPoints( &l, fl, facenum );
 	InitSampleInfo( l, iThread, sampleInfo );
 
+	CUtlVector<directlight_t*> lights;
+	CUtlVector<directlight_t*> supersampleLights;
+	BuildFaceLightLists( l, sampleInfo, lights, supersampleLights );
+	sampleInfo.m_ppLights = lights.Base();
+	sampleInfo.m_nLights = lights.Count();
+	sampleInfo.m_ppSupersampleLights = supersampleLights.Base();
+	sampleInfo.m_nSupersampleLights = supersampleLights.Count();
+
 	// Allocate sample positions/normals to SSE
 	int numGroups = ( fl->numsamples & 0x3) ? ( fl->numsamples / 4 ) + 1 : ( fl->numsamples / 4 );
 
@@ -110,6 +110,8 @@ struct lightinfo_t
 	int		hasbumpmap;
 };
 
+struct directlight_t;
+
 struct SSE_SampleInfo_t
 {
 	int		m_FaceNum;
@@ -129,6 +131,12 @@ struct SSE_SampleInfo_t
 	int	        m_Clusters[4];
 	FourVectors	m_Points;
 	FourVectors	m_PointNormals[ NUM_BUMP_VECTS + 1 ];
+
+	// Lights that can reach the face, in activelights order. See BuildFaceLightLists.
+	directlight_t	**m_ppLights;
+	int		m_nLights;
+	directlight_t	**m_ppSupersampleLights;
+	int		m_nSupersampleLights;
 };
 
 extern void InitLightinfo( lightinfo_t *l, int facenum );
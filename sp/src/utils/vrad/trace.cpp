@@ -148,21 +148,17 @@ public:
 	}
 };
 
-void TestLine( const FourVectors& start, const FourVectors& stop,
-               fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+static void SetupTestLineRays( FourVectors const& start, FourVectors const& stop, FourRays &rays, fltx4 &len )
 {
-	FourRays myrays;
-	myrays.origin = start;
-	myrays.direction = stop;
-	myrays.direction -= myrays.origin;
-	fltx4 len = myrays.direction.length();
-	myrays.direction *= ReciprocalSIMD( len );
-
-	RayTracingResult rt_result;
-	CCoverageCountTexture coverageCallback;
-
-	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? &coverageCallback : 0 );
+	rays.origin = start;
+	rays.direction = stop;
+	rays.direction -= rays.origin;
+	len = rays.direction.length();
+	rays.direction *= ReciprocalSIMD( len );
+}
 
+static fltx4 FractionVisibleFromTrace( const RayTracingResult &rt_result, const fltx4 &len, CCoverageCountTexture &coverageCallback )
+{
 	// Assume we can see the targets unless we get hits
 	float visibility[4];
 	for ( int i = 0; i < 4; i++ )
@@ -174,9 +170,44 @@ void TestLine( const FourVectors& start, const FourVectors& stop,
 			visibility[i] = 0.0f;
 		}
 	}
-	*pFractionVisible = LoadUnalignedSIMD( visibility );
+	fltx4 fractionVisible = LoadUnalignedSIMD( visibility );
 	if ( g_bTextureShadows )
-		*pFractionVisible = MinSIMD( *pFractionVisible, coverageCallback.GetFractionVisible() );
+		fractionVisible = MinSIMD( fractionVisible, coverageCallback.GetFractionVisible() );
+	return fractionVisible;
+}
+
+void TestLine( const FourVectors& start, const FourVectors& stop,
+               fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+{
+	FourRays myrays;
+	fltx4 len;
+	SetupTestLineRays( start, stop, myrays, len );
+
+	RayTracingResult rt_result;
+	CCoverageCountTexture coverageCallback;
+
+	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? &coverageCallback : 0 );
+
+	*pFractionVisible = FractionVisibleFromTrace( rt_result, len, coverageCallback );
+}
+
+void TestLine8( FourVectors const start[2], FourVectors const stop[2],
+                fltx4 pFractionVisible[2], int static_prop_index_to_ignore )
+{
+	FourRays myrays[2];
+	fltx4 len[2];
+	fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+	for ( int h = 0; h < 2; h++ )
+		SetupTestLineRays( start[h], stop[h], myrays[h], len[h] );
+
+	RayTracingResult rt_result[2];
+	CCoverageCountTexture coverageCallback[2];
+	ITransparentTriangleCallback *pCallbacks[2] = { &coverageCallback[0], &coverageCallback[1] };
+
+	g_RtEnv.Trace8Rays( myrays, tmin, len, rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? pCallbacks : 0 );
+
+	for ( int h = 0; h < 2; h++ )
+		pFractionVisible[h] = FractionVisibleFromTrace( rt_result[h], len[h], coverageCallback[h] );
 }
 
 
@@ -349,20 +380,12 @@ void DM_ClipBoxToBrush( CToolTrace *trace, const Vector& mins, const Vector& max
 	}
 }
 
-void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+// Everything TestLine_DoesHitSky does after the trace: sky hits don't occlude, and rays that
+// reach the sky outside a sky camera's area go on into the 3D skyboxes
+static void FinishTestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+	const FourRays &myrays, const fltx4 &len, const RayTracingResult &rt_result, CCoverageCountTexture &coverageCallback,
 	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
 {
-	FourRays myrays;
-	myrays.origin = start;
-	myrays.direction = stop;
-	myrays.direction -= myrays.origin;
-	fltx4 len = myrays.direction.length();
-	myrays.direction *= ReciprocalSIMD( len );
-	RayTracingResult rt_result;
-	CCoverageCountTexture coverageCallback;
-
-	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
-
 	if ( bDoDebug )
 	{
 		WriteTrace( "trace.txt", myrays, rt_result );
@@ -428,6 +451,42 @@ void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
 	*pFractionVisible = SubSIMD( Four_Ones, occlusion );
 }
 
+void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+{
+	FourRays myrays;
+	fltx4 len;
+	SetupTestLineRays( start, stop, myrays, len );
+	RayTracingResult rt_result;
+	CCoverageCountTexture coverageCallback;
+
+	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
+
+	FinishTestLine_DoesHitSky( start, stop, myrays, len, rt_result, coverageCallback, pFractionVisible, canRecurse, static_prop_to_skip, bDoDebug );
+}
+
+void TestLine8_DoesHitSky( FourVectors const start[2], FourVectors const stop[2],
+	fltx4 pFractionVisible[2], bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+{
+	FourRays myrays[2];
+	fltx4 len[2];
+	fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+	for ( int h = 0; h < 2; h++ )
+		SetupTestLineRays( start[h], stop[h], myrays[h], len[h] );
+
+	RayTracingResult rt_result[2];
+	CCoverageCountTexture coverageCallback[2];
+	ITransparentTriangleCallback *pCallbacks[2] = { &coverageCallback[0], &coverageCallback[1] };
+
+	g_RtEnv.Trace8Rays( myrays, tmin, len, rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows ? pCallbacks : 0 );
+
+	for ( int h = 0; h < 2; h++ )
+	{
+		FinishTestLine_DoesHitSky( start[h], stop[h], myrays[h], len[h], rt_result[h], coverageCallback[h],
+			&pFractionVisible[h], canRecurse, static_prop_to_skip, bDoDebug );
+	}
+}
+
 
 
 //-----------------------------------------------------------------------------
@@ -59,6 +59,7 @@ bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
+bool		g_bLightCulling = true;
 bool        g_bNoSkyRecurse = false;
 
 int			junk;
@@ -2019,6 +2020,7 @@ bool RadWorld_Go()
 	}
 
 	// build initial facelights
+	double flFacelightsStart = Plat_FloatTime();
 	if (g_bUseMPI) 
 	{
 		// RunThreadsOnIndividual (numfaces, true, BuildFacelights);
@@ -2028,6 +2030,7 @@ bool RadWorld_Go()
 	{
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
 	}
+	ReportFaceLightCulling( Plat_FloatTime() - flFacelightsStart );
 
 	// Was the process interrupted?
 	if( g_pIncremental && (g_iCurFace != numfaces) )
@@ -2257,7 +2260,7 @@ void VRAD_LoadBSP( char const *pFilename )
 	// Build acceleration structure
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
-	g_RtEnv.SetupAccelerationStructure();
+	g_RtEnv.SetupAccelerationStructure( numthreads );
 	float end = Plat_FloatTime();
 	printf ( "Done (%.2f seconds)\n", end-start );
 
@@ -2388,6 +2391,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bNoDetailLighting = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-nolightcull" ) )
+		{
+			g_bLightCulling = false;
+		}
 		else if ( !Q_stricmp( argv[i], "-rederrors" ) )
 		{
 			bRed2Black = false;
@@ -2806,6 +2813,8 @@ void PrintUsage( int argc, char **argv )
 		"  -stoponexit	   : Wait for a keypress on exit.\n"
 		"  -mpi_pw <pw>    : Use a password to choose a specific set of VMPI workers.\n"
 		"  -nodetaillight  : Don't light detail props.\n"
+		"  -nolightcull    : Test every light against every face when building\n"
+		"                    direct lighting (for timing comparisons).\n"
 		"  -centersamples  : Move sample centers.\n"
 		"  -luxeldensity # : Rescale all luxels by the specified amount (default: 1.0).\n"
 		"                    The number specified must be less than 1.0 or it will be\n"
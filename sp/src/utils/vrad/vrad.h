@@ -275,6 +275,7 @@ extern bool			bRed2Black;
 extern bool         g_bNoSkyRecurse;
 extern bool			bDumpNormals;
 extern bool			g_bFastAmbient;
+extern bool			g_bLightCulling;
 extern float		maxchop;
 extern FileHandle_t	pFileSamples[4][4];
 extern qboolean		g_bLowPriority;
@@ -360,6 +361,7 @@ qboolean IsIncremental(char *filename);
 int SaveIncremental(char *filename);
 int PartialHead (void);
 void BuildFacelights (int facenum, int threadnum);
+void ReportFaceLightCulling( float flElapsed );
 void PrecompLightmapOffsets();
 void FinalLightFace (int threadnum, int facenum);
 void PvsForOrigin (Vector& org, byte *pvs);
@@ -386,6 +388,12 @@ void TestLine( FourVectors const& start, FourVectors const& stop, fltx4 *pFracti
 void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
 
+// TestLine and TestLine_DoesHitSky for two groups of four lines at once. When all 8 lines point
+// the same way (same signs in each direction component) they go through the 8-wide tracer.
+void TestLine8( FourVectors const start[2], FourVectors const stop[2], fltx4 pFractionVisible[2], int static_prop_index_to_ignore=-1 );
+void TestLine8_DoesHitSky( FourVectors const start[2], FourVectors const stop[2],
+                           fltx4 pFractionVisible[2], bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
+
 // converts any marked brush entities to triangles for shadow casting
 void ExtractBrushEntityShadowCasters ( void );
 void AddBrushesForRayTrace ( void );
@@ -12,6 +12,8 @@
 #include "tier1/utlbuffer.h"
 #include "tier1/utlmap.h"
 #include "tier1/utlstring.h"
+#include "tier1/utllinkedlist.h"
+#include "tier1/generichash.h"
 
 #include "squirrel.h"
 #include "sqstdaux.h"
@@ -220,6 +222,17 @@ public:
 
 	virtual bool RaiseException(const char* pszExceptionText) override;
 
+	//----------------------------------------------------------------------------
+	// Compiled script cache
+	//----------------------------------------------------------------------------
+	virtual void SetCompileCacheSize(int nMaxScripts) override;
+	virtual void GetCompileCacheStats(ScriptCompileCacheStats_t* pStats) override;
+	virtual void ResetCompileCacheStats() override;
+
+	SQRESULT CompileBuffer(const char* pszScript, const char* pszId);
+	void RemoveCompiledScript(unsigned short iEntry);
+	void ClearCompiledScripts();
+
 
 	void WriteObject(CUtlBuffer* pBuffer, WriteStateMap& writeState, SQInteger idx);
 	void ReadObject(CUtlBuffer* pBuffer, ReadStateMap& readState);
@@ -227,6 +240,19 @@ public:
 	HSQOBJECT lastError_;
 	HSQOBJECT vectorClass_;
 	HSQOBJECT regexpClass_;
+
+	struct CompiledScript_t
+	{
+		CUtlString source;
+		CUtlString id;
+		uint32 hash;
+		HSQOBJECT closure;
+	};
+
+	CUtlLinkedList<CompiledScript_t, unsigned short> compiledScripts_;	// most recently used first
+	CUtlMap<uint32, unsigned short> compiledScriptIndex_;
+	int compileCacheSize_ = 256;
+	ScriptCompileCacheStats_t compileCacheStats_ = {};
 };
 
 SQUserPointer TYPETAG_VECTOR = "VectorTypeTag";
@@ -1588,6 +1614,8 @@ bool SquirrelVM::Init()
 	sq_setforeignptr(vm_, this);
 	sq_resetobject(&lastError_);
 
+	compiledScriptIndex_.SetLessFunc(DefLessFunc(uint32));
+
 	sq_setprintfunc(vm_, printfunc, errorfunc);
 
 
@@ -1660,6 +1688,8 @@ void SquirrelVM::Shutdown()
 {
 	if (vm_)
 	{
+		ClearCompiledScripts();
+
 		sq_release(vm_, &vectorClass_);
 		sq_release(vm_, &regexpClass_);
 
@@ -1703,7 +1733,7 @@ bool SquirrelVM::Frame(float simTime)
 ScriptStatus_t SquirrelVM::Run(const char* pszScript, bool bWait)
 {
 	SquirrelSafeCheck safeCheck(vm_);
-	if (SQ_FAILED(sq_compilebuffer(vm_, pszScript, strlen(pszScript), "<run>", SQTrue)))
+	if (SQ_FAILED(CompileBuffer(pszScript, "<run>")))
 	{
 		return SCRIPT_ERROR;
 	}
@@ -1725,7 +1755,7 @@ HSCRIPT SquirrelVM::CompileScript(const char* pszScript, const char* pszId)
 
 	Assert(vm_);
 	if (pszId == nullptr) pszId = "<unnamed>";
-	if (SQ_FAILED(sq_compilebuffer(vm_, pszScript, strlen(pszScript), pszId, SQTrue)))
+	if (SQ_FAILED(CompileBuffer(pszScript, pszId)))
 	{
 		return nullptr;
 	}
@@ -1747,6 +1777,107 @@ void SquirrelVM::ReleaseScript(HSCRIPT hScript)
 	delete obj;
 }
 
+//-----------------------------------------------------------------------------
+// Compiled script cache
+//
+// RunScriptCode and script files compile the same source over and over. A
+// compiled script is a closure that can be called any number of times, so
+// the closures are kept by source and name, and the least recently used
+// one is released once there are more than the cache size of them. The game
+// sets the size and reads the counters through IScriptVM, since this library
+// is linked into both the client and the server.
+//-----------------------------------------------------------------------------
+void SquirrelVM::SetCompileCacheSize(int nMaxScripts)
+{
+	compileCacheSize_ = nMaxScripts;
+
+	while (compiledScripts_.Count() > Max(compileCacheSize_, 0))
+	{
+		RemoveCompiledScript(compiledScripts_.Tail());
+		compileCacheStats_.nEvictions++;
+	}
+}
+
+void SquirrelVM::GetCompileCacheStats(ScriptCompileCacheStats_t* pStats)
+{
+	*pStats = compileCacheStats_;
+}
+
+void SquirrelVM::ResetCompileCacheStats()
+{
+	compileCacheStats_.nHits = compileCacheStats_.nMisses = compileCacheStats_.nEvictions = 0;
+}
+
+// Like sq_compilebuffer, pushes the compiled closure on success
+SQRESULT SquirrelVM::CompileBuffer(const char* pszScript, const char* pszId)
+{
+	int nLength = V_strlen(pszScript);
+	int nMaxEntries = compileCacheSize_;
+	if (nMaxEntries <= 0)
+		return sq_compilebuffer(vm_, pszScript, nLength, pszId, SQTrue);
+
+	uint32 hash = MurmurHash2(pszScript, nLength, HashString(pszId));
+	auto idx = compiledScriptIndex_.Find(hash);
+	if (idx != compiledScriptIndex_.InvalidIndex())
+	{
+		unsigned short iEntry = compiledScriptIndex_[idx];
+		CompiledScript_t& entry = compiledScripts_[iEntry];
+		if (entry.source == pszScript && entry.id == pszId)
+		{
+			compiledScripts_.Unlink(iEntry);
+			compiledScripts_.LinkToHead(iEntry);
+			compileCacheStats_.nHits++;
+
+			sq_pushobject(vm_, entry.closure);
+			return SQ_OK;
+		}
+
+		// Same hash, different script. The new one takes the slot.
+		RemoveCompiledScript(iEntry);
+	}
+
+	compileCacheStats_.nMisses++;
+
+	if (SQ_FAILED(sq_compilebuffer(vm_, pszScript, nLength, pszId, SQTrue)))
+		return SQ_ERROR;
+
+	while (compiledScripts_.Count() >= nMaxEntries)
+	{
+		RemoveCompiledScript(compiledScripts_.Tail());
+		compileCacheStats_.nEvictions++;
+	}
+
+	unsigned short iEntry = compiledScripts_.AddToHead();
+	CompiledScript_t& entry = compiledScripts_[iEntry];
+	entry.source = pszScript;
+	entry.id = pszId;
+	entry.hash = hash;
+	sq_resetobject(&entry.closure);
+	sq_getstackobj(vm_, -1, &entry.closure);
+	sq_addref(vm_, &entry.closure);
+
+	compiledScriptIndex_.Insert(hash, iEntry);
+	compileCacheStats_.nScripts++;
+	return SQ_OK;
+}
+
+void SquirrelVM::RemoveCompiledScript(unsigned short iEntry)
+{
+	CompiledScript_t& entry = compiledScripts_[iEntry];
+	sq_release(vm_, &entry.closure);
+	compiledScriptIndex_.Remove(entry.hash);
+	compiledScripts_.Remove(iEntry);
+	compileCacheStats_.nScripts--;
+}
+
+void SquirrelVM::ClearCompiledScripts()
+{
+	while (compiledScripts_.Count())
+	{
+		RemoveCompiledScript(compiledScripts_.Head());
+	}
+}
+
 ScriptStatus_t SquirrelVM::Run(HSCRIPT hScript, HSCRIPT hScope, bool bWait)
 {
 	SquirrelSafeCheck safeCheck(vm_);